@@ -1,11 +1,52 @@
+newoption {
+   trigger = "watertight",
+   description = "Use the watertight triangle test and drop the t_min = 0.01 self-intersection epsilon"
+}
+
+newoption {
+   trigger = "ray_stats",
+   description = "Count rays, node and primitive tests per thread and per pixel"
+}
+
 workspace "Basics of ray tracing"
    configurations { "Debug", "Release" }
    language "C++"
    architecture "x64"
-   systemversion "latest"
-   toolset "v142"
+   cppdialect "C++17"
    optimize "Speed"
-   buildoptions { "/openmp" }
+
+   filter "system:windows"
+      systemversion "latest"
+      toolset "v142"
+      buildoptions { "/openmp" }
+
+   -- premake5 gmake2 builds with gcc, or with clang given --cc=clang
+   filter "system:linux"
+      buildoptions { "-fopenmp" }
+      linkoptions { "-fopenmp" }
+      links { "pthread" }
+
+   -- One unit per instruction set, Kernels() picks the best the CPU supports at run time.
+   -- Contraction stays off so the FMA capable variants round exactly like the scalar code. Without traps
+   -- the comparisons of the triangle test can become selects, which the vectorizer needs, results are unchanged.
+   filter { "system:linux", "files:src/kernels_*.cpp" }
+      buildoptions { "-ffp-contract=off", "-fno-trapping-math" }
+
+   filter { "system:linux", "files:src/kernels_sse42.cpp" }
+      buildoptions { "-msse4.2" }
+
+   filter { "system:linux", "files:src/kernels_avx2.cpp" }
+      buildoptions { "-mavx2", "-mfma" }
+
+   filter { "system:linux", "files:src/kernels_avx512.cpp" }
+      buildoptions { "-mavx512f", "-mavx512dq", "-mavx512bw", "-mavx512vl", "-mavx2", "-mfma" }
+
+   filter { "system:windows", "files:src/kernels_avx2.cpp" }
+      buildoptions { "/arch:AVX2" }
+
+   filter { "system:windows", "files:src/kernels_avx512.cpp" }
+      buildoptions { "/arch:AVX512" }
+
    filter "configurations:Debug"
       defines { "DEBUG" }
       symbols "On"
@@ -14,6 +55,14 @@ workspace "Basics of ray tracing"
       defines { "NDEBUG" }
       optimize "On"
 
+   filter "options:watertight"
+      defines { "WATERTIGHT_INTERSECTION" }
+
+   filter "options:ray_stats"
+      defines { "RAY_STATISTICS" }
+
+   filter {}
+
    targetdir ("bin/%{prj.name}/%{cfg.longname}")
    objdir ("obj/%{prj.name}/%{cfg.longname}")
 
@@ -25,6 +74,16 @@ group "01. Ray generation"
       includedirs { "lib/linalg" }
       includedirs { "src/" }
       files {"src/ray_generation.h", "src/ray_generation.cpp" }
+      files {"src/image_output.h", "src/image_output.cpp"}
+      files {"src/image_writer.h", "src/image_writer.cpp"}
+      files {"src/aov.h", "src/aov.cpp"}
+      files {"src/ray_statistics.h", "src/ray_statistics.cpp"}
+      files {"src/profiler.h", "src/profiler.cpp"}
+      files {"src/ray_capture.h", "src/ray_capture.cpp"}
+      files {"src/memory_budget.h", "src/memory_budget.cpp"}
+      files {"src/cpu_features.h", "src/cpu_features.cpp"}
+      files {"src/kernels.h", "src/kernels_impl.h", "src/kernels.cpp"}
+      files {"src/kernels_generic.cpp", "src/kernels_sse42.cpp", "src/kernels_avx2.cpp", "src/kernels_avx512.cpp"}
    
    project "Ray generation app"
       kind "ConsoleApp"
@@ -33,17 +92,6 @@ group "01. Ray generation"
       links "Ray generation lib"
       files { "src/ray_generation_main.cpp" }
    
-   project "Ray generation tests"
-      kind "ConsoleApp"
-      includedirs { "lib/stb" }
-      includedirs { "lib/linalg" }
-      includedirs { "lib/catch2/single_include/catch2" }
-      includedirs { "src" }
-      files { "tests/test_utils.h" }
-      links "Ray generation lib"
-      debugargs { "--benchmark-samples", "25" }
-      files {"tests/ray_generation_tests.cpp"}
-
 group "02. Moller-Trumbore algorithm"
    project "Moller-Trumbore algorithm lib"
       kind "StaticLib"
@@ -51,6 +99,16 @@ group "02. Moller-Trumbore algorithm"
       includedirs { "lib/linalg" }
       includedirs { "src/" }
       files {"src/ray_generation.h", "src/ray_generation.cpp" }
+      files {"src/image_output.h", "src/image_output.cpp"}
+      files {"src/image_writer.h", "src/image_writer.cpp"}
+      files {"src/aov.h", "src/aov.cpp"}
+      files {"src/ray_statistics.h", "src/ray_statistics.cpp"}
+      files {"src/profiler.h", "src/profiler.cpp"}
+      files {"src/ray_capture.h", "src/ray_capture.cpp"}
+      files {"src/memory_budget.h", "src/memory_budget.cpp"}
+      files {"src/cpu_features.h", "src/cpu_features.cpp"}
+      files {"src/kernels.h", "src/kernels_impl.h", "src/kernels.cpp"}
+      files {"src/kernels_generic.cpp", "src/kernels_sse42.cpp", "src/kernels_avx2.cpp", "src/kernels_avx512.cpp"}
       files {"src/mt_algorithm.h", "src/mt_algorithm.cpp"}
    
    project "Moller-Trumbore algorithm app"
@@ -79,7 +137,19 @@ group "03. Lighting"
       includedirs { "lib/tinyobjloader" }
       includedirs { "src/" }
       files {"src/ray_generation.h", "src/ray_generation.cpp" }
+      files {"src/image_output.h", "src/image_output.cpp"}
+      files {"src/image_writer.h", "src/image_writer.cpp"}
+      files {"src/aov.h", "src/aov.cpp"}
+      files {"src/ray_statistics.h", "src/ray_statistics.cpp"}
+      files {"src/profiler.h", "src/profiler.cpp"}
+      files {"src/ray_capture.h", "src/ray_capture.cpp"}
+      files {"src/memory_budget.h", "src/memory_budget.cpp"}
+      files {"src/cpu_features.h", "src/cpu_features.cpp"}
+      files {"src/kernels.h", "src/kernels_impl.h", "src/kernels.cpp"}
+      files {"src/kernels_generic.cpp", "src/kernels_sse42.cpp", "src/kernels_avx2.cpp", "src/kernels_avx512.cpp"}
       files {"src/mt_algorithm.h", "src/mt_algorithm.cpp"}
+      files {"src/material.h", "src/material.cpp"}
+      files {"src/texture.h", "src/texture.cpp"}
       files {"src/lighting.h", "src/lighting.cpp"}
    
    project "Lighting app"
@@ -108,7 +178,19 @@ group "04. Shadow rays"
       includedirs { "lib/tinyobjloader" }
       includedirs { "src/" }
       files {"src/ray_generation.h", "src/ray_generation.cpp" }
+      files {"src/image_output.h", "src/image_output.cpp"}
+      files {"src/image_writer.h", "src/image_writer.cpp"}
+      files {"src/aov.h", "src/aov.cpp"}
+      files {"src/ray_statistics.h", "src/ray_statistics.cpp"}
+      files {"src/profiler.h", "src/profiler.cpp"}
+      files {"src/ray_capture.h", "src/ray_capture.cpp"}
+      files {"src/memory_budget.h", "src/memory_budget.cpp"}
+      files {"src/cpu_features.h", "src/cpu_features.cpp"}
+      files {"src/kernels.h", "src/kernels_impl.h", "src/kernels.cpp"}
+      files {"src/kernels_generic.cpp", "src/kernels_sse42.cpp", "src/kernels_avx2.cpp", "src/kernels_avx512.cpp"}
       files {"src/mt_algorithm.h", "src/mt_algorithm.cpp"}
+      files {"src/material.h", "src/material.cpp"}
+      files {"src/texture.h", "src/texture.cpp"}
       files {"src/lighting.h", "src/lighting.cpp"}
       files {"src/shadow_rays.h", "src/shadow_rays.cpp"}
 
@@ -138,7 +220,19 @@ group "05. Reflection"
       includedirs { "lib/tinyobjloader" }
       includedirs { "src/" }
       files {"src/ray_generation.h", "src/ray_generation.cpp" }
+      files {"src/image_output.h", "src/image_output.cpp"}
+      files {"src/image_writer.h", "src/image_writer.cpp"}
+      files {"src/aov.h", "src/aov.cpp"}
+      files {"src/ray_statistics.h", "src/ray_statistics.cpp"}
+      files {"src/profiler.h", "src/profiler.cpp"}
+      files {"src/ray_capture.h", "src/ray_capture.cpp"}
+      files {"src/memory_budget.h", "src/memory_budget.cpp"}
+      files {"src/cpu_features.h", "src/cpu_features.cpp"}
+      files {"src/kernels.h", "src/kernels_impl.h", "src/kernels.cpp"}
+      files {"src/kernels_generic.cpp", "src/kernels_sse42.cpp", "src/kernels_avx2.cpp", "src/kernels_avx512.cpp"}
       files {"src/mt_algorithm.h", "src/mt_algorithm.cpp"}
+      files {"src/material.h", "src/material.cpp"}
+      files {"src/texture.h", "src/texture.cpp"}
       files {"src/lighting.h", "src/lighting.cpp"}
       files {"src/shadow_rays.h", "src/shadow_rays.cpp"}
       files {"src/reflection.h", "src/reflection.cpp"}
@@ -169,7 +263,19 @@ group "06. Refraction"
       includedirs { "lib/tinyobjloader" }
       includedirs { "src/" }
       files {"src/ray_generation.h", "src/ray_generation.cpp" }
+      files {"src/image_output.h", "src/image_output.cpp"}
+      files {"src/image_writer.h", "src/image_writer.cpp"}
+      files {"src/aov.h", "src/aov.cpp"}
+      files {"src/ray_statistics.h", "src/ray_statistics.cpp"}
+      files {"src/profiler.h", "src/profiler.cpp"}
+      files {"src/ray_capture.h", "src/ray_capture.cpp"}
+      files {"src/memory_budget.h", "src/memory_budget.cpp"}
+      files {"src/cpu_features.h", "src/cpu_features.cpp"}
+      files {"src/kernels.h", "src/kernels_impl.h", "src/kernels.cpp"}
+      files {"src/kernels_generic.cpp", "src/kernels_sse42.cpp", "src/kernels_avx2.cpp", "src/kernels_avx512.cpp"}
       files {"src/mt_algorithm.h", "src/mt_algorithm.cpp"}
+      files {"src/material.h", "src/material.cpp"}
+      files {"src/texture.h", "src/texture.cpp"}
       files {"src/lighting.h", "src/lighting.cpp"}
       files {"src/shadow_rays.h", "src/shadow_rays.cpp"}
       files {"src/reflection.h", "src/reflection.cpp"}
@@ -201,7 +307,19 @@ group "07. Anti-aliasing"
       includedirs { "lib/tinyobjloader" }
       includedirs { "src/" }
       files {"src/ray_generation.h", "src/ray_generation.cpp" }
+      files {"src/image_output.h", "src/image_output.cpp"}
+      files {"src/image_writer.h", "src/image_writer.cpp"}
+      files {"src/aov.h", "src/aov.cpp"}
+      files {"src/ray_statistics.h", "src/ray_statistics.cpp"}
+      files {"src/profiler.h", "src/profiler.cpp"}
+      files {"src/ray_capture.h", "src/ray_capture.cpp"}
+      files {"src/memory_budget.h", "src/memory_budget.cpp"}
+      files {"src/cpu_features.h", "src/cpu_features.cpp"}
+      files {"src/kernels.h", "src/kernels_impl.h", "src/kernels.cpp"}
+      files {"src/kernels_generic.cpp", "src/kernels_sse42.cpp", "src/kernels_avx2.cpp", "src/kernels_avx512.cpp"}
       files {"src/mt_algorithm.h", "src/mt_algorithm.cpp"}
+      files {"src/material.h", "src/material.cpp"}
+      files {"src/texture.h", "src/texture.cpp"}
       files {"src/lighting.h", "src/lighting.cpp"}
       files {"src/shadow_rays.h", "src/shadow_rays.cpp"}
       files {"src/reflection.h", "src/reflection.cpp"}
@@ -215,17 +333,6 @@ group "07. Anti-aliasing"
       links "AntiAliasing lib"
       files { "src/anti_aliasing_main.cpp" }
    
-   project "AntiAliasing tests"
-      kind "ConsoleApp"
-      includedirs { "lib/stb" }
-      includedirs { "lib/linalg" }
-      includedirs { "lib/catch2/single_include/catch2" }
-      includedirs { "src" }
-      files { "tests/test_utils.h" }
-      links "AntiAliasing lib"
-      debugargs { "--benchmark-samples", "25" }
-      files {"tests/anti_aliasing_tests.cpp"}
-
 group "08. AABB"
    project "AABB lib"
       kind "StaticLib"
@@ -234,12 +341,26 @@ group "08. AABB"
       includedirs { "lib/tinyobjloader" }
       includedirs { "src/" }
       files {"src/ray_generation.h", "src/ray_generation.cpp" }
+      files {"src/image_output.h", "src/image_output.cpp"}
+      files {"src/image_writer.h", "src/image_writer.cpp"}
+      files {"src/aov.h", "src/aov.cpp"}
+      files {"src/ray_statistics.h", "src/ray_statistics.cpp"}
+      files {"src/profiler.h", "src/profiler.cpp"}
+      files {"src/ray_capture.h", "src/ray_capture.cpp"}
+      files {"src/memory_budget.h", "src/memory_budget.cpp"}
+      files {"src/cpu_features.h", "src/cpu_features.cpp"}
+      files {"src/kernels.h", "src/kernels_impl.h", "src/kernels.cpp"}
+      files {"src/kernels_generic.cpp", "src/kernels_sse42.cpp", "src/kernels_avx2.cpp", "src/kernels_avx512.cpp"}
       files {"src/mt_algorithm.h", "src/mt_algorithm.cpp"}
+      files {"src/material.h", "src/material.cpp"}
+      files {"src/texture.h", "src/texture.cpp"}
       files {"src/lighting.h", "src/lighting.cpp"}
       files {"src/shadow_rays.h", "src/shadow_rays.cpp"}
       files {"src/reflection.h", "src/reflection.cpp"}
       files {"src/refraction.h", "src/refraction.cpp"}
       files {"src/anti_aliasing.h", "src/anti_aliasing.cpp"}
+      files {"src/primitives.h", "src/primitives.cpp"}
+      files {"src/simplification.h", "src/simplification.cpp"}
       files {"src/aabb.h", "src/aabb.cpp"}
       
    project "AABB app"
@@ -249,18 +370,6 @@ group "08. AABB"
       links "AABB lib"
       files { "src/aabb_main.cpp" }
    
-   project "AABB tests"
-      kind "ConsoleApp"
-      includedirs { "lib/stb" }
-      includedirs { "lib/linalg" }
-      includedirs { "lib/catch2/single_include/catch2" }
-      includedirs { "lib/tinyobjloader" }
-      includedirs { "src" }
-      files { "tests/test_utils.h" }
-      links "AABB lib"
-      debugargs { "--benchmark-samples", "5" }
-      files {"tests/aabb_tests.cpp"}
-
 group "09. BVH"
    project "BVH lib"
       kind "StaticLib"
@@ -269,12 +378,26 @@ group "09. BVH"
       includedirs { "lib/tinyobjloader" }
       includedirs { "src/" }
       files {"src/ray_generation.h", "src/ray_generation.cpp" }
+      files {"src/image_output.h", "src/image_output.cpp"}
+      files {"src/image_writer.h", "src/image_writer.cpp"}
+      files {"src/aov.h", "src/aov.cpp"}
+      files {"src/ray_statistics.h", "src/ray_statistics.cpp"}
+      files {"src/profiler.h", "src/profiler.cpp"}
+      files {"src/ray_capture.h", "src/ray_capture.cpp"}
+      files {"src/memory_budget.h", "src/memory_budget.cpp"}
+      files {"src/cpu_features.h", "src/cpu_features.cpp"}
+      files {"src/kernels.h", "src/kernels_impl.h", "src/kernels.cpp"}
+      files {"src/kernels_generic.cpp", "src/kernels_sse42.cpp", "src/kernels_avx2.cpp", "src/kernels_avx512.cpp"}
       files {"src/mt_algorithm.h", "src/mt_algorithm.cpp"}
+      files {"src/material.h", "src/material.cpp"}
+      files {"src/texture.h", "src/texture.cpp"}
       files {"src/lighting.h", "src/lighting.cpp"}
       files {"src/shadow_rays.h", "src/shadow_rays.cpp"}
       files {"src/reflection.h", "src/reflection.cpp"}
       files {"src/refraction.h", "src/refraction.cpp"}
       files {"src/anti_aliasing.h", "src/anti_aliasing.cpp"}
+      files {"src/primitives.h", "src/primitives.cpp"}
+      files {"src/simplification.h", "src/simplification.cpp"}
       files {"src/aabb.h", "src/aabb.cpp"}
       files {"src/bvh.h", "src/bvh.cpp"}
       
@@ -285,16 +408,6 @@ group "09. BVH"
       links "BVH lib"
       files { "src/bvh_main.cpp" }
    
-   project "BVH tests"
-      kind "ConsoleApp"
-      includedirs { "lib/stb" }
-      includedirs { "lib/linalg" }
-      includedirs { "lib/catch2/single_include/catch2" }
-      includedirs { "src" }
-      files { "tests/test_utils.h" }
-      links "BVH lib"
-      debugargs { "--benchmark-samples", "25" }
-      files {"tests/bvh_tests.cpp"}
 --]]
 
 group "10. Denoising"
@@ -305,15 +418,30 @@ group "10. Denoising"
       includedirs { "lib/tinyobjloader" }
       includedirs { "src/" }
       files {"src/ray_generation.h", "src/ray_generation.cpp" }
+      files {"src/image_output.h", "src/image_output.cpp"}
+      files {"src/image_writer.h", "src/image_writer.cpp"}
+      files {"src/aov.h", "src/aov.cpp"}
+      files {"src/ray_statistics.h", "src/ray_statistics.cpp"}
+      files {"src/profiler.h", "src/profiler.cpp"}
+      files {"src/ray_capture.h", "src/ray_capture.cpp"}
+      files {"src/memory_budget.h", "src/memory_budget.cpp"}
+      files {"src/cpu_features.h", "src/cpu_features.cpp"}
+      files {"src/kernels.h", "src/kernels_impl.h", "src/kernels.cpp"}
+      files {"src/kernels_generic.cpp", "src/kernels_sse42.cpp", "src/kernels_avx2.cpp", "src/kernels_avx512.cpp"}
       files {"src/mt_algorithm.h", "src/mt_algorithm.cpp"}
+      files {"src/material.h", "src/material.cpp"}
+      files {"src/texture.h", "src/texture.cpp"}
       files {"src/lighting.h", "src/lighting.cpp"}
       files {"src/shadow_rays.h", "src/shadow_rays.cpp"}
       files {"src/reflection.h", "src/reflection.cpp"}
       files {"src/refraction.h", "src/refraction.cpp"}
       files {"src/anti_aliasing.h", "src/anti_aliasing.cpp"}
+      files {"src/primitives.h", "src/primitives.cpp"}
+      files {"src/simplification.h", "src/simplification.cpp"}
       files {"src/aabb.h", "src/aabb.cpp"}
       files {"src/bvh.h", "src/bvh.cpp"}
       files {"src/denoising.h", "src/denoising.cpp"}
+      files {"src/distributed.h", "src/distributed.cpp"}
       
    project "Denoising app"
       kind "ConsoleApp"
@@ -321,3 +449,131 @@ group "10. Denoising"
       includedirs { "src" }
       links "Denoising lib"
       files { "src/denoising_main.cpp" }
+
+   project "Denoising tests"
+      kind "ConsoleApp"
+      includedirs { "lib/stb" }
+      includedirs { "lib/linalg" }
+      includedirs { "lib/catch2/single_include/catch2" }
+      includedirs { "src" }
+      links "Denoising lib"
+      files {"tests/denoising_tests.cpp"}
+
+group "11. Benchmarks"
+   project "Kernel benchmarks"
+      kind "ConsoleApp"
+      includedirs { "lib/linalg" }
+      includedirs { "lib/tinyobjloader" }
+      includedirs { "src" }
+      links "Denoising lib"
+      files { "bench/bench_utils.h" }
+      files { "bench/kernel_benchmarks.cpp" }
+
+   project "Scene scaling benchmark"
+      kind "ConsoleApp"
+      includedirs { "lib/linalg" }
+      includedirs { "lib/tinyobjloader" }
+      includedirs { "src" }
+      links "Denoising lib"
+      files { "bench/scene_scaling.cpp" }
+
+   project "Ray replay"
+      kind "ConsoleApp"
+      includedirs { "lib/linalg" }
+      includedirs { "lib/tinyobjloader" }
+      includedirs { "src" }
+      links "Denoising lib"
+      files { "bench/bench_utils.h" }
+      files { "bench/ray_replay.cpp" }
+
+group "12. Headless renderer"
+   project "Render"
+      kind "ConsoleApp"
+      includedirs { "lib/linalg" }
+      includedirs { "src" }
+      links "Denoising lib"
+      debugargs { "scenes/cornell.scene" }
+      files {"src/render_job.h", "src/render_job.cpp"}
+      files { "src/render_main.cpp" }
+   project "Render service"
+      kind "ConsoleApp"
+      includedirs { "lib/linalg" }
+      includedirs { "src" }
+      links "Denoising lib"
+      debugargs { "render.sock" }
+      files {"src/render_job.h", "src/render_job.cpp"}
+      files {"src/render_service.h", "src/render_service.cpp"}
+      files { "src/render_service_main.cpp" }
+   project "Render service tests"
+      kind "ConsoleApp"
+      includedirs { "lib/linalg" }
+      includedirs { "lib/catch2/single_include/catch2" }
+      includedirs { "src" }
+      links "Denoising lib"
+      files {"src/render_job.h", "src/render_job.cpp"}
+      files {"src/render_service.h", "src/render_service.cpp"}
+      files {"tests/render_service_tests.cpp"}
+
+-- The tests of the earlier stages, built against the Denoising lib which holds all of them
+group "13. Module tests"
+   project "AABB tests"
+      kind "ConsoleApp"
+      includedirs { "lib/stb" }
+      includedirs { "lib/linalg" }
+      includedirs { "lib/catch2/single_include/catch2" }
+      includedirs { "lib/tinyobjloader" }
+      includedirs { "src" }
+      files { "tests/test_utils.h" }
+      links "Denoising lib"
+      debugargs { "--benchmark-samples", "5" }
+      files {"tests/aabb_tests.cpp"}
+
+   project "Watertight intersection tests"
+      kind "ConsoleApp"
+      includedirs { "lib/linalg" }
+      includedirs { "lib/catch2/single_include/catch2" }
+      includedirs { "src" }
+      links "Denoising lib"
+      debugargs { "--benchmark-samples", "5", "--rays", "1048576" }
+      files {"tests/watertight_tests.cpp"}
+
+   project "Image output tests"
+      kind "ConsoleApp"
+      includedirs { "lib/linalg" }
+      includedirs { "lib/catch2/single_include/catch2" }
+      includedirs { "src" }
+      links "Denoising lib"
+      files {"tests/image_output_tests.cpp"}
+
+   project "AntiAliasing tests"
+      kind "ConsoleApp"
+      includedirs { "lib/stb" }
+      includedirs { "lib/linalg" }
+      includedirs { "lib/catch2/single_include/catch2" }
+      includedirs { "src" }
+      files { "tests/test_utils.h" }
+      links "Denoising lib"
+      debugargs { "--benchmark-samples", "25" }
+      files {"tests/anti_aliasing_tests.cpp"}
+
+   project "Ray generation tests"
+      kind "ConsoleApp"
+      includedirs { "lib/stb" }
+      includedirs { "lib/linalg" }
+      includedirs { "lib/catch2/single_include/catch2" }
+      includedirs { "src" }
+      files { "tests/test_utils.h" }
+      links "Denoising lib"
+      debugargs { "--benchmark-samples", "25" }
+      files {"tests/ray_generation_tests.cpp"}
+
+   project "BVH tests"
+      kind "ConsoleApp"
+      includedirs { "lib/stb" }
+      includedirs { "lib/linalg" }
+      includedirs { "lib/catch2/single_include/catch2" }
+      includedirs { "src" }
+      files { "tests/test_utils.h" }
+      links "Denoising lib"
+      debugargs { "--benchmark-samples", "25" }
+      files {"tests/bvh_tests.cpp"}
@@ -0,0 +1,47 @@
+#pragma once
+
+// Timing shared by the benchmarks. Each pass runs over a fixed query set, throughput is reported as the mean with a
+// 95% confidence interval over the samples.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Results are folded in here so the optimiser cannot drop the measured work
+static volatile double sink = 0.0;
+
+// Prints the throughput of pass in millions of unit per second, pass handles units of them each time
+static void Measure(const std::string& name, const std::string& set, const char* unit, size_t units, unsigned int samples, const std::function<double()>& pass) {
+	// One untimed pass warms the caches and faults in the pages
+	sink = sink + pass();
+
+	std::vector<double> throughput;
+	for (unsigned int i = 0; i < samples; i++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		sink = sink + pass();
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		throughput.push_back(static_cast<double>(units) / elapsed.count() / 1e6);
+	}
+
+	double mean = 0.0;
+	for (double value : throughput) {
+		mean += value;
+	}
+	mean /= throughput.size();
+
+	double variance = 0.0;
+	for (double value : throughput) {
+		variance += (value - mean) * (value - mean);
+	}
+	variance /= std::max<size_t>(1, throughput.size() - 1);
+	const double interval = 1.96 * std::sqrt(variance / throughput.size());
+
+	std::printf("%-28s %-10s %10.2f +- %6.2f M%s/s  (min %.2f, max %.2f, %u samples)\n",
+		name.c_str(), set.c_str(), mean, interval, unit,
+		*std::min_element(throughput.begin(), throughput.end()),
+		*std::max_element(throughput.begin(), throughput.end()), samples);
+}
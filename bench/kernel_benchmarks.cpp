@@ -0,0 +1,232 @@
+// Micro-benchmarks of the intersection and traversal kernels, isolated from shading.
+// Ray sets are generated from the Cornell scenes with fixed seeds, so every run traces the same rays.
+// Each kernel runs over its ray set repeatedly, throughput is reported as the mean with a 95% confidence interval.
+
+#include "bvh.h"
+#include "bench_utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+
+class KernelScene : public BVH
+{
+public:
+	KernelScene() : BVH(640, 360) {};
+
+	const std::vector<Mesh>& Meshes() const { return meshes; };
+	float TMin() const { return t_min; };
+	float TMax() const { return t_max; };
+};
+
+class RaySet
+{
+public:
+	std::string name;
+	std::vector<Ray> rays;
+	// Per-ray end of the segment, the light distance for shadow rays
+	std::vector<float> max_t;
+};
+
+class PrimaryHit
+{
+public:
+	float3 position;
+	float3 normal;
+};
+
+static float3 CosineDirection(float3 normal, std::mt19937& generator) {
+	std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	const float pi = 3.14159265358979f;
+	float r = std::sqrt(uniform(generator));
+	float phi = 2.0f * pi * uniform(generator);
+
+	float3 tangent = linalg::normalize(linalg::cross(std::fabs(normal.x) > 0.5f ? float3 {0, 1, 0} : float3 {1, 0, 0}, normal));
+	float3 bitangent = linalg::cross(normal, tangent);
+	return r * std::cos(phi) * tangent + r * std::sin(phi) * bitangent + std::sqrt(std::max(0.0f, 1.0f - r * r)) * normal;
+}
+
+// Primary rays of the test camera, then one diffuse bounce and one light ray from every primary hit
+static std::vector<RaySet> RecordRays(const KernelScene& scene, float3 position, float3 direction, float3 light) {
+	Camera camera;
+	camera.SetPosition(position);
+	camera.SetDirection(direction);
+	camera.SetUp(float3 {0, 1, 0});
+	camera.SetRenderTargetSize(640, 360);
+
+	RaySet primary;
+	primary.name = "primary";
+	for (short y = 0; y < 360; y++) {
+		for (short x = 0; x < 640; x++) {
+			primary.rays.push_back(camera.GetCameraRay(x, y));
+			primary.max_t.push_back(scene.TMax());
+		}
+	}
+
+	std::vector<PrimaryHit> hits;
+	for (const auto& ray : primary.rays) {
+		IntersectableData data(scene.TMax());
+		const MaterialSurface* surface = nullptr;
+		if (!scene.ClosestHit(ray, data, surface)) {
+			continue;
+		}
+
+		PrimaryHit hit;
+		hit.normal = linalg::normalize(surface->GetNormal(data.baricentric));
+		if (linalg::dot(hit.normal, ray.direction) > 0.0f) {
+			hit.normal = -hit.normal;
+		}
+		hit.position = ray.position + ray.direction * data.t + hit.normal * 1e-3f;
+		hits.push_back(hit);
+	}
+
+	std::mt19937 generator(1234);
+	RaySet diffuse;
+	diffuse.name = "diffuse";
+	RaySet shadow;
+	shadow.name = "shadow";
+	for (const auto& hit : hits) {
+		diffuse.rays.push_back(Ray(hit.position, CosineDirection(hit.normal, generator)));
+		diffuse.max_t.push_back(scene.TMax());
+		shadow.rays.push_back(Ray(hit.position, light - hit.position));
+		shadow.max_t.push_back(linalg::length(light - hit.position));
+	}
+
+	return {primary, diffuse, shadow};
+}
+
+static void RunScene(const std::string& model, float3 position, float3 direction, float3 light, unsigned int samples) {
+	KernelScene scene;
+	if (scene.LoadGeometry(model)) {
+		std::fprintf(stderr, "Could not load %s\n", model.c_str());
+		return;
+	}
+	scene.BuildBVH();
+
+	std::vector<RaySet> sets = RecordRays(scene, position, direction, light);
+	std::vector<const MaterialTriangle*> triangles;
+	for (const auto& mesh : scene.Meshes()) {
+		for (const auto& triangle : mesh.Triangles()) {
+			triangles.push_back(&triangle);
+		}
+	}
+	std::printf("\n%s: %zu triangles, %zu meshes, %zu primary / %zu diffuse / %zu shadow rays\n", model.c_str(),
+		triangles.size(), scene.Meshes().size(), sets[0].rays.size(), sets[1].rays.size(), sets[2].rays.size());
+
+	// The primitive kernels test every ray of a slice against every triangle, so the pass stays short
+	const size_t sliceSize = std::min<size_t>(1024, sets[0].rays.size());
+	for (const auto& set : sets) {
+		const size_t slice = std::min(sliceSize, set.rays.size());
+		Measure("Triangle::Intersect", set.name, "tests", slice * triangles.size(), samples, [&] {
+			double hits = 0.0;
+			for (size_t r = 0; r < slice; r++) {
+				for (const auto* triangle : triangles) {
+					hits += triangle->Intersect(set.rays[r]).t < scene.TMax() ? 1.0 : 0.0;
+				}
+			}
+			return hits;
+		});
+	}
+
+	Sphere sphere(float3 {0.0f, 0.8f, 0.0f}, 0.3f);
+	for (const auto& set : sets) {
+		Measure("Sphere::Intersect", set.name, "tests", set.rays.size(), samples, [&] {
+			double hits = 0.0;
+			for (const auto& ray : set.rays) {
+				hits += sphere.Intersect(ray).t > 0.0f ? 1.0 : 0.0;
+			}
+			return hits;
+		});
+	}
+
+	for (const auto& set : sets) {
+		Measure("Mesh::AABBTest", set.name, "tests", set.rays.size() * scene.Meshes().size(), samples, [&] {
+			double hits = 0.0;
+			for (const auto& ray : set.rays) {
+				for (const auto& mesh : scene.Meshes()) {
+					hits += mesh.AABBTest(ray) ? 1.0 : 0.0;
+				}
+			}
+			return hits;
+		});
+	}
+
+	for (size_t s = 0; s < 2; s++) {
+		const RaySet& set = sets[s];
+		Measure("Closest hit, AABB list", set.name, "rays", set.rays.size(), samples, [&] {
+			double hits = 0.0;
+			for (const auto& ray : set.rays) {
+				IntersectableData data(scene.TMax());
+				const MaterialSurface* surface = nullptr;
+				hits += scene.AABB::ClosestHit(ray, data, surface) ? 1.0 : 0.0;
+			}
+			return hits;
+		});
+		Measure("Closest hit, BVH", set.name, "rays", set.rays.size(), samples, [&] {
+			double hits = 0.0;
+			for (const auto& ray : set.rays) {
+				IntersectableData data(scene.TMax());
+				const MaterialSurface* surface = nullptr;
+				hits += scene.ClosestHit(ray, data, surface) ? 1.0 : 0.0;
+			}
+			return hits;
+		});
+	}
+
+	const RaySet& shadow = sets[2];
+	Measure("Shadow query, AABB list", shadow.name, "rays", shadow.rays.size(), samples, [&] {
+		double occluded = 0.0;
+		for (size_t r = 0; r < shadow.rays.size(); r++) {
+			occluded += scene.AABB::TraceShadowRay(shadow.rays[r], shadow.max_t[r]) < shadow.max_t[r] ? 1.0 : 0.0;
+		}
+		return occluded;
+	});
+	Measure("Shadow query, BVH", shadow.name, "rays", shadow.rays.size(), samples, [&] {
+		double occluded = 0.0;
+		for (size_t r = 0; r < shadow.rays.size(); r++) {
+			occluded += scene.TraceShadowRay(shadow.rays[r], shadow.max_t[r]) < shadow.max_t[r] ? 1.0 : 0.0;
+		}
+		return occluded;
+	});
+
+	// The BVH again with every kernel variant this CPU runs, the default above is the widest
+	for (int i = 0; i <= static_cast<int>(DetectCpuIsa()); i++) {
+		const CpuIsa isa = static_cast<CpuIsa>(i);
+		SelectKernels(isa);
+		for (size_t s = 0; s < 2; s++) {
+			const RaySet& set = sets[s];
+			Measure(std::string("Closest hit, BVH, ") + CpuIsaName(isa), set.name, "rays", set.rays.size(), samples, [&] {
+				double hits = 0.0;
+				for (const auto& ray : set.rays) {
+					IntersectableData data(scene.TMax());
+					const MaterialSurface* surface = nullptr;
+					hits += scene.ClosestHit(ray, data, surface) ? 1.0 : 0.0;
+				}
+				return hits;
+			});
+		}
+	}
+	SelectKernels(DetectCpuIsa());
+}
+
+// kernel_benchmarks [--samples N], single threaded so the numbers compare across machines with different core counts
+int main(int argc, char* argv[]) {
+	unsigned int samples = 25;
+	for (int i = 1; i + 1 < argc; i++) {
+		if (std::string(argv[i]) == "--samples") {
+			samples = std::max(2, std::atoi(argv[i + 1]));
+		}
+	}
+
+	std::printf("Kernels: %s\n", CpuIsaName(Kernels().isa));
+
+	// Cameras and lights of the BVH and anti-aliasing tests
+	RunScene("models/CornellBox-Sphere.obj", float3 {0.0f, 0.795f, 1.6f}, float3 {0, 0.795f, -1}, float3 {0, 1.58f, -0.03f}, samples);
+	RunScene("models/CornellBox-Mirror.obj", float3 {-0.5f, 0.99f, 1.5f}, float3 {0, 0.99f, -1}, float3 {0, 1.98f, -0.06f}, samples);
+	return 0;
+}
@@ -0,0 +1,157 @@
+// Replays a ray capture (see RayCapture, denoising --capture <file>) through the acceleration structures built over
+// a model, without shading. Closest and shadow queries are timed apart, and every structure's hits are checked
+// against the first one, so a new builder or kernel can be compared on the exact rays of a production frame.
+
+#include "bvh.h"
+#include "bench_utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <string>
+
+class ReplayScene : public BVH
+{
+public:
+	ReplayScene() : BVH(16, 16) {};
+
+	float TMax() const { return t_max; };
+	// Queries are answered over (t_min, max_t) as they were when captured
+	void SetTMin(float value) { t_min = value; };
+};
+
+class ReplayQueries
+{
+public:
+	std::vector<Ray> closest;
+	std::vector<Ray> shadow;
+	std::vector<float> shadow_max_t;
+};
+
+// One acceleration structure as seen by the replay
+class Structure
+{
+public:
+	std::string name;
+	std::function<bool(const Ray&, IntersectableData&)> closest_hit;
+	std::function<float(const Ray&, float)> any_hit;
+};
+
+static ReplayQueries ToQueries(const std::vector<CapturedRay>& captured) {
+	ReplayQueries queries;
+	for (const auto& record : captured) {
+		Ray ray(record.origin, record.direction);
+		ray.spread = record.spread;
+		ray.cone_width = record.cone_width;
+		ray.time = record.time;
+		if (record.type == CAPTURE_SHADOW) {
+			queries.shadow.push_back(ray);
+			queries.shadow_max_t.push_back(record.max_t);
+		} else {
+			queries.closest.push_back(ray);
+		}
+	}
+	return queries;
+}
+
+// ray_replay <capture> <model.obj> [--samples N], single threaded like the kernel benchmarks
+int main(int argc, char* argv[]) {
+	if (argc < 3) {
+		std::fprintf(stderr, "Usage: ray_replay <capture> <model.obj> [--samples N]\n");
+		return -1;
+	}
+	unsigned int samples = 10;
+	for (int i = 3; i + 1 < argc; i++) {
+		if (std::string(argv[i]) == "--samples") {
+			samples = std::max(2, std::atoi(argv[i + 1]));
+		}
+	}
+
+	std::vector<CapturedRay> captured;
+	float captureTMin = 0.0f;
+	unsigned int lodLevels = 0;
+	if (!RayCapture::Load(argv[1], captured, captureTMin, lodLevels)) {
+		std::fprintf(stderr, "Could not read the capture %s\n", argv[1]);
+		return -1;
+	}
+
+	ReplayScene scene;
+	scene.SetTMin(captureTMin);
+	if (scene.LoadGeometry(argv[2])) {
+		std::fprintf(stderr, "Could not load %s\n", argv[2]);
+		return -1;
+	}
+	// The captured ray cones pick the same simplified meshes as in the frame
+	scene.BuildLODs(lodLevels);
+	auto start = std::chrono::high_resolution_clock::now();
+	scene.BuildBVH();
+	std::chrono::duration<double, std::milli> build = std::chrono::high_resolution_clock::now() - start;
+
+	ReplayQueries queries = ToQueries(captured);
+	std::printf("%s: %zu closest and %zu shadow queries, replayed with the captured t_min %g\n", argv[1], queries.closest.size(), queries.shadow.size(), captureTMin);
+	std::printf("%s: %zu meshes with %u LOD levels, BVH built in %.3f ms\n\n", argv[2], scene.MeshCount(), lodLevels, build.count());
+
+	const float tMax = scene.TMax();
+	std::vector<Structure> structures;
+	structures.push_back({"AABB list",
+		[&](const Ray& ray, IntersectableData& data) { const MaterialSurface* surface = nullptr; return scene.AABB::ClosestHit(ray, data, surface); },
+		[&](const Ray& ray, float max_t) { return scene.AABB::TraceShadowRay(ray, max_t); }});
+	structures.push_back({"BVH",
+		[&](const Ray& ray, IntersectableData& data) { const MaterialSurface* surface = nullptr; return scene.ClosestHit(ray, data, surface); },
+		[&](const Ray& ray, float max_t) { return scene.TraceShadowRay(ray, max_t); }});
+
+	// Hits of the first structure are the reference for the others
+	std::vector<float> referenceT;
+	std::vector<bool> referenceOccluded;
+	int result = 0;
+	for (const auto& structure : structures) {
+		std::vector<float> closestT(queries.closest.size());
+		for (size_t r = 0; r < queries.closest.size(); r++) {
+			IntersectableData data(tMax);
+			closestT[r] = structure.closest_hit(queries.closest[r], data) ? data.t : tMax;
+		}
+		std::vector<bool> occluded(queries.shadow.size());
+		for (size_t r = 0; r < queries.shadow.size(); r++) {
+			occluded[r] = structure.any_hit(queries.shadow[r], queries.shadow_max_t[r]) < queries.shadow_max_t[r];
+		}
+
+		if (referenceT.empty() && referenceOccluded.empty()) {
+			referenceT = closestT;
+			referenceOccluded = occluded;
+		} else {
+			size_t mismatches = 0;
+			for (size_t r = 0; r < closestT.size(); r++) {
+				mismatches += std::fabs(closestT[r] - referenceT[r]) > 1e-4f * std::max(1.0f, referenceT[r]) ? 1 : 0;
+			}
+			for (size_t r = 0; r < occluded.size(); r++) {
+				mismatches += occluded[r] != referenceOccluded[r] ? 1 : 0;
+			}
+			std::printf("%-28s %zu queries differ from %s\n", structure.name.c_str(), mismatches, structures.front().name.c_str());
+			result = mismatches ? -1 : result;
+		}
+
+		if (!queries.closest.empty()) {
+			Measure(structure.name, "closest", "rays", queries.closest.size(), samples, [&] {
+				double hits = 0.0;
+				for (const auto& ray : queries.closest) {
+					IntersectableData data(tMax);
+					hits += structure.closest_hit(ray, data) ? 1.0 : 0.0;
+				}
+				return hits;
+			});
+		}
+		if (!queries.shadow.empty()) {
+			Measure(structure.name, "shadow", "rays", queries.shadow.size(), samples, [&] {
+				double occludedCount = 0.0;
+				for (size_t r = 0; r < queries.shadow.size(); r++) {
+					occludedCount += structure.any_hit(queries.shadow[r], queries.shadow_max_t[r]) < queries.shadow_max_t[r] ? 1.0 : 0.0;
+				}
+				return occludedCount;
+			});
+		}
+	}
+	return result;
+}
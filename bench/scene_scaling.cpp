@@ -0,0 +1,338 @@
+// Scene-scaling benchmark on procedurally generated scenes: tessellated spheres, a grid of CornellBox-Sphere copies
+// and a random triangle soup. Sweeps triangle counts, resolutions and thread counts and writes one CSV row per run
+// with the acceleration structure build time, the geometry footprint and the primary ray throughput.
+
+#include "bvh.h"
+
+#include <omp.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+
+// Generated meshes are cut into spatial chunks of about this many triangles, so per-mesh bounds still cull
+static const size_t chunk_triangles = 1024;
+
+class ScalingScene : public BVH
+{
+public:
+	ScalingScene() : BVH(16, 16) {
+		materials.push_back(Material());
+	};
+
+	void AddTessellatedSphere(float3 center, float radius, int rings, int segments);
+	void AddCornellGrid(const std::string& model, size_t target_triangles);
+	void AddTriangleSoup(size_t count, unsigned int seed);
+
+	size_t TriangleCount() const;
+	size_t FootprintBytes() const;
+	void Bounds(float3& min, float3& max) const;
+
+	// Closest hits of the primary rays of a width x height view of the whole scene, traced passes times
+	size_t TracePrimary(int width, int height, int passes) const;
+
+protected:
+	MaterialTriangle MakeTriangle(float3 a, float3 b, float3 c);
+	// Buckets triangles into a grid of cells holding about chunk_triangles each, one mesh per cell
+	void AddChunked(const std::vector<MaterialTriangle>& triangles);
+};
+
+MaterialTriangle ScalingScene::MakeTriangle(float3 a, float3 b, float3 c) {
+	// Flat shaded, every vertex takes the face normal
+	const float3 normal = linalg::normalize(linalg::cross(b - a, c - a));
+	MaterialTriangle triangle {Vertex(a, normal), Vertex(b, normal), Vertex(c, normal)};
+	triangle.SetMaterial(0);
+	triangle.SetPrimitiveId(primitive_count++);
+	return triangle;
+}
+
+void ScalingScene::AddChunked(const std::vector<MaterialTriangle>& triangles) {
+	if (triangles.empty()) {
+		return;
+	}
+
+	float3 min = triangles[0].a.position;
+	float3 max = min;
+	for (const auto& triangle : triangles) {
+		for (const Vertex* vertex : {&triangle.a, &triangle.b, &triangle.c}) {
+			min = linalg::min(min, vertex->position);
+			max = linalg::max(max, vertex->position);
+		}
+	}
+
+	const int cells = std::max(1, static_cast<int>(std::ceil(std::cbrt(static_cast<double>(triangles.size()) / chunk_triangles))));
+	const float3 extent = linalg::max(max - min, float3(1e-6f));
+	std::vector<Mesh> chunks(static_cast<size_t>(cells) * cells * cells);
+	for (const auto& triangle : triangles) {
+		float3 centroid = (triangle.a.position + triangle.b.position + triangle.c.position) / 3.0f;
+		int3 cell = linalg::clamp(int3((centroid - min) / extent * static_cast<float>(cells)), int3(0), int3(cells - 1));
+		chunks[(static_cast<size_t>(cell.z) * cells + cell.y) * cells + cell.x].AddTriangle(triangle);
+	}
+
+	for (auto& chunk : chunks) {
+		if (!chunk.IsEmpty()) {
+			meshes.push_back(std::move(chunk));
+		}
+	}
+}
+
+void ScalingScene::AddTessellatedSphere(float3 center, float radius, int rings, int segments) {
+	const float pi = 3.14159265358979f;
+	auto point = [&](int ring, int segment) {
+		float theta = pi * ring / rings;
+		float phi = 2.0f * pi * segment / segments;
+		return center + radius * float3 {std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi)};
+	};
+
+	std::vector<MaterialTriangle> triangles;
+	for (int ring = 0; ring < rings; ring++) {
+		for (int segment = 0; segment < segments; segment++) {
+			float3 a = point(ring, segment);
+			float3 b = point(ring, segment + 1);
+			float3 c = point(ring + 1, segment);
+			float3 d = point(ring + 1, segment + 1);
+			if (ring > 0) {
+				triangles.push_back(MakeTriangle(a, b, c));
+			}
+			if (ring < rings - 1) {
+				triangles.push_back(MakeTriangle(b, d, c));
+			}
+		}
+	}
+	AddChunked(triangles);
+}
+
+void ScalingScene::AddCornellGrid(const std::string& model, size_t target_triangles) {
+	// The tree has no instancing, so every copy in the grid is real geometry
+	ScalingScene source;
+	if (source.LoadGeometry(model) || source.TriangleCount() == 0) {
+		std::fprintf(stderr, "Could not load %s\n", model.c_str());
+		return;
+	}
+
+	float3 min, max;
+	source.Bounds(min, max);
+	const float3 spacing = (max - min) * 1.1f;
+	const size_t copies = std::max<size_t>(1, (target_triangles + source.TriangleCount() - 1) / source.TriangleCount());
+	const size_t side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(copies))));
+
+	for (size_t copy = 0; copy < copies; copy++) {
+		const float3 offset {spacing.x * (copy % side), spacing.y * (copy / side), 0.0f};
+		for (const auto& sourceMesh : source.meshes) {
+			Mesh mesh;
+			for (const auto& triangle : sourceMesh.Triangles()) {
+				mesh.AddTriangle(MakeTriangle(triangle.a.position + offset, triangle.b.position + offset, triangle.c.position + offset));
+			}
+			meshes.push_back(std::move(mesh));
+		}
+	}
+}
+
+void ScalingScene::AddTriangleSoup(size_t count, unsigned int seed) {
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::uniform_real_distribution<float> offset(-1.0f, 1.0f);
+	// Edges shrink with the count so the soup keeps a similar depth complexity at every size
+	const float size = 2.0f / std::cbrt(static_cast<float>(std::max<size_t>(count, 1)));
+
+	std::vector<MaterialTriangle> triangles;
+	triangles.reserve(count);
+	for (size_t i = 0; i < count; i++) {
+		float3 a {unit(generator), unit(generator), unit(generator)};
+		float3 b = a + size * float3 {offset(generator), offset(generator), offset(generator)};
+		float3 c = a + size * float3 {offset(generator), offset(generator), offset(generator)};
+		triangles.push_back(MakeTriangle(a, b, c));
+	}
+	AddChunked(triangles);
+}
+
+size_t ScalingScene::TriangleCount() const {
+	size_t count = 0;
+	for (const auto& mesh : meshes) {
+		count += mesh.Triangles().size();
+	}
+	return count;
+}
+
+size_t ScalingScene::FootprintBytes() const {
+	size_t bytes = meshes.capacity() * sizeof(Mesh);
+	for (const auto& mesh : meshes) {
+		bytes += mesh.Triangles().capacity() * sizeof(MaterialTriangle);
+	}
+	for (const auto& tlas : tlases) {
+		bytes += sizeof(TLAS);
+		for (const auto& mesh : tlas.GetMeshes()) {
+			bytes += sizeof(Mesh) + mesh.Triangles().capacity() * sizeof(MaterialTriangle);
+		}
+	}
+	return bytes;
+}
+
+void ScalingScene::Bounds(float3& min, float3& max) const {
+	min = float3(std::numeric_limits<float>::max());
+	max = float3(-std::numeric_limits<float>::max());
+	for (const auto& mesh : meshes) {
+		min = linalg::min(min, mesh.aabb_min);
+		max = linalg::max(max, mesh.aabb_max);
+	}
+}
+
+size_t ScalingScene::TracePrimary(int width, int height, int passes) const {
+	float3 min, max;
+	Bounds(min, max);
+	const float3 center = (min + max) / 2.0f;
+	const float extent = linalg::length(max - min);
+
+	Camera view;
+	view.SetPosition(center + float3 {0.0f, 0.0f, extent});
+	view.SetDirection(center);
+	view.SetUp(float3 {0, 1, 0});
+	view.SetRenderTargetSize(width, height);
+
+	size_t hits = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:hits)
+	for (int row = 0; row < height * passes; row++) {
+		for (int x = 0; x < width; x++) {
+			Ray ray = view.GetCameraRay(x, row % height);
+			IntersectableData data(t_max);
+			const MaterialSurface* surface = nullptr;
+			hits += ClosestHit(ray, data, surface) ? 1 : 0;
+		}
+	}
+	return hits;
+}
+
+class Settings
+{
+public:
+	std::vector<size_t> triangle_counts {10000, 100000, 1000000};
+	std::vector<int> heights {90, 180, 360};
+	std::vector<int> threads;
+	std::string model = "models/CornellBox-Sphere.obj";
+};
+
+static std::vector<size_t> ParseList(const std::string& text) {
+	std::vector<size_t> values;
+	std::stringstream stream(text);
+	std::string item;
+	while (std::getline(stream, item, ',')) {
+		values.push_back(static_cast<size_t>(std::stod(item)));
+	}
+	return values;
+}
+
+// Speedup is against one thread, extrapolated linearly when the sweep starts higher; zero leaves the row without one
+static void PrintRow(const char* scene, const ScalingScene& geometry, double build_ms, const char* sweep,
+	int width, int height, int passes, int threads, double seconds, double speedup) {
+	const double rays = static_cast<double>(width) * height * passes;
+	std::printf("%s,%zu,%zu,%.3f,%.3f,%s,%d,%d,%d,%d,%.0f,%.6f,%.3f,%.3f,%.3f\n",
+		scene, geometry.TriangleCount(), geometry.MeshCount(), build_ms, geometry.FootprintBytes() / (1024.0 * 1024.0),
+		sweep, width, height, passes, threads, rays, seconds, rays / seconds / 1e6, speedup, speedup / threads);
+	std::fflush(stdout);
+}
+
+static double Time(const ScalingScene& geometry, int width, int height, int passes, int threads) {
+	omp_set_num_threads(threads);
+	// Best of three, the first also warms the caches and the thread pool
+	double best = std::numeric_limits<double>::max();
+	for (int run = 0; run < 3; run++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		geometry.TracePrimary(width, height, passes);
+		std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+		best = std::min(best, elapsed.count());
+	}
+	return best;
+}
+
+static void RunScene(const char* name, ScalingScene& geometry, const Settings& settings) {
+	// The top level splits the meshes into two fixed groups and needs both
+	if (geometry.MeshCount() < 2) {
+		std::fprintf(stderr, "Skipping %s, %zu meshes\n", name, geometry.MeshCount());
+		return;
+	}
+
+	auto start = std::chrono::high_resolution_clock::now();
+	geometry.BuildBVH();
+	std::chrono::duration<double, std::milli> build = std::chrono::high_resolution_clock::now() - start;
+
+	const int maxThreads = settings.threads.back();
+	for (int height : settings.heights) {
+		PrintRow(name, geometry, build.count(), "resolution", height * 16 / 9, height, 1, maxThreads,
+			Time(geometry, height * 16 / 9, height, 1, maxThreads), 0.0);
+	}
+
+	const int baseThreads = settings.threads.front();
+	const int baseHeight = settings.heights.front();
+	const int baseWidth = baseHeight * 16 / 9;
+	const double baseline = Time(geometry, baseWidth, baseHeight, 1, baseThreads) * baseThreads;
+	for (int threads : settings.threads) {
+		const double seconds = Time(geometry, baseWidth, baseHeight, 1, threads);
+		PrintRow(name, geometry, build.count(), "strong", baseWidth, baseHeight, 1, threads, seconds, baseline / seconds);
+	}
+
+	// The base view is traced once per baseline thread, so every thread keeps the same rays to trace
+	for (int threads : settings.threads) {
+		const int passes = std::max(1, threads / baseThreads);
+		const double seconds = Time(geometry, baseWidth, baseHeight, passes, threads);
+		PrintRow(name, geometry, build.count(), "weak", baseWidth, baseHeight, passes, threads, seconds,
+			baseline * passes / seconds);
+	}
+}
+
+// scene_scaling [--triangles 1e4,1e5,1e6,1e7] [--heights 90,180,360] [--threads 1,2,4,8] [--model file.obj] > scaling.csv
+int main(int argc, char* argv[]) {
+	Settings settings;
+	for (int t = 1; t <= omp_get_max_threads(); t *= 2) {
+		settings.threads.push_back(t);
+	}
+	for (int i = 1; i + 1 < argc; i += 2) {
+		const std::string option = argv[i];
+		if (option == "--triangles") {
+			settings.triangle_counts = ParseList(argv[i + 1]);
+		} else if (option == "--heights") {
+			std::vector<size_t> heights = ParseList(argv[i + 1]);
+			settings.heights.assign(heights.begin(), heights.end());
+		} else if (option == "--threads") {
+			std::vector<size_t> threads = ParseList(argv[i + 1]);
+			settings.threads.assign(threads.begin(), threads.end());
+		} else if (option == "--model") {
+			settings.model = argv[i + 1];
+		}
+	}
+	if (settings.triangle_counts.empty() || settings.heights.empty() || settings.threads.empty()) {
+		std::fprintf(stderr, "Empty sweep\n");
+		return -1;
+	}
+
+	std::printf("scene,triangles,meshes,build_ms,footprint_mb,sweep,width,height,passes,threads,rays,seconds,mrays_per_s,speedup,efficiency\n");
+	for (size_t target : settings.triangle_counts) {
+		{
+			ScalingScene geometry;
+			// Spheres of about 20k triangles on a square grid
+			const size_t spheres = std::max<size_t>(1, target / 20000);
+			const int rings = target < 20000 ? std::max(4, static_cast<int>(std::sqrt(target / 2.0))) : 100;
+			const size_t side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(spheres))));
+			for (size_t s = 0; s < spheres; s++) {
+				geometry.AddTessellatedSphere(float3 {2.5f * (s % side), 2.5f * (s / side), 0.0f}, 1.0f, rings, rings);
+			}
+			RunScene("spheres", geometry, settings);
+		}
+		{
+			ScalingScene geometry;
+			geometry.AddCornellGrid(settings.model, target);
+			RunScene("cornell_grid", geometry, settings);
+		}
+		{
+			ScalingScene geometry;
+			geometry.AddTriangleSoup(target, 42);
+			RunScene("soup", geometry, settings);
+		}
+	}
+	return 0;
+}
@@ -1,13 +1,18 @@
 #include "aabb.h"
+#include "simplification.h"
 
 //#define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
-AABB::AABB(short width, short height) :AntiAliasing(width, height) {}
+#include <algorithm>
+#include <cmath>
+
+AABB::AABB(int width, int height) :AntiAliasing(width, height) {}
 
 AABB::~AABB() {}
 
 int AABB::LoadGeometry(std::string filename) {
+	ProfileScope profile("load");
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
@@ -15,7 +20,7 @@ int AABB::LoadGeometry(std::string filename) {
 	std::string warn;
 	std::string err;
 
-	size_t delimeter = filename.find_last_of('//');
+	size_t delimeter = filename.find_last_of('/');
 	std::string dir = filename.substr(0, delimeter);
 
 	bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, filename.c_str(), dir.c_str());
@@ -29,9 +34,32 @@ int AABB::LoadGeometry(std::string filename) {
 	}
 
 	if (!ret) {
-		exit(1);
+		return -1;
+	}
+
+	size_t faceCount = 0;
+	for (const auto &shape : shapes) {
+		faceCount += shape.mesh.num_face_vertices.size();
+	}
+	if (OverBudget(faceCount * (sizeof(MaterialTriangle) + PackedTriangles::triangle_bytes) + shapes.size() * sizeof(Mesh))) {
+		std::cerr << filename << " does not fit the memory budget" << std::endl;
+		return memory_budget_exceeded;
 	}
 
+	// Compile every MTL entry into a BSDF record once, triangles only keep an index
+	size_t materialOffset = this->materials.size();
+	for (auto const &material : materials) {
+		Material compiled(material.illum, float3 {material.emission}, float3 {material.ambient},
+			float3 {material.diffuse}, float3 {material.specular}, material.shininess, material.ior);
+		if (!material.diffuse_texname.empty()) {
+			compiled.diffuse_texture = texture_cache.AddTexture(dir + "/" + material.diffuse_texname);
+		}
+		this->materials.push_back(compiled);
+	}
+	// Faces without a material, or a model without an MTL file, get a neutral grey Lambert
+	const size_t defaultMaterial = this->materials.size();
+	this->materials.push_back(Material());
+
 	// Loop over shapes
 	for (size_t s = 0; s < shapes.size(); s++) {
 		Mesh mesh;
@@ -50,9 +78,6 @@ int AABB::LoadGeometry(std::string filename) {
 				tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
 				tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
 
-				// tinyobj::real_t tx = attrib.texcoords[2 * idx.texcoord_index + 0];
-				// tinyobj::real_t ty = attrib.texcoords[2 * idx.texcoord_index + 1];
-
 				if (idx.normal_index >= 0) {
 					tinyobj::real_t nx = attrib.normals[3 * idx.normal_index + 0];
 					tinyobj::real_t ny = attrib.normals[3 * idx.normal_index + 1];
@@ -62,6 +87,12 @@ int AABB::LoadGeometry(std::string filename) {
 					vertices.push_back(Vertex(float3 {vx, vy, vz}));
 				}
 
+				if (idx.texcoord_index >= 0) {
+					tinyobj::real_t tx = attrib.texcoords[2 * idx.texcoord_index + 0];
+					tinyobj::real_t ty = attrib.texcoords[2 * idx.texcoord_index + 1];
+					vertices.back().tex = float3 {tx, ty, 0.0f};
+				}
+
 				// Optional: vertex colors
 				// tinyobj::real_t red = attrib.colors[3*idx.vertex_index+0];
 				// tinyobj::real_t green = attrib.colors[3*idx.vertex_index+1];
@@ -71,15 +102,9 @@ int AABB::LoadGeometry(std::string filename) {
 
 			MaterialTriangle triangle(vertices[0], vertices[1], vertices[2]);
 
-			int materialId = shapes[s].mesh.material_ids[f];
-			tinyobj::material_t material = materials[materialId];
-			triangle.SetEmisive(float3 {material.emission});
-			triangle.SetAmbient(float3 {material.ambient});
-			triangle.SetDiffuse(float3 {material.diffuse});
-			triangle.SetSpecular(float3 {material.specular}, material.shininess);
-			triangle.SetReflectiveness(material.illum == 5);
-			triangle.SetReflectivenessAndTransparency(material.illum == 7);
-			triangle.SetIor(material.ior);
+			const int materialId = shapes[s].mesh.material_ids[f];
+			triangle.SetMaterial(static_cast<unsigned int>(materialId < 0 ? defaultMaterial : materialOffset + materialId));
+			triangle.SetPrimitiveId(primitive_count++);
 
 			mesh.AddTriangle(triangle);
 
@@ -99,68 +124,381 @@ Payload AABB::TraceRay(const Ray &ray, const unsigned int max_raytrace_depth) co
 	if (max_raytrace_depth <= 0) {
 		return Miss(ray);
 	}
+	RAY_STAT(RayStatistics::CountDepth(raytracing_depth - max_raytrace_depth));
+	RayCapture::Record(ray.position, ray.direction, ray.spread, ray.cone_width, ray.time, t_max, CAPTURE_CLOSEST, raytracing_depth - max_raytrace_depth);
 
 	IntersectableData closestData(t_max);
-	MaterialTriangle closestTriangle;
+	const MaterialSurface *closestSurface = nullptr;
+
+	if (ClosestHit(ray, closestData, closestSurface)) {
+		return Hit(ray, closestData, closestSurface, max_raytrace_depth);
+	}
+
+	return Miss(ray);
+}
+
+bool AABB::ClosestHit(const Ray &ray, IntersectableData &closest, const MaterialSurface *&surface) const {
+	closest = IntersectableData(t_max);
+	surface = nullptr;
 
 	for (auto &mesh : meshes) {
 		if (!mesh.AABBTest(ray)) {
 			continue;
 		}
 
-		for (auto &object : mesh.Triangles()) {
-			IntersectableData data = object.Intersect(ray);
-			if (data.t < closestData.t && data.t > t_min) {
-				closestData = data;
-				closestTriangle = object;
-			}
-		}
-	}
-
-	if (closestData.t < t_max) {
-		return Hit(ray, closestData, &closestTriangle, max_raytrace_depth);
+		mesh.Intersect(ray, t_min, closest, surface);
 	}
 
-	return Miss(ray);
+	return surface != nullptr;
 }
 
 float AABB::TraceShadowRay(const Ray &ray, const float max_t) const {
-	IntersectableData closestData(max_t);
+	RAY_STAT(RayStatistics::CountRay(RAY_SHADOW));
+	RayCapture::Record(ray.position, ray.direction, ray.spread, ray.cone_width, ray.time, max_t, CAPTURE_SHADOW, 0);
 	for (auto &mesh : meshes) {
 		if (!mesh.AABBTest(ray)) {
 			continue;
 		}
 
-		for (auto &object : mesh.Triangles()) {
-			IntersectableData data = object.Intersect(ray);
-			if (data.t < closestData.t && data.t > t_min) {
-				return data.t;
-			}
+		float t = mesh.AnyHit(ray, t_min, max_t);
+		if (t < max_t) {
+			return t;
 		}
 	}
 
 	return max_t;
 }
 
-void Mesh::AddTriangle(const MaterialTriangle triangle) {
-	if (triangles.empty()) {
-		aabb_max = aabb_min = triangle.a.position;
+void AABB::AddSphere(float3 center, float radius, const Material &material) {
+	MaterialSphere sphere(center, radius);
+	sphere.SetMaterial(static_cast<unsigned int>(materials.size()));
+	sphere.SetPrimitiveId(primitive_count++);
+	materials.push_back(material);
+
+	Mesh mesh;
+	mesh.AddSphere(sphere);
+	meshes.push_back(mesh);
+}
+
+void AABB::AddQuad(int axis, float offset, float2 min, float2 max, bool flip_normal, const Material &material) {
+	MaterialQuad quad(axis, offset, min, max, flip_normal);
+	quad.SetMaterial(static_cast<unsigned int>(materials.size()));
+	quad.SetPrimitiveId(primitive_count++);
+	materials.push_back(material);
+
+	Mesh mesh;
+	mesh.AddQuad(quad);
+	meshes.push_back(mesh);
+}
+
+void AABB::AddBox(float3 min, float3 max, const Material &material) {
+	unsigned int materialId = static_cast<unsigned int>(materials.size());
+	materials.push_back(material);
+
+	Mesh mesh;
+	for (int axis = 0; axis < 3; axis++) {
+		int u = (axis + 1) % 3;
+		int v = (axis + 2) % 3;
+		float2 faceMin {min[u], min[v]};
+		float2 faceMax {max[u], max[v]};
+
+		MaterialQuad low(axis, min[axis], faceMin, faceMax, true);
+		low.SetMaterial(materialId);
+		low.SetPrimitiveId(primitive_count++);
+		mesh.AddQuad(low);
+
+		MaterialQuad high(axis, max[axis], faceMin, faceMax, false);
+		high.SetMaterial(materialId);
+		high.SetPrimitiveId(primitive_count++);
+		mesh.AddQuad(high);
+	}
+	meshes.push_back(mesh);
+}
+
+void AABB::BuildLODs(unsigned int levels) {
+	ProfileScope profile("lod build");
+	const float reduction = 0.25f;
+	float levelShare = 0.0f;
+	for (unsigned int level = 1; level <= levels; level++) {
+		levelShare += std::pow(reduction, static_cast<float>(level));
+	}
+	size_t lodBytes = 0;
+	for (const auto &mesh : meshes) {
+		if (mesh.Triangles().size() > lod_min_triangles) {
+			lodBytes += static_cast<size_t>((VectorBytes(mesh.Triangles()) + mesh.Triangles().size() * PackedTriangles::triangle_bytes) * levelShare);
+		}
+	}
+	if (OverBudget(lodBytes)) {
+		std::cerr << "Simplified levels do not fit the memory budget, tracing the full meshes" << std::endl;
+		return;
+	}
+
+	for (auto &mesh : meshes) {
+		if (mesh.Triangles().size() > lod_min_triangles) {
+			mesh.BuildLODs(levels, reduction);
+		}
+	}
+	lod_levels = levels;
+}
+
+void AABB::AccountMemory(MemoryReport &report) const {
+	AntiAliasing::AccountMemory(report);
+	report.Add(MEMORY_GEOMETRY, VectorBytes(meshes));
+	for (const auto &mesh : meshes) {
+		report.Add(MEMORY_GEOMETRY, mesh.MemoryBytes());
+	}
+}
+
+void AABB::SetMeshMotion(size_t mesh, float3 displacement) {
+	if (mesh >= meshes.size()) {
+		std::cerr << "No mesh " << mesh << " to set the motion of, or the meshes were moved into the BVH" << std::endl;
+		return;
+	}
+
+	meshes[mesh].SetMotion(displacement);
+}
+
+size_t Mesh::MemoryBytes() const {
+	size_t bytes = VectorBytes(triangles) + packed.MemoryBytes() + VectorBytes(spheres) + VectorBytes(quads) + VectorBytes(lods) +
+		VectorBytes(packed_lods) + VectorBytes(lod_errors);
+	for (const auto &level : lods) {
+		bytes += VectorBytes(level);
+	}
+	for (const auto &level : packed_lods) {
+		bytes += level.MemoryBytes();
+	}
+	return bytes;
+}
+
+void PackedTriangles::Add(const Triangle &triangle) {
+	const float3 edgeB = triangle.b.position - triangle.a.position;
+	const float3 edgeC = triangle.c.position - triangle.a.position;
+	for (int axis = 0; axis < 3; axis++) {
+		a[axis].push_back(triangle.a.position[axis]);
+		ba[axis].push_back(edgeB[axis]);
+		ca[axis].push_back(edgeC[axis]);
+	}
+}
+
+void PackedTriangles::Assign(const std::vector<MaterialTriangle> &triangles) {
+	for (int axis = 0; axis < 3; axis++) {
+		a[axis].clear();
+		ba[axis].clear();
+		ca[axis].clear();
+		a[axis].reserve(triangles.size());
+		ba[axis].reserve(triangles.size());
+		ca[axis].reserve(triangles.size());
+	}
+	for (const auto &triangle : triangles) {
+		Add(triangle);
+	}
+}
+
+TriangleBatch PackedTriangles::Batch() const {
+	return TriangleBatch {a[0].data(), a[1].data(), a[2].data(), ba[0].data(), ba[1].data(), ba[2].data(),
+		ca[0].data(), ca[1].data(), ca[2].data(), Size()};
+}
+
+size_t PackedTriangles::MemoryBytes() const {
+	size_t bytes = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		bytes += VectorBytes(a[axis]) + VectorBytes(ba[axis]) + VectorBytes(ca[axis]);
 	}
+	return bytes;
+}
+
+void Mesh::AddTriangle(const MaterialTriangle triangle) {
 	triangles.push_back(triangle);
+	packed.Add(triangle);
+	Extend(linalg::min(triangle.a.position, linalg::min(triangle.b.position, triangle.c.position)),
+		linalg::max(triangle.a.position, linalg::max(triangle.b.position, triangle.c.position)));
+}
+
+void Mesh::AddSphere(const MaterialSphere sphere) {
+	spheres.push_back(sphere);
+	Extend(sphere.aabb_min(), sphere.aabb_max());
+}
+
+void Mesh::AddQuad(const MaterialQuad quad) {
+	quads.push_back(quad);
+	Extend(quad.aabb_min(), quad.aabb_max());
+}
+
+void Mesh::Extend(float3 min, float3 max) {
+	// Called after the primitive is stored, so a single primitive means the bounds are still unset
+	if (triangles.size() + spheres.size() + quads.size() == 1) {
+		aabb_min = min;
+		aabb_max = max;
+		return;
+	}
+
+	aabb_min = linalg::min(min, aabb_min);
+	aabb_max = linalg::max(max, aabb_max);
+}
 
-	aabb_max = linalg::max(triangle.a.position, aabb_max);
-	aabb_max = linalg::max(triangle.b.position, aabb_max);
-	aabb_max = linalg::max(triangle.c.position, aabb_max);
+bool Mesh::Intersect(const Ray &ray, const float t_min, IntersectableData &closest, const MaterialSurface *&surface) const {
+	if (ray.time == 0.0f || motion == float3 {0.0f, 0.0f, 0.0f}) {
+		return IntersectStatic(ray, t_min, closest, surface);
+	}
+
+	// Moving the ray back by the displacement leaves t unchanged, only the hit point needs the offset
+	const float3 offset = motion * ray.time;
+	Ray moved(ray);
+	moved.position -= offset;
+	if (!IntersectStatic(moved, t_min, closest, surface)) {
+		return false;
+	}
+	closest.offset = offset;
+	return true;
+}
+
+float Mesh::AnyHit(const Ray &ray, const float t_min, const float max_t) const {
+	if (ray.time == 0.0f || motion == float3 {0.0f, 0.0f, 0.0f}) {
+		return AnyHitStatic(ray, t_min, max_t);
+	}
+
+	Ray moved(ray);
+	moved.position -= motion * ray.time;
+	return AnyHitStatic(moved, t_min, max_t);
+}
 
-	aabb_min = linalg::min(triangle.a.position, aabb_min);
-	aabb_min = linalg::min(triangle.b.position, aabb_min);
-	aabb_min = linalg::min(triangle.c.position, aabb_min);
+bool Mesh::IntersectStatic(const Ray &ray, const float t_min, IntersectableData &closest, const MaterialSurface *&surface) const {
+	bool found = false;
+
+	const size_t lod = SelectLOD(ray);
+#ifdef WATERTIGHT_INTERSECTION
+	for (auto &object : LODTriangles(lod)) {
+		IntersectableData data = object.Intersect(ray);
+		if (data.t < closest.t && data.t > t_min) {
+			closest = data;
+			surface = &object;
+			found = true;
+		}
+	}
+#else
+	const PackedTriangles &level = LODPacked(lod);
+	RAY_STAT(RayStatistics::CountPrimitiveTests(level.Size()));
+	float u, v;
+	float t = closest.t;
+	const int hit = Kernels().closest_triangle(level.Batch(), ToKernelRay(ray), t_min, t, u, v);
+	if (hit >= 0) {
+		closest = IntersectableData(t, float3 {1 - u - v, u, v});
+		surface = &LODTriangles(lod)[hit];
+		found = true;
+	}
+#endif
+
+	for (auto &object : spheres) {
+		IntersectableData data = object.Intersect(ray);
+		if (data.t < closest.t && data.t > t_min) {
+			closest = data;
+			surface = &object;
+			found = true;
+		}
+	}
+
+	for (auto &object : quads) {
+		IntersectableData data = object.Intersect(ray);
+		if (data.t < closest.t && data.t > t_min) {
+			closest = data;
+			surface = &object;
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+float Mesh::AnyHitStatic(const Ray &ray, const float t_min, const float max_t) const {
+	const size_t lod = SelectLOD(ray);
+#ifdef WATERTIGHT_INTERSECTION
+	for (auto &object : LODTriangles(lod)) {
+		IntersectableData data = object.Intersect(ray);
+		if (data.t < max_t && data.t > t_min) {
+			return data.t;
+		}
+	}
+#else
+	const PackedTriangles &level = LODPacked(lod);
+	float t;
+	const int hit = Kernels().any_triangle(level.Batch(), ToKernelRay(ray), t_min, max_t, t);
+	// Counted as the scalar loop would, up to the hit
+	RAY_STAT(RayStatistics::CountPrimitiveTests(hit >= 0 ? hit + 1 : level.Size()));
+	if (hit >= 0) {
+		return t;
+	}
+#endif
+
+	for (auto &object : spheres) {
+		IntersectableData data = object.Intersect(ray);
+		if (data.t < max_t && data.t > t_min) {
+			return data.t;
+		}
+	}
+
+	for (auto &object : quads) {
+		IntersectableData data = object.Intersect(ray);
+		if (data.t < max_t && data.t > t_min) {
+			return data.t;
+		}
+	}
+
+	return max_t;
+}
+
+void Mesh::BuildLODs(unsigned int levels, float reduction) {
+	lods.clear();
+	packed_lods.clear();
+	lod_errors.clear();
+
+	const std::vector<MaterialTriangle> *source = &triangles;
+	for (unsigned int level = 0; level < levels; level++) {
+		size_t target = static_cast<size_t>(source->size() * reduction);
+		float error;
+		std::vector<MaterialTriangle> simplified = SimplifyTriangles(*source, target, error);
+		// Stop once the simplifier is stuck, another level would only cost memory
+		if (simplified.empty() || simplified.size() >= source->size()) {
+			break;
+		}
+
+		// Errors add up as each level is built from the previous one
+		lod_errors.push_back(error + (lod_errors.empty() ? 0.0f : lod_errors.back()));
+		lods.push_back(std::move(simplified));
+		source = &lods.back();
+	}
+
+	packed_lods.resize(lods.size());
+	for (size_t level = 0; level < lods.size(); level++) {
+		packed_lods[level].Assign(lods[level]);
+	}
+}
+
+size_t Mesh::SelectLOD(const Ray &ray) const {
+	if (lods.empty() || (ray.spread <= 0.0f && ray.cone_width <= 0.0f)) {
+		return 0;
+	}
+
+	// Cone width at the nearest point of the bounds
+	float3 nearest = linalg::clamp(ray.position, aabb_min, aabb_max);
+	float width = ray.ConeWidth(linalg::length(nearest - ray.position));
+
+	size_t selected = 0;
+	for (size_t level = 0; level < lods.size(); level++) {
+		if (lod_errors[level] > 0.5f * width) {
+			break;
+		}
+		selected = level + 1;
+	}
+	return selected;
 }
 
 bool Mesh::AABBTest(const Ray &ray) const {
+	RAY_STAT(RayStatistics::CountNodeTest());
+	// The box only translates, so moving the ray back is the same as interpolating the endpoint bounds
+	const float3 origin = ray.position - motion * ray.time;
 	float3 invRaydir = float3(1.0) / ray.direction;
-	float3 t0 = (aabb_max - ray.position) * invRaydir;
-	float3 t1 = (aabb_min - ray.position) * invRaydir;
+	float3 t0 = (aabb_max - origin) * invRaydir;
+	float3 t1 = (aabb_min - origin) * invRaydir;
 	float3 tmin = linalg::min(t0, t1);
 	float3 tmax = linalg::max(t0, t1);
 	return linalg::maxelem(tmin) <= linalg::minelem(tmax);
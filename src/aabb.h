@@ -1,34 +1,125 @@
 #pragma once
 
 #include "anti_aliasing.h"
+#include "kernels.h"
+#include "primitives.h"
+
+// Structure of arrays copy of triangles, the layout the intersection kernels load whole vectors from
+class PackedTriangles
+{
+public:
+	// Bytes each triangle adds
+	static const size_t triangle_bytes = 9 * sizeof(float);
+
+	void Add(const Triangle& triangle);
+	void Assign(const std::vector<MaterialTriangle>& triangles);
+	size_t Size() const { return a[0].size(); };
+	TriangleBatch Batch() const;
+	size_t MemoryBytes() const;
+
+	// First vertex, then the edges to the second and third, per component
+	std::vector<float> a[3];
+	std::vector<float> ba[3];
+	std::vector<float> ca[3];
+};
+
+inline KernelRay ToKernelRay(const Ray& ray) {
+	return KernelRay {{ray.position.x, ray.position.y, ray.position.z}, {ray.direction.x, ray.direction.y, ray.direction.z}};
+}
 
 class Mesh
 {
 public:
 	Mesh() { triangles.clear(); };
 	virtual ~Mesh() { triangles.clear(); };
+	// Declared so the virtual destructor does not suppress moves, the BVH build moves meshes into its nodes
+	Mesh(const Mesh&) = default;
+	Mesh(Mesh&&) = default;
+	Mesh& operator=(const Mesh&) = default;
+	Mesh& operator=(Mesh&&) = default;
 
 	void AddTriangle(const MaterialTriangle triangle);
+	void AddSphere(const MaterialSphere sphere);
+	void AddQuad(const MaterialQuad quad);
 	const std::vector<MaterialTriangle>& Triangles() const { return triangles; };
+	const std::vector<MaterialSphere>& Spheres() const { return spheres; };
+	const std::vector<MaterialQuad>& Quads() const { return quads; };
+	bool IsEmpty() const { return triangles.empty() && spheres.empty() && quads.empty(); };
 	bool AABBTest(const Ray& ray) const;
 
+	// Precomputes simplified copies of the triangles, each level keeping about reduction of the previous one
+	void BuildLODs(unsigned int levels, float reduction);
+	// Coarsest level whose error stays under half the ray cone width at the mesh, 0 for the full triangles
+	// and level + 1 for the simplified ones
+	size_t SelectLOD(const Ray& ray) const;
+
+	// Closest hit in (t_min, closest.t), updates closest and surface when found
+	bool Intersect(const Ray& ray, const float t_min, IntersectableData& closest, const MaterialSurface*& surface) const;
+	// Any hit in (t_min, max_t), returns its t or max_t
+	float AnyHit(const Ray& ray, const float t_min, const float max_t) const;
+
+	// Rigid translation over the frame, the mesh is displaced by motion * ray.time. The primitives and
+	// aabb_min/aabb_max stay at time 0 and the bounds at time 1 are the same box moved by motion.
+	void SetMotion(float3 displacement) { motion = displacement; };
+	float3 Motion() const { return motion; };
+	// Primitives and simplified levels, without the Mesh itself
+	size_t MemoryBytes() const;
+
 	float3 aabb_min;
 	float3 aabb_max;
 	float3 aabb_center() const { return aabb_min + (aabb_max - aabb_min) / 2.0f; };
 protected:
+	void Extend(float3 min, float3 max);
+	// Intersect of the mesh at time 0
+	bool IntersectStatic(const Ray& ray, const float t_min, IntersectableData& closest, const MaterialSurface*& surface) const;
+	float AnyHitStatic(const Ray& ray, const float t_min, const float max_t) const;
+	const std::vector<MaterialTriangle>& LODTriangles(size_t lod) const { return lod ? lods[lod - 1] : triangles; };
+	const PackedTriangles& LODPacked(size_t lod) const { return lod ? packed_lods[lod - 1] : packed; };
+
 	std::vector<MaterialTriangle> triangles;
+	// The same triangles packed for the kernels, kept in step by AddTriangle and BuildLODs
+	PackedTriangles packed;
+	std::vector<MaterialSphere> spheres;
+	std::vector<MaterialQuad> quads;
+
+	std::vector<std::vector<MaterialTriangle>> lods;
+	std::vector<PackedTriangles> packed_lods;
+	std::vector<float> lod_errors;
+	float3 motion {0.0f, 0.0f, 0.0f};
 };
 
 class AABB : public AntiAliasing
 {
 public:
-	AABB(short width, short height);
+	AABB(int width, int height);
 	virtual ~AABB();
 
 	virtual int LoadGeometry(std::string filename);
 	virtual Payload TraceRay(const Ray& ray, const unsigned int max_raytrace_depth) const;
 	virtual float TraceShadowRay(const Ray& ray, const float max_t) const;
+	// Closest hit in (t_min, t_max), surface stays nullptr on a miss
+	virtual bool ClosestHit(const Ray& ray, IntersectableData& closest, const MaterialSurface*& surface) const;
+
+	// Analytic primitives, each added as its own mesh with tight bounds
+	void AddSphere(float3 center, float radius, const Material& material);
+	void AddQuad(int axis, float offset, float2 min, float2 max, bool flip_normal, const Material& material);
+	void AddBox(float3 min, float3 max, const Material& material);
+
+	// Simplified levels for every mesh above lod_min_triangles, call before BuildBVH which copies the meshes.
+	// Skipped, keeping only the full meshes, when the levels would exceed the memory budget.
+	void BuildLODs(unsigned int levels);
+	virtual unsigned int LODLevels() const { return lod_levels; };
+	// Meshes are numbered in the order they were loaded or added. Like BuildLODs, set motion before BuildBVH.
+	virtual size_t MeshCount() const { return meshes.size(); };
+	// Takes effect in the BVH only if set before BuildBVH
+	void SetMeshMotion(size_t mesh, float3 displacement);
 
 protected:
+	virtual void AccountMemory(MemoryReport& report) const;
+
 	std::vector<Mesh> meshes;
+	// Levels of the last BuildLODs that fit the budget
+	unsigned int lod_levels = 0;
+
+	const size_t lod_min_triangles = 64;
 };
\ No newline at end of file
@@ -1,16 +1,57 @@
 #include "anti_aliasing.h"
 
-AntiAliasing::AntiAliasing(short width, short height) :Refraction(width, height) {}
+#include <algorithm>
+#include <cmath>
+
+AntiAliasing::AntiAliasing(int width, int height) :Refraction(width, height) {}
 
 AntiAliasing::~AntiAliasing() {}
 
+void AntiAliasing::SetSampling(bool adaptive, unsigned int max_samples) {
+	adaptive_sampling = adaptive;
+	unsigned int side = static_cast<unsigned int>(std::sqrt(static_cast<float>(std::max(1u, max_samples))));
+	if (side == 1 && max_samples > 1) {
+		side = 2;
+	}
+	this->max_samples = side * side;
+}
+
 void AntiAliasing::DrawScene() {
+	ProfileScope profile("trace", true);
+	if (camera.NeedsSampling()) {
+		DrawSceneDistributed();
+	} else if (adaptive_sampling) {
+		DrawSceneAdaptive();
+	} else {
+		DrawSceneFixed();
+	}
+}
+
+size_t AntiAliasing::FrameStateBytes(size_t pixels) const {
+	size_t bytes = Refraction::FrameStateBytes(pixels);
+	if (adaptive_sampling && max_samples >= 4) {
+		const unsigned int detector = aov_channels | AOV_DEPTH | AOV_NORMAL | AOV_PRIMITIVE_ID;
+		bytes += pixels * sizeof(float) * (AOVBuffer::PlaneCount(detector, AOVLightCount()) - AOVBuffer::PlaneCount(aov_channels, AOVLightCount()));
+	}
+	return bytes;
+}
+
+void AntiAliasing::DrawSceneFixed() {
 	camera.SetRenderTargetSize(width * 2, height * 2);
+	PrepareAOVs();
 
-	for (int x = 0; x < width; x++) {
-#pragma omp parallel for
-		for (int y = 0; y < height; y++) {
+	const PixelWindow window = RenderWindow();
+	size_t pixelCount = 0;
+	for (int x = window.x0; x < window.x1; x++) {
+#pragma omp parallel for reduction(+:pixelCount)
+		for (int y = window.y0; y < window.y1; y++) {
+			if (!IsRendered(x, y)) {
+				continue;
+			}
+
+			// AOVs come from the first sub-sample only, averaging IDs or depths would be meaningless
 			Ray ray0 = camera.GetCameraRay(2 * x, 2 * y);
+			AttachAOVs(ray0, x, y);
 			Payload payload0 = TraceRay(ray0, raytracing_depth);
 			Ray ray1 = camera.GetCameraRay(2 * x + 1, 2 * y);
 			Payload payload1 = TraceRay(ray1, raytracing_depth);
@@ -23,6 +64,190 @@ void AntiAliasing::DrawScene() {
 			color /= 4.0f;
 
 			SetPixel(x, y, color);
+			pixelCount++;
+		}
+	}
+
+	primary_rays = 4 * pixelCount;
+}
+
+// Deterministic per sample jitter in [0, 1)
+static float SampleHash(unsigned int x, unsigned int y, unsigned int i) {
+	unsigned int h = x * 0x8da6b343u ^ y * 0xd8163841u ^ i * 0xcb1ab31fu;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return static_cast<float>(h >> 8) / 16777216.0f;
+}
+
+void AntiAliasing::DrawSceneAdaptive() {
+	camera.SetRenderTargetSize(width, height);
+	// Edge pixels are re-rendered with a side x side stratified pattern, a single sample has nothing to refine
+	const int side = static_cast<int>(std::sqrt(static_cast<float>(max_samples)));
+	// The edge detector reads these from the first pass, whatever AOVs the caller asked for
+	PrepareAOVs(side > 1 ? AOV_DEPTH | AOV_NORMAL | AOV_PRIMITIVE_ID : 0);
+
+	const PixelWindow window = RenderWindow();
+	size_t pixelCount = 0;
+	for (int x = window.x0; x < window.x1; x++) {
+#pragma omp parallel for reduction(+:pixelCount)
+		for (int y = window.y0; y < window.y1; y++) {
+			if (!IsRendered(x, y)) {
+				continue;
+			}
+
+			Ray ray = camera.GetCameraRay(x, y);
+			AttachAOVs(ray, x, y);
+			Payload payload = TraceRay(ray, raytracing_depth);
+			SetPixel(x, y, payload.color);
+			pixelCount++;
+		}
+	}
+
+	size_t edgeCount = 0;
+	if (side > 1) {
+		std::vector<unsigned char> edges = FindEdges();
+#pragma omp parallel for schedule(dynamic) reduction(+:edgeCount)
+		for (int y = window.y0; y < window.y1; y++) {
+			for (int x = window.x0; x < window.x1; x++) {
+				if (!edges[static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x)]) {
+					continue;
+				}
+
+				float3 color {0.0f, 0.0f, 0.0f};
+				for (int sy = 0; sy < side; sy++) {
+					for (int sx = 0; sx < side; sx++) {
+						unsigned int sample = static_cast<unsigned int>(sy * side + sx);
+						float3 jitter {
+							(sx + SampleHash(x, y, 2 * sample)) / side - 0.5f,
+							(sy + SampleHash(x, y, 2 * sample + 1)) / side - 0.5f,
+							0.0f
+						};
+						Ray ray = camera.GetCameraRay(x, y, jitter);
+						color += TraceRay(ray, raytracing_depth).color;
+					}
+				}
+
+				SetPixel(x, y, color / static_cast<float>(side * side));
+				edgeCount++;
+			}
 		}
 	}
+
+	primary_rays = pixelCount + edgeCount * side * side;
+}
+
+void AntiAliasing::DrawSceneDistributed() {
+	camera.SetRenderTargetSize(width, height);
+	PrepareAOVs();
+
+	const int side = static_cast<int>(std::sqrt(static_cast<float>(max_samples)));
+	const int count = side * side;
+	const PixelWindow window = RenderWindow();
+	size_t pixelCount = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:pixelCount)
+	for (int y = window.y0; y < window.y1; y++) {
+		for (int x = window.x0; x < window.x1; x++) {
+			if (!IsRendered(x, y)) {
+				continue;
+			}
+
+			// Pixel and lens are both stratified on the grid, the lens strata transposed and each
+			// dimension shifted per pixel so neighbouring pixels do not share their patterns
+			const float2 lensShift {SampleHash(x, y, 2 * count), SampleHash(x, y, 2 * count + 1)};
+			const float timeShift = SampleHash(x, y, 2 * count + 2);
+
+			float3 color {0.0f, 0.0f, 0.0f};
+			for (int sy = 0; sy < side; sy++) {
+				for (int sx = 0; sx < side; sx++) {
+					const unsigned int index = static_cast<unsigned int>(sy * side + sx);
+					CameraSample sample;
+					sample.pixel = float2 {
+						(sx + SampleHash(x, y, 2 * index)) / side - 0.5f,
+						(sy + SampleHash(x, y, 2 * index + 1)) / side - 0.5f
+					};
+					float2 lens = (float2 {static_cast<float>(sy), static_cast<float>(sx)} + 0.5f) / static_cast<float>(side) + lensShift;
+					sample.lens = lens - linalg::floor(lens);
+					float time = (index + 0.5f) / count + timeShift;
+					sample.time = time - std::floor(time);
+
+					Ray ray = camera.GetCameraRay(x, y, sample);
+					if (index == 0) {
+						AttachAOVs(ray, x, y);
+					}
+					color += TraceRay(ray, raytracing_depth).color;
+				}
+			}
+
+			SetPixel(x, y, color / static_cast<float>(count));
+			pixelCount++;
+		}
+	}
+
+	primary_rays = pixelCount * count;
+}
+
+std::vector<unsigned char> AntiAliasing::FindEdges() const {
+	std::vector<unsigned char> edges(static_cast<size_t>(width) * static_cast<size_t>(height), 0);
+
+	const float *depth = aov_buffer.Plane(AOV_DEPTH);
+	const float *normal[3] = {aov_buffer.Plane(AOV_NORMAL, 0), aov_buffer.Plane(AOV_NORMAL, 1), aov_buffer.Plane(AOV_NORMAL, 2)};
+	const float *primitive = aov_buffer.Plane(AOV_PRIMITIVE_ID);
+
+	auto luminance = [this](size_t i) {
+		float3 color = linalg::clamp(frame_buffer[i], 0.0f, 1.0f);
+		return 0.2126f * color.x + 0.7152f * color.y + 0.0722f * color.z;
+	};
+
+	auto differs = [&](size_t p, size_t q) {
+		bool hitP = std::isfinite(depth[p]);
+		bool hitQ = std::isfinite(depth[q]);
+		if (hitP != hitQ) {
+			return true;
+		}
+
+		if (hitP) {
+			float cosine = normal[0][p] * normal[0][q] + normal[1][p] * normal[1][q] + normal[2][p] * normal[2][q];
+			if (cosine < edge_normal_threshold) {
+				return true;
+			}
+			// Two triangles of one flat wall differ in ID but not in depth, only silhouettes count
+			if (primitive[p] != primitive[q]
+				&& std::fabs(depth[p] - depth[q]) > edge_depth_threshold * std::min(depth[p], depth[q])) {
+				return true;
+			}
+		}
+
+		float lp = luminance(p);
+		float lq = luminance(q);
+		return std::fabs(lp - lq) > edge_contrast_threshold * (std::max(lp, lq) + 0.05f);
+	};
+
+	// Each pair is tested once, both of its pixels are marked, so rows are split between even and odd passes.
+	// Pixels outside the window or mask were not traced this frame and take no part.
+	const PixelWindow window = RenderWindow();
+	for (int parity = 0; parity < 2; parity++) {
+#pragma omp parallel for
+		for (int y = window.y0 + parity; y < window.y1; y += 2) {
+			for (int x = window.x0; x < window.x1; x++) {
+				if (!IsRendered(x, y)) {
+					continue;
+				}
+
+				size_t p = static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x);
+				if (x + 1 < window.x1 && IsRendered(x + 1, y) && differs(p, p + 1)) {
+					edges[p] = 1;
+					edges[p + 1] = 1;
+				}
+				if (y + 1 < window.y1 && IsRendered(x, y + 1) && differs(p, p + width)) {
+					edges[p] = 1;
+					edges[p + width] = 1;
+				}
+			}
+		}
+	}
+
+	return edges;
 }
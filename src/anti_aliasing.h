@@ -5,7 +5,36 @@
 class AntiAliasing : public Refraction
 {
 public:
-	AntiAliasing(short width, short height);
+	AntiAliasing(int width, int height);
 	virtual ~AntiAliasing();
 	virtual void DrawScene();
-};
\ No newline at end of file
+
+	// Adaptive sampling traces one ray per pixel and re-samples detected edges with up to max_samples
+	// stratified jittered rays. Otherwise every pixel gets the fixed 2x2 grid.
+	// A thin lens or an open shutter overrides both, every pixel then takes max_samples over pixel, lens and time.
+	// max_samples is rounded down to a square grid, anything above 1 gets at least 2x2. With 1 every pixel
+	// takes a single ray and adaptive sampling refines no edge, which is the cheapest preview.
+	void SetSampling(bool adaptive, unsigned int max_samples = 16);
+	unsigned int GetMaxSamples() const { return max_samples; };
+	size_t GetPrimaryRayCount() const { return primary_rays; };
+
+protected:
+	// Adds the planes the edge detector of adaptive sampling needs
+	virtual size_t FrameStateBytes(size_t pixels) const;
+	void DrawSceneFixed();
+	void DrawSceneAdaptive();
+	void DrawSceneDistributed();
+	// Pixels whose primitive, normal or colour differs enough from a neighbour
+	std::vector<unsigned char> FindEdges() const;
+
+	bool adaptive_sampling = true;
+	unsigned int max_samples = 16;
+	size_t primary_rays = 0;
+
+	// Cosine between neighbouring normals below which they count as an edge
+	const float edge_normal_threshold = 0.9f;
+	// Depth jump between different primitives, relative to the nearer one
+	const float edge_depth_threshold = 0.02f;
+	// Luminance difference relative to the brighter neighbour
+	const float edge_contrast_threshold = 0.1f;
+};
@@ -0,0 +1,154 @@
+#include "aov.h"
+
+#include "image_output.h"
+
+#include <algorithm>
+#include <limits>
+
+void AOVBuffer::Configure(unsigned int channels, size_t pixel_count, size_t light_count) {
+	this->channels = channels;
+	this->light_count = light_count;
+	names.clear();
+	backgrounds.clear();
+	plane_channels.clear();
+	planes.clear();
+	std::fill(first_plane, first_plane + 7, -1);
+
+	// Names follow the EXR layer.component convention
+	const float infinity = std::numeric_limits<float>::infinity();
+	AddPlanes(AOV_DEPTH, "", "Z", infinity);
+	AddPlanes(AOV_NORMAL, "N", "XYZ", 0.0f);
+	AddPlanes(AOV_ALBEDO, "albedo", "RGB", 0.0f);
+	AddPlanes(AOV_MATERIAL_ID, "", "materialID", -1.0f);
+	AddPlanes(AOV_PRIMITIVE_ID, "", "primitiveID", -1.0f);
+	for (size_t i = 0; i < light_count; i++) {
+		AddPlanes(AOV_LIGHTS, "light" + std::to_string(i), "RGB", 0.0f);
+	}
+	AddPlanes(AOV_INDIRECT, "indirect", "RGB", 0.0f);
+
+	for (auto &plane : planes) {
+		plane.resize(pixel_count);
+	}
+	Reset();
+}
+
+bool AOVBuffer::Matches(unsigned int channels, size_t pixel_count, size_t light_count) const {
+	if (channels != this->channels || ((channels & AOV_LIGHTS) && light_count != this->light_count)) {
+		return false;
+	}
+	return planes.empty() || planes.front().size() == pixel_count;
+}
+
+size_t AOVBuffer::PlaneCount(unsigned int channels, size_t light_count) {
+	size_t count = 0;
+	count += (channels & AOV_DEPTH) ? 1 : 0;
+	count += (channels & AOV_NORMAL) ? 3 : 0;
+	count += (channels & AOV_ALBEDO) ? 3 : 0;
+	count += (channels & AOV_MATERIAL_ID) ? 1 : 0;
+	count += (channels & AOV_PRIMITIVE_ID) ? 1 : 0;
+	count += (channels & AOV_LIGHTS) ? 3 * light_count : 0;
+	count += (channels & AOV_INDIRECT) ? 3 : 0;
+	return count;
+}
+
+void AOVBuffer::Reset() {
+	for (size_t i = 0; i < planes.size(); i++) {
+		std::fill(planes[i].begin(), planes[i].end(), backgrounds[i]);
+	}
+}
+
+void AOVBuffer::Reset(size_t first, size_t last) {
+	for (size_t i = 0; i < planes.size(); i++) {
+		std::fill(planes[i].begin() + first, planes[i].begin() + last, backgrounds[i]);
+	}
+}
+
+void AOVBuffer::Set(size_t pixel, AOVChannel channel, float value) {
+	int plane = FirstPlane(channel);
+	if (plane < 0) {
+		return;
+	}
+
+	planes[plane][pixel] = value;
+}
+
+void AOVBuffer::Set(size_t pixel, AOVChannel channel, float3 value) {
+	int plane = FirstPlane(channel);
+	if (plane < 0) {
+		return;
+	}
+
+	planes[plane][pixel] = value.x;
+	planes[plane + 1][pixel] = value.y;
+	planes[plane + 2][pixel] = value.z;
+}
+
+void AOVBuffer::SetLight(size_t pixel, size_t light, float3 value) {
+	int plane = FirstPlane(AOV_LIGHTS);
+	if (plane < 0 || light >= light_count) {
+		return;
+	}
+
+	plane += 3 * static_cast<int>(light);
+	planes[plane][pixel] = value.x;
+	planes[plane + 1][pixel] = value.y;
+	planes[plane + 2][pixel] = value.z;
+}
+
+const float *AOVBuffer::Plane(AOVChannel channel, size_t component) const {
+	int plane = FirstPlane(channel);
+	if (plane < 0) {
+		return nullptr;
+	}
+
+	return planes[plane + component].data();
+}
+
+bool AOVBuffer::Save(const std::string &filename, int width, int height, unsigned int channels) const {
+	std::vector<std::string> savedNames;
+	std::vector<const float *> data;
+	for (size_t i = 0; i < planes.size(); i++) {
+		if (plane_channels[i] & channels) {
+			savedNames.push_back(names[i]);
+			data.push_back(planes[i].data());
+		}
+	}
+	return WriteEXR(filename, width, height, savedNames, data);
+}
+
+int AOVBuffer::FirstPlane(AOVChannel channel) const {
+	for (int bit = 0; bit < 7; bit++) {
+		if (channel == (1u << bit)) {
+			return first_plane[bit];
+		}
+	}
+	return -1;
+}
+
+void AOVBuffer::AddPlanes(AOVChannel channel, const std::string &layer, const char *components, float background) {
+	if (!Has(channel)) {
+		return;
+	}
+
+	for (int bit = 0; bit < 7; bit++) {
+		if (channel == (1u << bit) && first_plane[bit] < 0) {
+			first_plane[bit] = static_cast<int>(names.size());
+		}
+	}
+
+	// A single multi-letter component is a plain channel name like materialID
+	if (layer.empty()) {
+		names.push_back(components);
+		backgrounds.push_back(background);
+		plane_channels.push_back(channel);
+		planes.emplace_back();
+		return;
+	}
+
+	for (const char *c = components; *c; c++) {
+		names.push_back(layer + "." + *c);
+		backgrounds.push_back(background);
+		plane_channels.push_back(channel);
+		planes.emplace_back();
+	}
+}
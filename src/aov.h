@@ -0,0 +1,67 @@
+#pragma once
+
+#include "linalg.h"
+using namespace linalg::aliases;
+
+#include <string>
+#include <vector>
+
+// Arbitrary output variables, filled by the primary hit beside the color
+enum AOVChannel : unsigned int {
+	AOV_DEPTH = 1 << 0,
+	AOV_NORMAL = 1 << 1,
+	AOV_ALBEDO = 1 << 2,
+	AOV_MATERIAL_ID = 1 << 3,
+	AOV_PRIMITIVE_ID = 1 << 4,
+	// Direct light of every light, one RGB layer per light, shadowed when the pipeline traces shadow rays
+	AOV_LIGHTS = 1 << 5,
+	// Radiance brought in by secondary rays, averaged over the frames by the accumulating pipelines
+	AOV_INDIRECT = 1 << 6,
+	AOV_ALL = (1 << 7) - 1
+};
+
+// One float plane per component (SoA), so each pass is contiguous for the writer and for consumers
+class AOVBuffer
+{
+public:
+	AOVBuffer() {};
+	~AOVBuffer() {};
+
+	// channels is a mask of AOVChannel, also resets every plane to its background value
+	void Configure(unsigned int channels, size_t pixel_count, size_t light_count);
+	// Whether Configure with these would allocate the planes already there
+	bool Matches(unsigned int channels, size_t pixel_count, size_t light_count) const;
+	void Reset();
+	// Only pixels [first, last) of every plane
+	void Reset(size_t first, size_t last);
+	// Float planes Configure would allocate for channels
+	static size_t PlaneCount(unsigned int channels, size_t light_count);
+	unsigned int Channels() const { return channels; };
+	bool Has(AOVChannel channel) const { return (channels & channel) != 0; };
+
+	// Writes into the pixel, channels which were not configured are ignored
+	void Set(size_t pixel, AOVChannel channel, float value);
+	void Set(size_t pixel, AOVChannel channel, float3 value);
+	void SetLight(size_t pixel, size_t light, float3 value);
+
+	const std::vector<std::string>& Names() const { return names; };
+	const std::vector<std::vector<float>>& Planes() const { return planes; };
+	// Component plane of a configured channel, nullptr otherwise
+	const float* Plane(AOVChannel channel, size_t component = 0) const;
+
+	// The planes of the channels in the mask go into one multi-channel EXR
+	bool Save(const std::string& filename, int width, int height, unsigned int channels = AOV_ALL) const;
+
+protected:
+	int FirstPlane(AOVChannel channel) const;
+	void AddPlanes(AOVChannel channel, const std::string& layer, const char* components, float background);
+
+	unsigned int channels = 0;
+	size_t light_count = 0;
+	std::vector<std::string> names;
+	std::vector<float> backgrounds;
+	std::vector<unsigned int> plane_channels;
+	std::vector<std::vector<float>> planes;
+	// Index of the first plane of each channel bit, -1 when not configured
+	int first_plane[7] = {-1, -1, -1, -1, -1, -1, -1};
+};
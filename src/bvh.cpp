@@ -1,7 +1,9 @@
 #include "bvh.h"
 
+// Meshes box tested per kernel call
+static const size_t box_block = 64;
 
-BVH::BVH(short width, short height) :AABB(width, height) {}
+BVH::BVH(int width, int height) :AABB(width, height) {}
 
 BVH::~BVH() {}
 
@@ -9,78 +11,123 @@ bool cmp(const Mesh &a, const Mesh &b) {
 	return a.aabb_max.y < b.aabb_max.y;
 }
 
-void BVH::BuildBVH() {
+int BVH::BuildBVH() {
+	if (compacted) {
+		std::cerr << "The meshes were moved into the BVH, it cannot be built again" << std::endl;
+		return -1;
+	}
+
+	ProfileScope profile("bvh build");
+	tlases.clear();
 	std::sort(meshes.begin(), meshes.end(), cmp);
 	auto middle = meshes.begin();
-	std::advance(middle, 2);
-	std::vector<Mesh> leftHalf(meshes.begin(), middle);
-	std::vector<Mesh> rightHalf(middle, meshes.end());
+	std::advance(middle, std::min<size_t>(2, meshes.size()));
+
+	// The top level holds copies of the meshes. When the copies would not fit the memory budget the meshes
+	// are moved in instead, which releases the flat list that AABB::ClosestHit and MeshCount read.
+	size_t meshBytes = 0;
+	for (const auto &mesh : meshes) {
+		meshBytes += sizeof(Mesh) + mesh.MemoryBytes();
+	}
+	const bool compact = OverBudget(meshBytes);
+
+	std::vector<Mesh> leftHalf, rightHalf;
+	if (compact) {
+		leftHalf.assign(std::make_move_iterator(meshes.begin()), std::make_move_iterator(middle));
+		rightHalf.assign(std::make_move_iterator(middle), std::make_move_iterator(meshes.end()));
+		std::vector<Mesh>().swap(meshes);
+		compacted = true;
+	} else {
+		leftHalf.assign(meshes.begin(), middle);
+		rightHalf.assign(middle, meshes.end());
+	}
 
 	TLAS left;
 	for (auto &mesh : leftHalf) {
-		left.AddMesh(mesh);
+		left.AddMesh(std::move(mesh));
 	}
-	tlases.push_back(left);
+	tlases.push_back(std::move(left));
 
 	TLAS right;
 	for (auto &mesh : rightHalf) {
-		right.AddMesh(mesh);
+		right.AddMesh(std::move(mesh));
+	}
+	tlases.push_back(std::move(right));
+	return 0;
+}
+
+size_t BVH::MeshCount() const {
+	if (!compacted) {
+		return meshes.size();
+	}
+	size_t count = 0;
+	for (const auto &tlas : tlases) {
+		count += tlas.GetMeshes().size();
 	}
-	tlases.push_back(right);
+	return count;
 }
 
-Payload BVH::TraceRay(const Ray &ray, const unsigned int max_raytrace_depth) const {
-	if (max_raytrace_depth <= 0) {
-		return Miss(ray);
+void BVH::AccountMemory(MemoryReport &report) const {
+	AABB::AccountMemory(report);
+	report.Add(MEMORY_ACCELERATION, VectorBytes(tlases));
+	for (const auto &tlas : tlases) {
+		report.Add(MEMORY_ACCELERATION, VectorBytes(tlas.GetMeshes()) + tlas.GetBoxes().MemoryBytes());
+		for (const auto &mesh : tlas.GetMeshes()) {
+			report.Add(MEMORY_ACCELERATION, mesh.MemoryBytes());
+		}
 	}
+}
 
-	IntersectableData closestData(t_max);
-	MaterialTriangle closestTriangle;
+bool BVH::ClosestHit(const Ray &ray, IntersectableData &closest, const MaterialSurface *&surface) const {
+	closest = IntersectableData(t_max);
+	surface = nullptr;
 
+	const KernelRay kernelRay = ToKernelRay(ray);
+	unsigned char hits[box_block];
 	for (auto &tlas : tlases) {
 		if (!tlas.AABBTest(ray)) {
 			continue;
 		}
 
-		for (auto &mesh : tlas.GetMeshes()) {
-			if (!mesh.AABBTest(ray)) {
-				continue;
-			}
-
-			for (auto &object : mesh.Triangles()) {
-				IntersectableData data = object.Intersect(ray);
-				if (data.t < closestData.t && data.t > t_min) {
-					closestData = data;
-					closestTriangle = object;
+		const std::vector<Mesh> &meshes = tlas.GetMeshes();
+		for (size_t start = 0; start < meshes.size(); start += box_block) {
+			const size_t count = std::min(box_block, meshes.size() - start);
+			RAY_STAT(RayStatistics::CountNodeTests(count));
+			Kernels().box_tests(tlas.GetBoxes().Batch(start, count), kernelRay, ray.time, hits);
+			for (size_t i = 0; i < count; i++) {
+				if (hits[i]) {
+					meshes[start + i].Intersect(ray, t_min, closest, surface);
 				}
 			}
 		}
 	}
 
-	if (closestData.t < t_max) {
-		return Hit(ray, closestData, &closestTriangle, max_raytrace_depth);
-	}
-
-	return Miss(ray);
+	return surface != nullptr;
 }
 
 float BVH::TraceShadowRay(const Ray &ray, const float max_t) const {
-	IntersectableData closestData(max_t);
-
+	RAY_STAT(RayStatistics::CountRay(RAY_SHADOW));
+	RayCapture::Record(ray.position, ray.direction, ray.spread, ray.cone_width, ray.time, max_t, CAPTURE_SHADOW, 0);
+	const KernelRay kernelRay = ToKernelRay(ray);
+	unsigned char hits[box_block];
 	for (auto &tlas : tlases) {
 		if (!tlas.AABBTest(ray)) {
 			continue;
 		}
 
-		for (auto &mesh : tlas.GetMeshes()) {
-			if (!mesh.AABBTest(ray)) {
-				continue;
-			}
+		const std::vector<Mesh> &meshes = tlas.GetMeshes();
+		for (size_t start = 0; start < meshes.size(); start += box_block) {
+			const size_t count = std::min(box_block, meshes.size() - start);
+			RAY_STAT(RayStatistics::CountNodeTests(count));
+			Kernels().box_tests(tlas.GetBoxes().Batch(start, count), kernelRay, ray.time, hits);
+			for (size_t i = 0; i < count; i++) {
+				if (!hits[i]) {
+					continue;
+				}
 
-			for (auto &object : mesh.Triangles()) {
-				IntersectableData data = object.Intersect(ray);
-				if (data.t < closestData.t && data.t > t_min) {
-					return data.t;
+				float t = meshes[start + i].AnyHit(ray, t_min, max_t);
+				if (t < max_t) {
+					return t;
 				}
 			}
 		}
@@ -90,21 +137,52 @@ float BVH::TraceShadowRay(const Ray &ray, const float max_t) const {
 }
 
 bool TLAS::AABBTest(const Ray &ray) const {
+	RAY_STAT(RayStatistics::CountNodeTest());
+	// Linear interpolation of the endpoint unions encloses every linearly moving member at any time in between
+	const float3 boundsMin = ray.time == 0.0f ? aabb_min : linalg::lerp(aabb_min, aabb_min_end, ray.time);
+	const float3 boundsMax = ray.time == 0.0f ? aabb_max : linalg::lerp(aabb_max, aabb_max_end, ray.time);
 	float3 invRaydir = float3(1.0) / ray.direction;
-	float3 t0 = (aabb_max - ray.position) * invRaydir;
-	float3 t1 = (aabb_min - ray.position) * invRaydir;
+	float3 t0 = (boundsMax - ray.position) * invRaydir;
+	float3 t1 = (boundsMin - ray.position) * invRaydir;
 	float3 tmin = linalg::min(t0, t1);
 	float3 tmax = linalg::max(t0, t1);
 	return linalg::maxelem(tmin) <= linalg::minelem(tmax);
 }
 
-void TLAS::AddMesh(const Mesh mesh) {
+void TLAS::AddMesh(Mesh mesh) {
 	if (meshes.empty()) {
 		aabb_max = mesh.aabb_max;
 		aabb_min = mesh.aabb_min;
+		aabb_max_end = mesh.aabb_max + mesh.Motion();
+		aabb_min_end = mesh.aabb_min + mesh.Motion();
 	}
-	meshes.push_back(mesh);
-
 	aabb_max = linalg::max(mesh.aabb_max, aabb_max);
 	aabb_min = linalg::min(mesh.aabb_min, aabb_min);
+	aabb_max_end = linalg::max(mesh.aabb_max + mesh.Motion(), aabb_max_end);
+	aabb_min_end = linalg::min(mesh.aabb_min + mesh.Motion(), aabb_min_end);
+
+	boxes.Add(mesh);
+	meshes.push_back(std::move(mesh));
+}
+
+void PackedBoxes::Add(const Mesh &mesh) {
+	for (int axis = 0; axis < 3; axis++) {
+		min[axis].push_back(mesh.aabb_min[axis]);
+		max[axis].push_back(mesh.aabb_max[axis]);
+		motion[axis].push_back(mesh.Motion()[axis]);
+	}
+}
+
+BoxBatch PackedBoxes::Batch(size_t start, size_t count) const {
+	return BoxBatch {min[0].data() + start, min[1].data() + start, min[2].data() + start, max[0].data() + start,
+		max[1].data() + start, max[2].data() + start, motion[0].data() + start, motion[1].data() + start,
+		motion[2].data() + start, count};
+}
+
+size_t PackedBoxes::MemoryBytes() const {
+	size_t bytes = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		bytes += VectorBytes(min[axis]) + VectorBytes(max[axis]) + VectorBytes(motion[axis]);
+	}
+	return bytes;
 }
@@ -2,36 +2,65 @@
 
 #include "aabb.h"
 
+// Bounds and motion of a TLAS's meshes as structure of arrays, for the batch box test
+class PackedBoxes
+{
+public:
+	void Add(const Mesh& mesh);
+	BoxBatch Batch(size_t start, size_t count) const;
+	size_t MemoryBytes() const;
+
+	std::vector<float> min[3];
+	std::vector<float> max[3];
+	std::vector<float> motion[3];
+};
+
 class TLAS
 {
 public:
 	TLAS() { meshes.clear(); };
 	virtual ~TLAS() { meshes.clear(); };
+	TLAS(const TLAS&) = default;
+	TLAS(TLAS&&) = default;
+	TLAS& operator=(const TLAS&) = default;
+	TLAS& operator=(TLAS&&) = default;
 
 	bool AABBTest(const Ray& ray) const;
-	void AddMesh(const Mesh mesh);
+	void AddMesh(Mesh mesh);
 
+	// Bounds at time 0, and at time 1 for the moved meshes. Traversal interpolates them at the ray's time.
 	float3 aabb_min;
 	float3 aabb_max;
+	float3 aabb_min_end;
+	float3 aabb_max_end;
 	float3 aabb_center() const { return aabb_min + (aabb_max - aabb_min) / 2.0f; };
 
-	const std::vector<Mesh> GetMeshes() const { return meshes; };
+	const std::vector<Mesh>& GetMeshes() const { return meshes; };
+	const PackedBoxes& GetBoxes() const { return boxes; };
 
 protected:
 	std::vector<Mesh> meshes;
+	PackedBoxes boxes;
 };
 
 class BVH : public AABB
 {
 public:
-	BVH(short width, short height);
+	BVH(int width, int height);
 	virtual ~BVH();
 
-	virtual void BuildBVH();
+	// Splits the meshes into the top level, replacing an earlier build. Over the memory budget the meshes are
+	// moved in rather than copied; the scene cannot be built again after that and a rebuild returns -1.
+	virtual int BuildBVH();
+	// Also counts the meshes moved into the top level
+	virtual size_t MeshCount() const;
 
-	virtual Payload TraceRay(const Ray& ray, const unsigned int max_raytrace_depth) const;
+	virtual bool ClosestHit(const Ray& ray, IntersectableData& closest, const MaterialSurface*& surface) const;
 	virtual float TraceShadowRay(const Ray& ray, const float max_t) const;
 
 protected:
+	virtual void AccountMemory(MemoryReport& report) const;
+
 	std::vector<TLAS> tlases;
+	bool compacted = false;
 };
\ No newline at end of file
@@ -0,0 +1,102 @@
+#include "cpu_features.h"
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define CPU_FEATURES_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#else
+#include <cpuid.h>
+#endif
+#endif
+
+static const char *isa_names[static_cast<int>(CpuIsa::Count)] = {"generic", "sse4.2", "avx2", "avx512"};
+
+#ifdef CPU_FEATURES_X86
+static void CpuId(uint32_t leaf, uint32_t subleaf, uint32_t registers[4]) {
+#ifdef _MSC_VER
+	int values[4];
+	__cpuidex(values, static_cast<int>(leaf), static_cast<int>(subleaf));
+	for (int i = 0; i < 4; i++) {
+		registers[i] = static_cast<uint32_t>(values[i]);
+	}
+#else
+	registers[0] = registers[1] = registers[2] = registers[3] = 0;
+	__get_cpuid_count(leaf, subleaf, &registers[0], &registers[1], &registers[2], &registers[3]);
+#endif
+}
+
+// Register states the operating system saves on context switches, only valid once OSXSAVE is set
+static uint64_t EnabledStates() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t low, high;
+	__asm__ volatile("xgetbv" : "=a"(low), "=d"(high) : "c"(0));
+	return (static_cast<uint64_t>(high) << 32) | low;
+#endif
+}
+
+static CpuIsa Detect() {
+	uint32_t leaf0[4], leaf1[4], leaf7[4] = {};
+	CpuId(0, 0, leaf0);
+	CpuId(1, 0, leaf1);
+	if (leaf0[0] >= 7) {
+		CpuId(7, 0, leaf7);
+	}
+
+	const bool sse42 = (leaf1[2] & (1u << 20)) != 0;
+	if (!sse42) {
+		return CpuIsa::Generic;
+	}
+
+	const bool osxsave = (leaf1[2] & (1u << 27)) != 0;
+	const uint64_t states = osxsave ? EnabledStates() : 0;
+	// SSE and AVX state, then the opmask and upper ZMM state on top for AVX-512
+	const bool ymm = (states & 0x6) == 0x6;
+	const bool zmm = (states & 0xe6) == 0xe6;
+
+	const bool avx = (leaf1[2] & (1u << 28)) != 0;
+	const bool fma = (leaf1[2] & (1u << 12)) != 0;
+	const bool avx2 = (leaf7[1] & (1u << 5)) != 0;
+	if (!(ymm && avx && fma && avx2)) {
+		return CpuIsa::SSE42;
+	}
+
+	const uint32_t avx512Bits = (1u << 16) | (1u << 17) | (1u << 30) | (1u << 31);
+	if (!(zmm && (leaf7[1] & avx512Bits) == avx512Bits)) {
+		return CpuIsa::AVX2;
+	}
+	return CpuIsa::AVX512;
+}
+#else
+static CpuIsa Detect() {
+	return CpuIsa::Generic;
+}
+#endif
+
+CpuIsa DetectCpuIsa() {
+	static const CpuIsa detected = Detect();
+	return detected;
+}
+
+bool CpuSupports(CpuIsa isa) {
+	return isa < CpuIsa::Count && isa <= DetectCpuIsa();
+}
+
+const char *CpuIsaName(CpuIsa isa) {
+	return isa < CpuIsa::Count ? isa_names[static_cast<int>(isa)] : "unknown";
+}
+
+bool ParseCpuIsa(const char *name, CpuIsa &isa) {
+	for (int i = 0; i < static_cast<int>(CpuIsa::Count); i++) {
+		if (std::strcmp(name, isa_names[i]) == 0) {
+			isa = static_cast<CpuIsa>(i);
+			return true;
+		}
+	}
+	return false;
+}
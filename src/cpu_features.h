@@ -0,0 +1,21 @@
+#pragma once
+
+// Instruction sets the kernels are built for, in increasing order so the best supported one is the largest
+enum class CpuIsa {
+	Generic,
+	SSE42,
+	// AVX2 with FMA
+	AVX2,
+	// AVX-512 F, DQ, BW and VL
+	AVX512,
+	Count
+};
+
+// Best instruction set both the CPU and the operating system support, read once with cpuid and xgetbv.
+// Always Generic on other architectures.
+CpuIsa DetectCpuIsa();
+bool CpuSupports(CpuIsa isa);
+
+const char* CpuIsaName(CpuIsa isa);
+// Parses "generic", "sse4.2", "avx2" or "avx512", returns false on anything else
+bool ParseCpuIsa(const char* name, CpuIsa& isa);
@@ -2,70 +2,133 @@
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
-#include <time.h>
 #include <omp.h>
-#include <random>
+#include <algorithm>
+#include <cmath>
 
-Denoising::Denoising(short width, short height) : AABB(width, height) {
+// Random stream of the sample this thread is tracing, see SeedRandom
+static thread_local uint32_t random_state = 0;
+
+// Integer hash of the PCG family (Jarzynski and Olano 2020)
+static uint32_t HashRandom(uint32_t value) {
+	const uint32_t state = value * 747796405u + 2891336453u;
+	const uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// The same pixel and sample index always draw the same numbers, whichever thread or worker traces them
+static void SeedRandom(size_t pixel, unsigned int sample) {
+	random_state = HashRandom(static_cast<uint32_t>(pixel) ^ HashRandom(sample));
+}
+
+Denoising::Denoising(int width, int height) : AABB(width, height) {
 	raytracing_depth = 16;
+	gamma = 0.25f;
 }
 
 Denoising::~Denoising() {}
 
-void Denoising::Clear() {
-	history_buffer.resize(width * height);
-	frame_buffer.resize(width * height);
+int Denoising::Clear() {
+	const int result = AABB::Clear();
+	if (result != 0) {
+		return result;
+	}
+
+	const size_t pixels = static_cast<size_t>(width) * static_cast<size_t>(height);
+	history_buffer.resize(pixels);
+	moments_buffer.resize(pixels);
+	history_length.resize(pixels);
+	history_valid = false;
+	return 0;
+}
+
+size_t Denoising::FrameStateBytes(size_t pixels) const {
+	size_t perPixel = sizeof(float3) + 2 * sizeof(float) + 2 * sizeof(GBufferSample);
+	perPixel += (aov_channels & AOV_INDIRECT) ? sizeof(float3) : 0;
+	// Frames are accumulated one ray per pixel, without the planes of the adaptive sampling edge detector
+	return RayGenerationApp::FrameStateBytes(pixels) + pixels * perPixel;
+}
+
+void Denoising::AccountMemory(MemoryReport &report) const {
+	AABB::AccountMemory(report);
+	report.Add(MEMORY_HISTORY, VectorBytes(history_buffer) + VectorBytes(moments_buffer) + VectorBytes(history_length)
+		+ VectorBytes(g_buffer) + VectorBytes(previous_g_buffer) + VectorBytes(indirect_history));
+	report.Add(MEMORY_TEXTURES, VectorBytes(blue_noise));
 }
 
-Payload Denoising::Hit(const Ray &ray, const IntersectableData &data, const MaterialTriangle *triangle, const unsigned int raytrace_depth) const {
+Payload Denoising::Hit(const Ray &ray, const IntersectableData &data, const MaterialSurface *surface, const unsigned int raytrace_depth) const {
 	if (raytrace_depth <= 0) {
 		return Miss(ray);
 	}
 
-	if (triangle == nullptr) {
+	if (surface == nullptr) {
 		return Miss(ray);
 	}
 
+	const Material &material = materials[surface->material_id];
+
+	WriteAOVs(ray, data, surface, material);
+
 	Payload payload;
-	payload.color = triangle->emissive_color;
-	if (payload.color > float3 {0, 0, 0}) {
+	payload.color = material.emissive_color;
+	if (material.emitter) {
 		return payload;
 	}
 
-	float3 x = ray.position + ray.direction * data.t;
-	float3 normal = triangle->GetNormal(data.baricentric);
+	float3 error;
+	float3 x = surface->GetHitPoint(data.baricentric, error) + data.offset;
+	float3 geoNormal = surface->GetGeometricNormal(data.baricentric);
+	float3 normal = surface->GetNormal(data.baricentric);
 
-	if (triangle->reflectiveness) {
-		float3 reflectionDir = ray.direction - 2.0f * linalg::dot(normal, ray.direction) * normal;
-		Ray reflectionRay(x + reflectionDir * 0.001f, reflectionDir);
-		return TraceRay(reflectionRay, raytrace_depth - 1);
+	switch (material.type) {
+		case BSDFType::Mirror:
+		{
+			float3 reflectionDir = ray.direction - 2.0f * linalg::dot(normal, ray.direction) * normal;
+			Ray reflectionRay(OffsetRayOrigin(x, error, geoNormal, reflectionDir), reflectionDir);
+			reflectionRay.Continue(ray, data.t);
+			RAY_STAT(RayStatistics::CountRay(RAY_REFLECTION));
+			Payload reflectionPayload = TraceRay(reflectionRay, raytrace_depth - 1);
+			if (ray.aov) {
+				ray.aov->Set(ray.aov_pixel, AOV_INDIRECT, reflectionPayload.color);
+			}
+			return reflectionPayload;
+		}
+		default:
+			break;
 	}
 
+	float3 albedo = GetAlbedo(ray, data, surface, material);
 	const int nSecondaryRays = 1;
 	float3 color;
 	for (int i = 0; i < nSecondaryRays;i++) {
-		float3 randomDir = blue_noise[GetRandom(omp_get_thread_num()+clock())];
+		float3 randomDir = blue_noise[GetRandom()];
 		if (linalg::dot(randomDir, normal) <= 0.0f) {
 			randomDir = -randomDir;
 		}
 
-		Ray toLight(x, randomDir);
+		Ray toLight(OffsetRayOrigin(x, error, geoNormal, randomDir), randomDir);
+		toLight.Continue(ray, data.t);
+		toLight.spread = diffuse_ray_spread;
+		RAY_STAT(RayStatistics::CountRay(RAY_DIFFUSE));
 		Payload lightPayload = TraceRay(toLight, raytrace_depth - 1);
 
-		color += lightPayload.color * triangle->diffuse_color
+		color += lightPayload.color * albedo
 			* std::max(0.0f, linalg::dot(normal, toLight.direction));
 	}
 
 	payload.color += color / nSecondaryRays;
+	if (ray.aov) {
+		ray.aov->Set(ray.aov_pixel, AOV_INDIRECT, color / nSecondaryRays);
+	}
 
 	return payload;
 }
 
-void Denoising::SetHistory(unsigned short x, unsigned short y, float3 color) {
+void Denoising::SetHistory(unsigned int x, unsigned int y, float3 color) {
 	history_buffer[static_cast<size_t>(y) *static_cast<size_t>(width) + static_cast<size_t>(x)] = color;
 }
 
-float3 Denoising::GetHistory(unsigned short x, unsigned short y) const {
+float3 Denoising::GetHistory(unsigned int x, unsigned int y) const {
 	return history_buffer[static_cast<size_t>(y) *static_cast<size_t>(width) + static_cast<size_t>(x)];
 }
 
@@ -74,55 +137,474 @@ Payload Denoising::Miss(const Ray &ray) const {
 	return Payload();
 }
 
-int Denoising::GetRandom(const int thread_num) const {
-	static std::default_random_engine generator(thread_num);
-	static std::uniform_int_distribution<int> distribution(0, 512 * 512);
-	return distribution(generator);
+size_t Denoising::GetRandom() const {
+	random_state = HashRandom(random_state);
+	return static_cast<size_t>(random_state) % blue_noise.size();
 }
 
-float GammaCorrection(float x, float gamma, float a) {
-	return std::min(1.0f, std::powf(x, gamma) * a);
+float Luminance(float3 color) {
+	return linalg::dot(color, float3 {0.2126f, 0.7152f, 0.0722f});
 }
 
-float3 GammaCorrection(float3 v, float gamma, float a) {
-	return float3 { GammaCorrection(v.x, gamma, a), GammaCorrection(v.y, gamma, a), GammaCorrection(v.z, gamma, a) };
+void Denoising::DrawScene(int max_frame_number) {
+	camera.SetRenderTargetSize(width, height);
+	FillGBuffer();
+	ResetHistory();
+	PrepareAOVs();
+
+	// Every batch render of a view draws the same samples
+	sample_index = 0;
+	for (int frameNumber = 0; frameNumber < max_frame_number; frameNumber++) {
+		std::cout << "Frame " << (frameNumber + 1) << std::endl;
+		AccumulateFrame(false);
+	}
+
+	Resolve();
 }
 
-float3 GammaCorrection(float3 v, float gamma) {
-	return GammaCorrection(v, gamma, 1.0f);
+void Denoising::DrawFrame() {
+	camera.SetRenderTargetSize(width, height);
+	PrepareAOVs();
+
+	bool moved = !history_valid || camera != history_camera || crop_revision != history_crop_revision;
+	if (moved) {
+		std::swap(g_buffer, previous_g_buffer);
+		FillGBuffer();
+		if (history_valid) {
+			ReprojectHistory();
+		} else {
+			ResetHistory();
+		}
+	}
+
+	AccumulateFrame(moved && history_valid);
+	history_camera = camera;
+	history_crop_revision = crop_revision;
+	history_valid = true;
+
+	Resolve();
 }
 
-void Denoising::DrawScene(int max_frame_number) {
+void Denoising::AccumulateTile(const PixelWindow &window, unsigned int sample_count, unsigned int first_sample, AccumulationTile &tile) {
+	SetCropWindow(window.x0, window.y0, window.x1, window.y1);
 	camera.SetRenderTargetSize(width, height);
+	FillGBuffer();
+	ResetHistory();
+	PrepareAOVs();
+
+	sample_index = first_sample;
+	for (unsigned int sample = 0; sample < sample_count; sample++) {
+		AccumulateFrame(false);
+	}
+
+	tile.window = RenderWindow();
+	const size_t tileWidth = static_cast<size_t>(tile.window.Width());
+	const size_t pixelCount = tileWidth * static_cast<size_t>(tile.window.Height());
+	tile.illumination.resize(pixelCount);
+	tile.moments.resize(pixelCount);
+	tile.length.resize(pixelCount);
+	for (int y = tile.window.y0; y < tile.window.y1; y++) {
+		const size_t row = static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(tile.window.x0);
+		const size_t tileRow = static_cast<size_t>(y - tile.window.y0) * tileWidth;
+		std::copy(history_buffer.begin() + row, history_buffer.begin() + row + tileWidth, tile.illumination.begin() + tileRow);
+		std::copy(moments_buffer.begin() + row, moments_buffer.begin() + row + tileWidth, tile.moments.begin() + tileRow);
+		std::copy(history_length.begin() + row, history_length.begin() + row + tileWidth, tile.length.begin() + tileRow);
+	}
+
+	ResetCrop();
+}
+
+void Denoising::ResetAccumulation() {
+	camera.SetRenderTargetSize(width, height);
+	ResetHistory();
+}
+
+void Denoising::MergeTile(const AccumulationTile &tile) {
+	const size_t tileWidth = static_cast<size_t>(tile.window.Width());
+	for (int y = tile.window.y0; y < tile.window.y1; y++) {
+		for (int x = tile.window.x0; x < tile.window.x1; x++) {
+			const size_t p = static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x);
+			const size_t t = static_cast<size_t>(y - tile.window.y0) * tileWidth + static_cast<size_t>(x - tile.window.x0);
+			const float length = tile.length[t];
+			if (length <= 0.0f) {
+				continue;
+			}
+
+			// A pixel's first tile is copied as is, so disjoint tiles are stitched without any rounding
+			if (history_length[p] <= 0.0f) {
+				history_buffer[p] = tile.illumination[t];
+				moments_buffer[p] = tile.moments[t];
+				history_length[p] = length;
+				continue;
+			}
+
+			const float total = history_length[p] + length;
+			history_buffer[p] = (history_buffer[p] * history_length[p] + tile.illumination[t] * length) / total;
+			moments_buffer[p] = (moments_buffer[p] * history_length[p] + tile.moments[t] * length) / total;
+			history_length[p] = total;
+		}
+	}
+}
+
+void Denoising::ResolveAccumulation() {
+	camera.SetRenderTargetSize(width, height);
+	FillGBuffer();
+	// The merged history continues to accumulate with DrawFrame
+	history_camera = camera;
+	history_crop_revision = crop_revision;
+	history_valid = true;
+
+	Resolve();
+}
+
+void Denoising::ResetHistory() {
+	std::fill(history_buffer.begin(), history_buffer.end(), float3 {0.0f, 0.0f, 0.0f});
+	std::fill(moments_buffer.begin(), moments_buffer.end(), 0.0f);
+	std::fill(history_length.begin(), history_length.end(), 0.0f);
+	std::fill(indirect_history.begin(), indirect_history.end(), float3 {0.0f, 0.0f, 0.0f});
+	history_camera = camera;
+	history_crop_revision = crop_revision;
+	history_valid = true;
+}
+
+void Denoising::ReprojectHistory() {
+	ProfileScope profile("reproject");
+	std::vector<float3> reprojected(history_buffer.size(), float3 {0.0f, 0.0f, 0.0f});
+	std::vector<float> reprojectedMoments(moments_buffer.size(), 0.0f);
+	std::vector<float> reprojectedLength(history_length.size(), 0.0f);
+	std::vector<float3> reprojectedIndirect(indirect_history.size(), float3 {0.0f, 0.0f, 0.0f});
+
+	const PixelWindow window = RenderWindow();
+#pragma omp parallel for
+	for (int y = window.y0; y < window.y1; y++) {
+		for (int x = window.x0; x < window.x1; x++) {
+			const size_t p = static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x);
+			const GBufferSample &sample = g_buffer[p];
+			if (!sample.hit) {
+				continue;
+			}
+
+			// The motion vector follows from the primary hit and the camera delta
+			float2 pixel;
+			if (!history_camera.Project(sample.position, pixel)) {
+				continue;
+			}
+
+			// Bilinear taps, each kept only if it saw the same surface
+			const int x0 = static_cast<int>(std::floor(pixel.x));
+			const int y0 = static_cast<int>(std::floor(pixel.y));
+			const float fx = pixel.x - x0;
+			const float fy = pixel.y - y0;
+
+			float3 color {0.0f, 0.0f, 0.0f};
+			float3 indirect {0.0f, 0.0f, 0.0f};
+			float moments = 0.0f;
+			float length = 0.0f;
+			float sumWeight = 0.0f;
+			for (int tap = 0; tap < 4; tap++) {
+				const int qx = x0 + (tap & 1);
+				const int qy = y0 + (tap >> 1);
+				if (qx < 0 || qx >= width || qy < 0 || qy >= height) {
+					continue;
+				}
+
+				const size_t q = static_cast<size_t>(qy) * static_cast<size_t>(width) + static_cast<size_t>(qx);
+				const GBufferSample &previous = previous_g_buffer[q];
+				if (!previous.hit
+					|| linalg::length(previous.position - sample.position) > reprojection_tolerance * sample.depth
+					|| linalg::dot(previous.normal, sample.normal) < reprojection_normal_threshold) {
+					continue;
+				}
+
+				const float weight = ((tap & 1) ? fx : 1.0f - fx) * ((tap >> 1) ? fy : 1.0f - fy);
+				color += weight * history_buffer[q];
+				if (!indirect_history.empty()) {
+					indirect += weight * indirect_history[q];
+				}
+				moments += weight * moments_buffer[q];
+				length += weight * history_length[q];
+				sumWeight += weight;
+			}
+
+			if (sumWeight > 0.01f) {
+				reprojected[p] = color / sumWeight;
+				reprojectedMoments[p] = moments / sumWeight;
+				reprojectedLength[p] = length / sumWeight;
+				if (!indirect_history.empty()) {
+					reprojectedIndirect[p] = indirect / sumWeight;
+				}
+			}
+		}
+	}
+
+	std::swap(history_buffer, reprojected);
+	std::swap(moments_buffer, reprojectedMoments);
+	std::swap(history_length, reprojectedLength);
+	std::swap(indirect_history, reprojectedIndirect);
+}
+
+void Denoising::AccumulateFrame(bool clamp_history) {
+	ProfileScope profile("trace", true);
+	std::vector<float3> samples(history_buffer.size());
+	// The indirect AOV averages over the same frames as the image, starting over when it was just requested
+	const bool accumulateIndirect = aov_buffer.Has(AOV_INDIRECT);
+	bool restartIndirect = false;
+	if (!accumulateIndirect) {
+		std::vector<float3>().swap(indirect_history);
+	} else if (indirect_history.size() != history_buffer.size()) {
+		indirect_history.assign(history_buffer.size(), float3 {0.0f, 0.0f, 0.0f});
+		restartIndirect = true;
+	}
+
+	const PixelWindow window = RenderWindow();
+#pragma omp parallel for
+	for (int x = window.x0; x < window.x1; x++) {
+#pragma omp parallel for
+		for (int y = window.y0; y < window.y1; y++) {
+			if (!IsRendered(x, y)) {
+				continue;
+			}
+
+			size_t ix = static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x);
+			SeedRandom(ix, sample_index);
+			Ray ray = camera.GetCameraRay(x, y);
+			AttachAOVs(ray, x, y);
+			Payload payload = TraceRay(ray, raytracing_depth);
+			SetPixel(x, y, payload.color);
+
+			samples[ix] = payload.color / g_buffer[ix].albedo;
+		}
+	}
 
-	for (int frameNumber = 0; frameNumber < max_frame_number; frameNumber++) {
-		std::cout << "Frame " << (frameNumber + 1) << std::endl;
 #pragma omp parallel for
-		for (int x = 0; x < width; x++) {
+	for (int y = window.y0; y < window.y1; y++) {
+		for (int x = window.x0; x < window.x1; x++) {
+			if (!IsRendered(x, y)) {
+				continue;
+			}
+
+			const size_t p = static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x);
+			float3 history = GetHistory(x, y);
+
+			// Stale lighting in the reprojected history is pulled into the range of the new samples around it
+			if (clamp_history && history_length[p] > 0.0f) {
+				float3 mean {0.0f, 0.0f, 0.0f};
+				float3 meanSquared {0.0f, 0.0f, 0.0f};
+				float count = 0.0f;
+				for (int dy = -1; dy <= 1; dy++) {
+					for (int dx = -1; dx <= 1; dx++) {
+						const int qx = x + dx;
+						const int qy = y + dy;
+						if (!window.Contains(qx, qy) || !IsRendered(qx, qy)) {
+							continue;
+						}
+
+						const float3 neighbour = samples[static_cast<size_t>(qy) * static_cast<size_t>(width) + static_cast<size_t>(qx)];
+						mean += neighbour;
+						meanSquared += neighbour * neighbour;
+						count += 1.0f;
+					}
+				}
+				mean /= count;
+				float3 deviation = linalg::sqrt(linalg::max(meanSquared / count - mean * mean, float3(0.0f)));
+				history = linalg::clamp(history, mean - history_clamp_sigma * deviation, mean + history_clamp_sigma * deviation);
+			}
+
+			const float length = std::min(history_length[p] + 1.0f, max_history_length);
+			const float alpha = 1.0f / length;
+			const float luminance = Luminance(samples[p]);
+			SetHistory(x, y, linalg::lerp(history, samples[p], alpha));
+			moments_buffer[p] = moments_buffer[p] + (luminance * luminance - moments_buffer[p]) * alpha;
+			history_length[p] = length;
+			if (accumulateIndirect) {
+				const float3 indirect {aov_buffer.Plane(AOV_INDIRECT, 0)[p], aov_buffer.Plane(AOV_INDIRECT, 1)[p], aov_buffer.Plane(AOV_INDIRECT, 2)[p]};
+				indirect_history[p] = restartIndirect ? indirect : linalg::lerp(indirect_history[p], indirect, alpha);
+				aov_buffer.Set(p, AOV_INDIRECT, indirect_history[p]);
+			}
+		}
+	}
+	sample_index++;
+}
+
+void Denoising::Resolve() {
+	ProfileScope profile("denoise");
+	// The albedo was divided out before accumulation, so texture and material edges stay sharp
+	std::vector<float3> illumination(history_buffer);
+	std::vector<float> variance(history_buffer.size());
+	for (size_t i = 0; i < history_buffer.size(); i++) {
+		float luminance = Luminance(illumination[i]);
+		// Variance of the mean rather than of a single sample
+		variance[i] = std::max(0.0f, moments_buffer[i] - luminance * luminance) / std::max(1.0f, history_length[i]);
+	}
+
+	if (filter_iterations > 0) {
+		FilterIllumination(illumination, variance);
+	}
+
+	const PixelWindow window = RenderWindow();
+	for (int x = window.x0; x < window.x1; x++) {
+		for (int y = window.y0; y < window.y1; y++) {
+			if (!IsRendered(x, y)) {
+				continue;
+			}
+
+			size_t ix = static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x);
+			SetPixel(x, y, illumination[ix] * g_buffer[ix].albedo);
+		}
+	}
+}
+
+void Denoising::FillGBuffer() {
+	ProfileScope profile("g-buffer", true);
+	g_buffer.assign(static_cast<size_t>(width) * static_cast<size_t>(height), GBufferSample());
+
+	// Pixels which are not rendered stay misses, so neither the filter nor the reprojection reads them
+	const PixelWindow window = RenderWindow();
 #pragma omp parallel for
-			for (int y = 0; y < height; y++) {
-				Ray ray = camera.GetCameraRay(x, y);
-				Payload payload = TraceRay(ray, raytracing_depth);
-				SetPixel(x, y, payload.color);
-				SetHistory(x, y, GetHistory(x, y) + payload.color);
+	for (int y = window.y0; y < window.y1; y++) {
+		for (int x = window.x0; x < window.x1; x++) {
+			GBufferSample &sample = g_buffer[static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x)];
+			sample.albedo = float3 {1.0f, 1.0f, 1.0f};
+			if (!IsRendered(x, y)) {
+				continue;
+			}
+
+			Ray ray = camera.GetCameraRay(x, y);
+			IntersectableData data(t_max);
+			const MaterialSurface *surface = nullptr;
+			RayCapture::Record(ray.position, ray.direction, ray.spread, ray.cone_width, ray.time, t_max, CAPTURE_CLOSEST, 0);
+			const bool hit = ClosestHit(ray, data, surface);
+			ChargePixel(x, y);
+			if (!hit) {
+				continue;
+			}
+
+			sample.hit = true;
+			sample.depth = data.t;
+			sample.position = ray.position + ray.direction * data.t;
+			sample.normal = linalg::normalize(surface->GetNormal(data.baricentric));
+
+			// Only diffuse-like surfaces are demodulated, mirrors and emitters keep their full radiance
+			const Material &material = materials[surface->material_id];
+			if (!material.emitter && (material.type == BSDFType::Lambert || material.type == BSDFType::Phong)) {
+				sample.albedo = linalg::max(GetAlbedo(ray, data, surface, material), float3(0.01f));
 			}
 		}
 	}
+}
+
+void Denoising::FilterIllumination(std::vector<float3> &illumination, std::vector<float> &variance) const {
+	// B3 spline and 3x3 gaussian taps, indexed by the absolute offset
+	const float kernel[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+	const float gaussian[2] = {1.0f / 2.0f, 1.0f / 4.0f};
+	const float pixelAngle = 2.0f / static_cast<float>(height);
+
+	std::vector<float3> nextIllumination(illumination.size());
+	std::vector<float> nextVariance(variance.size());
 
-	for (short x = 0; x < width; x++) {
-		for (short y = 0; y < height; y++) {
-			float3 history = GetHistory(x, y) / max_frame_number;
-			history = GammaCorrection(history, 0.25f);
-			SetPixel(x, y, history);
+	// Only the rendered window is filtered, pixels outside it were never accumulated
+	const PixelWindow window = RenderWindow();
+	const int tilesX = (window.Width() + filter_tile_size - 1) / filter_tile_size;
+	const int tilesY = (window.Height() + filter_tile_size - 1) / filter_tile_size;
+
+	for (unsigned int iteration = 0; iteration < filter_iterations; iteration++) {
+		const int step = 1 << iteration;
+
+#pragma omp parallel for schedule(dynamic)
+		for (int tile = 0; tile < tilesX * tilesY; tile++) {
+			const int x0 = window.x0 + (tile % tilesX) * filter_tile_size;
+			const int y0 = window.y0 + (tile / tilesX) * filter_tile_size;
+			const int x1 = std::min(x0 + filter_tile_size, window.x1);
+			const int y1 = std::min(y0 + filter_tile_size, window.y1);
+
+			for (int y = y0; y < y1; y++) {
+				for (int x = x0; x < x1; x++) {
+					const size_t p = static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x);
+					const GBufferSample &center = g_buffer[p];
+					if (!center.hit) {
+						nextIllumination[p] = illumination[p];
+						nextVariance[p] = variance[p];
+						continue;
+					}
+
+					// The raw variance is too noisy at low sample counts to drive the luminance weight alone
+					float blurredVariance = 0.0f;
+					for (int dy = -1; dy <= 1; dy++) {
+						for (int dx = -1; dx <= 1; dx++) {
+							int qx = std::min(std::max(x + dx, window.x0), window.x1 - 1);
+							int qy = std::min(std::max(y + dy, window.y0), window.y1 - 1);
+							blurredVariance += gaussian[std::abs(dx)] * gaussian[std::abs(dy)]
+								* variance[static_cast<size_t>(qy) * static_cast<size_t>(width) + static_cast<size_t>(qx)];
+						}
+					}
+
+					const float luminanceScale = 1.0f / (sigma_luminance * std::sqrt(blurredVariance) + 1e-4f);
+					const float depthScale = 1.0f / (sigma_depth * step * pixelAngle * center.depth + 1e-4f);
+					const float centerLuminance = Luminance(illumination[p]);
+
+					float3 sum {0.0f, 0.0f, 0.0f};
+					float sumVariance = 0.0f;
+					float sumWeight = 0.0f;
+					for (int dy = -2; dy <= 2; dy++) {
+						const int qy = y + dy * step;
+						if (qy < 0 || qy >= height) {
+							continue;
+						}
+
+						for (int dx = -2; dx <= 2; dx++) {
+							const int qx = x + dx * step;
+							if (qx < 0 || qx >= width) {
+								continue;
+							}
+
+							const size_t q = static_cast<size_t>(qy) * static_cast<size_t>(width) + static_cast<size_t>(qx);
+							const GBufferSample &sample = g_buffer[q];
+							if (!sample.hit) {
+								continue;
+							}
+
+							float normalWeight = std::max(0.0f, linalg::dot(center.normal, sample.normal));
+							for (int i = 0; i < normal_squarings; i++) {
+								normalWeight *= normalWeight;
+							}
+
+							const float weight = kernel[std::abs(dx)] * kernel[std::abs(dy)] * normalWeight
+								* std::exp(-std::abs(center.depth - sample.depth) * depthScale
+									- std::abs(centerLuminance - Luminance(illumination[q])) * luminanceScale);
+
+							sum += weight * illumination[q];
+							sumVariance += weight * weight * variance[q];
+							sumWeight += weight;
+						}
+					}
+
+					if (sumWeight <= 0.0f) {
+						nextIllumination[p] = illumination[p];
+						nextVariance[p] = variance[p];
+						continue;
+					}
+
+					nextIllumination[p] = sum / sumWeight;
+					nextVariance[p] = sumVariance / (sumWeight * sumWeight);
+				}
+			}
 		}
+
+		std::swap(illumination, nextIllumination);
+		std::swap(variance, nextVariance);
 	}
 }
 
-void Denoising::LoadBlueNoise(std::string file_name) {
+int Denoising::LoadBlueNoise(std::string file_name) {
+	ProfileScope profile("load");
 	int width, height, channels;
 	unsigned char *img = stbi_load(file_name.c_str(), &width, &height, &channels, 0);
+	if (!img) {
+		std::cerr << "Could not load " << file_name << std::endl;
+		return -1;
+	}
 
-	std::vector<byte3> reference;
+	blue_noise.clear();
 	for (int i = 0; i < width * height; i++) {
 		float3 pixel {
 			(img[channels * i] - 128.0f) / 128.0f,
@@ -131,4 +613,6 @@ void Denoising::LoadBlueNoise(std::string file_name) {
 		};
 		blue_noise.push_back(pixel);
 	}
+	stbi_image_free(img);
+	return 0;
 }
@@ -2,22 +2,106 @@
 
 #include "aabb.h"
 
+// Primary hit features guiding the spatial filter and the temporal reprojection
+class GBufferSample {
+public:
+	float3 position;
+	float3 normal;
+	float3 albedo;
+	float depth = 0.0f;
+	bool hit = false;
+};
+
+// Accumulated history of one window, the unit of work a distributed worker sends back
+class AccumulationTile {
+public:
+	PixelWindow window;
+	// Row-major over the window, same meaning as the history buffers of Denoising
+	std::vector<float3> illumination;
+	std::vector<float> moments;
+	std::vector<float> length;
+};
+
 class Denoising: public AABB
 {
 public:
-	Denoising(short width, short height);
+	Denoising(int width, int height);
 	virtual ~Denoising();
-	virtual void Clear();
+	virtual int Clear();
 	virtual void DrawScene(int max_frame_number);
-	void LoadBlueNoise(std::string file_name);
+	// Batch renders accumulate SetFramesPerView frames for every view
+	virtual void DrawScene() { DrawScene(static_cast<int>(frames_per_view)); };
+	void SetFramesPerView(unsigned int frames) { frames_per_view = frames; };
+	unsigned int GetFramesPerView() const { return frames_per_view; };
+	static constexpr unsigned int default_frames_per_view = 16;
+	// One sample per pixel from the current camera, reusing the history of earlier frames across camera moves
+	void DrawFrame();
+	// -1 if the image could not be read
+	int LoadBlueNoise(std::string file_name);
+	// Number of a-trous passes after accumulation, 0 keeps the plain average
+	void SetFilterIterations(unsigned int iterations) { filter_iterations = iterations; };
+
+	// Distributed rendering, see distributed.h. A worker accumulates sample_count frames of a window from an empty history,
+	// numbered from first_sample so workers sharing pixels trace different samples.
+	// The coordinator merges the tiles of all workers weighted by their sample counts and resolves the frame once.
+	void AccumulateTile(const PixelWindow& window, unsigned int sample_count, unsigned int first_sample, AccumulationTile& tile);
+	void ResetAccumulation();
+	void MergeTile(const AccumulationTile& tile);
+	void ResolveAccumulation();
 
 protected:
-	Payload Hit(const Ray& ray, const IntersectableData& data, const MaterialTriangle* triangle, const unsigned int max_raytrace_depth) const;
-	void SetHistory(unsigned short x, unsigned short y, float3 color);
-	float3 GetHistory(unsigned short x, unsigned short y) const;
+	Payload Hit(const Ray& ray, const IntersectableData& data, const MaterialSurface* surface, const unsigned int max_raytrace_depth) const;
+	virtual void AccountMemory(MemoryReport& report) const;
+	// The frame and AOVs, the history, the two G-buffers and the indirect AOV history
+	virtual size_t FrameStateBytes(size_t pixels) const;
+	void SetHistory(unsigned int x, unsigned int y, float3 color);
+	float3 GetHistory(unsigned int x, unsigned int y) const;
 	Payload Miss(const Ray& ray) const;
+	void FillGBuffer();
+	void ResetHistory();
+	// Warps the history into the current view, dropping disoccluded pixels by position and normal tests
+	void ReprojectHistory();
+	// Traces one sample per pixel into the history, clamp_history bounds reprojected history by the new samples
+	void AccumulateFrame(bool clamp_history);
+	void Resolve();
+	// Edge-avoiding a-trous wavelet filter (Dammertz et al. 2010) with SVGF luminance weights (Schied et al. 2017)
+	void FilterIllumination(std::vector<float3>& illumination, std::vector<float>& variance) const;
+
+	// Running means of the demodulated illumination and its squared luminance, over history_length samples
 	std::vector<float3> history_buffer;
+	std::vector<float> moments_buffer;
+	std::vector<float> history_length;
+	// Running mean of the indirect AOV over the same samples, empty unless that AOV is enabled
+	std::vector<float3> indirect_history;
+	std::vector<GBufferSample> g_buffer;
+	std::vector<GBufferSample> previous_g_buffer;
+	// View the history was accumulated from
+	Camera history_camera;
+	// A new crop window or mask changes which pixels have a G-buffer, so it counts as a camera move
+	unsigned int history_crop_revision = 0;
+	bool history_valid = false;
 	std::vector<float3> blue_noise;
+	// Number of the next accumulated frame, with the pixel it picks the blue noise directions of each sample
+	unsigned int sample_index = 0;
+
+	unsigned int filter_iterations = 5;
+	unsigned int frames_per_view = default_frames_per_view;
+	// Normal weight is dot(n_p, n_q)^(2^normal_squarings)
+	const int normal_squarings = 7;
+	const float sigma_depth = 4.0f;
+	const float sigma_luminance = 4.0f;
+	const short filter_tile_size = 32;
+
+	const float max_history_length = 256.0f;
+	// Reprojected positions further apart than this fraction of the depth count as disoccluded
+	const float reprojection_tolerance = 0.02f;
+	const float reprojection_normal_threshold = 0.9f;
+	// Reprojected history is clamped to the mean +- this many deviations of the new 3x3 neighbourhood
+	const float history_clamp_sigma = 2.0f;
+
+	// Cone spread of the diffuse bounce, wide enough that it reaches the coarse mesh LODs
+	const float diffuse_ray_spread = 0.05f;
 
-	int GetRandom(const int thread_num) const;
+	// Next index into blue_noise of the sample this thread is tracing
+	size_t GetRandom() const;
 };
\ No newline at end of file
@@ -1,16 +1,154 @@
 #include "denoising.h"
 #include "denoising_main.h"
+#include "distributed.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Without arguments the frame is rendered locally. Otherwise one process runs
+//   denoising --coordinator <port> <worker count> [tiles|samples]
+// and every worker, on this or any other node, runs
+//   denoising --worker <coordinator host> <port>
+// On a single node the coordinator can instead start the workers itself, talking to them over their stdin and stdout
+//   denoising --spawn <worker count> [tiles|samples]
+// --timeout <seconds>, anywhere, drops a TCP peer which stays silent that long, 0 waits forever. Default 600.
+// --counters, anywhere, adds hardware counters to the phase report printed at exit.
+// --capture <file>, anywhere, records the traced rays for bench/ray_replay.
+// --memory-budget <MB>, anywhere, bounds the scene, acceleration structure and frame buffers.
+// --isa <generic|sse4.2|avx2|avx512>, anywhere, replaces the kernels picked for the CPU.
 int main(int argc, char *argv[]) {
-	Denoising *render = new Denoising(1920, 1080);
+	std::vector<std::string> args(argv + 1, argv + argc);
+	// A spawned worker's stdout carries the protocol, so everything it prints goes to stderr
+	const bool pipeWorker = !args.empty() && args[0] == "--pipe-worker";
+	if (pipeWorker) {
+		std::cout.rdbuf(std::cerr.rdbuf());
+	}
+	// Options a spawned worker needs to set up the same scene
+	std::vector<std::string> workerOptions;
+	auto countersFlag = std::find(args.begin(), args.end(), "--counters");
+	if (countersFlag != args.end()) {
+		args.erase(countersFlag);
+		if (!Profiler::EnableCounters()) {
+			std::cerr << "Hardware counters are not available, timing only" << std::endl;
+		}
+	}
+	std::string captureFile;
+	auto captureFlag = std::find(args.begin(), args.end(), "--capture");
+	if (captureFlag != args.end() && captureFlag + 1 != args.end()) {
+		captureFile = *(captureFlag + 1);
+		args.erase(captureFlag, captureFlag + 2);
+	}
+	size_t memoryBudget = 0;
+	auto budgetFlag = std::find(args.begin(), args.end(), "--memory-budget");
+	if (budgetFlag != args.end() && budgetFlag + 1 != args.end()) {
+		memoryBudget = static_cast<size_t>(std::max(0.0, std::atof((budgetFlag + 1)->c_str())) * 1024.0 * 1024.0);
+		workerOptions.insert(workerOptions.end(), budgetFlag, budgetFlag + 2);
+		args.erase(budgetFlag, budgetFlag + 2);
+	}
+	auto isaFlag = std::find(args.begin(), args.end(), "--isa");
+	if (isaFlag != args.end() && isaFlag + 1 != args.end()) {
+		CpuIsa isa;
+		if (!ParseCpuIsa((isaFlag + 1)->c_str(), isa) || !SelectKernels(isa)) {
+			std::cerr << "Kernels for " << *(isaFlag + 1) << " are not available on this CPU" << std::endl;
+		}
+		workerOptions.insert(workerOptions.end(), isaFlag, isaFlag + 2);
+		args.erase(isaFlag, isaFlag + 2);
+	}
+	unsigned int timeout = 600;
+	auto timeoutFlag = std::find(args.begin(), args.end(), "--timeout");
+	if (timeoutFlag != args.end() && timeoutFlag + 1 != args.end()) {
+		timeout = static_cast<unsigned int>(std::max(0, std::atoi((timeoutFlag + 1)->c_str())));
+		args.erase(timeoutFlag, timeoutFlag + 2);
+	}
+	std::cout << "Kernels: " << CpuIsaName(Kernels().isa) << std::endl;
+
+	const int width = 1920;
+	const int height = 1080;
+	const unsigned int samples = 16;
+
+	Denoising *render = new Denoising(width, height);
+	render->SetMemoryBudget(memoryBudget);
 	int result = render->LoadGeometry("models/CornellBox-Mirror.obj");
 	if (result) {
 		return result;
 	}
+	render->BuildLODs(3);
 	render->SetCamera(float3 {-0.5f, 0.99f, 1.5f}, float3 {0, 0.99f, -1}, float3 {0, 1, 0});
 	render->LoadBlueNoise("textures/blue-noise.png");
 	render->Clear();
-	render->DrawScene(128);
+	if (!captureFile.empty() && !render->StartRayCapture(captureFile)) {
+		std::cerr << "Could not open " << captureFile << std::endl;
+		return -1;
+	}
+
+	const std::string mode = args.empty() ? "" : args[0];
+	if (mode == "--worker" && args.size() > 2) {
+		std::unique_ptr<Connection> coordinator = Connection::Connect(args[1], static_cast<unsigned short>(std::atoi(args[2].c_str())));
+		if (coordinator) {
+			coordinator->SetTimeout(timeout);
+		}
+		result = coordinator ? Work(*render, *coordinator) : -1;
+		render->StopRayCapture();
+		return result;
+	}
+	if (pipeWorker) {
+		result = Work(*render, *Connection::StandardStreams());
+		render->StopRayCapture();
+		return result;
+	}
+
+	if ((mode == "--coordinator" && args.size() > 2) || (mode == "--spawn" && args.size() > 1)) {
+		const bool spawn = mode == "--spawn";
+		const size_t countArg = spawn ? 1 : 2;
+		const int workerCount = std::max(1, std::atoi(args[countArg].c_str()));
+		std::vector<std::unique_ptr<Connection>> workers;
+		if (spawn) {
+			std::vector<std::string> command = {argv[0], "--pipe-worker"};
+			command.insert(command.end(), workerOptions.begin(), workerOptions.end());
+			while (static_cast<int>(workers.size()) < workerCount) {
+				std::unique_ptr<Connection> worker = Connection::Spawn(command);
+				if (!worker) {
+					return -1;
+				}
+				workers.push_back(std::move(worker));
+			}
+		} else {
+			Listener listener(static_cast<unsigned short>(std::atoi(args[1].c_str())));
+			if (!listener.IsListening()) {
+				return -1;
+			}
+			while (static_cast<int>(workers.size()) < workerCount) {
+				std::unique_ptr<Connection> worker = listener.Accept();
+				if (!worker) {
+					return -1;
+				}
+				worker->SetTimeout(timeout);
+				workers.push_back(std::move(worker));
+			}
+		}
+
+		const bool bySamples = args.size() > countArg + 1 && args[countArg + 1] == "samples";
+		std::vector<RenderTask> tasks = bySamples
+			? SplitSamples(width, height, samples, static_cast<unsigned int>(workerCount))
+			: SplitTiles(width, height, 128, samples);
+		result = Coordinate(*render, workers, tasks);
+	} else {
+		render->DrawScene(samples);
+	}
+	if (result) {
+		return result;
+	}
+
+	if (!captureFile.empty()) {
+		std::cout << render->StopRayCapture() << " rays captured to " << captureFile << std::endl;
+	}
 	result = render->Save("results/denoising.png");
+
+	render->GetMemoryUsage().Print(std::cout);
+	Profiler::Report(std::cout);
+	Profiler::SaveChromeTrace("results/denoising_trace.json");
 	return result;
-}
\ No newline at end of file
+}
@@ -0,0 +1,641 @@
+#include "distributed.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <afunix.h>
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Messages are raw native-endian words, every node of the farm runs the same build
+static const uint32_t protocol_magic = 0x57445452; // "RTDW"
+static const uint32_t protocol_version = 2;
+
+enum MessageType : uint32_t {
+	MESSAGE_DONE = 0,
+	MESSAGE_TASK = 1
+};
+
+static bool InitSockets() {
+#ifdef _WIN32
+	static bool initialized = [] {
+		WSADATA data;
+		return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+	}();
+	return initialized;
+#else
+	return true;
+#endif
+}
+
+static void CloseSocket(intptr_t handle) {
+#ifdef _WIN32
+	closesocket(static_cast<SOCKET>(handle));
+#else
+	close(static_cast<int>(handle));
+#endif
+}
+
+Connection::Connection(intptr_t read_handle, intptr_t write_handle, bool is_socket) :
+	read_handle(read_handle),
+	write_handle(write_handle),
+	is_socket(is_socket) {}
+
+Connection::~Connection() {
+	if (is_socket) {
+		CloseSocket(read_handle);
+	}
+	if (process == -1) {
+		return;
+	}
+
+	// Closing stdin first lets a child which still waits for input see the end of it
+#ifdef _WIN32
+	_close(static_cast<int>(write_handle));
+	_close(static_cast<int>(read_handle));
+	WaitForSingleObject(reinterpret_cast<HANDLE>(process), INFINITE);
+	CloseHandle(reinterpret_cast<HANDLE>(process));
+#else
+	close(static_cast<int>(write_handle));
+	close(static_cast<int>(read_handle));
+	waitpid(static_cast<pid_t>(process), nullptr, 0);
+#endif
+}
+
+bool Connection::SetTimeout(unsigned int seconds) {
+	if (!is_socket) {
+		return false;
+	}
+
+#ifdef _WIN32
+	const DWORD timeout = static_cast<DWORD>(seconds) * 1000;
+#else
+	timeval timeout = {};
+	timeout.tv_sec = static_cast<time_t>(seconds);
+#endif
+	const char *option = reinterpret_cast<const char *>(&timeout);
+	return setsockopt(read_handle, SOL_SOCKET, SO_RCVTIMEO, option, sizeof(timeout)) == 0
+		&& setsockopt(write_handle, SOL_SOCKET, SO_SNDTIMEO, option, sizeof(timeout)) == 0;
+}
+
+bool Connection::Read(void *data, size_t size) {
+	char *bytes = static_cast<char *>(data);
+	while (size > 0) {
+		const int chunk = static_cast<int>(std::min<size_t>(size, 1 << 20));
+#ifdef _WIN32
+		const int received = is_socket
+			? recv(static_cast<SOCKET>(read_handle), bytes, chunk, 0)
+			: _read(static_cast<int>(read_handle), bytes, chunk);
+#else
+		const ssize_t received = is_socket
+			? recv(static_cast<int>(read_handle), bytes, chunk, 0)
+			: read(static_cast<int>(read_handle), bytes, chunk);
+#endif
+		if (received <= 0) {
+			return false;
+		}
+		bytes += received;
+		size -= static_cast<size_t>(received);
+	}
+	return true;
+}
+
+bool Connection::Write(const void *data, size_t size) {
+	const char *bytes = static_cast<const char *>(data);
+	while (size > 0) {
+		const int chunk = static_cast<int>(std::min<size_t>(size, 1 << 20));
+#ifdef _WIN32
+		const int sent = is_socket
+			? send(static_cast<SOCKET>(write_handle), bytes, chunk, 0)
+			: _write(static_cast<int>(write_handle), bytes, chunk);
+#else
+		// A worker which went away must fail the call rather than raise SIGPIPE
+		const ssize_t sent = is_socket
+			? send(static_cast<int>(write_handle), bytes, chunk, MSG_NOSIGNAL)
+			: write(static_cast<int>(write_handle), bytes, chunk);
+#endif
+		if (sent <= 0) {
+			return false;
+		}
+		bytes += sent;
+		size -= static_cast<size_t>(sent);
+	}
+	return true;
+}
+
+std::unique_ptr<Connection> Connection::Connect(const std::string &host, unsigned short port) {
+	if (!InitSockets()) {
+		return nullptr;
+	}
+
+	addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	addrinfo *addresses = nullptr;
+	if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0) {
+		std::cerr << "Could not resolve " << host << std::endl;
+		return nullptr;
+	}
+
+	std::unique_ptr<Connection> connection;
+	for (addrinfo *address = addresses; address && !connection; address = address->ai_next) {
+		intptr_t handle = static_cast<intptr_t>(socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+		if (handle == -1) {
+			continue;
+		}
+		if (connect(handle, address->ai_addr, static_cast<int>(address->ai_addrlen)) != 0) {
+			CloseSocket(handle);
+			continue;
+		}
+		connection.reset(new Connection(handle, handle, true));
+	}
+	freeaddrinfo(addresses);
+
+	if (!connection) {
+		std::cerr << "Could not connect to " << host << ":" << port << std::endl;
+	}
+	return connection;
+}
+
+// False if the path does not fit sun_path
+static bool LocalAddress(const std::string &socket_path, sockaddr_un &address) {
+	address = {};
+	address.sun_family = AF_UNIX;
+	if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+		std::cerr << "Invalid socket path " << socket_path << std::endl;
+		return false;
+	}
+	std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+	return true;
+}
+
+std::unique_ptr<Connection> Connection::ConnectLocal(const std::string &socket_path) {
+	sockaddr_un address;
+	if (!InitSockets() || !LocalAddress(socket_path, address)) {
+		return nullptr;
+	}
+
+	intptr_t handle = static_cast<intptr_t>(socket(AF_UNIX, SOCK_STREAM, 0));
+	if (handle == -1) {
+		return nullptr;
+	}
+	if (connect(handle, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+		std::cerr << "Could not connect to " << socket_path << std::endl;
+		CloseSocket(handle);
+		return nullptr;
+	}
+	return std::unique_ptr<Connection>(new Connection(handle, handle, true));
+}
+
+std::unique_ptr<Connection> Connection::StandardStreams() {
+#ifdef _WIN32
+	_setmode(0, _O_BINARY);
+	_setmode(1, _O_BINARY);
+#endif
+	return std::unique_ptr<Connection>(new Connection(0, 1, false));
+}
+
+#ifdef _WIN32
+// Command line quoting as parsed by the C runtime of the child
+static std::string QuoteArgument(const std::string &argument) {
+	if (!argument.empty() && argument.find_first_of(" \t\"") == std::string::npos) {
+		return argument;
+	}
+
+	std::string quoted = "\"";
+	size_t backslashes = 0;
+	for (char c : argument) {
+		if (c == '\\') {
+			backslashes++;
+			continue;
+		}
+		quoted.append(c == '"' ? 2 * backslashes + 1 : backslashes, '\\');
+		backslashes = 0;
+		quoted += c;
+	}
+	quoted.append(2 * backslashes, '\\');
+	return quoted + "\"";
+}
+
+std::unique_ptr<Connection> Connection::Spawn(const std::vector<std::string> &command) {
+	if (command.empty()) {
+		return nullptr;
+	}
+
+	SECURITY_ATTRIBUTES security = {sizeof(security), nullptr, TRUE};
+	HANDLE childInput, parentOutput, parentInput, childOutput;
+	if (!CreatePipe(&childInput, &parentOutput, &security, 0)) {
+		return nullptr;
+	}
+	if (!CreatePipe(&parentInput, &childOutput, &security, 0)) {
+		CloseHandle(childInput);
+		CloseHandle(parentOutput);
+		return nullptr;
+	}
+	// Only the child's ends are inherited, otherwise the child would keep its own stdin open
+	SetHandleInformation(parentOutput, HANDLE_FLAG_INHERIT, 0);
+	SetHandleInformation(parentInput, HANDLE_FLAG_INHERIT, 0);
+
+	std::string commandLine;
+	for (const auto &argument : command) {
+		commandLine += (commandLine.empty() ? "" : " ") + QuoteArgument(argument);
+	}
+	STARTUPINFOA startup = {};
+	startup.cb = sizeof(startup);
+	startup.dwFlags = STARTF_USESTDHANDLES;
+	startup.hStdInput = childInput;
+	startup.hStdOutput = childOutput;
+	startup.hStdError = GetStdHandle(STD_ERROR_HANDLE);
+	PROCESS_INFORMATION info = {};
+	const bool started = CreateProcessA(nullptr, &commandLine[0], nullptr, nullptr, TRUE, 0, nullptr, nullptr, &startup, &info) != 0;
+	CloseHandle(childInput);
+	CloseHandle(childOutput);
+	if (!started) {
+		std::cerr << "Could not start " << command.front() << std::endl;
+		CloseHandle(parentOutput);
+		CloseHandle(parentInput);
+		return nullptr;
+	}
+	CloseHandle(info.hThread);
+
+	const int readHandle = _open_osfhandle(reinterpret_cast<intptr_t>(parentInput), _O_RDONLY | _O_BINARY);
+	const int writeHandle = _open_osfhandle(reinterpret_cast<intptr_t>(parentOutput), _O_WRONLY | _O_BINARY);
+	std::unique_ptr<Connection> connection(new Connection(readHandle, writeHandle, false));
+	connection->process = reinterpret_cast<intptr_t>(info.hProcess);
+	return connection;
+}
+#else
+std::unique_ptr<Connection> Connection::Spawn(const std::vector<std::string> &command) {
+	if (command.empty()) {
+		return nullptr;
+	}
+
+	// A child which went away must fail Write rather than raise SIGPIPE
+	static const bool ignored = std::signal(SIGPIPE, SIG_IGN) != SIG_ERR;
+	(void)ignored;
+
+	int toChild[2];
+	int fromChild[2];
+	if (pipe(toChild) != 0) {
+		return nullptr;
+	}
+	if (pipe(fromChild) != 0) {
+		close(toChild[0]);
+		close(toChild[1]);
+		return nullptr;
+	}
+	// Children spawned later must not inherit these, or this child never sees the end of its input
+	for (int handle : {toChild[0], toChild[1], fromChild[0], fromChild[1]}) {
+		fcntl(handle, F_SETFD, FD_CLOEXEC);
+	}
+
+	// Built before the fork, the child may only make async-signal-safe calls until exec
+	std::vector<char *> argv;
+	for (const auto &argument : command) {
+		argv.push_back(const_cast<char *>(argument.c_str()));
+	}
+	argv.push_back(nullptr);
+
+	const pid_t pid = fork();
+	if (pid == 0) {
+		dup2(toChild[0], 0);
+		dup2(fromChild[1], 1);
+		close(toChild[0]);
+		close(toChild[1]);
+		close(fromChild[0]);
+		close(fromChild[1]);
+		execvp(argv[0], argv.data());
+		_exit(127);
+	}
+	close(toChild[0]);
+	close(fromChild[1]);
+	if (pid < 0) {
+		std::cerr << "Could not start " << command.front() << std::endl;
+		close(toChild[1]);
+		close(fromChild[0]);
+		return nullptr;
+	}
+
+	std::unique_ptr<Connection> connection(new Connection(fromChild[0], toChild[1], false));
+	connection->process = static_cast<intptr_t>(pid);
+	return connection;
+}
+#endif
+
+Listener::Listener(unsigned short port) {
+	if (!InitSockets()) {
+		return;
+	}
+
+	intptr_t candidate = static_cast<intptr_t>(socket(AF_INET, SOCK_STREAM, 0));
+	if (candidate == invalid_handle) {
+		return;
+	}
+
+	int reuse = 1;
+	setsockopt(candidate, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&reuse), sizeof(reuse));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+	address.sin_port = htons(port);
+	if (bind(candidate, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(candidate, 16) != 0) {
+		std::cerr << "Could not listen on port " << port << std::endl;
+		CloseSocket(candidate);
+		return;
+	}
+	handle = candidate;
+}
+
+Listener::Listener(const std::string &socket_path) {
+	sockaddr_un address;
+	if (!InitSockets() || !LocalAddress(socket_path, address)) {
+		return;
+	}
+
+	intptr_t candidate = static_cast<intptr_t>(socket(AF_UNIX, SOCK_STREAM, 0));
+	if (candidate == invalid_handle) {
+		return;
+	}
+
+	// A socket file nobody answers on was left behind by a server which did not shut down cleanly
+	intptr_t probe = static_cast<intptr_t>(socket(AF_UNIX, SOCK_STREAM, 0));
+	const bool taken = probe != invalid_handle && connect(probe, reinterpret_cast<sockaddr *>(&address), sizeof(address)) == 0;
+	if (probe != invalid_handle) {
+		CloseSocket(probe);
+	}
+	if (taken) {
+		std::cerr << "Another server is listening on " << socket_path << std::endl;
+		CloseSocket(candidate);
+		return;
+	}
+	std::remove(socket_path.c_str());
+	if (bind(candidate, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0 || listen(candidate, 16) != 0) {
+		std::cerr << "Could not listen on " << socket_path << std::endl;
+		CloseSocket(candidate);
+		return;
+	}
+	handle = candidate;
+	this->socket_path = socket_path;
+}
+
+Listener::~Listener() {
+	if (IsListening()) {
+		CloseSocket(handle);
+	}
+	if (!socket_path.empty()) {
+		std::remove(socket_path.c_str());
+	}
+}
+
+std::unique_ptr<Connection> Listener::Accept() {
+	if (!IsListening()) {
+		return nullptr;
+	}
+
+	intptr_t client = static_cast<intptr_t>(accept(handle, nullptr, nullptr));
+	if (client == invalid_handle) {
+		return nullptr;
+	}
+	return std::unique_ptr<Connection>(new Connection(client, client, true));
+}
+
+std::vector<RenderTask> SplitTiles(int width, int height, int tile_size, unsigned int samples) {
+	std::vector<RenderTask> tasks;
+	tile_size = std::max(1, tile_size);
+	for (int y = 0; y < height; y += tile_size) {
+		for (int x = 0; x < width; x += tile_size) {
+			RenderTask task;
+			task.window.x0 = x;
+			task.window.y0 = y;
+			task.window.x1 = std::min(x + tile_size, width);
+			task.window.y1 = std::min(y + tile_size, height);
+			task.samples = samples;
+			tasks.push_back(task);
+		}
+	}
+	return tasks;
+}
+
+std::vector<RenderTask> SplitSamples(int width, int height, unsigned int samples, unsigned int parts) {
+	std::vector<RenderTask> tasks;
+	parts = std::max(1u, std::min(parts, samples));
+	unsigned int first = 0;
+	for (unsigned int part = 0; part < parts; part++) {
+		RenderTask task;
+		task.window.x1 = width;
+		task.window.y1 = height;
+		task.samples = samples / parts + (part < samples % parts ? 1 : 0);
+		task.first_sample = first;
+		first += task.samples;
+		tasks.push_back(task);
+	}
+	return tasks;
+}
+
+static bool SendHandshake(Connection &connection) {
+	const uint32_t header[2] = {protocol_magic, protocol_version};
+	return connection.Write(header, sizeof(header));
+}
+
+static bool ReceiveHandshake(Connection &connection) {
+	uint32_t header[2];
+	return connection.Read(header, sizeof(header)) && header[0] == protocol_magic && header[1] == protocol_version;
+}
+
+static bool SendTask(Connection &connection, const RenderTask &task) {
+	const uint32_t message[7] = {
+		MESSAGE_TASK,
+		static_cast<uint32_t>(task.window.x0), static_cast<uint32_t>(task.window.y0),
+		static_cast<uint32_t>(task.window.x1), static_cast<uint32_t>(task.window.y1),
+		task.samples, task.first_sample
+	};
+	return connection.Write(message, sizeof(message));
+}
+
+static bool SendDone(Connection &connection) {
+	const uint32_t message = MESSAGE_DONE;
+	return connection.Write(&message, sizeof(message));
+}
+
+// more is false when the coordinator has no further work
+static bool ReceiveTask(Connection &connection, RenderTask &task, bool &more) {
+	uint32_t type;
+	if (!connection.Read(&type, sizeof(type))) {
+		return false;
+	}
+
+	more = type == MESSAGE_TASK;
+	if (!more) {
+		return type == MESSAGE_DONE;
+	}
+
+	uint32_t message[6];
+	if (!connection.Read(message, sizeof(message))) {
+		return false;
+	}
+	task.window.x0 = static_cast<int>(message[0]);
+	task.window.y0 = static_cast<int>(message[1]);
+	task.window.x1 = static_cast<int>(message[2]);
+	task.window.y1 = static_cast<int>(message[3]);
+	task.samples = message[4];
+	task.first_sample = message[5];
+	return true;
+}
+
+static bool SendTile(Connection &connection, const AccumulationTile &tile) {
+	const uint32_t header[4] = {
+		static_cast<uint32_t>(tile.window.x0), static_cast<uint32_t>(tile.window.y0),
+		static_cast<uint32_t>(tile.window.x1), static_cast<uint32_t>(tile.window.y1)
+	};
+	return connection.Write(header, sizeof(header))
+		&& connection.Write(tile.illumination.data(), tile.illumination.size() * sizeof(float3))
+		&& connection.Write(tile.moments.data(), tile.moments.size() * sizeof(float))
+		&& connection.Write(tile.length.data(), tile.length.size() * sizeof(float));
+}
+
+static bool ReceiveTile(Connection &connection, AccumulationTile &tile) {
+	uint32_t header[4];
+	if (!connection.Read(header, sizeof(header))) {
+		return false;
+	}
+
+	tile.window.x0 = static_cast<int>(header[0]);
+	tile.window.y0 = static_cast<int>(header[1]);
+	tile.window.x1 = static_cast<int>(header[2]);
+	tile.window.y1 = static_cast<int>(header[3]);
+	if (tile.window.Width() < 0 || tile.window.Height() < 0) {
+		return false;
+	}
+
+	const size_t pixelCount = static_cast<size_t>(tile.window.Width()) * static_cast<size_t>(tile.window.Height());
+	tile.illumination.resize(pixelCount);
+	tile.moments.resize(pixelCount);
+	tile.length.resize(pixelCount);
+	return connection.Read(tile.illumination.data(), pixelCount * sizeof(float3))
+		&& connection.Read(tile.moments.data(), pixelCount * sizeof(float))
+		&& connection.Read(tile.length.data(), pixelCount * sizeof(float));
+}
+
+static bool SameWindow(const PixelWindow &a, const PixelWindow &b) {
+	return a.x0 == b.x0 && a.y0 == b.y0 && a.x1 == b.x1 && a.y1 == b.y1;
+}
+
+int Coordinate(Denoising &render, std::vector<std::unique_ptr<Connection>> &workers, const std::vector<RenderTask> &tasks) {
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::deque<size_t> pending;
+	size_t inFlight = 0;
+	for (size_t i = 0; i < tasks.size(); i++) {
+		pending.push_back(i);
+	}
+	std::vector<AccumulationTile> tiles(tasks.size());
+	std::vector<bool> finished(tasks.size(), false);
+
+	std::vector<std::thread> threads;
+	for (size_t w = 0; w < workers.size(); w++) {
+		threads.emplace_back([&, w] {
+			Connection &worker = *workers[w];
+			bool alive = SendHandshake(worker) && ReceiveHandshake(worker);
+			if (!alive) {
+				std::cerr << "Worker " << w << " did not answer the handshake" << std::endl;
+			}
+
+			while (alive) {
+				size_t index;
+				{
+					// A failed worker may put its task back, so idle workers wait until nothing is in flight
+					std::unique_lock<std::mutex> lock(mutex);
+					changed.wait(lock, [&] { return !pending.empty() || inFlight == 0; });
+					if (pending.empty()) {
+						break;
+					}
+					index = pending.front();
+					pending.pop_front();
+					inFlight++;
+				}
+
+				AccumulationTile tile;
+				alive = SendTask(worker, tasks[index]) && ReceiveTile(worker, tile) && SameWindow(tile.window, tasks[index].window);
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					inFlight--;
+					if (alive) {
+						tiles[index] = std::move(tile);
+						finished[index] = true;
+					} else {
+						std::cerr << "Worker " << w << " dropped out, its task is handed to the others" << std::endl;
+						pending.push_back(index);
+					}
+				}
+				changed.notify_all();
+			}
+
+			if (alive) {
+				SendDone(worker);
+			}
+		});
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	if (std::find(finished.begin(), finished.end(), false) != finished.end()) {
+		std::cerr << "Not every task was rendered" << std::endl;
+		return -1;
+	}
+
+	render.ResetAccumulation();
+	for (const auto &tile : tiles) {
+		render.MergeTile(tile);
+	}
+	render.ResolveAccumulation();
+	return 0;
+}
+
+int Work(Denoising &render, Connection &coordinator) {
+	if (!ReceiveHandshake(coordinator) || !SendHandshake(coordinator)) {
+		std::cerr << "Coordinator did not answer the handshake" << std::endl;
+		return -1;
+	}
+
+	for (;;) {
+		RenderTask task;
+		bool more = false;
+		if (!ReceiveTask(coordinator, task, more)) {
+			return -1;
+		}
+		if (!more) {
+			return 0;
+		}
+
+		AccumulationTile tile;
+		render.AccumulateTile(task.window, task.samples, task.first_sample, tile);
+		if (!SendTile(coordinator, tile)) {
+			return -1;
+		}
+	}
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "denoising.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Byte stream to one peer, either a TCP or Unix domain socket or a pair of pipe descriptors
+class Connection
+{
+public:
+	Connection(intptr_t read_handle, intptr_t write_handle, bool is_socket);
+	// Closes a socket, or the pipes of a spawned process and then waits for it to exit
+	~Connection();
+
+	// Blocks until all of size is transferred, false once the peer is gone or the timeout expired
+	bool Read(void* data, size_t size);
+	bool Write(const void* data, size_t size);
+	// A socket peer which sends or takes nothing for this long counts as gone, 0 waits forever.
+	// Pipes have no timeout, false for them.
+	bool SetTimeout(unsigned int seconds);
+
+	static std::unique_ptr<Connection> Connect(const std::string& host, unsigned short port);
+	// Unix domain socket of a server on this machine
+	static std::unique_ptr<Connection> ConnectLocal(const std::string& socket_path);
+	// stdin and stdout of a worker launched by a pipe-aware parent
+	static std::unique_ptr<Connection> StandardStreams();
+	// Starts command, the program looked up on the PATH followed by its arguments, with its stdin and stdout
+	// connected to the returned pipes. The child's stderr is shared with this process.
+	static std::unique_ptr<Connection> Spawn(const std::vector<std::string>& command);
+
+protected:
+	intptr_t read_handle;
+	intptr_t write_handle;
+	bool is_socket;
+	// Process id, or process handle on Windows, of a spawned child
+	intptr_t process = -1;
+};
+
+class Listener
+{
+public:
+	explicit Listener(unsigned short port);
+	// Unix domain socket at socket_path, replacing a stale one. The file is removed again on destruction.
+	explicit Listener(const std::string& socket_path);
+	~Listener();
+
+	bool IsListening() const { return handle != invalid_handle; };
+	std::unique_ptr<Connection> Accept();
+
+protected:
+	static const intptr_t invalid_handle = -1;
+	intptr_t handle = invalid_handle;
+	std::string socket_path;
+};
+
+// Pixels and number of samples of one piece of work
+class RenderTask
+{
+public:
+	PixelWindow window;
+	unsigned int samples = 0;
+	// Index of the first sample, see Denoising::AccumulateTile
+	unsigned int first_sample = 0;
+};
+
+// Disjoint tiles, each rendered with every sample by one worker
+std::vector<RenderTask> SplitTiles(int width, int height, int tile_size, unsigned int samples);
+// The full frame over and over, the samples are divided between the parts and each starts after the ones before it
+std::vector<RenderTask> SplitSamples(int width, int height, unsigned int samples, unsigned int parts);
+
+// Hands the tasks to the workers as they become free and merges the returned tiles in task order,
+// so the result does not depend on which worker finished first. Tasks of a worker that drops out go to the others.
+// Returns -1 if some task could not be rendered by any worker.
+int Coordinate(Denoising& render, std::vector<std::unique_ptr<Connection>>& workers, const std::vector<RenderTask>& tasks);
+// Renders tasks of the coordinator until it sends the end marker. The scene must be set up as on the coordinator.
+int Work(Denoising& render, Connection& coordinator);
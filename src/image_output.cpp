@@ -0,0 +1,196 @@
+#include "image_output.h"
+#include "kernels.h"
+#include "profiler.h"
+
+#define STBI_MSC_SECURE_CRT
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+
+static_assert(sizeof(float3) == 3 * sizeof(float) && sizeof(byte3) == 3, "The tone mapping kernel reads pixels as interleaved channels");
+
+namespace {
+
+// Pixels per tone mapping call, enough to amortize the dispatch and few enough to spread over the threads
+const size_t tone_map_block = 4096;
+
+template <class T>
+void WriteBinary(std::ofstream &file, const T &value) {
+	file.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void WriteEXRAttribute(std::ofstream &file, const std::string &name, const std::string &type, int32_t size) {
+	file.write(name.c_str(), name.size() + 1);
+	file.write(type.c_str(), type.size() + 1);
+	WriteBinary(file, size);
+}
+
+}
+
+void ToneMap(const std::vector<float3> &hdr, std::vector<byte3> &ldr, ToneMapping tone_mapping, float exposure, float gamma, bool parallel) {
+	ProfileScope profile("tonemap");
+	ldr.resize(hdr.size());
+
+	const KernelToneMap kernelToneMap = tone_mapping == ToneMapping::Reinhard ? KERNEL_TONEMAP_REINHARD :
+		tone_mapping == ToneMapping::ACES ? KERNEL_TONEMAP_ACES : KERNEL_TONEMAP_CLAMP;
+	const KernelTable &kernels = Kernels();
+	const float *channels = reinterpret_cast<const float *>(hdr.data());
+	unsigned char *bytes = reinterpret_cast<unsigned char *>(ldr.data());
+	// Counted in blocks, so frames past 2^31 pixels still index with an int
+	const int blocks = static_cast<int>((hdr.size() + tone_map_block - 1) / tone_map_block);
+
+#pragma omp parallel for if(parallel)
+	for (int block = 0; block < blocks; block++) {
+		const size_t start = static_cast<size_t>(block) * tone_map_block;
+		const size_t pixels = std::min(tone_map_block, hdr.size() - start);
+		kernels.tone_map(channels + 3 * start, bytes + 3 * start, 3 * pixels, kernelToneMap, exposure, gamma);
+	}
+}
+
+bool WriteImage(const std::string &filename, int width, int height, const std::vector<float3> &pixels,
+	ToneMapping tone_mapping, float exposure, float gamma, bool parallel) {
+	ProfileScope profile("save");
+	std::string extension = FileExtension(filename);
+	if (extension == "hdr") {
+		return WriteHDR(filename, width, height, pixels);
+	}
+	if (extension == "pfm") {
+		return WritePFM(filename, width, height, pixels);
+	}
+	if (extension == "exr") {
+		return WriteEXR(filename, width, height, pixels);
+	}
+
+	std::vector<byte3> ldr;
+	ToneMap(pixels, ldr, tone_mapping, exposure, gamma, parallel);
+	return WritePNG(filename, width, height, ldr);
+}
+
+std::string FileExtension(const std::string &filename) {
+	size_t dot = filename.find_last_of('.');
+	if (dot == std::string::npos) {
+		return std::string();
+	}
+
+	std::string extension = filename.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+	return extension;
+}
+
+bool WritePNG(const std::string &filename, int width, int height, const std::vector<byte3> &pixels) {
+	return stbi_write_png(filename.c_str(), width, height, 3, pixels.data(), width * sizeof(uint8_t) * 3) == 1;
+}
+
+bool WriteHDR(const std::string &filename, int width, int height, const std::vector<float3> &pixels) {
+	return stbi_write_hdr(filename.c_str(), width, height, 3, reinterpret_cast<const float *>(pixels.data())) == 1;
+}
+
+bool WritePFM(const std::string &filename, int width, int height, const std::vector<float3> &pixels) {
+	std::ofstream file(filename, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+
+	// A negative scale marks little-endian data, rows go bottom to top
+	file << "PF\n" << width << " " << height << "\n-1.0\n";
+	for (int y = height - 1; y >= 0; y--) {
+		file.write(reinterpret_cast<const char *>(&pixels[static_cast<size_t>(y) * width]), sizeof(float3) * width);
+	}
+
+	return static_cast<bool>(file);
+}
+
+bool WriteEXR(const std::string &filename, int width, int height, const std::vector<float3> &pixels) {
+	std::vector<float> planes[3];
+	for (int c = 0; c < 3; c++) {
+		planes[c].resize(pixels.size());
+		for (size_t i = 0; i < pixels.size(); i++) {
+			planes[c][i] = pixels[i][c];
+		}
+	}
+	return WriteEXR(filename, width, height, {"R", "G", "B"}, {planes[0].data(), planes[1].data(), planes[2].data()});
+}
+
+bool WriteEXR(const std::string &filename, int width, int height, const std::vector<std::string> &names, const std::vector<const float *> &planes) {
+	std::ofstream file(filename, std::ios::binary);
+	if (!file || names.size() != planes.size()) {
+		return false;
+	}
+
+	// The format wants channels in alphabetical order, both in the header and in every scanline
+	std::vector<size_t> order(names.size());
+	for (size_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&names](size_t a, size_t b) { return names[a] < names[b]; });
+
+	// Version 2, with the long names flag once a layer name passes 31 characters
+	const int32_t magic = 20000630;
+	int32_t version = 2;
+	for (auto &name : names) {
+		if (name.size() > 31) {
+			version |= 0x400;
+		}
+	}
+	WriteBinary(file, magic);
+	WriteBinary(file, version);
+
+	int32_t channelListSize = 1;
+	for (auto &name : names) {
+		channelListSize += static_cast<int32_t>(name.size()) + 1 + 16;
+	}
+	WriteEXRAttribute(file, "channels", "chlist", channelListSize);
+	for (size_t i : order) {
+		file.write(names[i].c_str(), names[i].size() + 1);
+		WriteBinary(file, int32_t {2}); // FLOAT
+		WriteBinary(file, int32_t {0}); // pLinear and reserved
+		WriteBinary(file, int32_t {1}); // x sampling
+		WriteBinary(file, int32_t {1}); // y sampling
+	}
+	file.put(0);
+
+	WriteEXRAttribute(file, "compression", "compression", 1);
+	file.put(0);
+
+	const int32_t window[4] = {0, 0, width - 1, height - 1};
+	WriteEXRAttribute(file, "dataWindow", "box2i", 16);
+	file.write(reinterpret_cast<const char *>(window), 16);
+	WriteEXRAttribute(file, "displayWindow", "box2i", 16);
+	file.write(reinterpret_cast<const char *>(window), 16);
+
+	WriteEXRAttribute(file, "lineOrder", "lineOrder", 1);
+	file.put(0);
+
+	WriteEXRAttribute(file, "pixelAspectRatio", "float", 4);
+	WriteBinary(file, 1.0f);
+
+	WriteEXRAttribute(file, "screenWindowCenter", "v2f", 8);
+	WriteBinary(file, 0.0f);
+	WriteBinary(file, 0.0f);
+
+	WriteEXRAttribute(file, "screenWindowWidth", "float", 4);
+	WriteBinary(file, 1.0f);
+	file.put(0);
+
+	// Offset table, one chunk per scanline
+	const int32_t lineBytes = static_cast<int32_t>(names.size()) * width * static_cast<int32_t>(sizeof(float));
+	const uint64_t tableStart = static_cast<uint64_t>(file.tellp());
+	for (int y = 0; y < height; y++) {
+		WriteBinary(file, static_cast<uint64_t>(tableStart + 8ull * height + static_cast<uint64_t>(y) * (8 + lineBytes)));
+	}
+
+	for (int32_t y = 0; y < height; y++) {
+		WriteBinary(file, y);
+		WriteBinary(file, lineBytes);
+		for (size_t i : order) {
+			file.write(reinterpret_cast<const char *>(planes[i] + static_cast<size_t>(y) * width), sizeof(float) * width);
+		}
+	}
+
+	return static_cast<bool>(file);
+}
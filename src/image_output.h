@@ -0,0 +1,31 @@
+#pragma once
+
+#include "linalg.h"
+using namespace linalg::aliases;
+
+#include <string>
+#include <vector>
+
+enum class ToneMapping { Clamp, Reinhard, ACES };
+
+// Exposure, then the operator, then gamma, then truncation to 8 bits.
+// parallel = false keeps the pass on the calling thread, for writers running beside the renderer.
+void ToneMap(const std::vector<float3>& hdr, std::vector<byte3>& ldr, ToneMapping tone_mapping, float exposure, float gamma, bool parallel = true);
+
+// Lower-case extension without the dot, empty if there is none
+std::string FileExtension(const std::string& filename);
+
+// Format follows the extension: png is tone mapped, hdr, pfm and exr keep the linear values
+bool WriteImage(const std::string& filename, int width, int height, const std::vector<float3>& pixels,
+	ToneMapping tone_mapping, float exposure, float gamma, bool parallel = true);
+
+// Writers return true on success, rows are stored top to bottom
+bool WritePNG(const std::string& filename, int width, int height, const std::vector<byte3>& pixels);
+// Radiance RGBE
+bool WriteHDR(const std::string& filename, int width, int height, const std::vector<float3>& pixels);
+// Portable float map, little-endian
+bool WritePFM(const std::string& filename, int width, int height, const std::vector<float3>& pixels);
+// Scanline OpenEXR with uncompressed 32-bit float channels
+bool WriteEXR(const std::string& filename, int width, int height, const std::vector<float3>& pixels);
+// Any number of named planes of width * height floats, in any order
+bool WriteEXR(const std::string& filename, int width, int height, const std::vector<std::string>& names, const std::vector<const float*>& planes);
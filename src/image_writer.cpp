@@ -0,0 +1,85 @@
+#include "image_writer.h"
+
+#include <algorithm>
+#include <iostream>
+
+ImageWriter::ImageWriter(unsigned int threads, size_t max_pending) : max_pending(std::max<size_t>(1, max_pending)) {
+	for (unsigned int i = 0; i < std::max(1u, threads); i++) {
+		workers.emplace_back(&ImageWriter::Work, this);
+	}
+}
+
+ImageWriter::~ImageWriter() {
+	Flush();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	work_available.notify_all();
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+void ImageWriter::Submit(ImageJob job) {
+	std::unique_lock<std::mutex> lock(mutex);
+	slot_available.wait(lock, [this] { return queue.size() < max_pending; });
+	queue.push_back(std::move(job));
+	lock.unlock();
+	work_available.notify_one();
+}
+
+std::vector<float3> ImageWriter::AcquireBuffer(size_t pixel_count) {
+	std::vector<float3> buffer;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!free_buffers.empty()) {
+			buffer = std::move(free_buffers.back());
+			free_buffers.pop_back();
+		}
+	}
+	// Cropped and masked renders leave pixels untouched, so the old frame must not show through
+	buffer.assign(pixel_count, float3 {0.0f, 0.0f, 0.0f});
+	return buffer;
+}
+
+size_t ImageWriter::Flush() {
+	std::unique_lock<std::mutex> lock(mutex);
+	idle.wait(lock, [this] { return queue.empty() && in_progress == 0; });
+	size_t result = failures;
+	failures = 0;
+	return result;
+}
+
+void ImageWriter::Work() {
+	for (;;) {
+		ImageJob job;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			work_available.wait(lock, [this] { return stopping || !queue.empty(); });
+			if (queue.empty()) {
+				return;
+			}
+			job = std::move(queue.front());
+			queue.pop_front();
+			in_progress++;
+		}
+		slot_available.notify_one();
+
+		// Tone mapping stays on this thread, the renderer owns the OpenMP team
+		bool written = WriteImage(job.filename, job.width, job.height, job.pixels, job.tone_mapping, job.exposure, job.gamma, false);
+		if (!written) {
+			std::cerr << "Failed to write " << job.filename << std::endl;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			in_progress--;
+			failures += written ? 0 : 1;
+			if (free_buffers.size() < max_pending) {
+				free_buffers.push_back(std::move(job.pixels));
+			}
+		}
+		idle.notify_all();
+	}
+}
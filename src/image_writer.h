@@ -0,0 +1,54 @@
+#pragma once
+
+#include "image_output.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class ImageJob
+{
+public:
+	std::string filename;
+	int width = 0;
+	int height = 0;
+	std::vector<float3> pixels;
+	ToneMapping tone_mapping = ToneMapping::Clamp;
+	float exposure = 1.0f;
+	float gamma = 1.0f;
+};
+
+// Encodes and writes frames on background threads while the next frame renders.
+// Pixels are moved in and their storage is handed back through AcquireBuffer, so no frame is copied.
+class ImageWriter
+{
+public:
+	// Up to max_pending frames wait in the queue before Submit blocks, which bounds the memory in flight
+	ImageWriter(unsigned int threads = 2, size_t max_pending = 2);
+	~ImageWriter();
+
+	void Submit(ImageJob job);
+	// Storage of an already written frame if there is one, resized to pixel_count and cleared to black
+	std::vector<float3> AcquireBuffer(size_t pixel_count);
+	// Waits for every submitted frame, returns how many of them failed to write
+	size_t Flush();
+
+protected:
+	void Work();
+
+	std::vector<std::thread> workers;
+	std::deque<ImageJob> queue;
+	std::vector<std::vector<float3>> free_buffers;
+	size_t max_pending;
+	size_t in_progress = 0;
+	size_t failures = 0;
+	bool stopping = false;
+
+	std::mutex mutex;
+	std::condition_variable work_available;
+	std::condition_variable slot_available;
+	std::condition_variable idle;
+};
@@ -0,0 +1,41 @@
+#include "kernels.h"
+
+#include <atomic>
+
+// Defined by kernels_<isa>.cpp
+const KernelTable &GenericKernels();
+const KernelTable &SSE42Kernels();
+const KernelTable &AVX2Kernels();
+const KernelTable &AVX512Kernels();
+
+static std::atomic<const KernelTable *> selected_kernels {nullptr};
+
+const KernelTable &KernelsFor(CpuIsa isa) {
+	switch (isa) {
+		case CpuIsa::SSE42:
+			return SSE42Kernels();
+		case CpuIsa::AVX2:
+			return AVX2Kernels();
+		case CpuIsa::AVX512:
+			return AVX512Kernels();
+		default:
+			return GenericKernels();
+	}
+}
+
+const KernelTable &Kernels() {
+	const KernelTable *kernels = selected_kernels.load(std::memory_order_relaxed);
+	if (!kernels) {
+		kernels = &KernelsFor(DetectCpuIsa());
+		selected_kernels.store(kernels, std::memory_order_relaxed);
+	}
+	return *kernels;
+}
+
+bool SelectKernels(CpuIsa isa) {
+	if (!CpuSupports(isa)) {
+		return false;
+	}
+	selected_kernels.store(&KernelsFor(isa), std::memory_order_relaxed);
+	return true;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "cpu_features.h"
+
+#include <cstddef>
+
+// Hot loops compiled once per instruction set (kernels_generic.cpp, kernels_sse42.cpp, kernels_avx2.cpp and
+// kernels_avx512.cpp, all built from kernels_impl.h) and picked at run time, so one binary uses the widest
+// vectors of the node it runs on. The interface is plain floats: linalg is inline templates, and an inline
+// function instantiated in an AVX-512 translation unit could be kept by the linker for every caller.
+
+// Triangles as structure of arrays, the first vertex and the edges to the other two, see PackedTriangles
+class TriangleBatch
+{
+public:
+	const float* ax;
+	const float* ay;
+	const float* az;
+	const float* bax;
+	const float* bay;
+	const float* baz;
+	const float* cax;
+	const float* cay;
+	const float* caz;
+	size_t count;
+};
+
+// Mesh bounds at time 0 and their motion over the frame, see PackedBoxes
+class BoxBatch
+{
+public:
+	const float* min_x;
+	const float* min_y;
+	const float* min_z;
+	const float* max_x;
+	const float* max_y;
+	const float* max_z;
+	const float* motion_x;
+	const float* motion_y;
+	const float* motion_z;
+	size_t count;
+};
+
+class KernelRay
+{
+public:
+	float position[3];
+	float direction[3];
+};
+
+enum KernelToneMap {
+	KERNEL_TONEMAP_CLAMP,
+	KERNEL_TONEMAP_REINHARD,
+	KERNEL_TONEMAP_ACES
+};
+
+// Every variant returns bit for bit what the scalar code returns: the same operations in the same order,
+// with floating-point contraction off so the FMA variants do not fuse them.
+class KernelTable
+{
+public:
+	CpuIsa isa;
+	// Moller-Trumbore over the batch, closest hit in (t_min, t), the first of equal hits wins as in
+	// Mesh::Intersect. Returns its index and updates t, u and v, or returns -1 and leaves them.
+	int (*closest_triangle)(const TriangleBatch& triangles, const KernelRay& ray, float t_min, float& t, float& u, float& v);
+	// First triangle of the batch hit in (t_min, max_t), its index and t, or -1
+	int (*any_triangle)(const TriangleBatch& triangles, const KernelRay& ray, float t_min, float max_t, float& t);
+	// Slab test of each box moved by its motion * time, as Mesh::AABBTest, hits[i] is 1 or 0
+	void (*box_tests)(const BoxBatch& boxes, const KernelRay& ray, float time, unsigned char* hits);
+	// ToneMap of count interleaved channels
+	void (*tone_map)(const float* hdr, unsigned char* ldr, size_t count, KernelToneMap tone_map, float exposure, float gamma);
+};
+
+// Kernels of the best instruction set the CPU supports, unless SelectKernels chose others
+const KernelTable& Kernels();
+// Uses the kernels of isa from now on, false when the CPU does not support it. Not synchronized with
+// threads running kernels, call it between frames.
+bool SelectKernels(CpuIsa isa);
+// Kernels of one instruction set whether or not the CPU supports it, for benchmarks
+const KernelTable& KernelsFor(CpuIsa isa);
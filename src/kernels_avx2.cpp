@@ -0,0 +1,12 @@
+// Kernels built with AVX2 and FMA
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__AVX2__)
+#error "kernels_avx2.cpp must be compiled with -mavx2 -mfma, see Premake5.lua"
+#endif
+
+#define KERNEL_TABLE_ISA CpuIsa::AVX2
+#include "kernels_impl.h"
+
+const KernelTable &AVX2Kernels() {
+	return kernel_table;
+}
@@ -0,0 +1,12 @@
+// Kernels built with AVX-512
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__AVX512F__)
+#error "kernels_avx512.cpp must be compiled with -mavx512f, see Premake5.lua"
+#endif
+
+#define KERNEL_TABLE_ISA CpuIsa::AVX512
+#include "kernels_impl.h"
+
+const KernelTable &AVX512Kernels() {
+	return kernel_table;
+}
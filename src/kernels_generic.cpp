@@ -0,0 +1,8 @@
+// Kernels built with the compiler's baseline, SSE2 on x64, and the only ones on other architectures
+
+#define KERNEL_TABLE_ISA CpuIsa::Generic
+#include "kernels_impl.h"
+
+const KernelTable &GenericKernels() {
+	return kernel_table;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+// Bodies of the kernels, included once by each kernels_<isa>.cpp which defines KERNEL_TABLE_ISA and is
+// compiled with that instruction set. Everything here has internal linkage and calls no inline library code
+// (powf is the C library's), so no function built for a wider instruction set can leak to the other units.
+
+#include "kernels.h"
+
+#include <math.h>
+
+// GCC ignores the standard pragma, it gets -ffp-contract=off from Premake5.lua instead
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(_MSC_VER)
+#pragma fp_contract(off)
+#endif
+
+// Triangles tested before the hits are scanned, small enough for the results to stay in L1
+static const size_t kernel_block = 64;
+
+// Triangle::IntersectMollerTrumbore without branches, t is -1 on a miss
+static inline void IntersectTriangles(const TriangleBatch &triangles, size_t start, size_t count, const KernelRay &ray,
+	float *__restrict t, float *__restrict u, float *__restrict v) {
+	const float dx = ray.direction[0], dy = ray.direction[1], dz = ray.direction[2];
+	const float ox = ray.position[0], oy = ray.position[1], oz = ray.position[2];
+	const float *__restrict ax = triangles.ax + start;
+	const float *__restrict ay = triangles.ay + start;
+	const float *__restrict az = triangles.az + start;
+	const float *__restrict bax = triangles.bax + start;
+	const float *__restrict bay = triangles.bay + start;
+	const float *__restrict baz = triangles.baz + start;
+	const float *__restrict cax = triangles.cax + start;
+	const float *__restrict cay = triangles.cay + start;
+	const float *__restrict caz = triangles.caz + start;
+
+	for (size_t i = 0; i < count; i++) {
+		const float px = dy * caz[i] - dz * cay[i];
+		const float py = dz * cax[i] - dx * caz[i];
+		const float pz = dx * cay[i] - dy * cax[i];
+		const float det = bax[i] * px + bay[i] * py + baz[i] * pz;
+
+		const float tx = ox - ax[i];
+		const float ty = oy - ay[i];
+		const float tz = oz - az[i];
+		const float hitU = (tx * px + ty * py + tz * pz) / det;
+
+		const float qx = ty * baz[i] - tz * bay[i];
+		const float qy = tz * bax[i] - tx * baz[i];
+		const float qz = tx * bay[i] - ty * bax[i];
+		const float hitV = (dx * qx + dy * qy + dz * qz) / det;
+		const float hitT = (cax[i] * qx + cay[i] * qy + caz[i] * qz) / det;
+
+		// The nearest floats to +-1e-8, so the bounds match the scalar test's comparison in double.
+		// Bitwise operators, short-circuiting ones would branch and stop the loop from vectorizing.
+		const bool parallel = (det >= -1e-8f) & (det <= 1e-8f);
+		const bool outside = (hitU < 0.0f) | (hitU > 1.0f) | (hitV < 0.0f) | (hitU + hitV > 1.0f);
+		t[i] = parallel | outside ? -1.0f : hitT;
+		u[i] = hitU;
+		v[i] = hitV;
+	}
+}
+
+static int ClosestTriangle(const TriangleBatch &triangles, const KernelRay &ray, float t_min, float &t, float &u, float &v) {
+	float blockT[kernel_block], blockU[kernel_block], blockV[kernel_block];
+	int found = -1;
+	for (size_t start = 0; start < triangles.count; start += kernel_block) {
+		const size_t count = triangles.count - start < kernel_block ? triangles.count - start : kernel_block;
+		IntersectTriangles(triangles, start, count, ray, blockT, blockU, blockV);
+		for (size_t i = 0; i < count; i++) {
+			if (blockT[i] < t && blockT[i] > t_min) {
+				t = blockT[i];
+				u = blockU[i];
+				v = blockV[i];
+				found = static_cast<int>(start + i);
+			}
+		}
+	}
+	return found;
+}
+
+static int AnyTriangle(const TriangleBatch &triangles, const KernelRay &ray, float t_min, float max_t, float &t) {
+	float blockT[kernel_block], blockU[kernel_block], blockV[kernel_block];
+	for (size_t start = 0; start < triangles.count; start += kernel_block) {
+		const size_t count = triangles.count - start < kernel_block ? triangles.count - start : kernel_block;
+		IntersectTriangles(triangles, start, count, ray, blockT, blockU, blockV);
+		for (size_t i = 0; i < count; i++) {
+			if (blockT[i] < max_t && blockT[i] > t_min) {
+				t = blockT[i];
+				return static_cast<int>(start + i);
+			}
+		}
+	}
+	return -1;
+}
+
+// linalg's min and max, which keep the second argument when the comparison fails
+static inline float KernelMin(float a, float b) {
+	return a < b ? a : b;
+}
+
+static inline float KernelMax(float a, float b) {
+	return a < b ? b : a;
+}
+
+static void BoxTests(const BoxBatch &boxes, const KernelRay &ray, float time, unsigned char *__restrict hits) {
+	const float px = ray.position[0], py = ray.position[1], pz = ray.position[2];
+	const float invX = 1.0f / ray.direction[0];
+	const float invY = 1.0f / ray.direction[1];
+	const float invZ = 1.0f / ray.direction[2];
+	// Locals, as hits may alias anything and would otherwise force a reload of the batch every iteration
+	const float *__restrict minX = boxes.min_x;
+	const float *__restrict minY = boxes.min_y;
+	const float *__restrict minZ = boxes.min_z;
+	const float *__restrict maxX = boxes.max_x;
+	const float *__restrict maxY = boxes.max_y;
+	const float *__restrict maxZ = boxes.max_z;
+	const float *__restrict motionX = boxes.motion_x;
+	const float *__restrict motionY = boxes.motion_y;
+	const float *__restrict motionZ = boxes.motion_z;
+	const size_t count = boxes.count;
+
+	for (size_t i = 0; i < count; i++) {
+		const float ox = px - motionX[i] * time;
+		const float oy = py - motionY[i] * time;
+		const float oz = pz - motionZ[i] * time;
+
+		const float t0x = (maxX[i] - ox) * invX;
+		const float t0y = (maxY[i] - oy) * invY;
+		const float t0z = (maxZ[i] - oz) * invZ;
+		const float t1x = (minX[i] - ox) * invX;
+		const float t1y = (minY[i] - oy) * invY;
+		const float t1z = (minZ[i] - oz) * invZ;
+
+		const float enter = KernelMax(KernelMax(KernelMin(t0x, t1x), KernelMin(t0y, t1y)), KernelMin(t0z, t1z));
+		const float exit = KernelMin(KernelMin(KernelMax(t0x, t1x), KernelMax(t0y, t1y)), KernelMax(t0z, t1z));
+		hits[i] = enter <= exit ? 1 : 0;
+	}
+}
+
+// One operator per loop, so the body stays branch free and vectorizes
+template <KernelToneMap Operator>
+static void ToneMapChannels(const float *__restrict hdr, unsigned char *__restrict ldr, size_t count, float exposure, float gamma) {
+	const bool applyGamma = gamma != 1.0f;
+	for (size_t i = 0; i < count; i++) {
+		const float x = hdr[i] * exposure;
+		float value = x;
+		if (Operator == KERNEL_TONEMAP_REINHARD) {
+			value = x / (1.0f + x);
+		} else if (Operator == KERNEL_TONEMAP_ACES) {
+			// Narkowicz's fit of the ACES filmic curve
+			value = (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+		}
+		value = 0.0f < value ? value : 0.0f;
+		value = value < 1.0f ? value : 1.0f;
+		if (applyGamma) {
+			value = powf(value, gamma);
+		}
+		ldr[i] = static_cast<unsigned char>(value * 255);
+	}
+}
+
+static void ToneMap(const float *hdr, unsigned char *ldr, size_t count, KernelToneMap tone_map, float exposure, float gamma) {
+	switch (tone_map) {
+		case KERNEL_TONEMAP_REINHARD:
+			ToneMapChannels<KERNEL_TONEMAP_REINHARD>(hdr, ldr, count, exposure, gamma);
+			break;
+		case KERNEL_TONEMAP_ACES:
+			ToneMapChannels<KERNEL_TONEMAP_ACES>(hdr, ldr, count, exposure, gamma);
+			break;
+		default:
+			ToneMapChannels<KERNEL_TONEMAP_CLAMP>(hdr, ldr, count, exposure, gamma);
+			break;
+	}
+}
+
+static const KernelTable kernel_table = {KERNEL_TABLE_ISA, ClosestTriangle, AnyTriangle, BoxTests, ToneMap};
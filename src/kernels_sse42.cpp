@@ -0,0 +1,12 @@
+// Kernels built with SSE4.2. MSVC has no switch for it and builds this unit with its SSE2 baseline.
+
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(__SSE4_2__)
+#error "kernels_sse42.cpp must be compiled with -msse4.2, see Premake5.lua"
+#endif
+
+#define KERNEL_TABLE_ISA CpuIsa::SSE42
+#include "kernels_impl.h"
+
+const KernelTable &SSE42Kernels() {
+	return kernel_table;
+}
@@ -5,11 +5,12 @@
 
 #include <algorithm>
 
-Lighting::Lighting(short width, short height) : MTAlgorithm(width, height) {}
+Lighting::Lighting(int width, int height) : MTAlgorithm(width, height) {}
 
 Lighting::~Lighting() {}
 
 int Lighting::LoadGeometry(std::string filename) {
+	ProfileScope profile("load");
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
@@ -31,9 +32,32 @@ int Lighting::LoadGeometry(std::string filename) {
 	}
 
 	if (!ret) {
-		exit(1);
+		return -1;
 	}
 
+	size_t faceCount = 0;
+	for (const auto &shape : shapes) {
+		faceCount += shape.mesh.num_face_vertices.size();
+	}
+	if (OverBudget(faceCount * (sizeof(MaterialTriangle) + sizeof(MaterialTriangle *)))) {
+		std::cerr << filename << " does not fit the memory budget" << std::endl;
+		return memory_budget_exceeded;
+	}
+
+	// Compile every MTL entry into a BSDF record once, triangles only keep an index
+	size_t materialOffset = this->materials.size();
+	for (auto const &material : materials) {
+		Material compiled(material.illum, float3 {material.emission}, float3 {material.ambient},
+			float3 {material.diffuse}, float3 {material.specular}, material.shininess, material.ior);
+		if (!material.diffuse_texname.empty()) {
+			compiled.diffuse_texture = texture_cache.AddTexture(dir + "/" + material.diffuse_texname);
+		}
+		this->materials.push_back(compiled);
+	}
+	// Faces without a material, or a model without an MTL file, get a neutral grey Lambert
+	const size_t defaultMaterial = this->materials.size();
+	this->materials.push_back(Material());
+
 	// Loop over shapes
 	for (size_t s = 0; s < shapes.size(); s++) {
 		// Loop over faces(polygon)
@@ -50,9 +74,6 @@ int Lighting::LoadGeometry(std::string filename) {
 				tinyobj::real_t vy = attrib.vertices[3 * idx.vertex_index + 1];
 				tinyobj::real_t vz = attrib.vertices[3 * idx.vertex_index + 2];
 
-				// tinyobj::real_t tx = attrib.texcoords[2 * idx.texcoord_index + 0];
-				// tinyobj::real_t ty = attrib.texcoords[2 * idx.texcoord_index + 1];
-
 				if (idx.normal_index >= 0) {
 					tinyobj::real_t nx = attrib.normals[3 * idx.normal_index + 0];
 					tinyobj::real_t ny = attrib.normals[3 * idx.normal_index + 1];
@@ -62,6 +83,12 @@ int Lighting::LoadGeometry(std::string filename) {
 					vertices.push_back(Vertex(float3 {vx, vy, vz}));
 				}
 
+				if (idx.texcoord_index >= 0) {
+					tinyobj::real_t tx = attrib.texcoords[2 * idx.texcoord_index + 0];
+					tinyobj::real_t ty = attrib.texcoords[2 * idx.texcoord_index + 1];
+					vertices.back().tex = float3 {tx, ty, 0.0f};
+				}
+
 				// Optional: vertex colors
 				// tinyobj::real_t red = attrib.colors[3*idx.vertex_index+0];
 				// tinyobj::real_t green = attrib.colors[3*idx.vertex_index+1];
@@ -71,15 +98,9 @@ int Lighting::LoadGeometry(std::string filename) {
 
 			MaterialTriangle *triangle = new MaterialTriangle(vertices[0], vertices[1], vertices[2]);
 
-			int materialId = shapes[s].mesh.material_ids[f];
-			tinyobj::material_t material = materials[materialId];
-			triangle->SetEmisive(float3 {material.emission});
-			triangle->SetAmbient(float3 {material.ambient});
-			triangle->SetDiffuse(float3 {material.diffuse});
-			triangle->SetSpecular(float3 {material.specular}, material.shininess);
-			triangle->SetReflectiveness(material.illum == 5);
-			triangle->SetReflectivenessAndTransparency(material.illum == 7);
-			triangle->SetIor(material.ior);
+			const int materialId = shapes[s].mesh.material_ids[f];
+			triangle->SetMaterial(static_cast<unsigned int>(materialId < 0 ? defaultMaterial : materialOffset + materialId));
+			triangle->SetPrimitiveId(primitive_count++);
 
 			material_objects.push_back(triangle);
 
@@ -91,11 +112,42 @@ int Lighting::LoadGeometry(std::string filename) {
 	return 0;
 }
 
+void Lighting::SetMemoryBudget(size_t budget_bytes) {
+	MTAlgorithm::SetMemoryBudget(budget_bytes);
+	texture_cache.SetBudget(budget_bytes ? std::min(TextureCache::default_budget, budget_bytes / 4) : TextureCache::default_budget);
+}
+
+void Lighting::AccountMemory(MemoryReport &report) const {
+	MTAlgorithm::AccountMemory(report);
+	report.Add(MEMORY_GEOMETRY, VectorBytes(material_objects) + material_objects.size() * sizeof(MaterialTriangle));
+	report.Add(MEMORY_MATERIALS, VectorBytes(materials));
+	report.Add(MEMORY_TEXTURES, texture_cache.ResidentBytes());
+}
+
 void Lighting::AddLight(Light *light) {
 	lights.push_back(light);
+	scene_lights.push_back(light);
+}
+
+void Lighting::ApplyView(const RenderView &view) {
+	RayGenerationApp::ApplyView(view);
+
+	view_lights.clear();
+	if (view.lights.empty()) {
+		lights = scene_lights;
+		return;
+	}
+
+	lights.clear();
+	for (const auto &light : view.lights) {
+		view_lights.emplace_back(new Light(light.position, light.color));
+		lights.push_back(view_lights.back().get());
+	}
 }
 
 Payload Lighting::TraceRay(const Ray &ray, const unsigned int max_raytrace_depth) const {
+	RAY_STAT(RayStatistics::CountDepth(raytracing_depth - max_raytrace_depth));
+	RayCapture::Record(ray.position, ray.direction, ray.spread, ray.cone_width, ray.time, t_max, CAPTURE_CLOSEST, raytracing_depth - max_raytrace_depth);
 	IntersectableData closestData(t_max);
 	MaterialTriangle *closestTriangle = nullptr;
 	for (auto &object : material_objects) {
@@ -114,31 +166,66 @@ Payload Lighting::TraceRay(const Ray &ray, const unsigned int max_raytrace_depth
 }
 
 
-Payload Lighting::Hit(const Ray &ray, const IntersectableData &data, const MaterialTriangle *triangle) const {
-	if (triangle == nullptr) {
+Payload Lighting::Hit(const Ray &ray, const IntersectableData &data, const MaterialSurface *surface) const {
+	if (surface == nullptr) {
 		return Miss(ray);
 	}
 
+	const Material &material = materials[surface->material_id];
+
 	Payload payload;
-	payload.color = triangle->emissive_color;
+	payload.color = material.emissive_color;
 
 	float3 x = ray.position + ray.direction * data.t;
-	float3 normal = triangle->GetNormal(data.baricentric);
-
-	for (auto const &light : lights) {
-		Ray toLight(x, light->position - x);
+	float3 normal = surface->GetNormal(data.baricentric);
+	WriteAOVs(ray, data, surface, material);
 
-		payload.color += light->color * triangle->diffuse_color
-			* std::max(0.0f, linalg::dot(normal, toLight.direction));
+	float3 albedo = GetAlbedo(ray, data, surface, material);
+	for (size_t i = 0; i < lights.size(); i++) {
+		Ray toLight(x, lights[i]->position - x);
 
-		float3 reflectionDir = 2.0f * linalg::dot(normal, toLight.direction) * normal - toLight.direction;
-		payload.color += light->color * triangle->specular_color
-			* std::powf(std::max(0.0f, linalg::dot(ray.direction, reflectionDir)), triangle->specular_exponent);
+		float3 contribution = material.Evaluate(normal, ray.direction, toLight.direction, lights[i]->color, albedo);
+		if (ray.aov) {
+			ray.aov->SetLight(ray.aov_pixel, i, contribution);
+		}
+		payload.color += contribution;
 	}
 
 	return payload;
 }
 
+void Lighting::WriteAOVs(const Ray &ray, const IntersectableData &data, const MaterialSurface *surface, const Material &material) const {
+	if (ray.aov == nullptr) {
+		return;
+	}
+
+	AOVBuffer &aov = *ray.aov;
+	aov.Set(ray.aov_pixel, AOV_DEPTH, data.t);
+	aov.Set(ray.aov_pixel, AOV_NORMAL, surface->GetNormal(data.baricentric));
+	aov.Set(ray.aov_pixel, AOV_MATERIAL_ID, static_cast<float>(surface->material_id));
+	aov.Set(ray.aov_pixel, AOV_PRIMITIVE_ID, static_cast<float>(surface->primitive_id));
+	if (aov.Has(AOV_ALBEDO)) {
+		aov.Set(ray.aov_pixel, AOV_ALBEDO, GetAlbedo(ray, data, surface, material));
+	}
+}
+
+float3 Lighting::GetAlbedo(const Ray &ray, const IntersectableData &data, const MaterialSurface *surface, const Material &material) const {
+	if (material.diffuse_texture < 0) {
+		return material.diffuse_color;
+	}
+
+	// Width of the ray cone at the hit, stretched by the incidence angle and
+	// converted to texels through the surface's uv-to-world area ratio
+	float2 size = texture_cache.Size(material.diffuse_texture);
+	float cosIn = std::max(1e-3f, std::fabs(linalg::dot(ray.direction, surface->GetGeometricNormal(data.baricentric))));
+	float footprint = ray.ConeWidth(data.t) / cosIn;
+	float texels = footprint * std::sqrt(surface->GetTexCoordAreaRatio() * size.x * size.y);
+	float lod = texels > 1.0f ? std::log2(texels) : 0.0f;
+
+	float4 texel = texture_cache.Sample(material.diffuse_texture, surface->GetTexCoord(data.baricentric), lod);
+	return material.diffuse_color * texel.xyz();
+}
+
 float3 MaterialTriangle::GetNormal(float3 barycentric) const {
 	if (linalg::length(a.normal) > 0.0f && linalg::length(b.normal) > 0.0f && linalg::length(c.normal) > 0.0f) {
 		return a.normal * barycentric.x
@@ -148,3 +235,16 @@ float3 MaterialTriangle::GetNormal(float3 barycentric) const {
 
 	return geo_normal;
 }
+
+float2 MaterialTriangle::GetTexCoord(float3 barycentric) const {
+	float3 tex = a.tex * barycentric.x
+		+ b.tex * barycentric.y
+		+ c.tex * barycentric.z;
+	return float2 {tex.x, tex.y};
+}
+
+float MaterialTriangle::GetTexCoordAreaRatio() const {
+	float worldArea = linalg::length(linalg::cross(ba, ca));
+	float texArea = std::fabs(linalg::cross(b.tex - a.tex, c.tex - a.tex).z);
+	return worldArea > 0.0f ? texArea / worldArea : 0.0f;
+}
@@ -1,35 +1,44 @@
 #pragma once
 
 #include "mt_algorithm.h"
+#include "material.h"
+#include "texture.h"
 
-class MaterialTriangle : public Triangle
+// Shading interface shared by triangles and analytic primitives.
+// The barycentric argument is whatever the primitive's Intersect put in IntersectableData.
+class MaterialSurface
+{
+public:
+	virtual ~MaterialSurface() {};
+
+	void SetMaterial(unsigned int id) { material_id = id; };
+	void SetPrimitiveId(unsigned int id) { primitive_id = id; };
+
+	virtual float3 GetNormal(float3 barycentric) const = 0;
+	virtual float3 GetGeometricNormal(float3 barycentric) const = 0;
+	virtual float3 GetHitPoint(float3 barycentric, float3& error) const = 0;
+	virtual float2 GetTexCoord(float3 barycentric) const = 0;
+	virtual float GetTexCoordAreaRatio() const = 0;
+
+	unsigned int material_id = 0;
+	// Scene-wide index, only reported through the primitive ID AOV
+	unsigned int primitive_id = 0;
+};
+
+class MaterialTriangle : public Triangle, public MaterialSurface
 {
 public:
 	MaterialTriangle(Vertex a, Vertex b, Vertex c) : Triangle(a, b, c) { geo_normal = normalize(cross(ba, ca)); };
 	MaterialTriangle() { };
 	virtual ~MaterialTriangle() {};
 
-	void SetEmisive(float3 emissive) { emissive_color = emissive; };
-	void SetAmbient(float3 ambient) { ambient_color = ambient; };
-	void SetDiffuse(float3 diffuse) { diffuse_color = diffuse; };
-	void SetSpecular(float3 color, float shininess) { specular_color = color; specular_exponent = shininess; };
-	void SetReflectiveness(bool reflective) { reflectiveness = reflective; };
-	void SetReflectivenessAndTransparency(bool reflective_and_transparent) { reflectiveness_and_transparency = reflective_and_transparent; };
-	void SetIor(float in_ior) { ior = in_ior; };
-
 	float3 GetNormal(float3 barycentric) const;
+	float3 GetGeometricNormal(float3) const { return geo_normal; };
+	float3 GetHitPoint(float3 barycentric, float3& error) const { return Triangle::GetHitPoint(barycentric, error); };
+	float2 GetTexCoord(float3 barycentric) const;
+	float GetTexCoordAreaRatio() const;
 
 	float3 geo_normal;
-
-	float3 emissive_color;
-	float3 ambient_color;
-	float3 diffuse_color;
-	float3 specular_color;
-	float specular_exponent;
-	float ior;
-
-	bool reflectiveness = false;
-	bool reflectiveness_and_transparency = false;
 };
 
 class Light
@@ -45,16 +54,30 @@ public:
 class Lighting : public MTAlgorithm
 {
 public:
-	Lighting(short width, short height);
+	Lighting(int width, int height);
 	virtual ~Lighting();
 
 	virtual int LoadGeometry(std::string filename);
 
 	virtual void AddLight(Light* light);
+	// Also caps the texture cache to a quarter of the budget, tiles are paged in again on demand
+	virtual void SetMemoryBudget(size_t budget_bytes);
 protected:
+	virtual void ApplyView(const RenderView& view);
 	virtual Payload TraceRay(const Ray& ray, const unsigned int max_raytrace_depth) const;
-	virtual Payload Hit(const Ray& ray, const IntersectableData& data, const MaterialTriangle* traingle) const;
+	virtual Payload Hit(const Ray& ray, const IntersectableData& data, const MaterialSurface* surface) const;
+	float3 GetAlbedo(const Ray& ray, const IntersectableData& data, const MaterialSurface* surface, const Material& material) const;
+	// Fills the hit's AOVs when the ray carries a buffer, a no-op for secondary rays
+	void WriteAOVs(const Ray& ray, const IntersectableData& data, const MaterialSurface* surface, const Material& material) const;
+	size_t AOVLightCount() const { return lights.size(); };
+	virtual void AccountMemory(MemoryReport& report) const;
 
 	std::vector<MaterialTriangle*> material_objects;
+	std::vector<Material> materials;
+	TextureCache texture_cache;
 	std::vector<Light*> lights;
+	// Lights holds either these, added with AddLight, or the ones of the current view
+	std::vector<Light*> scene_lights;
+	std::vector<std::unique_ptr<Light>> view_lights;
+	unsigned int primitive_count = 0;
 };
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "material.h"
+
+#include <algorithm>
+#include <cmath>
+
+Material::Material() :
+	Material(2, float3 {0, 0, 0}, float3 {0, 0, 0}, float3 {0.5f, 0.5f, 0.5f}, float3 {0, 0, 0}, 1.0f, 1.0f) {}
+
+Material::Material(int illum, float3 emissive, float3 ambient, float3 diffuse, float3 specular, float shininess, float ior) :
+	emissive_color(emissive),
+	ambient_color(ambient),
+	diffuse_color(diffuse),
+	specular_color(specular),
+	specular_exponent(shininess),
+	ior(ior) {
+	if (illum == 5) {
+		type = BSDFType::Mirror;
+	} else if (illum == 7) {
+		type = BSDFType::Dielectric;
+	} else if (specular == float3 {0, 0, 0}) {
+		type = BSDFType::Lambert;
+	} else {
+		type = BSDFType::Phong;
+	}
+
+	emitter = emissive_color > float3 {0, 0, 0};
+
+	integral_exponent = -1;
+	if (shininess >= 0.0f && shininess <= 4096.0f && std::floor(shininess) == shininess) {
+		integral_exponent = static_cast<int>(shininess);
+	}
+}
+
+float3 Material::Evaluate(const float3 &normal, const float3 &view_dir, const float3 &to_light, const float3 &light_color) const {
+	return Evaluate(normal, view_dir, to_light, light_color, diffuse_color);
+}
+
+float3 Material::Evaluate(const float3 &normal, const float3 &view_dir, const float3 &to_light, const float3 &light_color, const float3 &albedo) const {
+	float cosIn = linalg::dot(normal, to_light);
+	float3 color = light_color * albedo * std::max(0.0f, cosIn);
+
+	switch (type) {
+		case BSDFType::Lambert:
+			return color;
+		case BSDFType::Phong:
+		case BSDFType::Mirror:
+		case BSDFType::Dielectric:
+		default:
+		{
+			float3 reflectionDir = 2.0f * cosIn * normal - to_light;
+			return color + light_color * specular_color
+				* SpecularPower(std::max(0.0f, linalg::dot(view_dir, reflectionDir)));
+		}
+	}
+}
+
+float Material::SpecularPower(float cos_alpha) const {
+	if (integral_exponent < 0) {
+		return std::pow(cos_alpha, specular_exponent);
+	}
+
+	// Exponentiation by squaring: at most 2 * log2(exponent) multiplies
+	float result = 1.0f;
+	float base = cos_alpha;
+	for (int e = integral_exponent; e > 0; e >>= 1) {
+		if (e & 1) {
+			result *= base;
+		}
+		base *= base;
+	}
+	return result;
+}
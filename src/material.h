@@ -0,0 +1,42 @@
+#pragma once
+
+#include "linalg.h"
+using namespace linalg::aliases;
+
+enum class BSDFType : unsigned char {
+	Lambert,
+	Phong,
+	Mirror,
+	Dielectric
+};
+
+class Material
+{
+public:
+	Material();
+	Material(int illum, float3 emissive, float3 ambient, float3 diffuse, float3 specular, float shininess, float ior);
+	~Material() {};
+
+	// Diffuse + specular response to a single light, classified at load time
+	float3 Evaluate(const float3 &normal, const float3 &view_dir, const float3 &to_light, const float3 &light_color) const;
+	float3 Evaluate(const float3 &normal, const float3 &view_dir, const float3 &to_light, const float3 &light_color, const float3 &albedo) const;
+	float SpecularPower(float cos_alpha) const;
+
+	BSDFType type;
+
+	float3 emissive_color;
+	float3 ambient_color;
+	float3 diffuse_color;
+	float3 specular_color;
+	float specular_exponent;
+	float ior;
+
+	// Index in the TextureCache, -1 when the material is untextured
+	int diffuse_texture = -1;
+
+	bool emitter;
+
+protected:
+	// Exponent as an integer when it is integral, -1 otherwise
+	int integral_exponent;
+};
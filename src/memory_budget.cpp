@@ -0,0 +1,69 @@
+#include "memory_budget.h"
+
+#include <iomanip>
+#include <sstream>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "Psapi.lib")
+#elif defined(__linux__)
+#include <fstream>
+#include <unistd.h>
+#endif
+
+static const char *category_names[MEMORY_CATEGORY_COUNT] = {"geometry", "materials", "textures", "acceleration", "frame", "history"};
+
+size_t MemoryReport::Total() const {
+	size_t total = 0;
+	for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+		total += bytes[i];
+	}
+	return total;
+}
+
+void MemoryReport::Print(std::ostream &stream) const {
+	const std::ios_base::fmtflags flags = stream.flags();
+	stream << std::fixed << std::setprecision(2);
+	for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+		stream << std::left << std::setw(14) << category_names[i] << std::right << std::setw(12) << bytes[i] / (1024.0 * 1024.0) << " MB\n";
+	}
+	stream << std::left << std::setw(14) << "total" << std::right << std::setw(12) << Total() / (1024.0 * 1024.0) << " MB\n";
+	const size_t resident = ProcessResidentBytes();
+	if (resident) {
+		stream << std::left << std::setw(14) << "resident" << std::right << std::setw(12) << resident / (1024.0 * 1024.0) << " MB\n";
+	}
+	stream.flags(flags);
+}
+
+std::string MemoryReport::ToJSON() const {
+	std::ostringstream json;
+	json << "{";
+	for (int i = 0; i < MEMORY_CATEGORY_COUNT; i++) {
+		json << "\"" << category_names[i] << "\": " << bytes[i] << ", ";
+	}
+	json << "\"total\": " << Total() << ", \"resident\": " << ProcessResidentBytes() << "}";
+	return json.str();
+}
+
+size_t ProcessResidentBytes() {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.WorkingSetSize;
+	}
+	return 0;
+#elif defined(__linux__)
+	std::ifstream statm("/proc/self/statm");
+	size_t total = 0, resident = 0;
+	if (statm >> total >> resident) {
+		return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	}
+	return 0;
+#else
+	return 0;
+#endif
+}
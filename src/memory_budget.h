@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+enum MemoryCategory {
+	// Triangles, spheres, quads and their simplified levels
+	MEMORY_GEOMETRY,
+	MEMORY_MATERIALS,
+	// Resident texture tiles and the blue noise
+	MEMORY_TEXTURES,
+	// Bounding volume hierarchy, including the meshes it holds
+	MEMORY_ACCELERATION,
+	// Frame buffer, AOVs and the per-pixel cost and mask
+	MEMORY_FRAME,
+	// Temporal accumulation and the G-buffers
+	MEMORY_HISTORY,
+	MEMORY_CATEGORY_COUNT
+};
+
+// Bytes held by each subsystem, as counted by RayGenerationApp::AccountMemory. Containers count their capacity,
+// allocator and heap overhead is not included, so the process footprint reads somewhat higher.
+class MemoryReport
+{
+public:
+	size_t bytes[MEMORY_CATEGORY_COUNT] = {};
+
+	void Add(MemoryCategory category, size_t amount) { bytes[category] += amount; };
+	size_t Total() const;
+	void Print(std::ostream& stream) const;
+	std::string ToJSON() const;
+};
+
+template <class T>
+size_t VectorBytes(const std::vector<T>& vector) {
+	return vector.capacity() * sizeof(T);
+}
+
+// Resident set size of the process, 0 where it cannot be read
+size_t ProcessResidentBytes();
@@ -7,6 +7,7 @@ Sphere::Sphere(float3 center, float radius) :
 Sphere::~Sphere() {}
 
 IntersectableData Sphere::Intersect(const Ray &ray) const {
+	RAY_STAT(RayStatistics::CountPrimitiveTest());
 	float3 oc = center - ray.position;
 	float a = linalg::dot(ray.direction, ray.direction);
 	float b = -2.0f * linalg::dot(oc, ray.direction);
@@ -29,11 +30,12 @@ IntersectableData Sphere::Intersect(const Ray &ray) const {
 
 
 
-MTAlgorithm::MTAlgorithm(short width, short height) : RayGenerationApp(width, height) {}
+MTAlgorithm::MTAlgorithm(int width, int height) : RayGenerationApp(width, height) {}
 
 MTAlgorithm::~MTAlgorithm() {}
 
 int MTAlgorithm::LoadGeometry(std::string filename) {
+	ProfileScope profile("load");
 	objects.push_back(new Sphere(float3 {2, 0, -1}, 0.4f));
 
 	Vertex a(float3 {-.5f, -.5f, -1.f});
@@ -79,6 +81,15 @@ Triangle::Triangle() :
 Triangle::~Triangle() = default;
 
 IntersectableData Triangle::Intersect(const Ray &ray) const {
+	RAY_STAT(RayStatistics::CountPrimitiveTest());
+#ifdef WATERTIGHT_INTERSECTION
+	return IntersectWatertight(ray);
+#else
+	return IntersectMollerTrumbore(ray);
+#endif
+}
+
+IntersectableData Triangle::IntersectMollerTrumbore(const Ray &ray) const {
 	float3 vP = cross(ray.direction, ca);
 	float det = linalg::dot(ba, vP);
 
@@ -101,3 +112,78 @@ IntersectableData Triangle::Intersect(const Ray &ray) const {
 	float t = linalg::dot(ca, vQ) / det;
 	return IntersectableData(t, float3 {1 - u - v, u, v});
 }
+
+IntersectableData Triangle::IntersectWatertight(const Ray &ray) const {
+#ifdef WATERTIGHT_INTERSECTION
+	const RayShear &shear = ray.watertight;
+#else
+	// Other builds only call this to compare the tests, so the ray does not carry its shear
+	const RayShear shear(ray.direction);
+#endif
+	float3 A = a.position - ray.position;
+	float3 B = b.position - ray.position;
+	float3 C = c.position - ray.position;
+
+	// Shear and scale the vertices into the ray's space, where the ray is the +z axis
+	float Ax = A[shear.kx] - shear.shear.x * A[shear.kz];
+	float Ay = A[shear.ky] - shear.shear.y * A[shear.kz];
+	float Bx = B[shear.kx] - shear.shear.x * B[shear.kz];
+	float By = B[shear.ky] - shear.shear.y * B[shear.kz];
+	float Cx = C[shear.kx] - shear.shear.x * C[shear.kz];
+	float Cy = C[shear.ky] - shear.shear.y * C[shear.kz];
+
+	float U = Cx * By - Cy * Bx;
+	float V = Ax * Cy - Ay * Cx;
+	float W = Bx * Ay - By * Ax;
+
+	// Exactly on an edge: redo the edge functions in double so neighbours agree on the sign
+	if (U == 0.0f || V == 0.0f || W == 0.0f) {
+		U = static_cast<float>(static_cast<double>(Cx) * By - static_cast<double>(Cy) * Bx);
+		V = static_cast<float>(static_cast<double>(Ax) * Cy - static_cast<double>(Ay) * Cx);
+		W = static_cast<float>(static_cast<double>(Bx) * Ay - static_cast<double>(By) * Ax);
+	}
+
+	if ((U < 0.0f || V < 0.0f || W < 0.0f) && (U > 0.0f || V > 0.0f || W > 0.0f)) {
+		return IntersectableData(-1.0f);
+	}
+
+	float det = U + V + W;
+	if (det == 0.0f) {
+		return IntersectableData(-1.0f);
+	}
+
+	float Az = shear.shear.z * A[shear.kz];
+	float Bz = shear.shear.z * B[shear.kz];
+	float Cz = shear.shear.z * C[shear.kz];
+	float T = U * Az + V * Bz + W * Cz;
+
+	float invDet = 1.0f / det;
+	return IntersectableData(T * invDet, float3 {U * invDet, V * invDet, W * invDet});
+}
+
+float3 Triangle::GetHitPoint(float3 barycentric, float3 &error) const {
+	float3 pa = barycentric.x * a.position;
+	float3 pb = barycentric.y * b.position;
+	float3 pc = barycentric.z * c.position;
+	error = ErrorGamma(7) * (linalg::abs(pa) + linalg::abs(pb) + linalg::abs(pc));
+	return pa + pb + pc;
+}
+
+float3 OffsetRayOrigin(const float3 &point, const float3 &error, const float3 &normal, const float3 &direction) {
+	float distance = linalg::dot(linalg::abs(normal), error);
+	float3 offset = distance * normal;
+	if (linalg::dot(direction, normal) < 0.0f) {
+		offset = -offset;
+	}
+
+	// Round away from the surface so the offset is not lost in the addition
+	float3 origin = point + offset;
+	for (int i = 0; i < 3; i++) {
+		if (offset[i] > 0.0f) {
+			origin[i] = std::nextafter(origin[i], std::numeric_limits<float>::infinity());
+		} else if (offset[i] < 0.0f) {
+			origin[i] = std::nextafter(origin[i], -std::numeric_limits<float>::infinity());
+		}
+	}
+	return origin;
+}
@@ -2,6 +2,7 @@
 
 #include "ray_generation.h"
 
+#include <limits>
 #include <vector>
 
 class IntersectableData {
@@ -11,6 +12,8 @@ public:
 	~IntersectableData() {};
 	float t;
 	float3 baricentric;
+	// Translation of a moving mesh at the ray's time, points rebuilt from baricentric need it added
+	float3 offset {0.0f, 0.0f, 0.0f};
 };
 
 class Intersectable {
@@ -51,7 +54,13 @@ public:
 	Triangle(Vertex a, Vertex b, Vertex c);
 	Triangle();
 	~Triangle();
+	// Moller-Trumbore by default, the watertight test in WATERTIGHT_INTERSECTION builds
 	IntersectableData Intersect(const Ray &ray) const;
+	IntersectableData IntersectMollerTrumbore(const Ray &ray) const;
+	IntersectableData IntersectWatertight(const Ray &ray) const;
+
+	// Hit point rebuilt from barycentrics, with a conservative bound on its rounding error
+	float3 GetHitPoint(float3 barycentric, float3 &error) const;
 
 	Vertex a;
 	Vertex b;
@@ -63,19 +72,40 @@ protected:
 
 
 
+// gamma(n) bound on the relative error of n floating-point operations (PBR 3rd ed., 3.9)
+inline float ErrorGamma(int n) {
+	const float epsilon = std::numeric_limits<float>::epsilon() * 0.5f;
+	return (n * epsilon) / (1 - n * epsilon);
+}
+
+// Moves a spawned ray origin out of the hit point's error box along the geometric normal,
+// on the side the new ray leaves towards, so it can't re-hit the surface it starts on
+float3 OffsetRayOrigin(const float3 &point, const float3 &error, const float3 &normal, const float3 &direction);
+
 class MTAlgorithm : public RayGenerationApp {
 public:
-	MTAlgorithm(short width, short height);
+	MTAlgorithm(int width, int height);
 	virtual ~MTAlgorithm();
 
 	virtual int LoadGeometry(std::string filename);
 
+	// Records every TraceRay and TraceShadowRay query until StopRayCapture, see RayCapture
+	bool StartRayCapture(std::string filename) const { return RayCapture::Start(filename, t_min, LODLevels()); };
+	size_t StopRayCapture() const { return RayCapture::Stop(); };
+	// Mesh LOD levels the scene was built with, none before AABB
+	virtual unsigned int LODLevels() const { return 0; };
+
 protected:
 	virtual Payload TraceRay(const Ray &ray, const unsigned int max_raytrace_depth) const;
 	virtual Payload Hit(const Ray &ray, const IntersectableData &t) const;
 
 	std::vector<Intersectable *> objects;
 
-	const float t_min = 0.01f;
+	// Not const so a replay can use the t_min its capture was recorded with
+#ifdef WATERTIGHT_INTERSECTION
+	float t_min = 0.0f;
+#else
+	float t_min = 0.01f;
+#endif
 	const float t_max = 1000.f;
 };
\ No newline at end of file
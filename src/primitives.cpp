@@ -0,0 +1,84 @@
+#include "primitives.h"
+
+#include <cmath>
+
+IntersectableData MaterialSphere::Intersect(const Ray &ray) const {
+	IntersectableData data = Sphere::Intersect(ray);
+	float3 point = ray.position + ray.direction * data.t;
+	return IntersectableData(data.t, (point - center) / radius);
+}
+
+float3 MaterialSphere::GetHitPoint(float3 barycentric, float3 &error) const {
+	// Reprojected onto the sphere, which bounds the error relative to the point itself
+	float3 point = center + barycentric * radius;
+	error = ErrorGamma(5) * linalg::abs(point);
+	return point;
+}
+
+float2 MaterialSphere::GetTexCoord(float3 barycentric) const {
+	const float pi = 3.14159265358979f;
+	float u = 0.5f + std::atan2(barycentric.z, barycentric.x) / (2.0f * pi);
+	float v = 0.5f + std::asin(std::max(-1.0f, std::min(1.0f, barycentric.y))) / pi;
+	return float2 {u, v};
+}
+
+float MaterialSphere::GetTexCoordAreaRatio() const {
+	const float pi = 3.14159265358979f;
+	return 1.0f / (4.0f * pi * radius * radius);
+}
+
+MaterialQuad::MaterialQuad(int axis, float offset, float2 min, float2 max, bool flip_normal) :
+	axis(axis), offset(offset), min(min), max(max) {
+	u_axis = (axis + 1) % 3;
+	v_axis = (axis + 2) % 3;
+	normal = float3 {0, 0, 0};
+	normal[axis] = flip_normal ? -1.0f : 1.0f;
+}
+
+IntersectableData MaterialQuad::Intersect(const Ray &ray) const {
+	RAY_STAT(RayStatistics::CountPrimitiveTest());
+	if (ray.direction[axis] == 0.0f) {
+		return IntersectableData(-1.0f);
+	}
+
+	float t = (offset - ray.position[axis]) / ray.direction[axis];
+	float u = ray.position[u_axis] + t * ray.direction[u_axis];
+	float v = ray.position[v_axis] + t * ray.direction[v_axis];
+	if (u < min.x || u > max.x || v < min.y || v > max.y) {
+		return IntersectableData(-1.0f);
+	}
+
+	return IntersectableData(t, float3 {(u - min.x) / (max.x - min.x), (v - min.y) / (max.y - min.y), 0.0f});
+}
+
+float3 MaterialQuad::GetHitPoint(float3 barycentric, float3 &error) const {
+	// The plane coordinate is exact, only the in-plane ones carry rounding error
+	float3 point;
+	point[axis] = offset;
+	point[u_axis] = min.x + barycentric.x * (max.x - min.x);
+	point[v_axis] = min.y + barycentric.y * (max.y - min.y);
+	error = ErrorGamma(3) * linalg::abs(point);
+	error[axis] = 0.0f;
+	return point;
+}
+
+float MaterialQuad::GetTexCoordAreaRatio() const {
+	float area = (max.x - min.x) * (max.y - min.y);
+	return area > 0.0f ? 1.0f / area : 0.0f;
+}
+
+float3 MaterialQuad::aabb_min() const {
+	float3 result;
+	result[axis] = offset;
+	result[u_axis] = min.x;
+	result[v_axis] = min.y;
+	return result;
+}
+
+float3 MaterialQuad::aabb_max() const {
+	float3 result;
+	result[axis] = offset;
+	result[u_axis] = max.x;
+	result[v_axis] = max.y;
+	return result;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "lighting.h"
+
+// Analytic sphere. Intersect stores the unit surface normal in IntersectableData::baricentric.
+class MaterialSphere : public Sphere, public MaterialSurface
+{
+public:
+	MaterialSphere(float3 center, float radius) : Sphere(center, radius) {};
+	virtual ~MaterialSphere() {};
+
+	IntersectableData Intersect(const Ray& ray) const;
+
+	float3 GetNormal(float3 barycentric) const { return barycentric; };
+	float3 GetGeometricNormal(float3 barycentric) const { return barycentric; };
+	float3 GetHitPoint(float3 barycentric, float3& error) const;
+	float2 GetTexCoord(float3 barycentric) const;
+	float GetTexCoordAreaRatio() const;
+
+	float3 aabb_min() const { return center - float3(radius); };
+	float3 aabb_max() const { return center + float3(radius); };
+};
+
+// Axis-aligned rectangle lying in the plane position[axis] = offset.
+// Intersect stores the (u, v) coordinates across the quad in IntersectableData::baricentric.
+class MaterialQuad : public Intersectable, public MaterialSurface
+{
+public:
+	MaterialQuad(int axis, float offset, float2 min, float2 max, bool flip_normal);
+	virtual ~MaterialQuad() {};
+
+	IntersectableData Intersect(const Ray& ray) const;
+
+	float3 GetNormal(float3) const { return normal; };
+	float3 GetGeometricNormal(float3) const { return normal; };
+	float3 GetHitPoint(float3 barycentric, float3& error) const;
+	float2 GetTexCoord(float3 barycentric) const { return float2 {barycentric.x, barycentric.y}; };
+	float GetTexCoordAreaRatio() const;
+
+	float3 aabb_min() const;
+	float3 aabb_max() const;
+
+protected:
+	int axis;
+	int u_axis;
+	int v_axis;
+	float offset;
+	float2 min;
+	float2 max;
+	float3 normal;
+};
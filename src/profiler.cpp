@@ -0,0 +1,299 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+class ProfileEvent
+{
+public:
+	const char* name;
+	unsigned int thread;
+	double start_us;
+	double duration_us;
+	bool counted;
+	CounterValues counters;
+};
+
+class PhaseTotals
+{
+public:
+	uint64_t calls = 0;
+	double total_us = 0.0;
+	double max_us = 0.0;
+	uint64_t counted_calls = 0;
+	CounterValues counters;
+};
+
+// Trace events stop being kept past this, the per-phase totals keep counting
+static const size_t max_events = 1 << 20;
+
+static std::mutex profiler_mutex;
+static const std::chrono::steady_clock::time_point profiler_start = std::chrono::steady_clock::now();
+static std::vector<ProfileEvent> events;
+// Keyed by the name's text, the same literal may have several addresses across translation units
+static std::map<std::string, PhaseTotals> phases;
+static size_t dropped_events = 0;
+
+static unsigned int ThreadNumber() {
+	static std::atomic<unsigned int> next {0};
+	thread_local unsigned int number = next++;
+	return number;
+}
+
+// Names of the scopes open on this thread, innermost last
+thread_local static std::vector<const char*> open_scopes;
+
+#ifdef __linux__
+class CounterGroup
+{
+public:
+	int fds[4] = {-1, -1, -1, -1};
+
+	~CounterGroup() {
+		for (int fd : fds) {
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+	}
+
+	bool Open() {
+		const uint64_t configs[4] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+		for (int i = 0; i < 4; i++) {
+			perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = configs[i];
+			attr.disabled = i == 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP;
+			// The calling thread on any CPU, the first counter leads the group so all four run together
+			fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0));
+			if (fds[i] < 0) {
+				return false;
+			}
+		}
+		ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		return true;
+	}
+
+	CounterValues Read() const {
+		uint64_t values[1 + 4] = {};
+		CounterValues result;
+		if (read(fds[0], values, sizeof(values)) == static_cast<ssize_t>(sizeof(values)) && values[0] == 4) {
+			result.cycles = values[1];
+			result.instructions = values[2];
+			result.cache_misses = values[3];
+			result.branch_misses = values[4];
+		}
+		return result;
+	}
+};
+
+static std::mutex counters_mutex;
+static std::vector<std::unique_ptr<CounterGroup>> counter_groups;
+#endif
+
+static std::atomic<bool> counters_enabled {false};
+
+static bool AttachCounters() {
+#ifdef __linux__
+	thread_local bool attached = false;
+	if (attached) {
+		return true;
+	}
+
+	std::unique_ptr<CounterGroup> group(new CounterGroup());
+	if (!group->Open()) {
+		return false;
+	}
+	attached = true;
+	std::lock_guard<std::mutex> lock(counters_mutex);
+	counter_groups.push_back(std::move(group));
+	return true;
+#else
+	return false;
+#endif
+}
+
+CounterValues CounterValues::operator-(const CounterValues &other) const {
+	CounterValues result;
+	result.cycles = cycles - other.cycles;
+	result.instructions = instructions - other.instructions;
+	result.cache_misses = cache_misses - other.cache_misses;
+	result.branch_misses = branch_misses - other.branch_misses;
+	return result;
+}
+
+CounterValues &CounterValues::operator+=(const CounterValues &other) {
+	cycles += other.cycles;
+	instructions += other.instructions;
+	cache_misses += other.cache_misses;
+	branch_misses += other.branch_misses;
+	return *this;
+}
+
+ProfileScope::ProfileScope(const char *name, bool counted) : name(name), counted(false) {
+	active = std::none_of(open_scopes.begin(), open_scopes.end(), [name](const char *open) { return std::strcmp(open, name) == 0; });
+	if (!active) {
+		return;
+	}
+
+	open_scopes.push_back(name);
+	if (counted && Profiler::CountersEnabled()) {
+		this->counted = true;
+		start_counters = Profiler::ReadCounters();
+	}
+	start = std::chrono::steady_clock::now();
+}
+
+ProfileScope::~ProfileScope() {
+	if (!active) {
+		return;
+	}
+
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	CounterValues counters;
+	if (counted) {
+		counters = Profiler::ReadCounters() - start_counters;
+	}
+	open_scopes.pop_back();
+	Profiler::Record(name, start, end, counted, counters);
+}
+
+bool Profiler::EnableCounters() {
+	bool attached = AttachCounters();
+	// Pool threads persist between parallel regions, so attaching them once covers every later loop
+#pragma omp parallel
+	{
+		if (!AttachCounters()) {
+#pragma omp critical
+			attached = false;
+		}
+	}
+	counters_enabled = attached;
+	return attached;
+}
+
+bool Profiler::CountersEnabled() {
+	return counters_enabled;
+}
+
+CounterValues Profiler::ReadCounters() {
+	CounterValues total;
+#ifdef __linux__
+	std::lock_guard<std::mutex> lock(counters_mutex);
+	for (const auto &group : counter_groups) {
+		total += group->Read();
+	}
+#endif
+	return total;
+}
+
+void Profiler::Record(const char *name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+	bool counted, const CounterValues &counters) {
+	ProfileEvent event;
+	event.name = name;
+	event.thread = ThreadNumber();
+	event.start_us = std::chrono::duration<double, std::micro>(start - profiler_start).count();
+	event.duration_us = std::chrono::duration<double, std::micro>(end - start).count();
+	event.counted = counted;
+	event.counters = counters;
+
+	std::lock_guard<std::mutex> lock(profiler_mutex);
+	PhaseTotals &phase = phases[name];
+	phase.calls++;
+	phase.total_us += event.duration_us;
+	phase.max_us = std::max(phase.max_us, event.duration_us);
+	if (counted) {
+		phase.counted_calls++;
+		phase.counters += counters;
+	}
+
+	if (events.size() < max_events) {
+		events.push_back(event);
+	} else {
+		dropped_events++;
+	}
+}
+
+void Profiler::Report(std::ostream &stream) {
+	std::lock_guard<std::mutex> lock(profiler_mutex);
+	const double wall_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - profiler_start).count();
+
+	std::vector<std::pair<std::string, PhaseTotals>> sorted(phases.begin(), phases.end());
+	std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) { return a.second.total_us > b.second.total_us; });
+
+	const std::ios_base::fmtflags flags = stream.flags();
+	stream << std::fixed << std::setprecision(2);
+	stream << "Profile over " << wall_us / 1000.0 << " ms, phases include the phases they call\n";
+	stream << std::left << std::setw(20) << "phase" << std::right << std::setw(8) << "calls" << std::setw(14) << "total ms"
+		<< std::setw(12) << "mean ms" << std::setw(12) << "max ms" << std::setw(9) << "wall %";
+	if (counters_enabled) {
+		stream << std::setw(8) << "IPC" << std::setw(16) << "cache misses" << std::setw(16) << "branch misses";
+	}
+	stream << "\n";
+
+	for (const auto &entry : sorted) {
+		const PhaseTotals &phase = entry.second;
+		stream << std::left << std::setw(20) << entry.first << std::right << std::setw(8) << phase.calls
+			<< std::setw(14) << phase.total_us / 1000.0 << std::setw(12) << phase.total_us / phase.calls / 1000.0
+			<< std::setw(12) << phase.max_us / 1000.0 << std::setw(9) << (wall_us > 0.0 ? 100.0 * phase.total_us / wall_us : 0.0);
+		if (counters_enabled && phase.counted_calls) {
+			stream << std::setw(8) << phase.counters.IPC() << std::setw(16) << phase.counters.cache_misses
+				<< std::setw(16) << phase.counters.branch_misses;
+		}
+		stream << "\n";
+	}
+	if (dropped_events) {
+		stream << dropped_events << " events past the first " << max_events << " are in the totals only\n";
+	}
+	stream.flags(flags);
+}
+
+bool Profiler::SaveChromeTrace(const std::string &filename) {
+	std::ofstream file(filename);
+	if (!file) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(profiler_mutex);
+	file << std::fixed << std::setprecision(3);
+	file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+	for (size_t i = 0; i < events.size(); i++) {
+		const ProfileEvent &event = events[i];
+		file << "{\"name\": \"" << event.name << "\", \"cat\": \"render\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << event.thread
+			<< ", \"ts\": " << event.start_us << ", \"dur\": " << event.duration_us;
+		if (event.counted) {
+			file << ", \"args\": {\"cycles\": " << event.counters.cycles << ", \"instructions\": " << event.counters.instructions
+				<< ", \"cache_misses\": " << event.counters.cache_misses << ", \"branch_misses\": " << event.counters.branch_misses << "}";
+		}
+		file << "}" << (i + 1 < events.size() ? ",\n" : "\n");
+	}
+	file << "]}\n";
+	return static_cast<bool>(file);
+}
+
+void Profiler::Reset() {
+	std::lock_guard<std::mutex> lock(profiler_mutex);
+	events.clear();
+	phases.clear();
+	dropped_events = 0;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Hardware events summed over every attached thread. Zero everywhere when counters are unavailable.
+class CounterValues
+{
+public:
+	uint64_t cycles = 0;
+	uint64_t instructions = 0;
+	uint64_t cache_misses = 0;
+	uint64_t branch_misses = 0;
+
+	CounterValues operator-(const CounterValues& other) const;
+	CounterValues& operator+=(const CounterValues& other);
+	double IPC() const { return cycles ? static_cast<double>(instructions) / cycles : 0.0; };
+};
+
+// Times its lifetime as one occurrence of a phase. Phases are named by string literals, the pointer is kept.
+// A scope whose name is already open on the same thread records nothing, so overrides that call their base
+// are not counted twice. With counted, the hardware counters are read at both ends, a few system calls per
+// attached thread, so keep counted scopes around whole loops rather than inside them.
+class ProfileScope
+{
+public:
+	explicit ProfileScope(const char* name, bool counted = false);
+	~ProfileScope();
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+	const char* name;
+	bool active;
+	bool counted;
+	std::chrono::steady_clock::time_point start;
+	CounterValues start_counters;
+};
+
+class Profiler
+{
+public:
+	// Opens cycle, instruction, cache miss and branch miss counters on the calling thread and on every thread
+	// of the OpenMP pool, through perf_event_open. Returns false where that is not available, other than on Linux
+	// or when perf_event_paranoid forbids it; timing works regardless.
+	static bool EnableCounters();
+	static bool CountersEnabled();
+	static CounterValues ReadCounters();
+
+	// Per-phase calls, wall time and counters, with times inclusive of nested phases
+	static void Report(std::ostream& stream);
+	// Every recorded scope as a complete event of the Chrome trace format, for chrome://tracing or Perfetto
+	static bool SaveChromeTrace(const std::string& filename);
+	static void Reset();
+
+	static void Record(const char* name, std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end,
+		bool counted, const CounterValues& counters);
+};
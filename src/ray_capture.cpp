@@ -0,0 +1,108 @@
+#include "ray_capture.h"
+
+#include <fstream>
+#include <memory>
+#include <mutex>
+
+static_assert(sizeof(CapturedRay) == 44, "Captured rays are stored as raw 44 byte records");
+
+// Records per thread buffer before it is appended to the file
+static const size_t block_records = 4096;
+
+const uint32_t RayCapture::magic;
+const uint32_t RayCapture::version;
+std::atomic<bool> RayCapture::active {false};
+
+static std::mutex capture_mutex;
+static std::ofstream capture_file;
+static size_t capture_written = 0;
+// Buffers outlive their threads, Stop flushes what they still hold
+static std::vector<std::unique_ptr<std::vector<CapturedRay>>> capture_buffers;
+
+// Appends and empties a buffer, with capture_mutex held
+static void FlushBuffer(std::vector<CapturedRay> &buffer) {
+	if (capture_file.is_open() && !buffer.empty()) {
+		capture_file.write(reinterpret_cast<const char *>(buffer.data()), buffer.size() * sizeof(CapturedRay));
+		capture_written += buffer.size();
+	}
+	buffer.clear();
+}
+
+bool RayCapture::Start(const std::string &filename, float t_min, unsigned int lod_levels) {
+	Stop();
+
+	std::lock_guard<std::mutex> lock(capture_mutex);
+	capture_file.open(filename, std::ios::binary | std::ios::trunc);
+	if (!capture_file) {
+		return false;
+	}
+
+	const uint32_t recordSize = sizeof(CapturedRay);
+	const uint32_t levels = lod_levels;
+	capture_file.write(reinterpret_cast<const char *>(&magic), sizeof(magic));
+	capture_file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+	capture_file.write(reinterpret_cast<const char *>(&recordSize), sizeof(recordSize));
+	capture_file.write(reinterpret_cast<const char *>(&levels), sizeof(levels));
+	capture_file.write(reinterpret_cast<const char *>(&t_min), sizeof(t_min));
+	capture_written = 0;
+	active = true;
+	return true;
+}
+
+size_t RayCapture::Stop() {
+	active = false;
+
+	std::lock_guard<std::mutex> lock(capture_mutex);
+	for (auto &buffer : capture_buffers) {
+		FlushBuffer(*buffer);
+	}
+	if (capture_file.is_open()) {
+		capture_file.close();
+	}
+	return capture_written;
+}
+
+void RayCapture::RecordActive(float3 origin, float3 direction, float spread, float cone_width, float time, float max_t,
+	CaptureType type, unsigned int depth) {
+	thread_local std::vector<CapturedRay> *buffer = [] {
+		std::lock_guard<std::mutex> lock(capture_mutex);
+		capture_buffers.emplace_back(new std::vector<CapturedRay>());
+		capture_buffers.back()->reserve(block_records);
+		return capture_buffers.back().get();
+	}();
+
+	CapturedRay ray;
+	ray.origin = origin;
+	ray.direction = direction;
+	ray.spread = spread;
+	ray.cone_width = cone_width;
+	ray.max_t = max_t;
+	ray.time = time;
+	ray.type = type;
+	ray.depth = static_cast<uint16_t>(depth);
+	buffer->push_back(ray);
+
+	if (buffer->size() >= block_records) {
+		std::lock_guard<std::mutex> lock(capture_mutex);
+		FlushBuffer(*buffer);
+	}
+}
+
+bool RayCapture::Load(const std::string &filename, std::vector<CapturedRay> &rays, float &t_min, unsigned int &lod_levels) {
+	std::ifstream file(filename, std::ios::binary);
+	uint32_t header[4] = {};
+	if (!file.read(reinterpret_cast<char *>(header), sizeof(header)) || !file.read(reinterpret_cast<char *>(&t_min), sizeof(t_min))) {
+		return false;
+	}
+	if (header[0] != magic || header[1] != version || header[2] != sizeof(CapturedRay)) {
+		return false;
+	}
+	lod_levels = header[3];
+
+	file.seekg(0, std::ios::end);
+	const std::streamoff bytes = static_cast<std::streamoff>(file.tellg()) - static_cast<std::streamoff>(sizeof(header) + sizeof(t_min));
+	file.seekg(sizeof(header) + sizeof(t_min));
+
+	rays.resize(static_cast<size_t>(bytes) / sizeof(CapturedRay));
+	return static_cast<bool>(file.read(reinterpret_cast<char *>(rays.data()), rays.size() * sizeof(CapturedRay)));
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "linalg.h"
+using namespace linalg::aliases;
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum CaptureType : uint16_t {
+	// Closest hit queries of TraceRay and of the Denoising G-buffer pass
+	CAPTURE_CLOSEST,
+	// Any hit queries of TraceShadowRay
+	CAPTURE_SHADOW
+};
+
+// One query as stored in a capture, 44 bytes. The segment is (t_min, max_t) with t_min from the file header.
+class CapturedRay
+{
+public:
+	float3 origin;
+	float3 direction;
+	// Ray cone of the query, which picks the mesh LODs it is tested against
+	float spread;
+	float cone_width;
+	float max_t;
+	float time;
+	uint16_t type;
+	// Recursion depth of closest queries, 0 for camera rays. Shadow queries do not know theirs and store 0.
+	uint16_t depth;
+};
+
+// Records the queries issued by TraceRay, TraceShadowRay and FillGBuffer into a binary stream, for replay against other
+// acceleration structures (bench/ray_replay.cpp). The file is a header of magic, version, record size, the number of
+// mesh LOD levels the scene was built with and t_min, then raw little-endian records. Each thread fills its own buffer and appends it to the file in blocks, so the
+// records of different threads interleave block by block.
+class RayCapture
+{
+public:
+	// Starts writing to filename, replacing an earlier capture that is still open
+	static bool Start(const std::string& filename, float t_min, unsigned int lod_levels);
+	// Flushes every thread's buffer and closes the file, returns the number of records written.
+	// Call between frames, while no thread is tracing.
+	static size_t Stop();
+	static bool Active() { return active.load(std::memory_order_relaxed); };
+
+	static void Record(float3 origin, float3 direction, float spread, float cone_width, float time, float max_t, CaptureType type,
+		unsigned int depth) {
+		if (Active()) {
+			RecordActive(origin, direction, spread, cone_width, time, max_t, type, depth);
+		}
+	};
+
+	// Replays have to build the same number of LOD levels before tracing the rays
+	static bool Load(const std::string& filename, std::vector<CapturedRay>& rays, float& t_min, unsigned int& lod_levels);
+
+	static const uint32_t magic = 0x43594152;
+	static const uint32_t version = 2;
+
+private:
+	static void RecordActive(float3 origin, float3 direction, float spread, float cone_width, float time, float max_t,
+		CaptureType type, unsigned int depth);
+
+	static std::atomic<bool> active;
+};
@@ -1,10 +1,10 @@
 #include "ray_generation.h"
 
-#define STBI_MSC_SECURE_CRT
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
 
-RayGenerationApp::RayGenerationApp(short width, short height) :
+RayGenerationApp::RayGenerationApp(int width, int height) :
 	width(width),
 	height(height) {}
 
@@ -17,15 +17,46 @@ void RayGenerationApp::SetCamera(float3 position, float3 direction, float3 appro
 	camera.SetRenderTargetSize(width, height);
 }
 
-void RayGenerationApp::Clear() {
+int RayGenerationApp::SetResolution(int width, int height) {
+	const int previousWidth = this->width;
+	const int previousHeight = this->height;
+	this->width = width;
+	this->height = height;
+	camera.SetRenderTargetSize(width, height);
+	ResetCrop();
+	const int result = Clear();
+	if (result != 0) {
+		this->width = previousWidth;
+		this->height = previousHeight;
+		camera.SetRenderTargetSize(previousWidth, previousHeight);
+	}
+	return result;
+}
+
+int RayGenerationApp::Clear() {
+	if (FrameOverBudget()) {
+		std::cerr << "Frame buffers of " << width << "x" << height << " exceed the memory budget" << std::endl;
+		return memory_budget_exceeded;
+	}
 	frame_buffer.resize(static_cast<size_t>(width) *static_cast<size_t>(height));
+	RAY_STAT(pixel_cost.assign(frame_buffer.size(), 0.0f));
+	return 0;
 }
 
 void RayGenerationApp::DrawScene() {
-	for (unsigned int x = 0; x < width; x++) {
+	ProfileScope profile("trace", true);
+	PrepareAOVs();
+
+	const PixelWindow window = RenderWindow();
+	for (int x = window.x0; x < window.x1; x++) {
 #pragma omp parallel for
-		for (int y = 0; y < height; y++) {
+		for (int y = window.y0; y < window.y1; y++) {
+			if (!IsRendered(x, y)) {
+				continue;
+			}
+
 			Ray ray = camera.GetCameraRay(x, y);
+			AttachAOVs(ray, x, y);
 			Payload payload = TraceRay(ray, raytracing_depth);
 			SetPixel(x, y, payload.color);
 		}
@@ -33,13 +64,227 @@ void RayGenerationApp::DrawScene() {
 }
 
 int RayGenerationApp::Save(std::string filename) const {
-	int result = stbi_write_png(filename.c_str(), width, height, 3, frame_buffer.data(), width * sizeof(uint8_t) * 3);
+	return WriteImage(filename, width, height, frame_buffer, tone_mapping, exposure, gamma) ? 0 : -1;
+}
+
+void RayGenerationApp::SaveAsync(std::string filename) {
+	if (!image_writer) {
+		image_writer.reset(new ImageWriter());
+	}
+
+	ImageJob job;
+	job.filename = filename;
+	job.width = width;
+	job.height = height;
+	job.pixels = std::move(frame_buffer);
+	job.tone_mapping = tone_mapping;
+	job.exposure = exposure;
+	job.gamma = gamma;
+	image_writer->Submit(std::move(job));
+
+	frame_buffer = image_writer->AcquireBuffer(static_cast<size_t>(width) * static_cast<size_t>(height));
+}
+
+int RayGenerationApp::WaitForSaves() {
+	if (!image_writer) {
+		return 0;
+	}
+
+	return image_writer->Flush() == 0 ? 0 : -1;
+}
+
+std::vector<byte3> RayGenerationApp::GetFrameBuffer() const {
+	std::vector<byte3> result;
+	ToneMap(frame_buffer, result, tone_mapping, exposure, gamma);
+	return result;
+}
 
-	if (result == 1) {
-		std::system(std::string("start " + filename).c_str());
+void RayGenerationApp::SetToneMapping(ToneMapping tone_mapping, float exposure, float gamma) {
+	this->tone_mapping = tone_mapping;
+	this->exposure = exposure;
+	this->gamma = gamma;
+}
+
+int RayGenerationApp::SaveAOVs(std::string filename) const {
+	return aov_buffer.Save(filename, width, height, aov_channels) ? 0 : -1;
+}
+
+void RayGenerationApp::SetCropWindow(int x0, int y0, int x1, int y1) {
+	has_crop = true;
+	crop.x0 = std::min(std::max(x0, 0), static_cast<int>(width));
+	crop.y0 = std::min(std::max(y0, 0), static_cast<int>(height));
+	crop.x1 = std::min(std::max(x1, crop.x0), static_cast<int>(width));
+	crop.y1 = std::min(std::max(y1, crop.y0), static_cast<int>(height));
+	crop_revision++;
+}
+
+void RayGenerationApp::SetPixelMask(const std::vector<unsigned char> &mask) {
+	if (mask.size() != static_cast<size_t>(width) * static_cast<size_t>(height)) {
+		std::cerr << "Pixel mask has " << mask.size() << " entries, expected " << static_cast<size_t>(width) * static_cast<size_t>(height) << std::endl;
+		return;
 	}
 
-	return result - 1;
+	pixel_mask = mask;
+	crop_revision++;
+}
+
+void RayGenerationApp::ResetCrop() {
+	has_crop = false;
+	pixel_mask.clear();
+	crop_revision++;
+}
+
+int RayGenerationApp::SaveCrop(std::string filename) const {
+	const PixelWindow window = RenderWindow();
+	if (window.Width() <= 0 || window.Height() <= 0) {
+		return -1;
+	}
+
+	std::vector<float3> pixels(static_cast<size_t>(window.Width()) * static_cast<size_t>(window.Height()));
+	for (int y = window.y0; y < window.y1; y++) {
+		std::copy(
+			frame_buffer.begin() + static_cast<size_t>(y) * static_cast<size_t>(width) + window.x0,
+			frame_buffer.begin() + static_cast<size_t>(y) * static_cast<size_t>(width) + window.x1,
+			pixels.begin() + static_cast<size_t>(y - window.y0) * static_cast<size_t>(window.Width()));
+	}
+	return WriteImage(filename, window.Width(), window.Height(), pixels, tone_mapping, exposure, gamma) ? 0 : -1;
+}
+
+int RayGenerationApp::RenderBatch(const std::vector<RenderView> &views) {
+	int result = 0;
+	for (const auto &view : views) {
+		ApplyView(view);
+		DrawScene();
+		if (!view.aov_filename.empty() && aov_channels != 0 && SaveAOVs(view.aov_filename) != 0) {
+			result = -1;
+		}
+		SaveAsync(view.filename);
+	}
+
+	return WaitForSaves() == 0 ? result : -1;
+}
+
+void RayGenerationApp::ApplyView(const RenderView &view) {
+	SetCamera(view.position, view.direction, view.up);
+}
+
+void RayGenerationApp::ResetRayStatistics() {
+	RayStatistics::Reset();
+	RAY_STAT(pixel_cost.assign(static_cast<size_t>(width) * static_cast<size_t>(height), 0.0f));
+}
+
+int RayGenerationApp::SaveRayStatistics(std::string filename) const {
+	std::ofstream file(filename);
+	if (!file) {
+		std::cerr << "Could not open " << filename << std::endl;
+		return -1;
+	}
+
+	file << GetRayStatistics().ToJSON();
+	return file ? 0 : -1;
+}
+
+int RayGenerationApp::SaveCostHeatmap(std::string filename) const {
+	if (pixel_cost.size() != static_cast<size_t>(width) * static_cast<size_t>(height)) {
+		std::cerr << "No cost heatmap, ray statistics are compiled out" << std::endl;
+		return -1;
+	}
+
+	std::vector<float3> pixels(pixel_cost.size());
+	if (FileExtension(filename) != "png") {
+		for (size_t i = 0; i < pixel_cost.size(); i++) {
+			pixels[i] = float3(pixel_cost[i]);
+		}
+		return WriteImage(filename, width, height, pixels, ToneMapping::Clamp, 1.0f, 1.0f) ? 0 : -1;
+	}
+
+	// A few pathological pixels would otherwise squash the rest of the ramp into black
+	std::vector<float> sorted(pixel_cost);
+	std::nth_element(sorted.begin(), sorted.begin() + sorted.size() * 99 / 100, sorted.end());
+	const float scale = std::max(sorted[sorted.size() * 99 / 100], 1.0f);
+
+	// Blue, cyan, green, yellow, red
+	const float3 ramp[5] = {{0, 0, 1}, {0, 1, 1}, {0, 1, 0}, {1, 1, 0}, {1, 0, 0}};
+	for (size_t i = 0; i < pixel_cost.size(); i++) {
+		float position = std::min(pixel_cost[i] / scale, 1.0f) * 4.0f;
+		int segment = std::min(static_cast<int>(position), 3);
+		pixels[i] = linalg::lerp(ramp[segment], ramp[segment + 1], position - segment);
+	}
+	return WriteImage(filename, width, height, pixels, ToneMapping::Clamp, 1.0f, 1.0f) ? 0 : -1;
+}
+
+PixelWindow RayGenerationApp::RenderWindow() const {
+	if (has_crop) {
+		return crop;
+	}
+
+	PixelWindow window;
+	window.x1 = width;
+	window.y1 = height;
+	return window;
+}
+
+bool RayGenerationApp::IsRendered(int x, int y) const {
+	if (has_crop && !crop.Contains(x, y)) {
+		return false;
+	}
+
+	return pixel_mask.empty() || pixel_mask[static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x)] != 0;
+}
+
+MemoryReport RayGenerationApp::GetMemoryUsage() const {
+	MemoryReport report;
+	AccountMemory(report);
+	return report;
+}
+
+void RayGenerationApp::AccountMemory(MemoryReport &report) const {
+	report.Add(MEMORY_FRAME, VectorBytes(frame_buffer) + VectorBytes(pixel_cost) + VectorBytes(pixel_mask));
+	for (const auto &plane : aov_buffer.Planes()) {
+		report.Add(MEMORY_FRAME, VectorBytes(plane));
+	}
+}
+
+bool RayGenerationApp::OverBudget(size_t additional_bytes) const {
+	return memory_budget != 0 && GetMemoryUsage().Total() + additional_bytes > memory_budget;
+}
+
+size_t RayGenerationApp::FrameStateBytes(size_t pixels) const {
+	size_t perPixel = sizeof(float3) + AOVBuffer::PlaneCount(aov_channels, AOVLightCount()) * sizeof(float);
+	RAY_STAT(perPixel += sizeof(float));
+	return pixels * perPixel;
+}
+
+bool RayGenerationApp::FrameOverBudget() const {
+	// The buffers already held are resized in place, only the growth is new
+	const MemoryReport usage = GetMemoryUsage();
+	const size_t held = usage.bytes[MEMORY_FRAME] + usage.bytes[MEMORY_HISTORY];
+	const size_t projected = FrameStateBytes(static_cast<size_t>(width) * static_cast<size_t>(height));
+	return OverBudget(projected > held ? projected - held : 0);
+}
+
+void RayGenerationApp::PrepareAOVs(unsigned int internal_channels) {
+	unsigned int channels = aov_channels | internal_channels;
+	const size_t pixels = channels ? static_cast<size_t>(width) * static_cast<size_t>(height) : 0;
+	if (!aov_buffer.Matches(channels, pixels, AOVLightCount())) {
+		aov_buffer.Configure(channels, pixels, AOVLightCount());
+		return;
+	}
+
+	const PixelWindow window = RenderWindow();
+	for (int y = window.y0; y < window.y1 && pixels; y++) {
+		const size_t row = static_cast<size_t>(y) * static_cast<size_t>(width);
+		aov_buffer.Reset(row + static_cast<size_t>(window.x0), row + static_cast<size_t>(window.x1));
+	}
+}
+
+void RayGenerationApp::AttachAOVs(Ray &ray, unsigned int x, unsigned int y) {
+	if (aov_buffer.Channels() == 0) {
+		return;
+	}
+
+	ray.aov = &aov_buffer;
+	ray.aov_pixel = static_cast<size_t>(y) * static_cast<size_t>(width) + static_cast<size_t>(x);
 }
 
 Payload RayGenerationApp::TraceRay(const Ray &ray, const unsigned int max_raytrace_depth) const {
@@ -53,14 +298,25 @@ Payload RayGenerationApp::Miss(const Ray &ray) const {
 	return Payload(color);
 }
 
-void RayGenerationApp::SetPixel(unsigned short x, unsigned short y, float3 color) {
-	unsigned int ix = y * width + x;
+void RayGenerationApp::SetPixel(unsigned int x, unsigned int y, float3 color) {
+	size_t ix = static_cast<size_t>(y) * static_cast<size_t>(width) + x;
 
-	if (ix >= 0 && ix < frame_buffer.size()) {
-		frame_buffer[ix] = byte3(color * 255);
+	if (ix < frame_buffer.size()) {
+		frame_buffer[ix] = color;
+		// Every ray the thread traced since its last pixel belonged to this one
+		ChargePixel(x, y);
 	}
 }
 
+void RayGenerationApp::ChargePixel(const unsigned int x, const unsigned int y) {
+#ifdef RAY_STATISTICS
+	size_t ix = static_cast<size_t>(y) * static_cast<size_t>(width) + x;
+	if (ix < pixel_cost.size()) {
+		pixel_cost[ix] += static_cast<float>(RayStatistics::TakePixelCost());
+	}
+#endif
+}
+
 Camera::Camera() {}
 
 Camera::~Camera() {}
@@ -78,22 +334,99 @@ void Camera::SetUp(float3 approx_up) {
 	this->up = linalg::normalize(linalg::cross(right, direction));
 }
 
-void Camera::SetRenderTargetSize(short width, short height) {
+void Camera::SetRenderTargetSize(int width, int height) {
 	this->width = width;
 	this->height = height;
 }
 
-Ray Camera::GetCameraRay(short x, short y) const {
+Ray Camera::GetCameraRay(int x, int y) const {
+	return GetCameraRay(x, y, float3 {0.0f, 0.0f, 0.0f});
+}
+
+Ray Camera::GetCameraRay(int x, int y, float3 jitter) const {
+	CameraSample sample;
+	sample.pixel = float2 {jitter.x, jitter.y};
+	return GetCameraRay(x, y, sample);
+}
+
+// Shirley and Chiu's concentric map, keeps the strata of the square compact on the disk
+static float2 ConcentricDisk(float2 u) {
+	const float pi = 3.14159265358979f;
+	float2 offset = 2.0f * u - 1.0f;
+	if (offset.x == 0.0f && offset.y == 0.0f) {
+		return float2 {0.0f, 0.0f};
+	}
+
+	float radius;
+	float theta;
+	if (std::fabs(offset.x) > std::fabs(offset.y)) {
+		radius = offset.x;
+		theta = pi / 4.0f * (offset.y / offset.x);
+	} else {
+		radius = offset.y;
+		theta = pi / 2.0f - pi / 4.0f * (offset.x / offset.y);
+	}
+	return radius * float2 {std::cos(theta), std::sin(theta)};
+}
+
+Ray Camera::GetCameraRay(int x, int y, const CameraSample &sample) const {
+	RAY_STAT(RayStatistics::CountRay(RAY_PRIMARY));
 	float aspectRatio = static_cast<float>(width) / static_cast<float>(height);
 
-	float u = (2.0f * (static_cast<float>(x) + 0.5f) / static_cast<float>(width) - 1.0f) * aspectRatio;
-	float v = (2.0f * (static_cast<float>(y) + 0.5f) / static_cast<float>(height) - 1.0f);
+	float u = (2.0f * (static_cast<float>(x) + 0.5f + sample.pixel.x) / static_cast<float>(width) - 1.0f) * aspectRatio;
+	float v = (2.0f * (static_cast<float>(y) + 0.5f + sample.pixel.y) / static_cast<float>(height) - 1.0f);
 
 	float3 direction = this->direction + u * right - v * up;
 
-	return Ray(this->position, direction);
+	if (aperture_radius > 0.0f) {
+		// direction is one unit deep along the view axis, so this lands on the plane in focus
+		float3 focus = this->position + direction * focus_distance;
+		float2 disk = aperture_radius * ConcentricDisk(sample.lens);
+		float3 origin = this->position + disk.x * right + disk.y * up;
+
+		Ray ray(origin, focus - origin);
+		ray.spread = 2.0f / static_cast<float>(height);
+		ray.time = shutter_open + (shutter_close - shutter_open) * sample.time;
+		return ray;
+	}
+
+	Ray ray(this->position, direction);
+	ray.spread = 2.0f / static_cast<float>(height);
+	ray.time = shutter_open + (shutter_close - shutter_open) * sample.time;
+	return ray;
+}
+
+void Camera::SetLens(float aperture_radius, float focus_distance) {
+	this->aperture_radius = std::max(0.0f, aperture_radius);
+	this->focus_distance = focus_distance;
+}
+
+void Camera::SetShutter(float open, float close) {
+	shutter_open = std::min(std::max(open, 0.0f), 1.0f);
+	shutter_close = std::min(std::max(close, shutter_open), 1.0f);
+}
+
+bool Camera::Project(float3 point, float2 &pixel) const {
+	float3 offset = point - this->position;
+	float z = linalg::dot(offset, direction);
+	if (z <= 0.0f) {
+		return false;
+	}
+
+	float aspectRatio = static_cast<float>(width) / static_cast<float>(height);
+	float u = linalg::dot(offset, right) / z / aspectRatio;
+	float v = -linalg::dot(offset, up) / z;
+
+	pixel = float2 {
+		(u + 1.0f) * static_cast<float>(width) / 2.0f - 0.5f,
+		(v + 1.0f) * static_cast<float>(height) / 2.0f - 0.5f
+	};
+	return true;
 }
 
-Ray Camera::GetCameraRay(short x, short y, float3 jitter) const {
-	return GetCameraRay(x, y);
+bool Camera::operator==(const Camera &other) const {
+	return position == other.position && direction == other.direction && up == other.up
+		&& width == other.width && height == other.height
+		&& aperture_radius == other.aperture_radius && focus_distance == other.focus_distance
+		&& shutter_open == other.shutter_open && shutter_close == other.shutter_close;
 }
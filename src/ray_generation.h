@@ -1,5 +1,12 @@
 #pragma once
 
+#include "aov.h"
+#include "image_output.h"
+#include "image_writer.h"
+#include "memory_budget.h"
+#include "profiler.h"
+#include "ray_capture.h"
+#include "ray_statistics.h"
 #include "linalg.h"
 using namespace linalg::aliases;
 using namespace linalg::ostream_overloads;
@@ -7,15 +14,55 @@ using namespace linalg::ostream_overloads;
 #include <string>
 #include <vector>
 #include <iostream>
+#include <memory>
+#include <utility>
 
-class Ray {
+// Axis permutation and shear of the watertight triangle test (Woop, Benthin, Wald 2013)
+class RayShear {
 public:
-	Ray(float3 position, float3 direction) : position(position) {
-		this->direction = normalize(direction);
+	explicit RayShear(float3 direction) {
+		kz = linalg::argmax(linalg::abs(direction));
+		kx = (kz + 1) % 3;
+		ky = (kx + 1) % 3;
+		if (direction[kz] < 0.0f) {
+			std::swap(kx, ky);
+		}
+		shear = float3 {direction[kx] / direction[kz], direction[ky] / direction[kz], 1.0f / direction[kz]};
 	};
+	int kx, ky, kz;
+	float3 shear;
+};
+
+class Ray {
+public:
+	Ray(float3 position, float3 direction) : position(position), direction(normalize(direction))
+#ifdef WATERTIGHT_INTERSECTION
+		, watertight(this->direction)
+#endif
+	{};
 	~Ray() {};
+	float ConeWidth(float t) const { return cone_width + spread * t; };
+	// Secondary ray off the parent's hit at t, with the parent's time and a cone starting as wide as the parent's ended
+	void Continue(const Ray& parent, float t) {
+		time = parent.time;
+		spread = parent.spread;
+		cone_width = parent.ConeWidth(t);
+	};
 	float3 position;
 	float3 direction;
+	// Ray cone spread angle and width at the origin, used to pick texture mip levels and mesh LODs
+	float spread = 0.0f;
+	float cone_width = 0.0f;
+	// Moment within the frame the ray samples, secondary rays inherit it so moving meshes stay consistent
+	float time = 0.0f;
+	// Set on primary rays only, the first hit writes its AOVs there
+	AOVBuffer* aov = nullptr;
+	size_t aov_pixel = 0;
+
+#ifdef WATERTIGHT_INTERSECTION
+	// Only the builds which intersect with the watertight test pay for it on every ray
+	RayShear watertight;
+#endif
 };
 
 class Payload {
@@ -26,6 +73,50 @@ public:
 	float3 color;
 };
 
+// Half-open pixel rectangle [x0, x1) x [y0, y1)
+class PixelWindow {
+public:
+	int x0 = 0;
+	int y0 = 0;
+	int x1 = 0;
+	int y1 = 0;
+
+	int Width() const { return x1 - x0; };
+	int Height() const { return y1 - y0; };
+	bool Contains(int x, int y) const { return x >= x0 && x < x1 && y >= y0 && y < y1; };
+};
+
+// Position of one camera ray within the pixel, the lens and the shutter
+class CameraSample {
+public:
+	// Offset from the pixel centre, in pixels
+	float2 pixel {0.0f, 0.0f};
+	// Point on the aperture in [0, 1)^2, the centre of the lens is 0.5
+	float2 lens {0.5f, 0.5f};
+	// Fraction of the shutter interval in [0, 1)
+	float time = 0.0f;
+};
+
+// Point light of a RenderView, kept apart from the Light class so views can be described at this level
+class ViewLight {
+public:
+	float3 position;
+	float3 color;
+};
+
+// One viewpoint of a batch render
+class RenderView {
+public:
+	float3 position;
+	float3 direction;
+	float3 up {0.0f, 1.0f, 0.0f};
+	// Replace the scene lights for this view, which keeps the lights added to the scene when empty
+	std::vector<ViewLight> lights;
+	std::string filename;
+	// Written beside the image when not empty and AOVs are enabled
+	std::string aov_filename;
+};
+
 
 class Camera {
 public:
@@ -35,10 +126,24 @@ public:
 	void SetPosition(float3 position);
 	void SetDirection(float3 direction);
 	void SetUp(float3 approx_up);
-	void SetRenderTargetSize(short width, short height);
+	void SetRenderTargetSize(int width, int height);
+
+	Ray GetCameraRay(int x, int y) const;
+	// jitter.xy offsets the sample from the pixel centre, in pixels
+	Ray GetCameraRay(int x, int y, float3 jitter) const;
+	Ray GetCameraRay(int x, int y, const CameraSample& sample) const;
+	// Thin lens with the given aperture radius, sharp at focus_distance along the view direction. 0 is a pinhole.
+	void SetLens(float aperture_radius, float focus_distance);
+	// Rays sample times in [open, close], in the units of mesh motion where the frame spans 0 to 1.
+	// Both are clamped to the frame, the motion bounds of the acceleration structures only hold inside it.
+	void SetShutter(float open, float close);
+	// A single ray per pixel no longer converges with an aperture or an open shutter
+	bool NeedsSampling() const { return aperture_radius > 0.0f || shutter_close != shutter_open; };
+	// Inverse of GetCameraRay, pixel receives continuous coordinates. False for points behind the camera.
+	bool Project(float3 point, float2& pixel) const;
 
-	Ray GetCameraRay(short x, short y) const;
-	Ray GetCameraRay(short x, short y, float3 jitter) const;
+	bool operator==(const Camera& other) const;
+	bool operator!=(const Camera& other) const { return !(*this == other); };
 
 private:
 	float3 position;
@@ -46,34 +151,136 @@ private:
 	float3 up;
 	float3 right;
 
-	short width;
-	short height;
+	int width;
+	int height;
+
+	float aperture_radius = 0.0f;
+	float focus_distance = 1.0f;
+	float shutter_open = 0.0f;
+	float shutter_close = 0.0f;
 };
 
 
 
 class RayGenerationApp {
 public:
-	RayGenerationApp(short width, short height);
+	RayGenerationApp(int width, int height);
 	virtual ~RayGenerationApp();
 
 	void SetCamera(float3 position, float3 direction, float3 approx_up);
-	void Clear();
+	void SetLens(float aperture_radius, float focus_distance) { camera.SetLens(aperture_radius, focus_distance); };
+	void SetShutter(float open, float close) { camera.SetShutter(open, close); };
+	// Bounces after the primary ray, reflection and refraction stop there
+	void SetRaytracingDepth(unsigned int depth) { raytracing_depth = depth; };
+	unsigned int GetRaytracingDepth() const { return raytracing_depth; };
+	// Camera and lights of one view, as RenderBatch sets them
+	void SetView(const RenderView& view) { ApplyView(view); };
+	// Resizes the frame of an already loaded scene, dropping the crop window and mask. The frame is cleared,
+	// returns what Clear returned. The previous resolution is kept when that failed.
+	int SetResolution(int width, int height);
+	int GetWidth() const { return width; };
+	int GetHeight() const { return height; };
+	// memory_budget_exceeded, before anything is resized, if the frame state would not fit the budget
+	virtual int Clear();
 	virtual void DrawScene();
+	// Format follows the extension: png is tone mapped, hdr, pfm and exr keep the linear values
 	int Save(std::string filename) const;
+	// Hands the frame to a background writer and renders on into a recycled buffer
+	void SaveAsync(std::string filename);
+	// Blocks until every SaveAsync finished, -1 if any of them failed
+	int WaitForSaves();
 	// Public method to compare the final image with a reference
-	std::vector<byte3> GetFrameBuffer() const { return frame_buffer; }
+	std::vector<byte3> GetFrameBuffer() const;
+	const std::vector<float3>& GetHDRFrameBuffer() const { return frame_buffer; }
+	void SetToneMapping(ToneMapping tone_mapping, float exposure = 1.0f, float gamma = 1.0f);
+	// Mask of AOVChannel filled by the primary rays of the following renders
+	void SetAOVs(unsigned int channels) { aov_channels = channels; };
+	const AOVBuffer& GetAOVs() const { return aov_buffer; };
+	int SaveAOVs(std::string filename) const;
+
+	// Following renders only trace pixels inside the window, the rest of frame_buffer keeps its values.
+	// The window is clamped to the frame, an empty one renders nothing.
+	void SetCropWindow(int x0, int y0, int x1, int y1);
+	// width * height flags, nonzero pixels are rendered. Combines with the crop window.
+	void SetPixelMask(const std::vector<unsigned char>& mask);
+	void ResetCrop();
+	// Only the crop window as a standalone image
+	int SaveCrop(std::string filename) const;
+
+	// Renders every view against the already loaded scene and acceleration structure. Frame N is written
+	// in the background while frame N+1 traces. Returns -1 if any image failed to write.
+	int RenderBatch(const std::vector<RenderView>& views);
+
+	// Counted only in RAY_STATISTICS builds. Reset between frames, not while rendering.
+	void ResetRayStatistics();
+	RayCounters GetRayStatistics() const { return RayStatistics::Totals(); };
+	int SaveRayStatistics(std::string filename) const;
+	// Node and primitive tests spent on each pixel. PNG gets a false colour ramp up to the 99th percentile,
+	// hdr, pfm and exr keep the raw counts.
+	const std::vector<float>& GetCostBuffer() const { return pixel_cost; };
+	int SaveCostHeatmap(std::string filename) const;
+
+	// Bytes currently held by the scene, acceleration structure and frame state, by subsystem
+	MemoryReport GetMemoryUsage() const;
+	// Loads and builds that would take the accounted total past budget_bytes fall back to a more compact form or
+	// fail with memory_budget_exceeded, leaving the scene as it was. 0 disables the budget.
+	virtual void SetMemoryBudget(size_t budget_bytes) { memory_budget = budget_bytes; };
+	size_t GetMemoryBudget() const { return memory_budget; };
+	static const int memory_budget_exceeded = -2;
 protected:
-	void SetPixel(const unsigned short x, const unsigned short y, const float3 color);
+	// Also charges the pixel with the work of the calling thread, see ChargePixel
+	void SetPixel(const unsigned int x, const unsigned int y, const float3 color);
+	// Adds the node and primitive tests the calling thread made since its last charge to the pixel's cost.
+	// Passes which trace rays without writing the pixel call it themselves, or the next pixel pays for them.
+	void ChargePixel(const unsigned int x, const unsigned int y);
 	virtual Payload TraceRay(const Ray &ray, const unsigned int max_raytrace_depth) const;
 
 	virtual Payload Miss(const Ray &ray) const;
 
-	short width;
-	short height;
+	// Sizes and clears the AOV planes before a frame, AttachAOVs then routes a primary ray to its pixel. Planes which
+	// keep their channels and size only have the render window cleared, so tiles and bands fill one frame together.
+	// internal_channels are filled for the renderer's own use and left out of SaveAOVs.
+	void PrepareAOVs(unsigned int internal_channels = 0);
+	void AttachAOVs(Ray& ray, unsigned int x, unsigned int y);
+	virtual size_t AOVLightCount() const { return 0; };
+	// Camera and lights of a view, the camera and lights are left as the last view set them
+	virtual void ApplyView(const RenderView& view);
+
+	// Pixel range every DrawScene loop runs over, the whole frame without a crop window
+	PixelWindow RenderWindow() const;
+	// Inside the window and not masked out
+	bool IsRendered(int x, int y) const;
+
+	// Each class adds the containers it owns and calls its base
+	virtual void AccountMemory(MemoryReport& report) const;
+	// Whether additional_bytes more would exceed the budget
+	bool OverBudget(size_t additional_bytes = 0) const;
+	// Bytes of the per-pixel state of a frame of pixels: the frame buffer, the AOV planes and what subclasses add
+	virtual size_t FrameStateBytes(size_t pixels) const;
+	// Whether growing the frame state to the current resolution would exceed the budget
+	bool FrameOverBudget() const;
+
+	int width;
+	int height;
 
 	unsigned int raytracing_depth = 10;
 
-	std::vector<byte3> frame_buffer;
+	// Linear radiance, quantised only on output
+	std::vector<float3> frame_buffer;
+	ToneMapping tone_mapping = ToneMapping::Clamp;
+	float exposure = 1.0f;
+	float gamma = 1.0f;
+	unsigned int aov_channels = 0;
+	AOVBuffer aov_buffer;
+	// Traversal cost per pixel, sized by Clear in RAY_STATISTICS builds
+	std::vector<float> pixel_cost;
+	// Created on the first SaveAsync
+	std::unique_ptr<ImageWriter> image_writer;
+	bool has_crop = false;
+	PixelWindow crop;
+	std::vector<unsigned char> pixel_mask;
+	// Bumped whenever the window or mask changes, lets renderers with per-pixel state notice
+	unsigned int crop_revision = 0;
+	size_t memory_budget = 0;
 	Camera camera;
 };
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include "ray_statistics.h"
+
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+// Counters outlive their threads so totals stay complete, OpenMP keeps its pool alive anyway
+static std::mutex registry_mutex;
+static std::vector<std::unique_ptr<RayCounters>> registry;
+
+void RayCounters::Add(const RayCounters &other) {
+	for (int i = 0; i < RAY_TYPE_COUNT; i++) {
+		rays[i] += other.rays[i];
+	}
+	node_tests += other.node_tests;
+	primitive_tests += other.primitive_tests;
+	for (int i = 0; i < max_depth; i++) {
+		depth[i] += other.depth[i];
+	}
+	pixel_cost += other.pixel_cost;
+}
+
+uint64_t RayCounters::TotalRays() const {
+	uint64_t total = 0;
+	for (int i = 0; i < RAY_TYPE_COUNT; i++) {
+		total += rays[i];
+	}
+	return total;
+}
+
+std::string RayCounters::ToJSON() const {
+	int deepest = 0;
+	for (int i = 0; i < max_depth; i++) {
+		if (depth[i]) {
+			deepest = i + 1;
+		}
+	}
+
+	std::ostringstream json;
+	json << "{\n";
+#ifdef RAY_STATISTICS
+	json << "  \"enabled\": true,\n";
+#else
+	json << "  \"enabled\": false,\n";
+#endif
+	json << "  \"rays\": {\n";
+	json << "    \"primary\": " << rays[RAY_PRIMARY] << ",\n";
+	json << "    \"shadow\": " << rays[RAY_SHADOW] << ",\n";
+	json << "    \"reflection\": " << rays[RAY_REFLECTION] << ",\n";
+	json << "    \"refraction\": " << rays[RAY_REFRACTION] << ",\n";
+	json << "    \"diffuse\": " << rays[RAY_DIFFUSE] << ",\n";
+	json << "    \"total\": " << TotalRays() << "\n";
+	json << "  },\n";
+	json << "  \"node_tests\": " << node_tests << ",\n";
+	json << "  \"primitive_tests\": " << primitive_tests << ",\n";
+	const double rayCount = static_cast<double>(TotalRays());
+	json << "  \"node_tests_per_ray\": " << (rayCount > 0 ? node_tests / rayCount : 0.0) << ",\n";
+	json << "  \"primitive_tests_per_ray\": " << (rayCount > 0 ? primitive_tests / rayCount : 0.0) << ",\n";
+	json << "  \"depth\": [";
+	for (int i = 0; i < deepest; i++) {
+		json << (i ? ", " : "") << depth[i];
+	}
+	json << "]\n";
+	json << "}\n";
+	return json.str();
+}
+
+RayCounters &RayStatistics::Local() {
+	thread_local RayCounters *counters = [] {
+		std::lock_guard<std::mutex> lock(registry_mutex);
+		registry.emplace_back(new RayCounters());
+		return registry.back().get();
+	}();
+	return *counters;
+}
+
+void RayStatistics::CountDepth(unsigned int depth) {
+	Local().depth[depth < RayCounters::max_depth ? depth : RayCounters::max_depth - 1]++;
+}
+
+uint64_t RayStatistics::TakePixelCost() {
+	RayCounters &counters = Local();
+	uint64_t cost = counters.pixel_cost;
+	counters.pixel_cost = 0;
+	return cost;
+}
+
+RayCounters RayStatistics::Totals() {
+	RayCounters totals;
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	for (const auto &counters : registry) {
+		totals.Add(*counters);
+	}
+	totals.pixel_cost = 0;
+	return totals;
+}
+
+void RayStatistics::Reset() {
+	std::lock_guard<std::mutex> lock(registry_mutex);
+	for (auto &counters : registry) {
+		*counters = RayCounters();
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Instrumentation is compiled in only with RAY_STATISTICS (premake5 --ray_stats), otherwise RAY_STAT drops its statement
+#ifdef RAY_STATISTICS
+#define RAY_STAT(statement) statement
+#else
+#define RAY_STAT(statement)
+#endif
+
+enum RayType {
+	RAY_PRIMARY,
+	RAY_SHADOW,
+	RAY_REFLECTION,
+	RAY_REFRACTION,
+	RAY_DIFFUSE,
+	RAY_TYPE_COUNT
+};
+
+// Counters of one thread. Each thread only writes its own, allocated apart and padded so no two share a cache line.
+class RayCounters
+{
+public:
+	static const int max_depth = 32;
+
+	uint64_t rays[RAY_TYPE_COUNT] = {};
+	// Bounding box tests of meshes and TLAS nodes
+	uint64_t node_tests = 0;
+	// Triangle, sphere and quad intersections
+	uint64_t primitive_tests = 0;
+	// Traced rays by recursion depth, 0 for the camera rays, the last bin takes everything deeper
+	uint64_t depth[max_depth] = {};
+	// Node and primitive tests since the last pixel was written, see RayStatistics::TakePixelCost
+	uint64_t pixel_cost = 0;
+
+	void Add(const RayCounters& other);
+	uint64_t TotalRays() const;
+	std::string ToJSON() const;
+
+private:
+	char padding[64] = {};
+};
+
+class RayStatistics
+{
+public:
+	// Counters of the calling thread, registered on its first use
+	static RayCounters& Local();
+	static void CountRay(RayType type) { Local().rays[type]++; };
+	static void CountDepth(unsigned int depth);
+	static void CountNodeTest() { RayCounters& counters = Local(); counters.node_tests++; counters.pixel_cost++; };
+	static void CountPrimitiveTest() { RayCounters& counters = Local(); counters.primitive_tests++; counters.pixel_cost++; };
+	// Batches tested by one kernel call
+	static void CountNodeTests(size_t count) { RayCounters& counters = Local(); counters.node_tests += count; counters.pixel_cost += count; };
+	static void CountPrimitiveTests(size_t count) { RayCounters& counters = Local(); counters.primitive_tests += count; counters.pixel_cost += count; };
+	// Work of the calling thread since its previous call, the pixel it just finished is charged with it
+	static uint64_t TakePixelCost();
+
+	// Sum over every thread that ever counted. Call between frames, while no thread is counting.
+	static RayCounters Totals();
+	static void Reset();
+};
@@ -1,45 +1,62 @@
 #include "reflection.h"
 
-Reflection::Reflection(short width, short height) :ShadowRays(width, height) {}
+Reflection::Reflection(int width, int height) :ShadowRays(width, height) {}
 
 Reflection::~Reflection() {}
 
-Payload Reflection::Hit(const Ray &ray, const IntersectableData &data, const MaterialTriangle *triangle, const unsigned int raytrace_depth) const {
+Payload Reflection::Hit(const Ray &ray, const IntersectableData &data, const MaterialSurface *surface, const unsigned int raytrace_depth) const {
 	if (raytrace_depth <= 0) {
 		return Miss(ray);
 	}
 
-	if (triangle == nullptr) {
+	if (surface == nullptr) {
 		return Miss(ray);
 	}
 
-	Payload payload;
-	payload.color = triangle->emissive_color;
-
-	float3 x = ray.position + ray.direction * data.t;
-	float3 normal = triangle->GetNormal(data.baricentric);
+	const Material &material = materials[surface->material_id];
 
-	if (triangle->reflectiveness) {
-		float3 reflectionDir = ray.direction - 2.0f * linalg::dot(normal, ray.direction) * normal;
-		Ray reflectionRay(x + reflectionDir * 0.001f, reflectionDir);
-		return TraceRay(reflectionRay, raytrace_depth - 1);
+	Payload payload;
+	payload.color = material.emissive_color;
+
+	float3 error;
+	float3 x = surface->GetHitPoint(data.baricentric, error) + data.offset;
+	float3 geoNormal = surface->GetGeometricNormal(data.baricentric);
+	float3 normal = surface->GetNormal(data.baricentric);
+	WriteAOVs(ray, data, surface, material);
+
+	switch (material.type) {
+		case BSDFType::Mirror:
+		{
+			float3 reflectionDir = ray.direction - 2.0f * linalg::dot(normal, ray.direction) * normal;
+			Ray reflectionRay(OffsetRayOrigin(x, error, geoNormal, reflectionDir), reflectionDir);
+			reflectionRay.Continue(ray, data.t);
+			RAY_STAT(RayStatistics::CountRay(RAY_REFLECTION));
+			Payload reflectionPayload = TraceRay(reflectionRay, raytrace_depth - 1);
+			if (ray.aov) {
+				ray.aov->Set(ray.aov_pixel, AOV_INDIRECT, reflectionPayload.color);
+			}
+			return reflectionPayload;
+		}
+		default:
+			break;
 	}
 
-	for (auto const &light : lights) {
-		Ray toLight(x, light->position - x);
-		float toLightDist = linalg::length(light->position - x);
+	float3 albedo = GetAlbedo(ray, data, surface, material);
+	for (size_t i = 0; i < lights.size(); i++) {
+		Ray toLight(OffsetRayOrigin(x, error, geoNormal, lights[i]->position - x), lights[i]->position - x);
+		toLight.time = ray.time;
+		float toLightDist = linalg::length(lights[i]->position - toLight.position);
 
 		float traceShadow = TraceShadowRay(toLight, toLightDist);
 		if (std::fabs(traceShadow - toLightDist) > 0.001f) {
 			continue;
 		}
 
-		payload.color += light->color * triangle->diffuse_color
-			* std::max(0.0f, linalg::dot(normal, toLight.direction));
-
-		float3 reflectionDir = 2.0f * linalg::dot(normal, toLight.direction) * normal - toLight.direction;
-		payload.color += light->color * triangle->specular_color
-			* std::powf(std::max(0.0f, linalg::dot(ray.direction, reflectionDir)), triangle->specular_exponent);
+		float3 contribution = material.Evaluate(normal, ray.direction, toLight.direction, lights[i]->color, albedo);
+		if (ray.aov) {
+			ray.aov->SetLight(ray.aov_pixel, i, contribution);
+		}
+		payload.color += contribution;
 	}
 
 	return payload;
@@ -5,8 +5,8 @@
 class Reflection: public ShadowRays
 {
 public:
-	Reflection(short width, short height);
+	Reflection(int width, int height);
 	virtual ~Reflection();
 protected:
-	virtual Payload Hit(const Ray& ray, const IntersectableData& data, const MaterialTriangle* triangle, const unsigned int max_raytrace_depth) const;
+	virtual Payload Hit(const Ray& ray, const IntersectableData& data, const MaterialSurface* surface, const unsigned int max_raytrace_depth) const;
 };
\ No newline at end of file
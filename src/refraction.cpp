@@ -1,105 +1,129 @@
 #include "refraction.h"
 
-Refraction::Refraction(short width, short height) :Reflection(width, height) {
+Refraction::Refraction(int width, int height) :Reflection(width, height) {
 	raytracing_depth = 5;
 }
 
 Refraction::~Refraction() {}
 
-Payload Refraction::Hit(const Ray &ray, const IntersectableData &data, const MaterialTriangle *triangle, const unsigned int raytrace_depth) const {
+Payload Refraction::Hit(const Ray &ray, const IntersectableData &data, const MaterialSurface *surface, const unsigned int raytrace_depth) const {
 	if (raytrace_depth <= 0) {
 		return Miss(ray);
 	}
 
-	if (triangle == nullptr) {
+	if (surface == nullptr) {
 		return Miss(ray);
 	}
 
+	const Material &material = materials[surface->material_id];
+
 	Payload payload;
-	payload.color = triangle->emissive_color;
+	payload.color = material.emissive_color;
+
+	float3 error;
+	float3 x = surface->GetHitPoint(data.baricentric, error) + data.offset;
+	float3 geoNormal = surface->GetGeometricNormal(data.baricentric);
+	float3 normal = surface->GetNormal(data.baricentric);
+	WriteAOVs(ray, data, surface, material);
+
+	switch (material.type) {
+		case BSDFType::Mirror:
+		{
+			float3 reflectionDir = ray.direction - 2.0f * linalg::dot(normal, ray.direction) * normal;
+			Ray reflectionRay(OffsetRayOrigin(x, error, geoNormal, reflectionDir), reflectionDir);
+			reflectionRay.Continue(ray, data.t);
+			RAY_STAT(RayStatistics::CountRay(RAY_REFLECTION));
+			Payload reflectionPayload = TraceRay(reflectionRay, raytrace_depth - 1);
+			if (ray.aov) {
+				ray.aov->Set(ray.aov_pixel, AOV_INDIRECT, reflectionPayload.color);
+			}
+			return reflectionPayload;
+		}
 
-	float3 x = ray.position + ray.direction * data.t;
-	float3 normal = triangle->GetNormal(data.baricentric);
+		case BSDFType::Dielectric:
+		{
+			float kr;
+			float cosIn = std::max(-1.0f, std::min(1.0f, linalg::dot(ray.direction, normal)));
+			float etaIn = 1.0f;
+			float etaTr = material.ior;
 
-	if (triangle->reflectiveness) {
-		float3 reflectionDir = ray.direction - 2.0f * linalg::dot(normal, ray.direction) * normal;
-		Ray reflectionRay(x + reflectionDir * 0.001f, reflectionDir);
-		return TraceRay(reflectionRay, raytrace_depth - 1);
-	}
+			if (cosIn > 0.0f) {
+				std::swap(etaIn, etaTr);
+			}
 
-	if (triangle->reflectiveness_and_transparency) {
-		float kr;
-		float cosIn = std::max(-1.0f, std::min(1.0f, linalg::dot(ray.direction, normal)));
-		float etaIn = 1.0f;
-		float etaTr = triangle->ior;
+			float sinTr = etaIn / etaTr * std::sqrt(std::max(0.0f, 1 - cosIn * cosIn));
+			if (sinTr >= 1.0f) {
+				kr = 1.0f;
+			} else {
+				float cosTr = std::sqrt(std::max(0.0f, 1 - sinTr * sinTr));
+				cosIn = std::fabs(cosIn);
+				float Rs = ((etaTr * cosIn) - (etaIn * cosTr)) / ((etaTr * cosIn) + (etaIn * cosTr));
+				float Rp = ((etaIn * cosIn) - (etaTr * cosTr)) / ((etaIn * cosIn) + (etaTr * cosTr));
+				kr = (Rs * Rs + Rp * Rp) / 2.0f;
+			}
 
-		if (cosIn > 0.0f) {
-			std::swap(etaIn, etaTr);
-		}
+			Payload refractionPayload;
 
-		float sinTr = etaIn / etaTr * std::sqrtf(std::max(0.0f, 1 - cosIn * cosIn));
-		if (sinTr >= 1.0f) {
-			kr = 1.0f;
-		} else {
-			float cosTr = std::sqrtf(std::max(0.0f, 1 - sinTr * sinTr));
-			cosIn = std::fabs(cosIn);
-			float Rs = ((etaTr * cosIn) - (etaIn * cosTr)) / ((etaTr * cosIn) + (etaIn * cosTr));
-			float Rp = ((etaIn * cosIn) - (etaTr * cosTr)) / ((etaIn * cosIn) + (etaTr * cosTr));
-			kr = (Rs * Rs + Rp * Rp) / 2.0f;
-		}
+			if (kr < 1.0f) {
+				float cosIn = std::max(-1.0f, std::min(1.0f, linalg::dot(ray.direction, normal)));
+				float etaIn = 1.0f;
+				float etaTr = material.ior;
 
-		bool outside = (linalg::dot(ray.direction, normal) < 0.0f);
-		float3 bias = 0.001f * normal;
-		Payload refractionPayload;
+				if (cosIn < 0.0f) {
+					cosIn = -cosIn;
+				} else {
+					std::swap(etaIn, etaTr);
+				}
 
-		if (kr < 1.0f) {
-			float cosIn = std::max(-1.0f, std::min(1.0f, linalg::dot(ray.direction, normal)));
-			float etaIn = 1.0f;
-			float etaTr = triangle->ior;
+				float eta = etaIn / etaTr;
+				float k = 1.0f - eta * eta * (1.0f - cosIn * cosIn);
+				float3 refractionDir = {0, 0, 0};
 
-			if (cosIn < 0.0f) {
-				cosIn = -cosIn;
-			} else {
-				std::swap(etaIn, etaTr);
+				if (k >= 0.0f) {
+					refractionDir = eta * ray.direction + (eta * cosIn - std::sqrt(k)) * normal;
+				}
+
+				Ray refractionRay(OffsetRayOrigin(x, error, geoNormal, refractionDir), refractionDir);
+				refractionRay.Continue(ray, data.t);
+				RAY_STAT(RayStatistics::CountRay(RAY_REFRACTION));
+				refractionPayload = TraceRay(refractionRay, raytrace_depth - 1);
 			}
 
-			float eta = etaIn / etaTr;
-			float k = 1.0f - eta * eta * (1.0f - cosIn * cosIn);
-			float3 refractionDir = {0, 0, 0};
+			float3 reflectionDir = ray.direction - 2.0f * linalg::dot(normal, ray.direction) * normal;
+			Ray reflectionRay(OffsetRayOrigin(x, error, geoNormal, reflectionDir), reflectionDir);
+			reflectionRay.Continue(ray, data.t);
+			RAY_STAT(RayStatistics::CountRay(RAY_REFLECTION));
+			Payload reflectionPayload = TraceRay(reflectionRay, raytrace_depth - 1);
 
-			if (k >= 0.0f) {
-				refractionDir = eta * ray.direction + (eta * cosIn - std::sqrtf(k)) * normal;
+			Payload combined;
+			combined.color = reflectionPayload.color * kr + refractionPayload.color * (1.0f - kr);
+			if (ray.aov) {
+				ray.aov->Set(ray.aov_pixel, AOV_INDIRECT, combined.color);
 			}
 
-			Ray refractionRay(outside ? x - bias : x + bias, refractionDir);
-			refractionPayload = TraceRay(refractionRay, raytrace_depth - 1);
+			return combined;
 		}
 
-		float3 reflectionDir = ray.direction - 2.0f * linalg::dot(normal, ray.direction) * normal;
-		Ray reflectionRay(outside ? x + bias : x - bias, reflectionDir);
-		Payload reflectionPayload = TraceRay(reflectionRay, raytrace_depth - 1);
-
-		Payload combined;
-		combined.color = reflectionPayload.color * kr + refractionPayload.color * (1.0f - kr);
-
-		return combined;
+		default:
+			break;
 	}
 
-	for (auto const &light : lights) {
-		Ray toLight(x, light->position - x);
-		float toLightDist = linalg::length(light->position - x);
+	float3 albedo = GetAlbedo(ray, data, surface, material);
+	for (size_t i = 0; i < lights.size(); i++) {
+		Ray toLight(OffsetRayOrigin(x, error, geoNormal, lights[i]->position - x), lights[i]->position - x);
+		toLight.time = ray.time;
+		float toLightDist = linalg::length(lights[i]->position - toLight.position);
 
 		float traceShadow = TraceShadowRay(toLight, toLightDist);
 		if (std::fabs(traceShadow - toLightDist) > 0.001f) {
 			continue;
 		}
 
-		payload.color += light->color * triangle->diffuse_color
-			* std::max(0.0f, linalg::dot(normal, toLight.direction));
-
-		float3 reflectionDir = 2.0f * linalg::dot(normal, toLight.direction) * normal - toLight.direction;
-		payload.color += light->color * triangle->specular_color
-			* std::powf(std::max(0.0f, linalg::dot(ray.direction, reflectionDir)), triangle->specular_exponent);
+		float3 contribution = material.Evaluate(normal, ray.direction, toLight.direction, lights[i]->color, albedo);
+		if (ray.aov) {
+			ray.aov->SetLight(ray.aov_pixel, i, contribution);
+		}
+		payload.color += contribution;
 	}
 
 	return payload;
@@ -0,0 +1,792 @@
+#include "render_job.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+static const char *pipeline_names[] = {"lighting", "shadow_rays", "reflection", "refraction", "anti_aliasing", "aabb", "bvh", "denoising"};
+
+static const char *tone_mapping_names[] = {"clamp", "reinhard", "aces"};
+
+static const char *aov_names[] = {"depth", "normal", "albedo", "material_id", "primitive_id", "lights", "indirect"};
+
+static const char *shape_names[] = {"sphere", "quad", "box"};
+
+// Image formats WriteImage knows
+static const char *output_extensions[] = {"png", "hdr", "pfm", "exr"};
+
+static std::string Trim(const std::string &text) {
+	const size_t first = text.find_first_not_of(" \t\r");
+	if (first == std::string::npos) {
+		return "";
+	}
+	return text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+}
+
+static std::vector<std::string> SplitWords(const std::string &text) {
+	std::istringstream stream(text);
+	std::vector<std::string> words;
+	std::string word;
+	while (stream >> word) {
+		words.push_back(word);
+	}
+	return words;
+}
+
+static bool ParseInt(const std::string &text, long long min, long long max, long long &value) {
+	errno = 0;
+	char *end = nullptr;
+	const long long parsed = std::strtoll(text.c_str(), &end, 10);
+	if (text.empty() || *end != '\0' || errno == ERANGE || parsed < min || parsed > max) {
+		return false;
+	}
+	value = parsed;
+	return true;
+}
+
+static bool ParseUnsigned(const std::string &text, unsigned int &value) {
+	long long parsed;
+	if (!ParseInt(text, 0, std::numeric_limits<unsigned int>::max(), parsed)) {
+		return false;
+	}
+	value = static_cast<unsigned int>(parsed);
+	return true;
+}
+
+static bool ParseFloat(const std::string &text, float &value) {
+	char *end = nullptr;
+	const float parsed = std::strtof(text.c_str(), &end);
+	if (text.empty() || *end != '\0') {
+		return false;
+	}
+	value = parsed;
+	return true;
+}
+
+static bool ParseDouble(const std::string &text, double &value) {
+	char *end = nullptr;
+	const double parsed = std::strtod(text.c_str(), &end);
+	if (text.empty() || *end != '\0') {
+		return false;
+	}
+	value = parsed;
+	return true;
+}
+
+static bool ParseFloat3(const std::string &text, float3 &value) {
+	const std::vector<std::string> words = SplitWords(text);
+	if (words.size() != 3) {
+		return false;
+	}
+	for (int i = 0; i < 3; i++) {
+		if (!ParseFloat(words[i], value[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+template <size_t Count>
+static int FindName(const char *(&names)[Count], const std::string &name) {
+	for (size_t i = 0; i < Count; i++) {
+		if (name == names[i]) {
+			return static_cast<int>(i);
+		}
+	}
+	return -1;
+}
+
+bool SetRenderJobKey(RenderJob &job, const std::string &key, const std::string &value, std::string &error) {
+	long long number = 0;
+	bool valid = true;
+	if (key == "name") {
+		job.name = value;
+	} else if (key == "pipeline") {
+		const int pipeline = FindName(pipeline_names, value);
+		valid = pipeline >= 0;
+		job.pipeline = valid ? static_cast<RenderPipeline>(pipeline) : job.pipeline;
+	} else if (key == "model") {
+		job.model = value;
+	} else if (key == "width" || key == "height") {
+		// Any size whose pixels can be indexed, the buffers are addressed with size_t
+		valid = ParseInt(value, 1, std::numeric_limits<int>::max(), number);
+		if (valid) {
+			(key == "width" ? job.width : job.height) = static_cast<int>(number);
+		}
+	} else if (key == "spp") {
+		valid = ParseUnsigned(value, job.spp);
+	} else if (key == "sampling") {
+		valid = value == "fixed" || value == "adaptive";
+		job.adaptive_sampling = value == "adaptive";
+	} else if (key == "depth") {
+		valid = ParseUnsigned(value, job.depth);
+	} else if (key == "lods") {
+		valid = ParseUnsigned(value, job.lods);
+	} else if (key == "filter_iterations") {
+		valid = ParseUnsigned(value, job.filter_iterations);
+	} else if (key == "blue_noise") {
+		job.blue_noise = value;
+	} else if (key == "tile_size") {
+		valid = ParseInt(value, 0, std::numeric_limits<int>::max(), number);
+		job.tile_size = static_cast<int>(number);
+	} else if (key == "threads") {
+		valid = ParseInt(value, 0, std::numeric_limits<int>::max(), number);
+		job.threads = static_cast<int>(number);
+	} else if (key == "tone_mapping") {
+		const int tone_mapping = FindName(tone_mapping_names, value);
+		valid = tone_mapping >= 0;
+		job.tone_mapping = valid ? static_cast<ToneMapping>(tone_mapping) : job.tone_mapping;
+	} else if (key == "exposure") {
+		valid = ParseFloat(value, job.exposure);
+	} else if (key == "gamma") {
+		valid = ParseFloat(value, job.gamma) && job.gamma > 0.0f;
+	} else if (key == "aovs") {
+		job.aovs = 0;
+		for (const auto &name : SplitWords(value)) {
+			const int channel = FindName(aov_names, name);
+			if (name == "all") {
+				job.aovs = AOV_ALL;
+			} else if (channel >= 0) {
+				job.aovs |= 1u << channel;
+			} else {
+				valid = false;
+			}
+		}
+	} else if (key == "aperture") {
+		valid = ParseFloat(value, job.aperture_radius) && job.aperture_radius >= 0.0f;
+	} else if (key == "focus_distance") {
+		valid = ParseFloat(value, job.focus_distance) && job.focus_distance > 0.0f;
+	} else if (key == "shutter") {
+		const std::vector<std::string> words = SplitWords(value);
+		valid = words.size() == 2 && ParseFloat(words[0], job.shutter_open) && ParseFloat(words[1], job.shutter_close) &&
+			job.shutter_open >= 0.0f && job.shutter_open <= job.shutter_close && job.shutter_close <= 1.0f;
+	} else if (key == "memory_budget") {
+		double megabytes = 0.0;
+		valid = ParseDouble(value, megabytes) && megabytes >= 0.0;
+		job.memory_budget = static_cast<size_t>(megabytes * 1024.0 * 1024.0);
+	} else if (key == "crop") {
+		const std::vector<std::string> words = SplitWords(value);
+		long long corners[4] = {};
+		valid = words.size() == 4;
+		for (size_t i = 0; valid && i < 4; i++) {
+			valid = ParseInt(words[i], 0, std::numeric_limits<int>::max(), corners[i]);
+		}
+		valid = valid && corners[2] > corners[0] && corners[3] > corners[1];
+		if (valid) {
+			job.crop.x0 = static_cast<int>(corners[0]);
+			job.crop.y0 = static_cast<int>(corners[1]);
+			job.crop.x1 = static_cast<int>(corners[2]);
+			job.crop.y1 = static_cast<int>(corners[3]);
+		}
+	} else {
+		error = "unknown key " + key;
+		return false;
+	}
+
+	if (!valid) {
+		error = "invalid " + key + " '" + value + "'";
+	}
+	return valid;
+}
+
+static bool SetLightKey(ViewLight &light, const std::string &key, const std::string &value, std::string &error) {
+	if (key != "position" && key != "color") {
+		error = "unknown light key " + key;
+		return false;
+	}
+	if (!ParseFloat3(value, key == "position" ? light.position : light.color)) {
+		error = "invalid " + key + " '" + value + "', expected three numbers";
+		return false;
+	}
+	return true;
+}
+
+static bool SetPrimitiveKey(RenderJobPrimitive &primitive, const std::string &key, const std::string &value, std::string &error) {
+	const bool sphere = primitive.shape == PrimitiveShape::Sphere;
+	long long number = 0;
+	bool valid = true;
+	if (key == "center" && sphere) {
+		valid = ParseFloat3(value, primitive.center);
+	} else if (key == "radius" && sphere) {
+		valid = ParseFloat(value, primitive.radius) && primitive.radius > 0.0f;
+	} else if ((key == "min" || key == "max") && !sphere) {
+		valid = ParseFloat3(value, key == "min" ? primitive.min : primitive.max);
+	} else if (key == "flip" && primitive.shape == PrimitiveShape::Quad) {
+		valid = value == "true" || value == "false";
+		primitive.flip_normal = value == "true";
+	} else if (key == "illum") {
+		valid = ParseInt(value, 0, 10, number);
+		primitive.illum = static_cast<int>(number);
+	} else if (key == "diffuse" || key == "specular" || key == "emissive") {
+		valid = ParseFloat3(value, key == "diffuse" ? primitive.diffuse : key == "specular" ? primitive.specular : primitive.emissive);
+	} else if (key == "shininess") {
+		valid = ParseFloat(value, primitive.shininess);
+	} else if (key == "ior") {
+		valid = ParseFloat(value, primitive.ior) && primitive.ior > 0.0f;
+	} else {
+		error = "unknown " + std::string(shape_names[static_cast<int>(primitive.shape)]) + " key " + key;
+		return false;
+	}
+
+	if (!valid) {
+		error = "invalid " + key + " '" + value + "'";
+	}
+	return valid;
+}
+
+// The axis a quad faces, the only one its corners share. -1 unless the other two span a rectangle.
+static int QuadAxis(const RenderJobPrimitive &quad) {
+	int axis = -1;
+	for (int i = 0; i < 3; i++) {
+		if (quad.min[i] == quad.max[i]) {
+			if (axis >= 0) {
+				return -1;
+			}
+			axis = i;
+		} else if (quad.min[i] > quad.max[i]) {
+			return -1;
+		}
+	}
+	return axis;
+}
+
+static bool SetViewKey(RenderJobView &view, const std::string &key, const std::string &value, std::string &error) {
+	if (key == "position" || key == "direction" || key == "up") {
+		float3 &vector = key == "position" ? view.position : key == "direction" ? view.direction : view.up;
+		if (!ParseFloat3(value, vector)) {
+			error = "invalid " + key + " '" + value + "', expected three numbers";
+			return false;
+		}
+		return true;
+	}
+	if (key == "output" || key == "aov_output") {
+		const std::vector<std::string> files = SplitWords(value);
+		for (const auto &file : files) {
+			const std::string extension = FileExtension(file);
+			if (FindName(output_extensions, extension) < 0 || (key == "aov_output" && extension != "exr")) {
+				error = "unsupported format of " + file;
+				return false;
+			}
+		}
+		if (key == "output") {
+			view.outputs.insert(view.outputs.end(), files.begin(), files.end());
+		} else if (files.size() == 1) {
+			view.aov_output = files.front();
+		} else {
+			error = "aov_output takes one file";
+			return false;
+		}
+		return true;
+	}
+	error = "unknown view key " + key;
+	return false;
+}
+
+// Whole-job checks once its last section is read
+static bool CheckJob(const RenderJob &job, bool outputs_required, std::string &error) {
+	if (job.model.empty()) {
+		error = job.name + " has no model";
+		return false;
+	}
+	if (job.views.empty()) {
+		error = job.name + " has no [view]";
+		return false;
+	}
+	for (const auto &view : job.views) {
+		if (outputs_required && view.outputs.empty()) {
+			error = "a view of " + job.name + " has no output";
+			return false;
+		}
+	}
+	const unsigned long long pixels = static_cast<unsigned long long>(job.width) * static_cast<unsigned long long>(job.height);
+	if (pixels > std::numeric_limits<size_t>::max() / sizeof(float3)) {
+		error = job.name + " has more pixels than this build can address";
+		return false;
+	}
+	if (job.crop.x1 > job.width || job.crop.y1 > job.height) {
+		error = "the crop of " + job.name + " reaches outside the frame";
+		return false;
+	}
+	if (!job.primitives.empty() && job.pipeline < RenderPipeline::AABB) {
+		error = job.name + ": spheres, quads and boxes need the aabb pipeline or one after it";
+		return false;
+	}
+	for (const auto &primitive : job.primitives) {
+		if (primitive.shape == PrimitiveShape::Quad && QuadAxis(primitive) < 0) {
+			error = "a quad of " + job.name + " does not have corners equal along exactly one axis";
+			return false;
+		}
+		if (primitive.shape == PrimitiveShape::Box && !(primitive.min.x < primitive.max.x && primitive.min.y < primitive.max.y && primitive.min.z < primitive.max.z)) {
+			error = "a box of " + job.name + " has a max corner not above its min corner";
+			return false;
+		}
+	}
+	return true;
+}
+
+int LoadRenderJobs(const std::string &filename, std::vector<RenderJob> &jobs) {
+	std::ifstream file(filename);
+	if (!file) {
+		std::cerr << "Could not open " << filename << std::endl;
+		return -1;
+	}
+
+	std::string error;
+	if (ParseRenderJobs(file, filename, jobs, error) != 0) {
+		std::cerr << error << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+int LoadRenderJobs(const std::vector<std::string> &filenames, const std::vector<std::string> &overrides, std::vector<RenderJob> &jobs) {
+	for (const auto &filename : filenames) {
+		if (LoadRenderJobs(filename, jobs) != 0) {
+			return -1;
+		}
+	}
+	for (const auto &setting : overrides) {
+		const size_t equals = setting.find('=');
+		std::string error = "expected key=value";
+		for (auto &job : jobs) {
+			if (equals == std::string::npos || !SetRenderJobKey(job, setting.substr(0, equals), setting.substr(equals + 1), error)) {
+				std::cerr << "--set " << setting << ": " << error << std::endl;
+				return -1;
+			}
+		}
+	}
+	return 0;
+}
+
+int ParseRenderJobs(std::istream &stream, const std::string &source, std::vector<RenderJob> &jobs, std::string &error,
+	bool outputs_required) {
+	enum Section { NONE, DEFAULTS, JOB, LIGHT, VIEW, PRIMITIVE };
+	Section section = NONE;
+	RenderJob defaults;
+	std::vector<RenderJob> loaded;
+	std::string line;
+	int lineNumber = 0;
+	int jobLine = 0;
+
+	auto fail = [&](int at) {
+		error = source + ":" + std::to_string(at) + ": " + error;
+		return -1;
+	};
+
+	while (std::getline(stream, line)) {
+		lineNumber++;
+		line = Trim(line.substr(0, line.find('#')));
+		if (line.empty()) {
+			continue;
+		}
+
+		if (line.front() == '[' && line.back() == ']') {
+			const std::string name = Trim(line.substr(1, line.size() - 2));
+			if (name == "defaults") {
+				section = DEFAULTS;
+			} else if (name == "job") {
+				if (!loaded.empty() && !CheckJob(loaded.back(), outputs_required, error)) {
+					return fail(jobLine);
+				}
+				loaded.push_back(defaults);
+				loaded.back().name = "job " + std::to_string(loaded.size());
+				jobLine = lineNumber;
+				section = JOB;
+			} else if ((name == "light" || name == "view") && !loaded.empty()) {
+				section = name == "light" ? LIGHT : VIEW;
+				if (section == LIGHT) {
+					loaded.back().lights.push_back(ViewLight {float3 {0.0f, 0.0f, 0.0f}, float3 {1.0f, 1.0f, 1.0f}});
+				} else {
+					loaded.back().views.push_back(RenderJobView());
+				}
+			} else if (FindName(shape_names, name) >= 0 && !loaded.empty()) {
+				section = PRIMITIVE;
+				loaded.back().primitives.push_back(RenderJobPrimitive());
+				loaded.back().primitives.back().shape = static_cast<PrimitiveShape>(FindName(shape_names, name));
+			} else {
+				const bool nested = name == "light" || name == "view" || FindName(shape_names, name) >= 0;
+				error = nested ? "[" + name + "] before any [job]" : "unknown section [" + name + "]";
+				return fail(lineNumber);
+			}
+			continue;
+		}
+
+		const size_t equals = line.find('=');
+		if (equals == std::string::npos) {
+			error = "expected key = value";
+			return fail(lineNumber);
+		}
+		const std::string key = Trim(line.substr(0, equals));
+		const std::string value = Trim(line.substr(equals + 1));
+
+		bool valid = false;
+		switch (section) {
+			case DEFAULTS:
+				valid = SetRenderJobKey(defaults, key, value, error);
+				break;
+			case JOB:
+				valid = SetRenderJobKey(loaded.back(), key, value, error);
+				break;
+			case LIGHT:
+				valid = SetLightKey(loaded.back().lights.back(), key, value, error);
+				break;
+			case VIEW:
+				valid = SetViewKey(loaded.back().views.back(), key, value, error);
+				break;
+			case PRIMITIVE:
+				valid = SetPrimitiveKey(loaded.back().primitives.back(), key, value, error);
+				break;
+			default:
+				error = key + " outside of a section";
+				break;
+		}
+		if (!valid) {
+			return fail(lineNumber);
+		}
+	}
+
+	if (loaded.empty()) {
+		error = "no [job]";
+		return fail(lineNumber);
+	}
+	if (!CheckJob(loaded.back(), outputs_required, error)) {
+		return fail(jobLine);
+	}
+
+	jobs.insert(jobs.end(), loaded.begin(), loaded.end());
+	return 0;
+}
+
+static void WriteFloat3(std::ostream &stream, const float3 &value) {
+	stream << value.x << " " << value.y << " " << value.z;
+}
+
+std::string FormatRenderJob(const RenderJob &job) {
+	std::ostringstream text;
+	// Enough digits that every float reads back unchanged
+	text << std::setprecision(std::numeric_limits<float>::max_digits10);
+	text << "[job]\n";
+	text << "name = " << job.name << "\n";
+	text << "pipeline = " << pipeline_names[static_cast<int>(job.pipeline)] << "\n";
+	text << "model = " << job.model << "\n";
+	text << "width = " << job.width << "\n";
+	text << "height = " << job.height << "\n";
+	text << "spp = " << job.spp << "\n";
+	text << "sampling = " << (job.adaptive_sampling ? "adaptive" : "fixed") << "\n";
+	if (job.depth > 0) {
+		text << "depth = " << job.depth << "\n";
+	}
+	text << "lods = " << job.lods << "\n";
+	text << "filter_iterations = " << job.filter_iterations << "\n";
+	text << "blue_noise = " << job.blue_noise << "\n";
+	text << "tile_size = " << job.tile_size << "\n";
+	text << "threads = " << job.threads << "\n";
+	text << "tone_mapping = " << tone_mapping_names[static_cast<int>(job.tone_mapping)] << "\n";
+	text << "exposure = " << job.exposure << "\n";
+	text << "gamma = " << job.gamma << "\n";
+	if (job.aovs) {
+		text << "aovs =";
+		for (size_t i = 0; i < sizeof(aov_names) / sizeof(aov_names[0]); i++) {
+			if (job.aovs & (1u << i)) {
+				text << " " << aov_names[i];
+			}
+		}
+		text << "\n";
+	}
+	text << "aperture = " << job.aperture_radius << "\n";
+	text << "focus_distance = " << job.focus_distance << "\n";
+	text << "shutter = " << job.shutter_open << " " << job.shutter_close << "\n";
+	text << "memory_budget = " << std::setprecision(std::numeric_limits<double>::max_digits10)
+		<< static_cast<double>(job.memory_budget) / (1024.0 * 1024.0) << std::setprecision(std::numeric_limits<float>::max_digits10) << "\n";
+	if (job.crop.Width() > 0) {
+		text << "crop = " << job.crop.x0 << " " << job.crop.y0 << " " << job.crop.x1 << " " << job.crop.y1 << "\n";
+	}
+
+	for (const auto &light : job.lights) {
+		text << "[light]\nposition = ";
+		WriteFloat3(text, light.position);
+		text << "\ncolor = ";
+		WriteFloat3(text, light.color);
+		text << "\n";
+	}
+	text << FormatRenderPrimitives(job);
+	for (const auto &view : job.views) {
+		text << "[view]\nposition = ";
+		WriteFloat3(text, view.position);
+		text << "\ndirection = ";
+		WriteFloat3(text, view.direction);
+		text << "\nup = ";
+		WriteFloat3(text, view.up);
+		text << "\n";
+		if (!view.outputs.empty()) {
+			text << "output =";
+			for (const auto &output : view.outputs) {
+				text << " " << output;
+			}
+			text << "\n";
+		}
+		if (!view.aov_output.empty()) {
+			text << "aov_output = " << view.aov_output << "\n";
+		}
+	}
+	return text.str();
+}
+
+std::string FormatRenderPrimitives(const RenderJob &job) {
+	std::ostringstream text;
+	text << std::setprecision(std::numeric_limits<float>::max_digits10);
+	for (const auto &primitive : job.primitives) {
+		text << "[" << shape_names[static_cast<int>(primitive.shape)] << "]\n";
+		if (primitive.shape == PrimitiveShape::Sphere) {
+			text << "center = ";
+			WriteFloat3(text, primitive.center);
+			text << "\nradius = " << primitive.radius << "\n";
+		} else {
+			text << "min = ";
+			WriteFloat3(text, primitive.min);
+			text << "\nmax = ";
+			WriteFloat3(text, primitive.max);
+			text << "\n";
+		}
+		if (primitive.shape == PrimitiveShape::Quad) {
+			text << "flip = " << (primitive.flip_normal ? "true" : "false") << "\n";
+		}
+		text << "illum = " << primitive.illum << "\ndiffuse = ";
+		WriteFloat3(text, primitive.diffuse);
+		text << "\nspecular = ";
+		WriteFloat3(text, primitive.specular);
+		text << "\nemissive = ";
+		WriteFloat3(text, primitive.emissive);
+		text << "\nshininess = " << primitive.shininess << "\nior = " << primitive.ior << "\n";
+	}
+	return text.str();
+}
+
+template <class Pipeline>
+static Pipeline *Create(PipelineInstance &instance, const RenderJob &job) {
+	Pipeline *render = new Pipeline(job.width, job.height);
+	instance.render.reset(render);
+	return render;
+}
+
+static PipelineInstance CreatePipeline(const RenderJob &job) {
+	PipelineInstance instance;
+	switch (job.pipeline) {
+		case RenderPipeline::Lighting:
+			Create<Lighting>(instance, job);
+			break;
+		case RenderPipeline::ShadowRays:
+			Create<ShadowRays>(instance, job);
+			break;
+		case RenderPipeline::Reflection:
+			Create<Reflection>(instance, job);
+			break;
+		case RenderPipeline::Refraction:
+			Create<Refraction>(instance, job);
+			break;
+		case RenderPipeline::AntiAliasing:
+			instance.anti_aliasing = Create<AntiAliasing>(instance, job);
+			break;
+		case RenderPipeline::AABB:
+			instance.aabb = Create<AABB>(instance, job);
+			instance.anti_aliasing = instance.aabb;
+			break;
+		case RenderPipeline::BVH:
+			instance.bvh = Create<BVH>(instance, job);
+			instance.aabb = instance.bvh;
+			instance.anti_aliasing = instance.bvh;
+			break;
+		case RenderPipeline::Denoising:
+			instance.denoising = Create<Denoising>(instance, job);
+			instance.aabb = instance.denoising;
+			instance.anti_aliasing = instance.denoising;
+			break;
+	}
+	instance.default_depth = instance.render->GetRaytracingDepth();
+	return instance;
+}
+
+std::unique_ptr<PipelineInstance> LoadRenderScene(const RenderJob &job) {
+	std::unique_ptr<PipelineInstance> pipeline(new PipelineInstance(CreatePipeline(job)));
+	Lighting &render = *pipeline->render;
+
+	render.SetMemoryBudget(job.memory_budget);
+	if (render.LoadGeometry(job.model) != 0) {
+		std::cerr << job.name << ": could not load " << job.model << std::endl;
+		return nullptr;
+	}
+	for (const auto &primitive : job.primitives) {
+		const Material material(primitive.illum, primitive.emissive, float3 {0.0f, 0.0f, 0.0f}, primitive.diffuse, primitive.specular,
+			primitive.shininess, primitive.ior);
+		if (primitive.shape == PrimitiveShape::Sphere) {
+			pipeline->aabb->AddSphere(primitive.center, primitive.radius, material);
+		} else if (primitive.shape == PrimitiveShape::Box) {
+			pipeline->aabb->AddBox(primitive.min, primitive.max, material);
+		} else {
+			// The quad's rectangle is given in the two axes after the one it faces, as AABB::AddBox builds its faces
+			const int axis = QuadAxis(primitive);
+			const int u = (axis + 1) % 3;
+			const int v = (axis + 2) % 3;
+			pipeline->aabb->AddQuad(axis, primitive.min[axis], float2 {primitive.min[u], primitive.min[v]},
+				float2 {primitive.max[u], primitive.max[v]}, primitive.flip_normal, material);
+		}
+	}
+	if (pipeline->aabb && job.lods > 0) {
+		pipeline->aabb->BuildLODs(job.lods);
+	}
+	if (pipeline->bvh && pipeline->bvh->BuildBVH() != 0) {
+		std::cerr << job.name << ": could not build the BVH" << std::endl;
+		return nullptr;
+	}
+	if (pipeline->denoising && pipeline->denoising->LoadBlueNoise(job.blue_noise) != 0) {
+		return nullptr;
+	}
+	return pipeline;
+}
+
+int ApplyRenderJobSettings(PipelineInstance &pipeline, const RenderJob &job) {
+	Lighting &render = *pipeline.render;
+#ifdef _OPENMP
+	if (job.threads > 0) {
+		omp_set_num_threads(job.threads);
+	}
+#endif
+	if (pipeline.anti_aliasing && job.spp > 0) {
+		pipeline.anti_aliasing->SetSampling(job.adaptive_sampling, job.spp);
+	} else if (pipeline.anti_aliasing) {
+		pipeline.anti_aliasing->SetSampling(job.adaptive_sampling);
+	}
+	if (pipeline.denoising) {
+		pipeline.denoising->SetFramesPerView(job.spp > 0 ? job.spp : Denoising::default_frames_per_view);
+		pipeline.denoising->SetFilterIterations(job.filter_iterations);
+	}
+	render.SetRaytracingDepth(job.depth > 0 ? job.depth : pipeline.default_depth);
+	render.SetToneMapping(job.tone_mapping, job.exposure, job.gamma);
+	render.SetAOVs(job.aovs);
+	render.SetLens(job.aperture_radius, job.focus_distance);
+	render.SetShutter(job.shutter_open, job.shutter_close);
+	const int cleared = render.GetWidth() != job.width || render.GetHeight() != job.height ?
+		render.SetResolution(job.width, job.height) : render.Clear();
+	if (cleared != 0) {
+		std::cerr << job.name << ": the frame does not fit the memory budget" << std::endl;
+		return -1;
+	}
+	return 0;
+}
+
+void ApplyRenderJobView(PipelineInstance &pipeline, const RenderJob &job, size_t view) {
+	RenderView settings;
+	settings.position = job.views[view].position;
+	settings.direction = job.views[view].direction;
+	settings.up = job.views[view].up;
+	settings.lights = job.lights;
+	pipeline.render->SetView(settings);
+}
+
+PixelWindow RenderJobWindow(const RenderJob &job) {
+	if (job.crop.Width() > 0) {
+		return job.crop;
+	}
+	PixelWindow frame;
+	frame.x1 = job.width;
+	frame.y1 = job.height;
+	return frame;
+}
+
+// Tiles of the job's window in scanline order. Denoising accumulates every tile from an empty history and resolves
+// the merged frame once, as a distributed render does, so the filter sees across tile edges.
+static void RenderTiles(const PipelineInstance &pipeline, const RenderJob &job) {
+	const PixelWindow frame = RenderJobWindow(job);
+	std::vector<PixelWindow> windows;
+	for (int y = frame.y0; y < frame.y1; y += job.tile_size) {
+		for (int x = frame.x0; x < frame.x1; x += job.tile_size) {
+			PixelWindow window;
+			window.x0 = x;
+			window.y0 = y;
+			window.x1 = x + std::min(job.tile_size, frame.x1 - x);
+			window.y1 = y + std::min(job.tile_size, frame.y1 - y);
+			windows.push_back(window);
+		}
+	}
+
+	std::vector<AccumulationTile> tiles;
+	for (size_t i = 0; i < windows.size(); i++) {
+		const PixelWindow &window = windows[i];
+		if (pipeline.denoising) {
+			tiles.emplace_back();
+			pipeline.denoising->AccumulateTile(window, pipeline.denoising->GetFramesPerView(), 0, tiles.back());
+		} else {
+			pipeline.render->SetCropWindow(window.x0, window.y0, window.x1, window.y1);
+			pipeline.render->DrawScene();
+		}
+		std::cout << "\rTile " << i + 1 << "/" << windows.size() << std::flush;
+	}
+	std::cout << std::endl;
+
+	if (pipeline.denoising) {
+		pipeline.denoising->ResetAccumulation();
+		for (const auto &tile : tiles) {
+			pipeline.denoising->MergeTile(tile);
+		}
+		pipeline.denoising->ResolveAccumulation();
+	}
+	if (job.crop.Width() > 0) {
+		pipeline.render->SetCropWindow(frame.x0, frame.y0, frame.x1, frame.y1);
+	} else {
+		pipeline.render->ResetCrop();
+	}
+}
+
+int RunRenderJob(const RenderJob &job) {
+	if (job.spp > 1 && job.pipeline < RenderPipeline::AntiAliasing) {
+		std::cerr << job.name << ": " << pipeline_names[static_cast<int>(job.pipeline)] << " traces one sample per pixel, spp is ignored" << std::endl;
+	}
+
+	std::unique_ptr<PipelineInstance> pipeline = LoadRenderScene(job);
+	if (!pipeline) {
+		return -1;
+	}
+	if (ApplyRenderJobSettings(*pipeline, job) != 0) {
+		return -1;
+	}
+	Lighting &render = *pipeline->render;
+	if (job.crop.Width() > 0) {
+		render.SetCropWindow(job.crop.x0, job.crop.y0, job.crop.x1, job.crop.y1);
+	}
+
+	int result = 0;
+	for (size_t v = 0; v < job.views.size(); v++) {
+		const RenderJobView &view = job.views[v];
+		auto start = std::chrono::steady_clock::now();
+		ApplyRenderJobView(*pipeline, job, v);
+		if (job.tile_size > 0) {
+			RenderTiles(*pipeline, job);
+		} else {
+			render.DrawScene();
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << job.name << ", view " << v + 1 << "/" << job.views.size() << ": " << job.width << "x" << job.height
+			<< " in " << elapsed.count() << " s" << std::endl;
+
+		for (const auto &output : view.outputs) {
+			if (render.Save(output) != 0) {
+				std::cerr << job.name << ": could not write " << output << std::endl;
+				result = -1;
+			}
+		}
+		if (job.aovs && !view.aov_output.empty() && render.SaveAOVs(view.aov_output) != 0) {
+			std::cerr << job.name << ": could not write " << view.aov_output << std::endl;
+			result = -1;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include "bvh.h"
+#include "denoising.h"
+
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Renderers a job can run, each one adding a feature to the one before
+enum class RenderPipeline { Lighting, ShadowRays, Reflection, Refraction, AntiAliasing, AABB, BVH, Denoising };
+
+class RenderJobView
+{
+public:
+	float3 position {0.0f, 0.0f, 0.0f};
+	float3 direction {0.0f, 0.0f, -1.0f};
+	float3 up {0.0f, 1.0f, 0.0f};
+	// The frame is saved to each, the format following the extension
+	std::vector<std::string> outputs;
+	// OpenEXR file of the AOVs, written when the job asks for any
+	std::string aov_output;
+};
+
+enum class PrimitiveShape { Sphere, Quad, Box };
+
+// Analytic shape added to the model's meshes, see AABB::AddSphere. Needs the aabb pipeline or one after it.
+class RenderJobPrimitive
+{
+public:
+	PrimitiveShape shape = PrimitiveShape::Sphere;
+	float3 center {0.0f, 0.0f, 0.0f};
+	float radius = 1.0f;
+	// Opposite corners of a box. Those of a quad are equal along the axis it faces, its normal points
+	// towards that axis unless flipped.
+	float3 min {0.0f, 0.0f, 0.0f};
+	float3 max {1.0f, 1.0f, 1.0f};
+	bool flip_normal = false;
+	// Material with the meaning of the MTL keys illum, Kd, Ks, Ke, Ns and Ni
+	int illum = 2;
+	float3 diffuse {0.5f, 0.5f, 0.5f};
+	float3 specular {0.0f, 0.0f, 0.0f};
+	float3 emissive {0.0f, 0.0f, 0.0f};
+	float shininess = 1.0f;
+	float ior = 1.0f;
+};
+
+// One scene loaded once and rendered from each of its views
+class RenderJob
+{
+public:
+	std::string name;
+	RenderPipeline pipeline = RenderPipeline::BVH;
+	std::string model;
+	int width = 1920;
+	int height = 1080;
+	// Frames accumulated by Denoising, the most samples per pixel of AntiAliasing and the pipelines after it
+	// (rounded to a square grid, see AntiAliasing::SetSampling).
+	// 0 keeps the pipeline's default.
+	unsigned int spp = 0;
+	bool adaptive_sampling = true;
+	// Bounces after the primary ray, 0 keeps the pipeline's default
+	unsigned int depth = 0;
+	unsigned int lods = 0;
+	unsigned int filter_iterations = 5;
+	std::string blue_noise = "textures/blue-noise.png";
+	// Pixels on a side of the tiles the frame is rendered in, 0 renders it whole
+	int tile_size = 0;
+	// OpenMP threads, 0 keeps the default
+	int threads = 0;
+	ToneMapping tone_mapping = ToneMapping::Clamp;
+	float exposure = 1.0f;
+	float gamma = 1.0f;
+	unsigned int aovs = 0;
+	float aperture_radius = 0.0f;
+	float focus_distance = 1.0f;
+	float shutter_open = 0.0f;
+	float shutter_close = 0.0f;
+	size_t memory_budget = 0;
+	// Only these pixels are traced, the rest of the frame stays black. Empty renders the whole frame.
+	PixelWindow crop;
+
+	std::vector<ViewLight> lights;
+	std::vector<RenderJobPrimitive> primitives;
+	std::vector<RenderJobView> views;
+};
+
+// Reads the jobs of a scene description file and appends them to jobs. The file is a list of sections:
+//
+//   # Keys here are the starting point of every later job
+//   [defaults]
+//   width = 3840
+//   [job]
+//   name = mirror
+//   pipeline = denoising
+//   model = models/CornellBox-Mirror.obj
+//   spp = 16
+//   [light]
+//   position = 0 1.98 -0.06
+//   color = 0.78 0.78 0.78
+//   [sphere]
+//   center = 0.3 0.3 -0.2
+//   radius = 0.3
+//   illum = 5
+//   [view]
+//   position = -0.5 0.99 1.5
+//   direction = 0 0.99 -1
+//   output = results/mirror.png results/mirror.exr
+//
+// [light], [view], [sphere], [quad] and [box] sections belong to the [job] above them. Errors are printed with their
+// line, -1 is returned and jobs is left as it was.
+int LoadRenderJobs(const std::string& filename, std::vector<RenderJob>& jobs);
+// Jobs of every file in order, then each key=value of overrides set in all of them as SetRenderJobKey does.
+// -1 after printing the first error.
+int LoadRenderJobs(const std::vector<std::string>& filenames, const std::vector<std::string>& overrides, std::vector<RenderJob>& jobs);
+// LoadRenderJobs from text, source names it in the "source:line: message" of error.
+// Views without an output are accepted unless outputs_required.
+int ParseRenderJobs(std::istream& stream, const std::string& source, std::vector<RenderJob>& jobs, std::string& error,
+	bool outputs_required = true);
+// Text of one [job] with its lights, primitives and views, which ParseRenderJobs reads back into the same job
+std::string FormatRenderJob(const RenderJob& job);
+// Only the [sphere], [quad] and [box] sections of the job
+std::string FormatRenderPrimitives(const RenderJob& job);
+// Sets one [job] key, as in the file. False with a message in error for unknown keys and bad values.
+bool SetRenderJobKey(RenderJob& job, const std::string& key, const std::string& value, std::string& error);
+
+// The job's renderer, with pointers to the classes along its pipeline that add the steps a job may need
+class PipelineInstance
+{
+public:
+	std::unique_ptr<Lighting> render;
+	AntiAliasing* anti_aliasing = nullptr;
+	AABB* aabb = nullptr;
+	BVH* bvh = nullptr;
+	Denoising* denoising = nullptr;
+	// Depth the pipeline was created with, restored for jobs which leave it unset
+	unsigned int default_depth = 0;
+};
+
+// Creates the job's renderer and loads what depends on the files and not on the render settings: the model, its
+// LODs and BVH under the memory budget, and the blue noise. Null on failure, after printing why.
+std::unique_ptr<PipelineInstance> LoadRenderScene(const RenderJob& job);
+// Settings that may change between renders of a loaded scene: resolution, threads, sampling, depth, tone mapping,
+// AOVs, lens and shutter. Clears the frame and the denoising history, -1 if they do not fit the memory budget.
+int ApplyRenderJobSettings(PipelineInstance& pipeline, const RenderJob& job);
+// Camera of the view, lights of the job
+void ApplyRenderJobView(PipelineInstance& pipeline, const RenderJob& job, size_t view);
+// The crop window of the job, or the whole frame
+PixelWindow RenderJobWindow(const RenderJob& job);
+
+// Loads the job's scene and renders and saves every view. Returns 0, or the first failure.
+int RunRenderJob(const RenderJob& job);
@@ -0,0 +1,53 @@
+#include "render_job.h"
+#include "kernels.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Headless renderer, runs every job of the scene description files in order (see render_job.h for the format)
+//   render <scene file>... [--job <name>] [--set <key>=<value>]...
+// --job renders only the jobs of that name, --set overrides a [job] key in every job, after the files are read.
+int main(int argc, char *argv[]) {
+	std::vector<std::string> files;
+	std::vector<std::string> overrides;
+	std::string only;
+	for (int i = 1; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--job" && i + 1 < argc) {
+			only = argv[++i];
+		} else if (arg == "--set" && i + 1 < argc) {
+			overrides.push_back(argv[++i]);
+		} else {
+			files.push_back(arg);
+		}
+	}
+	if (files.empty()) {
+		std::cerr << "Usage: render <scene file>... [--job <name>] [--set <key>=<value>]..." << std::endl;
+		return -1;
+	}
+
+	std::vector<RenderJob> jobs;
+	if (LoadRenderJobs(files, overrides, jobs) != 0) {
+		return -1;
+	}
+
+	std::cout << "Kernels: " << CpuIsaName(Kernels().isa) << std::endl;
+	int result = 0;
+	size_t rendered = 0;
+	for (const auto &job : jobs) {
+		if (!only.empty() && job.name != only) {
+			continue;
+		}
+		rendered++;
+		// A failed job does not stop the batch
+		if (RunRenderJob(job) != 0) {
+			result = -1;
+		}
+	}
+	if (rendered == 0) {
+		std::cerr << "No job named " << only << std::endl;
+		return -1;
+	}
+	return result;
+}
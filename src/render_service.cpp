@@ -0,0 +1,427 @@
+#include "render_service.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Same framing as distributed.cpp, client and server run on one machine
+static const uint32_t service_magic = 0x56535452; // "RTSV"
+static const uint32_t service_version = 1;
+// Longest request text accepted, far beyond any single job
+static const uint32_t max_request_bytes = 1 << 20;
+// Pixels per band of the streamed passes, small enough that the first one arrives within milliseconds
+static const int band_pixels = 1 << 14;
+// A client which stops sending its request or taking the pixels is dropped after this long, so it cannot block the queue
+static const unsigned int client_timeout_seconds = 30;
+
+enum ServiceMessage : uint32_t {
+	SERVICE_PIXELS = 0,
+	SERVICE_VIEW_COMPLETE = 1,
+	SERVICE_FAILED = 2,
+	SERVICE_FINISHED = 3
+};
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static int Fail(Connection &client, const std::string &message) {
+	std::cerr << message << std::endl;
+	const uint32_t header[2] = {SERVICE_FAILED, static_cast<uint32_t>(message.size())};
+	client.Write(header, sizeof(header));
+	client.Write(message.data(), message.size());
+	return -1;
+}
+
+static bool SendPixels(Connection &client, const Lighting &render, size_t view, unsigned int pass, unsigned int passes, const PixelWindow &window) {
+	const uint32_t header[8] = {
+		SERVICE_PIXELS, static_cast<uint32_t>(view), pass, passes,
+		static_cast<uint32_t>(window.x0), static_cast<uint32_t>(window.y0),
+		static_cast<uint32_t>(window.x1), static_cast<uint32_t>(window.y1)
+	};
+	const std::vector<float3> &frame = render.GetHDRFrameBuffer();
+	std::vector<float3> pixels;
+	pixels.reserve(static_cast<size_t>(window.Width()) * static_cast<size_t>(window.Height()));
+	for (int y = window.y0; y < window.y1; y++) {
+		const size_t row = static_cast<size_t>(y) * static_cast<size_t>(render.GetWidth());
+		pixels.insert(pixels.end(), frame.begin() + row + window.x0, frame.begin() + row + window.x1);
+	}
+	return client.Write(header, sizeof(header)) && client.Write(pixels.data(), pixels.size() * sizeof(float3));
+}
+
+// A coarse pass first only pays off when the requested sampling traces several rays per pixel from the start.
+// Adaptive sampling already begins with one ray per pixel and only refines the edges.
+static unsigned int SamplingPasses(const PipelineInstance &pipeline, const RenderJob &job) {
+	if (!pipeline.anti_aliasing) {
+		return 1;
+	}
+	const bool distributed = job.aperture_radius > 0.0f || job.shutter_close != job.shutter_open;
+	if (distributed) {
+		return job.spp == 1 ? 1 : 2;
+	}
+	return job.adaptive_sampling ? 1 : 2;
+}
+
+RenderService::RenderService(size_t max_scenes, size_t memory_limit) :
+	max_scenes(std::max<size_t>(1, max_scenes)),
+	memory_limit(memory_limit) {}
+
+int RenderService::Serve(const std::string &socket_path) {
+	Listener listener(socket_path);
+	if (!listener.IsListening()) {
+		return -1;
+	}
+
+	// Starts the OpenMP threads now rather than in the first request
+#pragma omp parallel
+	{
+	}
+
+	std::cout << "Listening on " << socket_path << std::endl;
+	for (;;) {
+		std::unique_ptr<Connection> client = listener.Accept();
+		if (!client) {
+			std::cerr << "Could not accept on " << socket_path << std::endl;
+			return -1;
+		}
+		client->SetTimeout(client_timeout_seconds);
+		Handle(*client);
+	}
+}
+
+int RenderService::Handle(Connection &client) {
+	uint32_t header[3];
+	if (!client.Read(header, sizeof(header)) || header[0] != service_magic || header[1] != service_version || header[2] > max_request_bytes) {
+		std::cerr << "Ignoring a client which sent no request" << std::endl;
+		return -1;
+	}
+	std::string text(header[2], '\0');
+	const uint32_t reply[2] = {service_magic, service_version};
+	if (!client.Read(&text[0], text.size()) || !client.Write(reply, sizeof(reply))) {
+		return -1;
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	std::istringstream stream(text);
+	std::vector<RenderJob> jobs;
+	std::string error;
+	if (ParseRenderJobs(stream, "request", jobs, error, false) != 0) {
+		return Fail(client, error);
+	}
+	if (jobs.size() != 1) {
+		return Fail(client, "request: expected one [job], got " + std::to_string(jobs.size()));
+	}
+	const RenderJob &job = jobs.front();
+
+	bool warm = false;
+	PipelineInstance *pipeline = Acquire(job, warm, error);
+	if (!pipeline) {
+		return Fail(client, error);
+	}
+	const double loaded = SecondsSince(start);
+
+	if (ApplyRenderJobSettings(*pipeline, job) != 0) {
+		Evict();
+		return Fail(client, job.name + ": the frame does not fit the memory budget");
+	}
+	double first_pixels = 0.0;
+	const int result = Render(client, *pipeline, job, start, first_pixels);
+	std::cout << job.name << ": " << (warm ? "cached" : "loaded") << " scene in " << loaded * 1000.0 << " ms, first pixels after "
+		<< first_pixels * 1000.0 << " ms, " << (result == 0 ? "done" : "abandoned") << " after " << SecondsSince(start) * 1000.0
+		<< " ms" << std::endl;
+
+	// The frame buffers of the last request count against the memory limit as well
+	Evict();
+	return result;
+}
+
+PipelineInstance *RenderService::Acquire(const RenderJob &job, bool &warm, std::string &error) {
+	uint64_t hash = 0;
+	if (!HashModel(job.model, hash)) {
+		error = job.name + ": could not read " + job.model;
+		return nullptr;
+	}
+
+	// Materials and textures are looked up beside the model, so equal files in other directories are other scenes
+	std::ostringstream key;
+	key << std::hex << hash << std::dec << " " << std::filesystem::absolute(job.model).parent_path().string() << " "
+		<< static_cast<int>(job.pipeline) << " " << job.lods << " " << job.memory_budget << "\n" << FormatRenderPrimitives(job);
+	if (job.pipeline == RenderPipeline::Denoising) {
+		const FileHash *noise = HashFile(job.blue_noise);
+		key << " " << job.blue_noise << " " << std::hex << (noise ? noise->hash : 0) << std::dec;
+	}
+
+	for (auto scene = scenes.begin(); scene != scenes.end(); ++scene) {
+		if (scene->key == key.str()) {
+			scenes.splice(scenes.begin(), scenes, scene);
+			warm = true;
+			return scenes.front().pipeline.get();
+		}
+	}
+
+	std::unique_ptr<PipelineInstance> pipeline = LoadRenderScene(job);
+	if (!pipeline) {
+		error = job.name + ": could not load the scene of " + job.model;
+		return nullptr;
+	}
+	scenes.emplace_front();
+	scenes.front().key = key.str();
+	scenes.front().model = job.model;
+	scenes.front().pipeline = std::move(pipeline);
+	warm = false;
+	Evict();
+	return scenes.front().pipeline.get();
+}
+
+bool RenderService::HashModel(const std::string &model, uint64_t &hash) {
+	const FileHash *file = HashFile(model);
+	if (!file) {
+		return false;
+	}
+	hash = file->hash;
+
+	// Lighting::LoadGeometry looks up the libraries and their textures in the model's directory
+	const std::filesystem::path dir = std::filesystem::path(model).parent_path();
+	std::vector<std::string> pending = file->references;
+	for (size_t i = 0; i < pending.size(); i++) {
+		const FileHash *reference = HashFile((dir / pending[i]).string());
+		hash = (hash ^ (reference ? reference->hash : 0)) * 1099511628211ull;
+		for (size_t r = 0; reference && r < reference->references.size(); r++) {
+			if (std::find(pending.begin(), pending.end(), reference->references[r]) == pending.end()) {
+				pending.push_back(reference->references[r]);
+			}
+		}
+	}
+	return true;
+}
+
+const RenderService::FileHash *RenderService::HashFile(const std::string &path) {
+	std::error_code failure;
+	const uintmax_t size = std::filesystem::file_size(path, failure);
+	if (failure) {
+		return nullptr;
+	}
+	const std::filesystem::file_time_type time = std::filesystem::last_write_time(path, failure);
+	if (failure) {
+		return nullptr;
+	}
+
+	const auto known = file_hashes.find(path);
+	if (known != file_hashes.end() && known->second.size == size && known->second.time == time) {
+		return &known->second;
+	}
+
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return nullptr;
+	}
+	// 64-bit FNV-1a
+	uint64_t value = 14695981039346656037ull;
+	std::vector<char> buffer(1 << 16);
+	while (file) {
+		file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		const size_t count = static_cast<size_t>(file.gcount());
+		for (size_t i = 0; i < count; i++) {
+			value ^= static_cast<unsigned char>(buffer[i]);
+			value *= 1099511628211ull;
+		}
+	}
+
+	FileHash &entry = file_hashes[path];
+	entry.size = size;
+	entry.time = time;
+	entry.hash = value;
+	entry.references.clear();
+	const std::string extension = std::filesystem::path(path).extension().string();
+	if (extension == ".obj" || extension == ".mtl") {
+		// Second pass over the text, only when the file changed
+		file.clear();
+		file.seekg(0);
+		std::string line;
+		while (std::getline(file, line)) {
+			std::istringstream words(line);
+			std::string keyword;
+			words >> keyword;
+			std::string name;
+			if (keyword == "mtllib") {
+				while (words >> name) {
+					entry.references.push_back(name);
+				}
+			} else if (keyword == "map_Kd") {
+				// Options come first, the file name is the last word
+				while (words >> name) {}
+				if (!name.empty()) {
+					entry.references.push_back(name);
+				}
+			}
+		}
+	}
+	return &entry;
+}
+
+void RenderService::Evict() {
+	while (scenes.size() > 1) {
+		size_t bytes = 0;
+		for (const auto &scene : scenes) {
+			bytes += scene.pipeline->render->GetMemoryUsage().Total();
+		}
+		if (scenes.size() <= max_scenes && (memory_limit == 0 || bytes <= memory_limit)) {
+			return;
+		}
+		std::cout << "Evicting " << scenes.back().model << std::endl;
+		scenes.pop_back();
+	}
+}
+
+int RenderService::Render(Connection &client, PipelineInstance &pipeline, const RenderJob &job,
+	std::chrono::steady_clock::time_point start, double &first_pixels) {
+	Lighting &render = *pipeline.render;
+	const PixelWindow window = RenderJobWindow(job);
+	bool sent = false;
+	auto send = [&](size_t view, unsigned int pass, unsigned int passes, const PixelWindow &pixels) {
+		if (!SendPixels(client, render, view, pass, passes, pixels)) {
+			return false;
+		}
+		if (!sent) {
+			first_pixels = SecondsSince(start);
+			sent = true;
+		}
+		return true;
+	};
+
+	for (size_t v = 0; v < job.views.size(); v++) {
+		ApplyRenderJobView(pipeline, job, v);
+		if (pipeline.denoising) {
+			// Every frame adds a sample to the history, the resolved window is sent after each
+			render.SetCropWindow(window.x0, window.y0, window.x1, window.y1);
+			const unsigned int frames = pipeline.denoising->GetFramesPerView();
+			for (unsigned int frame = 0; frame < frames; frame++) {
+				pipeline.denoising->DrawFrame();
+				if (!send(v, frame, frames, window)) {
+					return -1;
+				}
+			}
+		} else {
+			// Bands of rows, sent as they finish. A coarse pass with one ray per pixel goes first when it helps.
+			const unsigned int passes = SamplingPasses(pipeline, job);
+			const int rows = std::max(1, band_pixels / window.Width());
+			for (unsigned int pass = 0; pass < passes; pass++) {
+				if (passes > 1 && pass == 0) {
+					// A single sample traces one ray per pixel and skips the edge refinement
+					pipeline.anti_aliasing->SetSampling(true, 1);
+				} else if (passes > 1 && job.spp > 0) {
+					pipeline.anti_aliasing->SetSampling(job.adaptive_sampling, job.spp);
+				} else if (passes > 1) {
+					pipeline.anti_aliasing->SetSampling(job.adaptive_sampling);
+				}
+
+				for (int y = window.y0; y < window.y1; y += rows) {
+					PixelWindow band = window;
+					band.y0 = y;
+					band.y1 = std::min(y + rows, window.y1);
+					render.SetCropWindow(band.x0, band.y0, band.x1, band.y1);
+					render.DrawScene();
+					if (!send(v, pass, passes, band)) {
+						return -1;
+					}
+				}
+			}
+		}
+
+		const uint32_t complete[2] = {SERVICE_VIEW_COMPLETE, static_cast<uint32_t>(v)};
+		if (!client.Write(complete, sizeof(complete))) {
+			return -1;
+		}
+	}
+	render.ResetCrop();
+
+	const uint32_t finished = SERVICE_FINISHED;
+	return client.Write(&finished, sizeof(finished)) ? 0 : -1;
+}
+
+int RequestRender(const std::string &socket_path, RenderJob job, const std::function<bool(const ServiceUpdate&)> &on_update) {
+	for (std::string *path : {&job.model, &job.blue_noise}) {
+		if (!path->empty()) {
+			*path = std::filesystem::absolute(*path).string();
+		}
+	}
+	const std::string text = FormatRenderJob(job);
+	if (text.size() > max_request_bytes) {
+		std::cerr << job.name << ": request too long" << std::endl;
+		return -1;
+	}
+
+	std::unique_ptr<Connection> service = Connection::ConnectLocal(socket_path);
+	if (!service) {
+		return -1;
+	}
+	const uint32_t request[3] = {service_magic, service_version, static_cast<uint32_t>(text.size())};
+	uint32_t reply[2];
+	if (!service->Write(request, sizeof(request)) || !service->Write(text.data(), text.size()) ||
+		!service->Read(reply, sizeof(reply)) || reply[0] != service_magic || reply[1] != service_version) {
+		std::cerr << "No answer from the render service on " << socket_path << std::endl;
+		return -1;
+	}
+
+	ServiceUpdate update;
+	for (;;) {
+		uint32_t type;
+		if (!service->Read(&type, sizeof(type))) {
+			std::cerr << "The render service closed the connection" << std::endl;
+			return -1;
+		}
+
+		if (type == SERVICE_PIXELS) {
+			uint32_t header[7];
+			if (!service->Read(header, sizeof(header))) {
+				return -1;
+			}
+			update.view = header[0];
+			update.pass = header[1];
+			update.passes = header[2];
+			update.window.x0 = static_cast<int>(header[3]);
+			update.window.y0 = static_cast<int>(header[4]);
+			update.window.x1 = static_cast<int>(header[5]);
+			update.window.y1 = static_cast<int>(header[6]);
+			update.view_complete = false;
+			if (update.view >= job.views.size() || update.window.x0 < 0 || update.window.y0 < 0 ||
+				update.window.x1 > job.width || update.window.y1 > job.height ||
+				update.window.Width() < 0 || update.window.Height() < 0) {
+				std::cerr << "The render service sent a window outside the frame" << std::endl;
+				return -1;
+			}
+			update.pixels.resize(static_cast<size_t>(update.window.Width()) * static_cast<size_t>(update.window.Height()));
+			if (!service->Read(update.pixels.data(), update.pixels.size() * sizeof(float3))) {
+				return -1;
+			}
+		} else if (type == SERVICE_VIEW_COMPLETE) {
+			uint32_t view;
+			if (!service->Read(&view, sizeof(view))) {
+				return -1;
+			}
+			update.view = view;
+			update.window = PixelWindow();
+			update.pixels.clear();
+			update.view_complete = true;
+		} else if (type == SERVICE_FAILED) {
+			uint32_t length;
+			std::string message;
+			if (service->Read(&length, sizeof(length)) && length <= max_request_bytes) {
+				message.resize(length);
+				service->Read(&message[0], length);
+			}
+			std::cerr << "Render service: " << message << std::endl;
+			return -1;
+		} else if (type == SERVICE_FINISHED) {
+			return 0;
+		} else {
+			std::cerr << "Unknown message from the render service" << std::endl;
+			return -1;
+		}
+
+		if (!on_update(update)) {
+			return -1;
+		}
+	}
+}
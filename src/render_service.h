@@ -0,0 +1,89 @@
+#pragma once
+
+#include "distributed.h"
+#include "render_job.h"
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Pixels streamed back by the service, linear radiance row-major over the window
+class ServiceUpdate
+{
+public:
+	size_t view = 0;
+	// Each pass covers the whole window and is finer than the one before, the last has the requested quality
+	unsigned int pass = 0;
+	unsigned int passes = 0;
+	PixelWindow window;
+	std::vector<float3> pixels;
+	// Set on the update closing a view, it carries no pixels
+	bool view_complete = false;
+};
+
+// Long-lived renderer on a Unix domain socket. A request is one [job] of the scene description format (see
+// render_job.h) with its lights and views, the views need no output. Each view is streamed back as it renders.
+// Loaded scenes with their BVH stay cached between requests, keyed by the content hash of the model with the material
+// libraries and diffuse textures it names, its directory and the settings the load depends on: pipeline, LODs,
+// memory budget, analytic primitives and blue noise. The least recently used is
+// evicted first. Requests are answered one at a time, each one using every thread.
+class RenderService
+{
+public:
+	// Keeps at most max_scenes loaded and, unless memory_limit is 0, no more than memory_limit bytes of them
+	RenderService(size_t max_scenes, size_t memory_limit);
+
+	// Answers clients one after the other, returns only if the socket fails
+	int Serve(const std::string& socket_path);
+	// Reads and renders one request, -1 if it failed or the client went away
+	int Handle(Connection& client);
+
+protected:
+	class CachedScene
+	{
+	public:
+		std::string key;
+		std::string model;
+		std::unique_ptr<PipelineInstance> pipeline;
+	};
+
+	// Hash of a file as of its size and modification time, so warm requests do not read it again
+	class FileHash
+	{
+	public:
+		uintmax_t size = 0;
+		std::filesystem::file_time_type time;
+		uint64_t hash = 0;
+		// Material libraries an OBJ names, diffuse textures of an MTL, relative to the model's directory
+		std::vector<std::string> references;
+	};
+
+	// Cached scene of the job, loaded on a miss. Null with the reason in error.
+	PipelineInstance* Acquire(const RenderJob& job, bool& warm, std::string& error);
+	// The model and every file it references, a missing reference hashes as empty since the loader does without it
+	bool HashModel(const std::string& model, uint64_t& hash);
+	// Null if the file cannot be read
+	const FileHash* HashFile(const std::string& path);
+	// Drops least recently used scenes until the limits hold, the most recent one always stays
+	void Evict();
+	// Renders every view, sending the pixels as they finish. first_pixels receives the seconds since start.
+	int Render(Connection& client, PipelineInstance& pipeline, const RenderJob& job,
+		std::chrono::steady_clock::time_point start, double& first_pixels);
+
+	size_t max_scenes;
+	size_t memory_limit;
+	// Most recently used first
+	std::list<CachedScene> scenes;
+	std::map<std::string, FileHash> file_hashes;
+};
+
+// Sends job to the service at socket_path and calls on_update with everything it streams back, returning false
+// from on_update cancels the request. Relative model and blue noise paths are taken from the caller's working
+// directory. Returns 0 once every view completed, otherwise -1.
+int RequestRender(const std::string& socket_path, RenderJob job, const std::function<bool(const ServiceUpdate&)>& on_update);
@@ -0,0 +1,112 @@
+#include "render_service.h"
+#include "kernels.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Render service, keeps scenes loaded between requests (see render_service.h)
+//   render_service <socket path> [--scenes <count>] [--cache-memory <MB>]
+// As a client, renders the jobs of scene description files on a running service and saves their outputs
+//   render_service <socket path> --request <scene file>... [--job <name>] [--set <key>=<value>]...
+static int RunClient(const std::string &socket_path, const std::vector<std::string> &files, const std::string &only,
+	const std::vector<std::string> &overrides) {
+	std::vector<RenderJob> jobs;
+	if (LoadRenderJobs(files, overrides, jobs) != 0) {
+		return -1;
+	}
+
+	int result = 0;
+	size_t rendered = 0;
+	for (const auto &job : jobs) {
+		if (!only.empty() && job.name != only) {
+			continue;
+		}
+		rendered++;
+
+		const auto start = std::chrono::steady_clock::now();
+		std::chrono::duration<double> first_pixels {0.0};
+		bool first = true;
+		std::vector<float3> frame(static_cast<size_t>(job.width) * static_cast<size_t>(job.height));
+		auto update = [&](const ServiceUpdate &update) {
+			if (first) {
+				first_pixels = std::chrono::steady_clock::now() - start;
+				first = false;
+			}
+			if (!update.view_complete) {
+				for (int y = 0; y < update.window.Height(); y++) {
+					std::copy_n(update.pixels.begin() + static_cast<size_t>(y) * static_cast<size_t>(update.window.Width()),
+						update.window.Width(),
+						frame.begin() + static_cast<size_t>(update.window.y0 + y) * static_cast<size_t>(job.width) + update.window.x0);
+				}
+				return true;
+			}
+
+			std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+			std::cout << job.name << ", view " << update.view + 1 << "/" << job.views.size() << ": first pixels after "
+				<< first_pixels.count() * 1000.0 << " ms, done in " << elapsed.count() * 1000.0 << " ms" << std::endl;
+			for (const auto &output : job.views[update.view].outputs) {
+				if (!WriteImage(output, job.width, job.height, frame, job.tone_mapping, job.exposure, job.gamma)) {
+					std::cerr << job.name << ": could not write " << output << std::endl;
+					result = -1;
+				}
+			}
+			std::fill(frame.begin(), frame.end(), float3 {0.0f, 0.0f, 0.0f});
+			first = true;
+			return true;
+		};
+		if (RequestRender(socket_path, job, update) != 0) {
+			result = -1;
+		}
+	}
+	if (rendered == 0) {
+		std::cerr << "No job named " << only << std::endl;
+		return -1;
+	}
+	return result;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		std::cerr << "Usage: render_service <socket path> [--scenes <count>] [--cache-memory <MB>]" << std::endl;
+		std::cerr << "       render_service <socket path> --request <scene file>... [--job <name>] [--set <key>=<value>]..." << std::endl;
+		return -1;
+	}
+
+	const std::string socket_path = argv[1];
+	size_t max_scenes = 4;
+	size_t memory_limit = 0;
+	bool client = false;
+	std::vector<std::string> files;
+	std::vector<std::string> overrides;
+	std::string only;
+	for (int i = 2; i < argc; i++) {
+		const std::string arg = argv[i];
+		if (arg == "--scenes" && i + 1 < argc) {
+			max_scenes = std::strtoul(argv[++i], nullptr, 10);
+		} else if (arg == "--cache-memory" && i + 1 < argc) {
+			memory_limit = static_cast<size_t>(std::atof(argv[++i]) * 1024.0 * 1024.0);
+		} else if (arg == "--request") {
+			client = true;
+		} else if (arg == "--job" && i + 1 < argc) {
+			only = argv[++i];
+		} else if (arg == "--set" && i + 1 < argc) {
+			overrides.push_back(argv[++i]);
+		} else if (client) {
+			files.push_back(arg);
+		} else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return -1;
+		}
+	}
+
+	if (client) {
+		return RunClient(socket_path, files, only, overrides);
+	}
+
+	std::cout << "Kernels: " << CpuIsaName(Kernels().isa) << std::endl;
+	RenderService service(max_scenes, memory_limit);
+	return service.Serve(socket_path);
+}
@@ -1,6 +1,6 @@
 #include "shadow_rays.h"
 
-ShadowRays::ShadowRays(short width, short height) : Lighting(width, height) {}
+ShadowRays::ShadowRays(int width, int height) : Lighting(width, height) {}
 
 ShadowRays::~ShadowRays() {}
 
@@ -8,6 +8,8 @@ Payload ShadowRays::TraceRay(const Ray &ray, const unsigned int max_raytrace_dep
 	if (max_raytrace_depth <= 0) {
 		return Miss(ray);
 	}
+	RAY_STAT(RayStatistics::CountDepth(raytracing_depth - max_raytrace_depth));
+	RayCapture::Record(ray.position, ray.direction, ray.spread, ray.cone_width, ray.time, t_max, CAPTURE_CLOSEST, raytracing_depth - max_raytrace_depth);
 	
 	IntersectableData closestData(t_max);
 	MaterialTriangle *closestTriangle = nullptr;
@@ -28,42 +30,50 @@ Payload ShadowRays::TraceRay(const Ray &ray, const unsigned int max_raytrace_dep
 }
 
 
-Payload ShadowRays::Hit(const Ray &ray, const IntersectableData &data, const MaterialTriangle *triangle, const unsigned int max_raytrace_depth) const {
+Payload ShadowRays::Hit(const Ray &ray, const IntersectableData &data, const MaterialSurface *surface, const unsigned int max_raytrace_depth) const {
 	if (max_raytrace_depth <= 0) {
 		return Miss(ray);
 	}
 	
-	if (triangle == nullptr) {
+	if (surface == nullptr) {
 		return Miss(ray);
 	}
 
+	const Material &material = materials[surface->material_id];
+
 	Payload payload;
-	payload.color = triangle->emissive_color;
+	payload.color = material.emissive_color;
 
-	float3 x = ray.position + ray.direction * data.t;
-	float3 normal = triangle->GetNormal(data.baricentric);
+	float3 error;
+	float3 x = surface->GetHitPoint(data.baricentric, error) + data.offset;
+	float3 geoNormal = surface->GetGeometricNormal(data.baricentric);
+	float3 normal = surface->GetNormal(data.baricentric);
+	WriteAOVs(ray, data, surface, material);
 
-	for (auto const &light : lights) {
-		Ray toLight(x, light->position - x);
-		float toLightDist = linalg::length(light->position - x);
+	float3 albedo = GetAlbedo(ray, data, surface, material);
+	for (size_t i = 0; i < lights.size(); i++) {
+		Ray toLight(OffsetRayOrigin(x, error, geoNormal, lights[i]->position - x), lights[i]->position - x);
+		toLight.time = ray.time;
+		float toLightDist = linalg::length(lights[i]->position - toLight.position);
 
 		float traceShadow = TraceShadowRay(toLight, toLightDist);
 		if (std::fabs(traceShadow - toLightDist) > 0.001f) {
 			continue;
 		}
 
-		payload.color += light->color * triangle->diffuse_color
-			* std::max(0.0f, linalg::dot(normal, toLight.direction));
-
-		float3 reflectionDir = 2.0f * linalg::dot(normal, toLight.direction) * normal - toLight.direction;
-		payload.color += light->color * triangle->specular_color
-			* std::powf(std::max(0.0f, linalg::dot(ray.direction, reflectionDir)), triangle->specular_exponent);
+		float3 contribution = material.Evaluate(normal, ray.direction, toLight.direction, lights[i]->color, albedo);
+		if (ray.aov) {
+			ray.aov->SetLight(ray.aov_pixel, i, contribution);
+		}
+		payload.color += contribution;
 	}
 
 	return payload;
 }
 
 float ShadowRays::TraceShadowRay(const Ray &ray, const float max_t) const {
+	RAY_STAT(RayStatistics::CountRay(RAY_SHADOW));
+	RayCapture::Record(ray.position, ray.direction, ray.spread, ray.cone_width, ray.time, max_t, CAPTURE_SHADOW, 0);
 	IntersectableData closestData(max_t);
 	for (auto &object : material_objects) {
 		IntersectableData data = object->Intersect(ray);
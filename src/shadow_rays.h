@@ -5,11 +5,11 @@
 class ShadowRays : public Lighting
 {
 public:
-	ShadowRays(short width, short height);
+	ShadowRays(int width, int height);
 	virtual ~ShadowRays();
 
 protected:
 	virtual Payload TraceRay(const Ray& ray, const unsigned int max_raytrace_depth) const;
-	virtual Payload Hit(const Ray& ray, const IntersectableData& data, const MaterialTriangle* triangle, const unsigned int max_raytrace_depth) const;
+	virtual Payload Hit(const Ray& ray, const IntersectableData& data, const MaterialSurface* surface, const unsigned int max_raytrace_depth) const;
 	virtual float TraceShadowRay(const Ray& ray, const float max_t) const;
 };
\ No newline at end of file
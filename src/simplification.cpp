@@ -0,0 +1,294 @@
+#include "simplification.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <queue>
+#include <tuple>
+
+namespace {
+
+// Symmetric 4x4 matrix accumulating squared distances to a set of planes
+class Quadric {
+public:
+	Quadric() { std::fill(m, m + 10, 0.0); };
+	Quadric(double a, double b, double c, double d, double weight) {
+		m[0] = a * a; m[1] = a * b; m[2] = a * c; m[3] = a * d;
+		m[4] = b * b; m[5] = b * c; m[6] = b * d;
+		m[7] = c * c; m[8] = c * d;
+		m[9] = d * d;
+		for (auto &value : m) {
+			value *= weight;
+		}
+	};
+
+	Quadric &operator+=(const Quadric &other) {
+		for (int i = 0; i < 10; i++) {
+			m[i] += other.m[i];
+		}
+		return *this;
+	};
+
+	double Error(const float3 &p) const {
+		double x = p.x, y = p.y, z = p.z;
+		return m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+			+ m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+			+ m[7] * z * z + 2 * m[8] * z
+			+ m[9];
+	};
+
+	double m[10];
+};
+
+struct SimplifyCorner {
+	float3 normal;
+	float3 tex;
+};
+
+struct SimplifyFace {
+	int v[3];
+	SimplifyCorner corners[3];
+	unsigned int material_id;
+	unsigned int primitive_id;
+	bool removed;
+
+	bool Has(int vertex) const { return v[0] == vertex || v[1] == vertex || v[2] == vertex; };
+};
+
+struct SimplifyVertex {
+	float3 position;
+	Quadric quadric;
+	std::vector<int> faces;
+	unsigned int version = 0;
+	bool removed = false;
+};
+
+struct Collapse {
+	double cost;
+	int a;
+	int b;
+	unsigned int version_a;
+	unsigned int version_b;
+	float3 position;
+
+	bool operator>(const Collapse &other) const { return cost > other.cost; };
+};
+
+// Border planes are weighted up so open edges (like the sides of a water grid) stay put
+const double border_weight = 10.0;
+
+Collapse EvaluateCollapse(const std::vector<SimplifyVertex> &vertices, int a, int b) {
+	Quadric quadric = vertices[a].quadric;
+	quadric += vertices[b].quadric;
+
+	// Endpoints and midpoint instead of the optimal position, which needs a 3x3 solve and can be unstable
+	float3 candidates[3] = {vertices[a].position, vertices[b].position, (vertices[a].position + vertices[b].position) * 0.5f};
+
+	Collapse collapse {quadric.Error(candidates[0]), a, b, vertices[a].version, vertices[b].version, candidates[0]};
+	for (int i = 1; i < 3; i++) {
+		double cost = quadric.Error(candidates[i]);
+		if (cost < collapse.cost) {
+			collapse.cost = cost;
+			collapse.position = candidates[i];
+		}
+	}
+	collapse.cost = std::max(0.0, collapse.cost);
+	return collapse;
+}
+
+// Rejects collapses which would turn a surviving face over
+bool CollapseFlipsFace(const std::vector<SimplifyVertex> &vertices, const std::vector<SimplifyFace> &faces, const Collapse &collapse) {
+	for (int vertex : {collapse.a, collapse.b}) {
+		for (int f : vertices[vertex].faces) {
+			const SimplifyFace &face = faces[f];
+			if (face.removed || (face.Has(collapse.a) && face.Has(collapse.b))) {
+				continue;
+			}
+
+			float3 before[3], after[3];
+			for (int k = 0; k < 3; k++) {
+				before[k] = vertices[face.v[k]].position;
+				after[k] = (face.v[k] == collapse.a || face.v[k] == collapse.b) ? collapse.position : before[k];
+			}
+
+			float3 normalBefore = linalg::cross(before[1] - before[0], before[2] - before[0]);
+			float3 normalAfter = linalg::cross(after[1] - after[0], after[2] - after[0]);
+			if (linalg::dot(normalBefore, normalAfter) <= 0.2f * linalg::length(normalBefore) * linalg::length(normalAfter)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+}
+
+std::vector<MaterialTriangle> SimplifyTriangles(const std::vector<MaterialTriangle> &triangles, size_t target_count, float &error) {
+	error = 0.0f;
+
+	// Weld corners by position, normals and texture coordinates stay per corner
+	std::vector<SimplifyVertex> vertices;
+	std::vector<SimplifyFace> faces;
+	std::map<std::tuple<float, float, float>, int> welded;
+
+	for (auto &triangle : triangles) {
+		const Vertex *corners[3] = {&triangle.a, &triangle.b, &triangle.c};
+
+		SimplifyFace face;
+		for (int k = 0; k < 3; k++) {
+			auto key = std::make_tuple(corners[k]->position.x, corners[k]->position.y, corners[k]->position.z);
+			auto found = welded.find(key);
+			if (found == welded.end()) {
+				found = welded.emplace(key, static_cast<int>(vertices.size())).first;
+				SimplifyVertex vertex;
+				vertex.position = corners[k]->position;
+				vertices.push_back(vertex);
+			}
+			face.v[k] = found->second;
+			face.corners[k] = SimplifyCorner {corners[k]->normal, corners[k]->tex};
+		}
+		face.material_id = triangle.material_id;
+		face.primitive_id = triangle.primitive_id;
+		face.removed = false;
+
+		if (face.v[0] == face.v[1] || face.v[1] == face.v[2] || face.v[0] == face.v[2]) {
+			continue;
+		}
+		faces.push_back(face);
+	}
+
+	std::map<std::pair<int, int>, std::pair<int, int>> edges;
+	for (int f = 0; f < static_cast<int>(faces.size()); f++) {
+		const SimplifyFace &face = faces[f];
+		float3 p0 = vertices[face.v[0]].position;
+		float3 normal = linalg::cross(vertices[face.v[1]].position - p0, vertices[face.v[2]].position - p0);
+		float length = linalg::length(normal);
+
+		for (int k = 0; k < 3; k++) {
+			vertices[face.v[k]].faces.push_back(f);
+
+			auto key = std::minmax(face.v[k], face.v[(k + 1) % 3]);
+			auto &edge = edges[key];
+			edge.first++;
+			edge.second = f;
+		}
+
+		if (length > 0.0f) {
+			normal /= length;
+			Quadric plane(normal.x, normal.y, normal.z, -linalg::dot(normal, p0), 1.0);
+			for (int k = 0; k < 3; k++) {
+				vertices[face.v[k]].quadric += plane;
+			}
+		}
+	}
+
+	// Border edges get a plane through the edge, perpendicular to their only face
+	for (auto &edge : edges) {
+		if (edge.second.first != 1) {
+			continue;
+		}
+
+		const SimplifyFace &face = faces[edge.second.second];
+		float3 p0 = vertices[face.v[0]].position;
+		float3 faceNormal = linalg::cross(vertices[face.v[1]].position - p0, vertices[face.v[2]].position - p0);
+		float3 a = vertices[edge.first.first].position;
+		float3 b = vertices[edge.first.second].position;
+		float3 normal = linalg::cross(b - a, faceNormal);
+		float length = linalg::length(normal);
+		if (length <= 0.0f) {
+			continue;
+		}
+
+		normal /= length;
+		Quadric plane(normal.x, normal.y, normal.z, -linalg::dot(normal, a), border_weight);
+		vertices[edge.first.first].quadric += plane;
+		vertices[edge.first.second].quadric += plane;
+	}
+
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> collapses;
+	for (auto &edge : edges) {
+		collapses.push(EvaluateCollapse(vertices, edge.first.first, edge.first.second));
+	}
+
+	size_t liveFaces = faces.size();
+	while (liveFaces > target_count && !collapses.empty()) {
+		Collapse collapse = collapses.top();
+		collapses.pop();
+
+		SimplifyVertex &a = vertices[collapse.a];
+		SimplifyVertex &b = vertices[collapse.b];
+		// Stale entry, one of the endpoints moved since it was queued
+		if (a.removed || b.removed || a.version != collapse.version_a || b.version != collapse.version_b) {
+			continue;
+		}
+		if (CollapseFlipsFace(vertices, faces, collapse)) {
+			continue;
+		}
+
+		a.position = collapse.position;
+		a.quadric += b.quadric;
+		for (int f : b.faces) {
+			SimplifyFace &face = faces[f];
+			if (face.removed) {
+				continue;
+			}
+
+			if (face.Has(collapse.a)) {
+				face.removed = true;
+				liveFaces--;
+			} else {
+				for (int k = 0; k < 3; k++) {
+					if (face.v[k] == collapse.b) {
+						face.v[k] = collapse.a;
+					}
+				}
+				a.faces.push_back(f);
+			}
+		}
+		b.removed = true;
+		b.faces.clear();
+		a.faces.erase(std::remove_if(a.faces.begin(), a.faces.end(), [&faces](int f) { return faces[f].removed; }), a.faces.end());
+		a.version++;
+
+		error = std::max(error, static_cast<float>(std::sqrt(collapse.cost)));
+
+		std::vector<int> neighbours;
+		for (int f : a.faces) {
+			for (int k = 0; k < 3; k++) {
+				if (faces[f].v[k] != collapse.a) {
+					neighbours.push_back(faces[f].v[k]);
+				}
+			}
+		}
+		std::sort(neighbours.begin(), neighbours.end());
+		neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+		for (int neighbour : neighbours) {
+			collapses.push(EvaluateCollapse(vertices, collapse.a, neighbour));
+		}
+	}
+
+	std::vector<MaterialTriangle> simplified;
+	for (auto &face : faces) {
+		if (face.removed) {
+			continue;
+		}
+
+		Vertex corners[3] = {Vertex(vertices[face.v[0]].position), Vertex(vertices[face.v[1]].position), Vertex(vertices[face.v[2]].position)};
+		for (int k = 0; k < 3; k++) {
+			corners[k].normal = face.corners[k].normal;
+			corners[k].tex = face.corners[k].tex;
+		}
+
+		if (linalg::length(linalg::cross(corners[1].position - corners[0].position, corners[2].position - corners[0].position)) <= 0.0f) {
+			continue;
+		}
+
+		MaterialTriangle triangle(corners[0], corners[1], corners[2]);
+		triangle.SetMaterial(face.material_id);
+		triangle.SetPrimitiveId(face.primitive_id);
+		simplified.push_back(triangle);
+	}
+
+	return simplified;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "lighting.h"
+
+#include <vector>
+
+// Quadric error metric edge collapse (Garland, Heckbert 1997).
+// Collapses edges until at most target_count triangles are left, keeping open borders in place.
+// error receives the largest geometric deviation introduced, in world units.
+std::vector<MaterialTriangle> SimplifyTriangles(const std::vector<MaterialTriangle> &triangles, size_t target_count, float &error);
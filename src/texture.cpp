@@ -0,0 +1,275 @@
+#include "texture.h"
+
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Texel of a level in the texture's format, RGBA8 channels stay in 0..255
+static float4 LoadTexel(TextureFormat format, const uint8_t *texels, size_t index) {
+	if (format == TextureFormat::Float) {
+		return reinterpret_cast<const float4 *>(texels)[index];
+	}
+	const uint8_t *texel = texels + 4 * index;
+	return float4(byte4 {texel[0], texel[1], texel[2], texel[3]});
+}
+
+static void StoreTexel(TextureFormat format, uint8_t *texels, size_t index, float4 value) {
+	if (format == TextureFormat::Float) {
+		reinterpret_cast<float4 *>(texels)[index] = value;
+		return;
+	}
+	byte4 packed(linalg::clamp(value, 0.0f, 255.0f) + 0.5f);
+	std::copy(&packed.x, &packed.x + 4, texels + 4 * index);
+}
+
+Texture::Texture(std::string filename) {
+	int width, height, channels;
+	// The finest level is the decoder's buffer as it is, RGBA8 is never widened to floats
+	uint8_t *img;
+	if (stbi_is_hdr(filename.c_str())) {
+		format = TextureFormat::Float;
+		img = reinterpret_cast<uint8_t *>(stbi_loadf(filename.c_str(), &width, &height, &channels, 4));
+	} else {
+		format = TextureFormat::RGBA8;
+		img = stbi_load(filename.c_str(), &width, &height, &channels, 4);
+	}
+	if (!img) {
+		return;
+	}
+
+	pages = std::tmpfile();
+	if (!pages) {
+		stbi_image_free(img);
+		return;
+	}
+
+	// Box-filtered mip chain, each level is written out and then only used to filter the next one,
+	// so at most two levels are in memory at a time
+	uint2 size {static_cast<unsigned int>(width), static_cast<unsigned int>(height)};
+	WriteLevel(img, size);
+	std::vector<uint8_t> level;
+	while (size.x > 1 || size.y > 1) {
+		uint2 next {std::max(1u, size.x / 2), std::max(1u, size.y / 2)};
+		std::vector<uint8_t> downsampled = Downsample(img ? img : level.data(), size, next);
+		if (img) {
+			stbi_image_free(img);
+			img = nullptr;
+		}
+		level.swap(downsampled);
+		size = next;
+		WriteLevel(level.data(), size);
+	}
+	if (img) {
+		stbi_image_free(img);
+	}
+}
+
+std::vector<uint8_t> Texture::Downsample(const uint8_t *texels, uint2 size, uint2 next) const {
+	std::vector<uint8_t> downsampled(static_cast<size_t>(next.x) * static_cast<size_t>(next.y) * TexelBytes());
+	for (unsigned int y = 0; y < next.y; y++) {
+		for (unsigned int x = 0; x < next.x; x++) {
+			// Every source texel covered by the destination footprint, so odd sizes are not biased
+			unsigned int x0 = x * size.x / next.x;
+			unsigned int x1 = std::max(x0 + 1, ((x + 1) * size.x + next.x - 1) / next.x);
+			unsigned int y0 = y * size.y / next.y;
+			unsigned int y1 = std::max(y0 + 1, ((y + 1) * size.y + next.y - 1) / next.y);
+
+			float4 sum {0, 0, 0, 0};
+			for (unsigned int sy = y0; sy < y1; sy++) {
+				for (unsigned int sx = x0; sx < x1; sx++) {
+					sum += LoadTexel(format, texels, static_cast<size_t>(sy) * size.x + sx);
+				}
+			}
+			StoreTexel(format, downsampled.data(), static_cast<size_t>(y) * next.x + x, sum / static_cast<float>((x1 - x0) * (y1 - y0)));
+		}
+	}
+	return downsampled;
+}
+
+Texture::~Texture() {
+	if (pages) {
+		std::fclose(pages);
+	}
+}
+
+uint2 Texture::LevelTiles(unsigned int level) const {
+	return uint2 {(level_sizes[level].x + tile_size - 1) / tile_size, (level_sizes[level].y + tile_size - 1) / tile_size};
+}
+
+size_t Texture::TileBytes() const {
+	return static_cast<size_t>(tile_size) * tile_size * TexelBytes();
+}
+
+void Texture::WriteLevel(const uint8_t *texels, uint2 size) {
+	level_offsets.push_back(level_offsets.empty() ? 0 :
+		level_offsets.back() + static_cast<size_t>(LevelTiles(Levels() - 1).x) * LevelTiles(Levels() - 1).y * TileBytes());
+	level_sizes.push_back(size);
+
+	uint2 tiles = LevelTiles(Levels() - 1);
+	std::vector<uint8_t> tile(TileBytes());
+	const size_t texelBytes = TexelBytes();
+
+	for (unsigned int ty = 0; ty < tiles.y; ty++) {
+		for (unsigned int tx = 0; tx < tiles.x; tx++) {
+			for (unsigned int y = 0; y < tile_size; y++) {
+				for (unsigned int x = 0; x < tile_size; x++) {
+					// Tiles on the right and bottom borders are padded by clamping
+					unsigned int sx = std::min(tx * tile_size + x, size.x - 1);
+					unsigned int sy = std::min(ty * tile_size + y, size.y - 1);
+					const uint8_t *texel = texels + (static_cast<size_t>(sy) * size.x + sx) * texelBytes;
+					std::copy(texel, texel + texelBytes, tile.data() + (static_cast<size_t>(y) * tile_size + x) * texelBytes);
+				}
+			}
+			std::fwrite(tile.data(), 1, tile.size(), pages);
+		}
+	}
+}
+
+void Texture::ReadTile(unsigned int level, unsigned int tile, uint8_t *destination) const {
+	std::lock_guard<std::mutex> lock(pages_mutex);
+	size_t offset = level_offsets[level] + static_cast<size_t>(tile) * TileBytes();
+#ifdef _MSC_VER
+	_fseeki64(pages, static_cast<__int64>(offset), SEEK_SET);
+#else
+	fseeko(pages, static_cast<off_t>(offset), SEEK_SET);
+#endif
+	std::fread(destination, 1, TileBytes(), pages);
+}
+
+const size_t TextureCache::default_budget;
+
+TextureCache::TextureCache(size_t budget_bytes) : budget(budget_bytes) {}
+
+TextureCache::~TextureCache() {}
+
+int TextureCache::AddTexture(std::string filename) {
+	auto existing = texture_ids.find(filename);
+	if (existing != texture_ids.end()) {
+		return existing->second;
+	}
+
+	std::unique_ptr<Texture> texture(new Texture(filename));
+	if (!texture->IsValid()) {
+		std::cerr << "Failed to load texture " << filename << std::endl;
+		return -1;
+	}
+
+	textures.push_back(std::move(texture));
+	int id = static_cast<int>(textures.size()) - 1;
+	texture_ids[filename] = id;
+	return id;
+}
+
+void TextureCache::SetBudget(size_t budget_bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	budget = budget_bytes;
+	Evict();
+}
+
+size_t TextureCache::ResidentBytes() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return resident;
+}
+
+float2 TextureCache::Size(int texture) const {
+	uint2 size = textures[texture]->LevelSize(0);
+	return float2 {static_cast<float>(size.x), static_cast<float>(size.y)};
+}
+
+float4 TextureCache::Sample(int texture, float2 uv, float lod) const {
+	const Texture &tex = *textures[texture];
+	uint64_t textureKey = static_cast<uint64_t>(texture) << 48;
+
+	lod = std::max(0.0f, std::min(lod, static_cast<float>(tex.Levels() - 1)));
+	unsigned int level = static_cast<unsigned int>(lod);
+	float blend = lod - static_cast<float>(level);
+
+	float4 color = SampleLevel(tex, textureKey, level, uv);
+	if (blend > 0.0f && level + 1 < tex.Levels()) {
+		color = linalg::lerp(color, SampleLevel(tex, textureKey, level + 1, uv), blend);
+	}
+	return color;
+}
+
+float4 TextureCache::SampleLevel(const Texture &texture, uint64_t texture_key, unsigned int level, float2 uv) const {
+	uint2 size = texture.LevelSize(level);
+	float x = (uv.x - std::floor(uv.x)) * size.x - 0.5f;
+	float y = (1.0f - (uv.y - std::floor(uv.y))) * size.y - 0.5f;
+	float fx = std::floor(x);
+	float fy = std::floor(y);
+	int x0 = static_cast<int>(fx);
+	int y0 = static_cast<int>(fy);
+	float wx = x - fx;
+	float wy = y - fy;
+
+	// Neighbouring texels usually share a tile, keep it between fetches
+	Tile tile;
+	uint64_t tileKey = ~0ull;
+	float4 top = linalg::lerp(Texel(texture, texture_key, level, x0, y0, tile, tileKey),
+		Texel(texture, texture_key, level, x0 + 1, y0, tile, tileKey), wx);
+	float4 bottom = linalg::lerp(Texel(texture, texture_key, level, x0, y0 + 1, tile, tileKey),
+		Texel(texture, texture_key, level, x0 + 1, y0 + 1, tile, tileKey), wx);
+	return linalg::lerp(top, bottom, wy);
+}
+
+float4 TextureCache::Texel(const Texture &texture, uint64_t texture_key, unsigned int level, int x, int y, Tile &tile, uint64_t &tile_key) const {
+	uint2 size = texture.LevelSize(level);
+	unsigned int ux = static_cast<unsigned int>((x % static_cast<int>(size.x) + static_cast<int>(size.x)) % static_cast<int>(size.x));
+	unsigned int uy = static_cast<unsigned int>((y % static_cast<int>(size.y) + static_cast<int>(size.y)) % static_cast<int>(size.y));
+
+	unsigned int tileIndex = (uy / Texture::tile_size) * texture.LevelTiles(level).x + ux / Texture::tile_size;
+	uint64_t key = texture_key | (static_cast<uint64_t>(level) << 40) | tileIndex;
+	if (key != tile_key) {
+		tile = GetTile(texture, key, level, tileIndex);
+		tile_key = key;
+	}
+
+	size_t ix = static_cast<size_t>(uy % Texture::tile_size) * Texture::tile_size + ux % Texture::tile_size;
+	if (texture.Format() == TextureFormat::Float) {
+		return reinterpret_cast<const float4 *>(tile->data())[ix];
+	}
+
+	const uint8_t *texel = tile->data() + 4 * ix;
+	return float4 {texel[0] / 255.0f, texel[1] / 255.0f, texel[2] / 255.0f, texel[3] / 255.0f};
+}
+
+TextureCache::Tile TextureCache::GetTile(const Texture &texture, uint64_t key, unsigned int level, unsigned int tile) const {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = tiles.find(key);
+		if (found != tiles.end()) {
+			lru.splice(lru.begin(), lru, found->second.second);
+			return found->second.first;
+		}
+	}
+
+	// Page in outside of the cache lock, so other threads keep sampling resident tiles
+	std::shared_ptr<std::vector<uint8_t>> data(new std::vector<uint8_t>(texture.TileBytes()));
+	texture.ReadTile(level, tile, data->data());
+
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = tiles.find(key);
+	if (found != tiles.end()) {
+		return found->second.first;
+	}
+
+	lru.push_front(key);
+	tiles[key] = std::make_pair(Tile(data), lru.begin());
+	resident += data->size();
+	Evict();
+	return data;
+}
+
+void TextureCache::Evict() const {
+	// Tiles still referenced by a sampling thread are freed when it drops them
+	while (resident > budget && lru.size() > 1) {
+		auto victim = tiles.find(lru.back());
+		resident -= victim->second.first->size();
+		tiles.erase(victim);
+		lru.pop_back();
+	}
+}
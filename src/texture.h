@@ -0,0 +1,86 @@
+#pragma once
+
+#include "linalg.h"
+using namespace linalg::aliases;
+
+#include <cstdint>
+#include <cstdio>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+enum class TextureFormat : unsigned char {
+	RGBA8,
+	Float
+};
+
+// Mip-mapped texture stored as square tiles in a page file.
+// Nothing but the page table stays in memory, tiles are paged in by TextureCache.
+class Texture
+{
+public:
+	Texture(std::string filename);
+	~Texture();
+
+	static const unsigned int tile_size = 32;
+
+	bool IsValid() const { return pages != nullptr; };
+	TextureFormat Format() const { return format; };
+	unsigned int Levels() const { return static_cast<unsigned int>(level_sizes.size()); };
+	uint2 LevelSize(unsigned int level) const { return level_sizes[level]; };
+	uint2 LevelTiles(unsigned int level) const;
+	size_t TexelBytes() const { return format == TextureFormat::Float ? sizeof(float4) : sizeof(uint32_t); };
+	size_t TileBytes() const;
+
+	void ReadTile(unsigned int level, unsigned int tile, uint8_t *destination) const;
+
+protected:
+	// Texels are in the texture's format, four bytes or four floats each
+	void WriteLevel(const uint8_t *texels, uint2 size);
+	std::vector<uint8_t> Downsample(const uint8_t *texels, uint2 size, uint2 next) const;
+
+	TextureFormat format = TextureFormat::RGBA8;
+	std::vector<uint2> level_sizes;
+	std::vector<size_t> level_offsets;
+
+	std::FILE *pages = nullptr;
+	mutable std::mutex pages_mutex;
+};
+
+// LRU cache of texture tiles bounded by a memory budget in bytes
+class TextureCache
+{
+public:
+	static const size_t default_budget = 256u << 20;
+
+	TextureCache(size_t budget_bytes = default_budget);
+	~TextureCache();
+
+	int AddTexture(std::string filename);
+	void SetBudget(size_t budget_bytes);
+	size_t ResidentBytes() const;
+
+	// Trilinear lookup, lod is the mip level in texels (0 is the finest)
+	float4 Sample(int texture, float2 uv, float lod) const;
+	float2 Size(int texture) const;
+
+protected:
+	typedef std::shared_ptr<const std::vector<uint8_t>> Tile;
+
+	float4 SampleLevel(const Texture &texture, uint64_t texture_key, unsigned int level, float2 uv) const;
+	float4 Texel(const Texture &texture, uint64_t texture_key, unsigned int level, int x, int y, Tile &tile, uint64_t &tile_key) const;
+	Tile GetTile(const Texture &texture, uint64_t key, unsigned int level, unsigned int tile) const;
+	void Evict() const;
+
+	std::vector<std::unique_ptr<Texture>> textures;
+	std::unordered_map<std::string, int> texture_ids;
+
+	size_t budget;
+	mutable size_t resident = 0;
+	mutable std::mutex mutex;
+	mutable std::list<uint64_t> lru;
+	mutable std::unordered_map<uint64_t, std::pair<Tile, std::list<uint64_t>::iterator>> tiles;
+};
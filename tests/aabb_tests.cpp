@@ -12,6 +12,8 @@ TEST_CASE("AABB test") {
 	REQUIRE(result == 0);
 	render->SetCamera(float3{ 0.0f, 0.795f, 1.6f }, float3{ 0, 0.795f, -1 }, float3{ 0, 1, 0 });
 	render->AddLight(new Light(float3{ 0, 1.58f, -0.03f }, float3{ 0.78f, 0.78f, 0.78f }));
+	// The reference was rendered on the fixed 2x2 grid
+	render->SetSampling(false);
 	render->Clear();
 
 	BENCHMARK("Draw scene")
@@ -20,4 +22,45 @@ TEST_CASE("AABB test") {
 	};
 
 	REQUIRE(validate_framebuffer("references/aabb.png", render->GetFrameBuffer()));
-}
\ No newline at end of file
+}
+
+TEST_CASE("Analytic primitives") {
+	AABB render(8, 8);
+	render.AddSphere(float3{ 0.0f, 0.0f, -5.0f }, 1.0f, Material());
+	render.AddBox(float3{ 3.0f, -1.0f, -6.0f }, float3{ 5.0f, 1.0f, -4.0f }, Material());
+
+	IntersectableData closest(0.0f);
+	const MaterialSurface* surface = nullptr;
+
+	SECTION("Ray hits the front of the sphere") {
+		REQUIRE(render.ClosestHit(Ray(float3{ 0.0f, 0.0f, 0.0f }, float3{ 0.0f, 0.0f, -1.0f }), closest, surface));
+		REQUIRE(closest.t == Approx(4.0f));
+		float3 normal = surface->GetNormal(closest.baricentric);
+		REQUIRE(normal.z == Approx(1.0f));
+	}
+
+	SECTION("Ray grazes the sphere") {
+		REQUIRE(render.ClosestHit(Ray(float3{ 0.0f, 0.999f, 0.0f }, float3{ 0.0f, 0.0f, -1.0f }), closest, surface));
+		REQUIRE(closest.t == Approx(5.0f).epsilon(0.02));
+		REQUIRE_FALSE(render.ClosestHit(Ray(float3{ 0.0f, 1.001f, 0.0f }, float3{ 0.0f, 0.0f, -1.0f }), closest, surface));
+	}
+
+	SECTION("Ray misses everything") {
+		REQUIRE_FALSE(render.ClosestHit(Ray(float3{ 0.0f, 0.0f, 0.0f }, float3{ 0.0f, 1.0f, 0.0f }), closest, surface));
+		REQUIRE(surface == nullptr);
+	}
+
+	SECTION("Ray hits the near face of the box") {
+		REQUIRE(render.ClosestHit(Ray(float3{ 4.0f, 0.0f, 0.0f }, float3{ 0.0f, 0.0f, -1.0f }), closest, surface));
+		REQUIRE(closest.t == Approx(4.0f));
+		float3 normal = surface->GetNormal(closest.baricentric);
+		REQUIRE(normal.z == Approx(1.0f));
+		REQUIRE(normal.x == Approx(0.0f));
+	}
+
+	SECTION("Ray hits the side face of the box") {
+		REQUIRE(render.ClosestHit(Ray(float3{ 2.0f, 0.0f, -5.0f }, float3{ 1.0f, 0.0f, 0.0f }), closest, surface));
+		REQUIRE(closest.t == Approx(1.0f));
+		REQUIRE(surface->GetNormal(closest.baricentric).x == Approx(-1.0f));
+	}
+}
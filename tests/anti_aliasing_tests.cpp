@@ -12,6 +12,8 @@ TEST_CASE("Anti-aliasings test") {
 	REQUIRE(result == 0);
 	render->SetCamera(float3{ -0.5f, 0.99f, 1.5f }, float3{ 0, 0.99f, -1 }, float3{ 0, 1, 0 });
 	render->AddLight(new Light(float3{ 0, 1.98f, -0.06f }, float3{ 0.78f, 0.78f, 0.78f }));
+	// The reference was rendered on the fixed 2x2 grid
+	render->SetSampling(false);
 	render->Clear();
 
     BENCHMARK("Draw scene")
@@ -20,4 +22,68 @@ TEST_CASE("Anti-aliasings test") {
     };
 
     REQUIRE(validate_framebuffer("references/anti_aliasing.png", render->GetFrameBuffer()));
-}
\ No newline at end of file
+}
+
+TEST_CASE("Adaptive anti-aliasing test") {
+	AntiAliasing* render = new AntiAliasing(1920, 1080);
+	int result = render->LoadGeometry("models/CornellBox-Mirror.obj");
+	REQUIRE(result == 0);
+	render->SetCamera(float3{ -0.5f, 0.99f, 1.5f }, float3{ 0, 0.99f, -1 }, float3{ 0, 1, 0 });
+	render->AddLight(new Light(float3{ 0, 1.98f, -0.06f }, float3{ 0.78f, 0.78f, 0.78f }));
+	render->Clear();
+
+	render->SetSampling(false);
+	render->DrawScene();
+	std::vector<byte3> fixed = render->GetFrameBuffer();
+	size_t fixedRays = render->GetPrimaryRayCount();
+
+	render->SetSampling(true, 4);
+	BENCHMARK("Draw scene")
+	{
+		render->DrawScene();
+	};
+	std::vector<byte3> adaptive = render->GetFrameBuffer();
+
+	INFO("Adaptive primary rays " << render->GetPrimaryRayCount() << " of " << fixedRays);
+	CHECK(render->GetPrimaryRayCount() * 2 < fixedRays);
+
+	// Flat areas lose the sub-pixel average, so only the mean difference is bounded
+	double difference = 0.0;
+	for (size_t i = 0; i < fixed.size(); i++) {
+		for (int c = 0; c < 3; c++) {
+			difference += std::abs(static_cast<int>(fixed[i][c]) - static_cast<int>(adaptive[i][c]));
+		}
+	}
+	CHECK(difference / (3.0 * fixed.size()) < 1.0);
+}
+
+TEST_CASE("Adaptive sample counts") {
+	AntiAliasing render(160, 90);
+	REQUIRE(render.LoadGeometry("models/CornellBox-Mirror.obj") == 0);
+	render.SetCamera(float3{ -0.5f, 0.99f, 1.5f }, float3{ 0, 0.99f, -1 }, float3{ 0, 1, 0 });
+	render.AddLight(new Light(float3{ 0, 1.98f, -0.06f }, float3{ 0.78f, 0.78f, 0.78f }));
+	render.Clear();
+	const size_t pixels = 160 * 90;
+
+	SECTION("One sample refines nothing") {
+		render.SetSampling(true, 1);
+		REQUIRE(render.GetMaxSamples() == 1);
+		render.DrawScene();
+		REQUIRE(render.GetPrimaryRayCount() == pixels);
+	}
+
+	SECTION("Fewer than four samples still refine on a 2x2 grid") {
+		render.SetSampling(true, 2);
+		REQUIRE(render.GetMaxSamples() == 4);
+		render.DrawScene();
+		REQUIRE(render.GetPrimaryRayCount() > pixels);
+		REQUIRE((render.GetPrimaryRayCount() - pixels) % 4 == 0);
+	}
+
+	SECTION("Other counts round down to a square") {
+		render.SetSampling(true, 8);
+		REQUIRE(render.GetMaxSamples() == 4);
+		render.SetSampling(true, 0);
+		REQUIRE(render.GetMaxSamples() == 1);
+	}
+}
@@ -6,12 +6,17 @@
 
 #include "bvh.h"
 
+#include <algorithm>
+#include <cmath>
+
 TEST_CASE("BVH test") {
     BVH* render = new BVH(1920, 1080);
     int result = render->LoadGeometry("models/CornellBox-Sphere.obj");
     REQUIRE(result == 0);
     render->SetCamera(float3{ 0.0f, 0.795f, 1.6f }, float3{ 0, 0.795f, -1 }, float3{ 0, 1, 0 });
     render->AddLight(new Light(float3{ 0, 1.58f, -0.03f }, float3{ 0.78f, 0.78f, 0.78f }));
+    // The reference was rendered on the fixed 2x2 grid
+    render->SetSampling(false);
     render->Clear();
 
     BENCHMARK("BVH scene")
@@ -20,4 +25,61 @@ TEST_CASE("BVH test") {
     };
 
     REQUIRE(validate_framebuffer("references/bvh.png", render->GetFrameBuffer()));
-}
\ No newline at end of file
+}
+
+TEST_CASE("A BVH can be rebuilt unless its meshes were moved in") {
+	BVH copied(64, 36);
+	REQUIRE(copied.LoadGeometry("models/CornellBox-Mirror.obj") == 0);
+	const size_t meshes = copied.MeshCount();
+	REQUIRE(copied.BuildBVH() == 0);
+	REQUIRE(copied.BuildBVH() == 0);
+	REQUIRE(copied.MeshCount() == meshes);
+
+	// No room for copies, so the build moves the meshes into the top level
+	BVH compact(64, 36);
+	REQUIRE(compact.LoadGeometry("models/CornellBox-Mirror.obj") == 0);
+	compact.SetMemoryBudget(compact.GetMemoryUsage().Total() + 1);
+	REQUIRE(compact.BuildBVH() == 0);
+	REQUIRE(compact.MeshCount() == meshes);
+	REQUIRE(compact.BuildBVH() == -1);
+	REQUIRE(compact.MeshCount() == meshes);
+
+	BVH empty(64, 36);
+	REQUIRE(empty.BuildBVH() == 0);
+	REQUIRE(empty.MeshCount() == 0);
+}
+
+TEST_CASE("A frame over the memory budget is refused before it grows") {
+	BVH render(64, 36);
+	REQUIRE(render.LoadGeometry("models/CornellBox-Mirror.obj") == 0);
+	REQUIRE(render.Clear() == 0);
+	render.SetMemoryBudget(render.GetMemoryUsage().Total());
+	const size_t held = render.GetMemoryUsage().Total();
+	const bool exceeded = render.SetResolution(128, 72) == BVH::memory_budget_exceeded;
+	REQUIRE(exceeded);
+	REQUIRE(render.GetWidth() == 64);
+	REQUIRE(render.GetMemoryUsage().Total() == held);
+	REQUIRE(render.SetResolution(32, 18) == 0);
+}
+
+TEST_CASE("AOVs of tiles add up to the frame") {
+	BVH render(32, 18);
+	REQUIRE(render.LoadGeometry("models/CornellBox-Mirror.obj") == 0);
+	REQUIRE(render.BuildBVH() == 0);
+	render.SetCamera(float3{ 0.0f, 0.795f, 1.6f }, float3{ 0, 0.795f, -1 }, float3{ 0, 1, 0 });
+	render.SetSampling(false);
+	render.SetAOVs(AOV_DEPTH);
+	REQUIRE(render.Clear() == 0);
+	render.DrawScene();
+	const std::vector<float> whole = render.GetAOVs().Planes().front();
+	REQUIRE(std::count_if(whole.begin(), whole.end(), [](float depth) { return std::isfinite(depth); }) > 0);
+
+	render.SetCamera(float3{ 0.0f, 0.795f, 1.0f }, float3{ 0, 0.795f, -1 }, float3{ 0, 1, 0 });
+	render.DrawScene();
+	render.SetCamera(float3{ 0.0f, 0.795f, 1.6f }, float3{ 0, 0.795f, -1 }, float3{ 0, 1, 0 });
+	render.SetCropWindow(0, 0, 32, 9);
+	render.DrawScene();
+	render.SetCropWindow(0, 9, 32, 18);
+	render.DrawScene();
+	REQUIRE(render.GetAOVs().Planes().front() == whole);
+}
@@ -0,0 +1,220 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include "denoising.h"
+#include "distributed.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+// Exposes the history so the tests can see what survives a camera move
+class DenoisingProbe : public Denoising
+{
+public:
+	DenoisingProbe(int width, int height) : Denoising(width, height) {};
+
+	// Share of the pixels with a primary hit whose history was carried over by the last reprojection
+	float ReprojectedFraction() const {
+		size_t hits = 0;
+		size_t kept = 0;
+		for (size_t p = 0; p < g_buffer.size(); p++) {
+			if (!g_buffer[p].hit) {
+				continue;
+			}
+			hits++;
+			// A frame adds one sample, anything above it came from the history
+			kept += history_length[p] > 1.0f ? 1 : 0;
+		}
+		return hits ? static_cast<float>(kept) / static_cast<float>(hits) : 0.0f;
+	}
+	float HistoryLength(size_t pixel) const { return history_length[pixel]; };
+};
+
+static void SetUpCornellBox(Denoising& render) {
+	REQUIRE(render.LoadGeometry("models/CornellBox-Mirror.obj") == 0);
+	REQUIRE(render.LoadBlueNoise("textures/blue-noise.png") == 0);
+	render.SetCamera(float3{ -0.5f, 0.99f, 1.5f }, float3{ 0, 0.99f, -1 }, float3{ 0, 1, 0 });
+	render.Clear();
+}
+
+TEST_CASE("Reprojection keeps the history across a small camera move") {
+	DenoisingProbe render(160, 90);
+	SetUpCornellBox(render);
+	for (int frame = 0; frame < 4; frame++) {
+		render.DrawFrame();
+	}
+
+	render.SetCamera(float3{ -0.49f, 0.99f, 1.5f }, float3{ 0, 0.99f, -1 }, float3{ 0, 1, 0 });
+	render.DrawFrame();
+	INFO("Reprojected fraction " << render.ReprojectedFraction());
+	REQUIRE(render.ReprojectedFraction() >= 0.85f);
+}
+
+// Pixels whose indirect AOV is not black, a single frame only has the few whose bounce found the light
+static size_t LitIndirectPixels(const Denoising& render) {
+	const float* indirect = render.GetAOVs().Plane(AOV_INDIRECT);
+	REQUIRE(indirect != nullptr);
+	return static_cast<size_t>(std::count_if(indirect, indirect + static_cast<size_t>(render.GetWidth()) * static_cast<size_t>(render.GetHeight()),
+		[](float value) { return value > 0.0f; }));
+}
+
+TEST_CASE("The indirect AOV accumulates like the image") {
+	Denoising render(160, 90);
+	SetUpCornellBox(render);
+	render.SetAOVs(AOV_INDIRECT);
+
+	render.DrawFrame();
+	const size_t single = LitIndirectPixels(render);
+	for (int frame = 0; frame < 15; frame++) {
+		render.DrawFrame();
+	}
+	const size_t accumulated = LitIndirectPixels(render);
+	INFO("Lit pixels " << single << " after one frame, " << accumulated << " after 16");
+	REQUIRE(single > 0);
+	REQUIRE(accumulated > 8 * single);
+}
+
+TEST_CASE("Tiles only depend on their first sample") {
+	Denoising render(64, 36);
+	SetUpCornellBox(render);
+	PixelWindow window;
+	window.x0 = 16;
+	window.y0 = 8;
+	window.x1 = 48;
+	window.y1 = 28;
+
+	AccumulationTile first;
+	AccumulationTile again;
+	AccumulationTile later;
+	render.AccumulateTile(window, 2, 0, first);
+	render.AccumulateTile(window, 2, 0, again);
+	render.AccumulateTile(window, 2, 2, later);
+	REQUIRE(first.illumination == again.illumination);
+	REQUIRE(first.illumination != later.illumination);
+}
+
+TEST_CASE("A history over the memory budget fails the clear") {
+	Denoising render(64, 36);
+	SetUpCornellBox(render);
+	// The G-buffers are counted before the first frames fill them
+	render.SetMemoryBudget(render.GetMemoryUsage().Total());
+	const bool unfilled = render.Clear() == Denoising::memory_budget_exceeded;
+	REQUIRE(unfilled);
+
+	// A camera move fills the second one, then the frame state is all there
+	render.SetMemoryBudget(0);
+	render.DrawFrame();
+	render.SetCamera(float3{ -0.49f, 0.99f, 1.5f }, float3{ 0, 0.99f, -1 }, float3{ 0, 1, 0 });
+	render.DrawFrame();
+	render.SetMemoryBudget(render.GetMemoryUsage().Total());
+	REQUIRE(render.Clear() == 0);
+	const size_t held = render.GetMemoryUsage().Total();
+	const bool exceeded = render.SetResolution(128, 72) == Denoising::memory_budget_exceeded;
+	REQUIRE(exceeded);
+	// Checked before anything grew, the frame stays as it was
+	REQUIRE(render.GetWidth() == 64);
+	REQUIRE(render.GetMemoryUsage().Total() == held);
+
+	render.SetMemoryBudget(0);
+	REQUIRE(render.Clear() == 0);
+}
+
+TEST_CASE("Distributed rendering over a local socket") {
+	const int width = 64;
+	const int height = 36;
+	const unsigned int samples = 3;
+	DenoisingProbe coordinator(width, height);
+	SetUpCornellBox(coordinator);
+	Denoising worker(width, height);
+	SetUpCornellBox(worker);
+
+	const std::string socketPath = "denoising_tests.sock";
+	Listener listener(socketPath);
+	REQUIRE(listener.IsListening());
+
+	// One real worker, and one which takes a task and then disappears, so its task has to go to the other
+	int workResult = -1;
+	std::thread workerThread([&] {
+		std::unique_ptr<Connection> connection = Connection::ConnectLocal(socketPath);
+		workResult = connection ? Work(worker, *connection) : -1;
+	});
+	std::thread dropoutThread([&] {
+		std::unique_ptr<Connection> connection = Connection::ConnectLocal(socketPath);
+		uint32_t handshake[2];
+		uint32_t task[7];
+		if (connection && connection->Read(handshake, sizeof(handshake)) && connection->Write(handshake, sizeof(handshake))) {
+			connection->Read(task, sizeof(task));
+		}
+	});
+
+	std::vector<std::unique_ptr<Connection>> workers;
+	for (int i = 0; i < 2; i++) {
+		workers.push_back(listener.Accept());
+		REQUIRE(workers.back());
+		REQUIRE(workers.back()->SetTimeout(60));
+	}
+	const int result = Coordinate(coordinator, workers, SplitTiles(width, height, 16, samples));
+	workerThread.join();
+	dropoutThread.join();
+	REQUIRE(result == 0);
+	REQUIRE(workResult == 0);
+
+	// Every pixel was accumulated exactly once with all of its samples
+	for (size_t p = 0; p < static_cast<size_t>(width) * static_cast<size_t>(height); p++) {
+		REQUIRE(coordinator.HistoryLength(p) == static_cast<float>(samples));
+	}
+}
+
+TEST_CASE("A silent peer times out") {
+	const std::string socketPath = "denoising_tests_timeout.sock";
+	Listener listener(socketPath);
+	REQUIRE(listener.IsListening());
+	std::unique_ptr<Connection> client = Connection::ConnectLocal(socketPath);
+	REQUIRE(client);
+	std::unique_ptr<Connection> server = listener.Accept();
+	REQUIRE(server);
+	REQUIRE(server->SetTimeout(1));
+
+	const auto start = std::chrono::steady_clock::now();
+	uint32_t message;
+	REQUIRE_FALSE(server->Read(&message, sizeof(message)));
+	REQUIRE(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+}
+
+#ifndef _WIN32
+TEST_CASE("Spawned processes talk over their standard streams") {
+	std::unique_ptr<Connection> child = Connection::Spawn({"cat"});
+	REQUIRE(child);
+	REQUIRE_FALSE(child->SetTimeout(1));
+
+	const char sent[] = "RTDW over a pipe";
+	char received[sizeof(sent)] = {};
+	REQUIRE(child->Write(sent, sizeof(sent)));
+	REQUIRE(child->Read(received, sizeof(received)));
+	REQUIRE(std::memcmp(sent, received, sizeof(sent)) == 0);
+	// The destructor closes the child's stdin and waits for it to exit
+	child.reset();
+}
+#endif
+
+#ifdef RAY_STATISTICS
+TEST_CASE("Every traversal test is charged to the pixel it was made for") {
+	Denoising render(64, 36);
+	SetUpCornellBox(render);
+	render.ResetRayStatistics();
+	render.DrawFrame();
+
+	const RayCounters totals = render.GetRayStatistics();
+	double charged = 0.0;
+	float highest = 0.0f;
+	for (float cost : render.GetCostBuffer()) {
+		charged += cost;
+		highest = std::max(highest, cost);
+	}
+	REQUIRE(charged == static_cast<double>(totals.node_tests + totals.primitive_tests));
+	// The G-buffer pass would otherwise land on the first pixel each thread writes afterwards
+	REQUIRE(highest < 0.01 * charged);
+}
+#endif
@@ -0,0 +1,47 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include "image_output.h"
+#include "image_writer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+TEST_CASE("Writers follow the extension") {
+	REQUIRE(FileExtension("results/mirror.PNG") == "png");
+	REQUIRE(FileExtension("mirror").empty());
+
+	const std::vector<float3> pixels(8, float3 {0.25f, 0.5f, 1.0f});
+	REQUIRE(WriteImage("image_output_tests.pfm", 4, 2, pixels, ToneMapping::Clamp, 1.0f, 1.0f));
+	std::ifstream file("image_output_tests.pfm", std::ios::binary);
+	const std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	file.close();
+	std::remove("image_output_tests.pfm");
+	// Header, then the linear values untouched by tone mapping
+	const std::string header = "PF\n4 2\n-1.0\n";
+	REQUIRE(contents.compare(0, header.size(), header) == 0);
+	REQUIRE(contents.size() == header.size() + pixels.size() * 3 * sizeof(float));
+	float first[3];
+	std::memcpy(first, contents.data() + header.size(), sizeof(first));
+	REQUIRE(float3 {first[0], first[1], first[2]} == pixels[0]);
+}
+
+TEST_CASE("Frame buffers handed back by the image writer are cleared") {
+	ImageWriter writer(1, 1);
+	ImageJob job;
+	job.filename = "image_output_tests_writer.pfm";
+	job.width = 4;
+	job.height = 2;
+	job.pixels.assign(8, float3 {1.0f, 1.0f, 1.0f});
+	writer.Submit(std::move(job));
+	REQUIRE(writer.Flush() == 0);
+	std::remove("image_output_tests_writer.pfm");
+
+	const std::vector<float3> buffer = writer.AcquireBuffer(8);
+	REQUIRE(buffer.size() == 8);
+	for (const float3 &pixel : buffer) {
+		REQUIRE(pixel == float3 {0.0f, 0.0f, 0.0f});
+	}
+}
@@ -34,6 +34,24 @@ TEST_CASE("Camera tests") {
 	CHECK(ray.direction == normalize(float3 {-0.5, -0.5, 1}));
 }
 
+TEST_CASE("Shutter times stay within the frame") {
+	Camera camera;
+	camera.SetRenderTargetSize(2, 2);
+	camera.SetShutter(-0.5f, 1.5f);
+
+	CameraSample sample;
+	sample.time = 0.0f;
+	CHECK(camera.GetCameraRay(0, 0, sample).time == 0.0f);
+	sample.time = 0.999f;
+	CHECK(camera.GetCameraRay(0, 0, sample).time <= 1.0f);
+
+	// A reversed interval collapses to the opening time
+	camera.SetShutter(0.75f, 0.25f);
+	sample.time = 0.5f;
+	CHECK(camera.GetCameraRay(0, 0, sample).time == 0.75f);
+	CHECK_FALSE(camera.NeedsSampling());
+}
+
 TEST_CASE("Ray generation test") {
 	RayGenerationApp *render = new RayGenerationApp(1920, 1080);
 
@@ -0,0 +1,186 @@
+#define CATCH_CONFIG_MAIN
+#include "catch.hpp"
+
+#include "render_service.h"
+
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+// Exposes the cache so the tests can tell a hit from a load
+class RenderServiceProbe : public RenderService
+{
+public:
+	explicit RenderServiceProbe(size_t max_scenes) : RenderService(max_scenes, 0) {};
+
+	size_t CachedScenes() const { return scenes.size(); };
+	// Renderer of the most recently used scene, the same one again means the request hit the cache
+	const Lighting* MostRecent() const { return scenes.empty() ? nullptr : scenes.front().pipeline->render.get(); };
+};
+
+static RenderJob TestJob(const std::string& model) {
+	RenderJob job;
+	job.name = "service test";
+	job.pipeline = RenderPipeline::BVH;
+	job.model = model;
+	job.width = 32;
+	job.height = 18;
+	job.lights.push_back(ViewLight {float3{ 0, 1.58f, -0.03f }, float3{ 0.78f, 0.78f, 0.78f }});
+	RenderJobView view;
+	view.position = float3{ 0.0f, 0.795f, 1.6f };
+	view.direction = float3{ 0, 0.795f, -1 };
+	job.views.push_back(view);
+	return job;
+}
+
+// What the client received for one request
+class RequestOutcome
+{
+public:
+	int client_result = -1;
+	int service_result = -1;
+	size_t final_pixels = 0;
+	size_t completed_views = 0;
+};
+
+// Runs the client of one request on its own thread and answers it here
+static RequestOutcome Request(RenderServiceProbe& service, const RenderJob& job) {
+	const std::string socketPath = "render_service_tests.sock";
+	RequestOutcome outcome;
+	Listener listener(socketPath);
+	if (!listener.IsListening()) {
+		return outcome;
+	}
+
+	std::thread client([&] {
+		outcome.client_result = RequestRender(socketPath, job, [&](const ServiceUpdate& update) {
+			if (update.view_complete) {
+				outcome.completed_views++;
+			} else if (update.pass + 1 == update.passes) {
+				outcome.final_pixels += update.pixels.size();
+			}
+			return true;
+		});
+	});
+	std::unique_ptr<Connection> connection = listener.Accept();
+	outcome.service_result = connection ? service.Handle(*connection) : -1;
+	client.join();
+	return outcome;
+}
+
+TEST_CASE("Requests stream every pixel and reuse the cached scene") {
+	RenderServiceProbe service(1);
+	const RenderJob mirror = TestJob("models/CornellBox-Mirror.obj");
+
+	RequestOutcome outcome = Request(service, mirror);
+	REQUIRE(outcome.service_result == 0);
+	REQUIRE(outcome.client_result == 0);
+	REQUIRE(outcome.completed_views == 1);
+	REQUIRE(outcome.final_pixels == static_cast<size_t>(mirror.width * mirror.height));
+	const Lighting* loaded = service.MostRecent();
+	REQUIRE(loaded != nullptr);
+
+	// Other render settings keep the scene
+	RenderJob larger = mirror;
+	larger.width = 48;
+	larger.height = 27;
+	outcome = Request(service, larger);
+	REQUIRE(outcome.client_result == 0);
+	REQUIRE(outcome.final_pixels == static_cast<size_t>(larger.width * larger.height));
+	REQUIRE(service.MostRecent() == loaded);
+
+	// With room for one scene, another model evicts the first and the first is loaded again afterwards
+	REQUIRE(Request(service, TestJob("models/CornellBox-Sphere.obj")).client_result == 0);
+	REQUIRE(service.CachedScenes() == 1);
+	REQUIRE(service.MostRecent() != loaded);
+	REQUIRE(Request(service, mirror).client_result == 0);
+	REQUIRE(service.CachedScenes() == 1);
+}
+
+TEST_CASE("An edited material library misses the cache") {
+	const std::filesystem::path dir = "render_service_tests";
+	std::filesystem::create_directories(dir);
+	for (const char* file : {"CornellBox-Mirror.obj", "CornellBox-Mirror.mtl"}) {
+		std::filesystem::copy_file(std::filesystem::path("models") / file, dir / file, std::filesystem::copy_options::overwrite_existing);
+	}
+
+	RenderServiceProbe service(2);
+	const RenderJob job = TestJob((dir / "CornellBox-Mirror.obj").string());
+	REQUIRE(Request(service, job).client_result == 0);
+	const Lighting* loaded = service.MostRecent();
+	REQUIRE(Request(service, job).client_result == 0);
+	REQUIRE(service.MostRecent() == loaded);
+
+	{
+		std::ofstream library(dir / "CornellBox-Mirror.mtl", std::ios::app);
+		library << "\n# edited\n";
+	}
+	REQUIRE(Request(service, job).client_result == 0);
+	REQUIRE(service.MostRecent() != loaded);
+	REQUIRE(service.CachedScenes() == 2);
+
+	std::filesystem::remove_all(dir);
+}
+
+TEST_CASE("Analytic primitives survive the job format and key the cache") {
+	RenderJob job = TestJob("models/CornellBox-Mirror.obj");
+	RenderJobPrimitive sphere;
+	sphere.center = float3{ -0.4f, 0.35f, -0.3f };
+	sphere.radius = 0.35f;
+	sphere.illum = 5;
+	job.primitives.push_back(sphere);
+	RenderJobPrimitive quad;
+	quad.shape = PrimitiveShape::Quad;
+	quad.min = float3{ -0.5f, 1.5f, -0.5f };
+	quad.max = float3{ 0.5f, 1.5f, 0.5f };
+	quad.flip_normal = true;
+	quad.emissive = float3{ 1.0f, 1.0f, 1.0f };
+	job.primitives.push_back(quad);
+
+	std::istringstream text(FormatRenderJob(job));
+	std::vector<RenderJob> parsed;
+	std::string error;
+	const int result = ParseRenderJobs(text, "formatted", parsed, error, false);
+	INFO(error);
+	REQUIRE(result == 0);
+	REQUIRE(parsed.size() == 1);
+	REQUIRE(FormatRenderPrimitives(parsed[0]) == FormatRenderPrimitives(job));
+	REQUIRE(parsed[0].primitives.size() == 2);
+	REQUIRE(parsed[0].primitives[1].shape == PrimitiveShape::Quad);
+	REQUIRE(parsed[0].primitives[1].flip_normal);
+
+	RenderServiceProbe service(2);
+	REQUIRE(Request(service, TestJob("models/CornellBox-Mirror.obj")).client_result == 0);
+	const Lighting* plain = service.MostRecent();
+	RequestOutcome outcome = Request(service, job);
+	REQUIRE(outcome.client_result == 0);
+	REQUIRE(outcome.final_pixels == static_cast<size_t>(job.width * job.height));
+	REQUIRE(service.MostRecent() != plain);
+	REQUIRE(service.CachedScenes() == 2);
+}
+
+TEST_CASE("Streamed bands keep the AOVs of the ones before") {
+	RenderServiceProbe service(1);
+	RenderJob job = TestJob("models/CornellBox-Mirror.obj");
+	// Bands are 16384 pixels, so this frame takes three of them
+	job.width = 32;
+	job.height = 1040;
+	job.aovs = AOV_DEPTH;
+	RequestOutcome outcome = Request(service, job);
+	REQUIRE(outcome.client_result == 0);
+	REQUIRE(outcome.final_pixels == static_cast<size_t>(job.width * job.height));
+
+	const float* depth = service.MostRecent()->GetAOVs().Plane(AOV_DEPTH);
+	REQUIRE(depth != nullptr);
+	const size_t bandRows = 512;
+	for (size_t y0 = 0; y0 < static_cast<size_t>(job.height); y0 += bandRows) {
+		const size_t y1 = std::min(y0 + bandRows, static_cast<size_t>(job.height));
+		const size_t hits = static_cast<size_t>(std::count_if(depth + y0 * job.width, depth + y1 * job.width,
+			[](float value) { return std::isfinite(value); }));
+		INFO("Rows " << y0 << " to " << y1);
+		REQUIRE(hits > 0);
+	}
+}
@@ -1,19 +1,237 @@
 #pragma once
 
+// Private copy of the loader, the libraries the tests link may carry their own
+#define STB_IMAGE_STATIC
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#include "stb_image_write.h"
 
 #include "linalg.h"
 using namespace linalg::aliases;
 
-bool validate_framebuffer(std::string reference_file, std::vector<byte3> frame_buffer)
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Thresholds a frame must meet against its reference. The defaults accept numerically different but
+// visually identical output, like reordered sums or a different sampler; ImageTolerance::Exact() asks for a bit match.
+class ImageTolerance
+{
+public:
+	// Root mean square error of the 8 bit channels
+	double max_rmse = 2.0;
+	double min_psnr = 40.0;
+	// Mean SSIM of the luminance over 8x8 windows
+	double min_ssim = 0.99;
+	// Mean of the per-pixel colour error, see compare_images
+	double max_flip = 0.02;
+
+	static ImageTolerance Exact() {
+		ImageTolerance exact;
+		exact.max_rmse = 0.0;
+		exact.min_psnr = std::numeric_limits<double>::infinity();
+		exact.min_ssim = 1.0;
+		exact.max_flip = 0.0;
+		return exact;
+	}
+};
+
+class ImageMetrics
+{
+public:
+	double rmse = 0.0;
+	double psnr = std::numeric_limits<double>::infinity();
+	double ssim = 1.0;
+	double flip = 0.0;
+	// Per-pixel colour error in [0, 1], for the diff image
+	std::vector<float> error_map;
+
+	bool Passes(const ImageTolerance& tolerance) const {
+		return rmse <= tolerance.max_rmse && psnr >= tolerance.min_psnr && ssim >= tolerance.min_ssim && flip <= tolerance.max_flip;
+	}
+};
+
+// sRGB 8 bit to CIE L*a*b* with a D65 white
+float3 srgb_to_lab(float3 srgb)
+{
+	float3 linear;
+	for (int i = 0; i < 3; i++)
+	{
+		float c = srgb[i] / 255.0f;
+		linear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	float3 xyz{
+		(0.4124f * linear.x + 0.3576f * linear.y + 0.1805f * linear.z) / 0.9505f,
+		0.2126f * linear.x + 0.7152f * linear.y + 0.0722f * linear.z,
+		(0.0193f * linear.x + 0.1192f * linear.y + 0.9505f * linear.z) / 1.0890f };
+
+	auto f = [](float t) { return t > 0.008856f ? std::cbrt(t) : 7.787f * t + 16.0f / 116.0f; };
+	return float3{ 116.0f * f(xyz.y) - 16.0f, 500.0f * (f(xyz.x) - f(xyz.y)), 200.0f * (f(xyz.y) - f(xyz.z)) };
+}
+
+// City block distance on lightness plus Euclidean on the chroma plane, which tracks large colour differences better than Delta E
+float hyab_distance(float3 a, float3 b)
+{
+	return std::fabs(a.x - b.x) + linalg::length(float2{ a.y - b.y, a.z - b.z });
+}
+
+// Separable 5 tap Gaussian, sigma of one pixel, clamped at the borders
+std::vector<float3> gaussian_blur(const std::vector<float3>& image, int width, int height)
+{
+	const float weights[5] = { 0.0545f, 0.2442f, 0.4026f, 0.2442f, 0.0545f };
+	std::vector<float3> rows(image.size());
+	std::vector<float3> result(image.size());
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float3 sum{ 0, 0, 0 };
+			for (int k = -2; k <= 2; k++)
+			{
+				sum += weights[k + 2] * image[y * width + std::clamp(x + k, 0, width - 1)];
+			}
+			rows[y * width + x] = sum;
+		}
+	}
+	for (int y = 0; y < height; y++)
+	{
+		for (int x = 0; x < width; x++)
+		{
+			float3 sum{ 0, 0, 0 };
+			for (int k = -2; k <= 2; k++)
+			{
+				sum += weights[k + 2] * rows[std::clamp(y + k, 0, height - 1) * width + x];
+			}
+			result[y * width + x] = sum;
+		}
+	}
+	return result;
+}
+
+// RMSE and PSNR over the 8 bit channels, SSIM over 8x8 luminance windows at a stride of 4, and a FLIP-style
+// colour error: both images are prefiltered with a small Gaussian standing in for the contrast sensitivity,
+// compared with the HyAB distance in L*a*b* and remapped to [0, 1] like FLIP's colour pipeline. FLIP's
+// edge and point detectors are left out, so the error reads lower than the reference implementation's on thin features.
+ImageMetrics compare_images(const std::vector<byte3>& reference, const std::vector<byte3>& frame, int width, int height)
+{
+	ImageMetrics metrics;
+	const size_t count = static_cast<size_t>(width) * height;
+
+	double squared = 0.0;
+	std::vector<float3> referenceColor(count), frameColor(count);
+	std::vector<float> referenceLuma(count), frameLuma(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		referenceColor[i] = float3(reference[i]);
+		frameColor[i] = float3(frame[i]);
+		float3 difference = referenceColor[i] - frameColor[i];
+		squared += linalg::dot(difference, difference);
+		referenceLuma[i] = linalg::dot(referenceColor[i], float3{ 0.2126f, 0.7152f, 0.0722f });
+		frameLuma[i] = linalg::dot(frameColor[i], float3{ 0.2126f, 0.7152f, 0.0722f });
+	}
+	metrics.rmse = std::sqrt(squared / (3.0 * count));
+	metrics.psnr = metrics.rmse > 0.0 ? 20.0 * std::log10(255.0 / metrics.rmse) : std::numeric_limits<double>::infinity();
+
+	const double c1 = (0.01 * 255.0) * (0.01 * 255.0);
+	const double c2 = (0.03 * 255.0) * (0.03 * 255.0);
+	const int window = 8;
+	double ssimSum = 0.0;
+	int windows = 0;
+	for (int y0 = 0; y0 + window <= height; y0 += window / 2)
+	{
+		for (int x0 = 0; x0 + window <= width; x0 += window / 2)
+		{
+			double meanR = 0.0, meanF = 0.0;
+			for (int y = y0; y < y0 + window; y++)
+			{
+				for (int x = x0; x < x0 + window; x++)
+				{
+					meanR += referenceLuma[y * width + x];
+					meanF += frameLuma[y * width + x];
+				}
+			}
+			const double n = window * window;
+			meanR /= n;
+			meanF /= n;
+
+			double varianceR = 0.0, varianceF = 0.0, covariance = 0.0;
+			for (int y = y0; y < y0 + window; y++)
+			{
+				for (int x = x0; x < x0 + window; x++)
+				{
+					double r = referenceLuma[y * width + x] - meanR;
+					double f = frameLuma[y * width + x] - meanF;
+					varianceR += r * r;
+					varianceF += f * f;
+					covariance += r * f;
+				}
+			}
+			varianceR /= n - 1;
+			varianceF /= n - 1;
+			covariance /= n - 1;
+
+			ssimSum += ((2 * meanR * meanF + c1) * (2 * covariance + c2)) /
+				((meanR * meanR + meanF * meanF + c1) * (varianceR + varianceF + c2));
+			windows++;
+		}
+	}
+	metrics.ssim = windows ? ssimSum / windows : 1.0;
+
+	// Green against blue is the largest HyAB distance in sRGB and bounds the remapping
+	const float hyabMax = std::pow(hyab_distance(srgb_to_lab(float3{ 0, 255, 0 }), srgb_to_lab(float3{ 0, 0, 255 })), 0.7f);
+	std::vector<float3> referenceBlur = gaussian_blur(referenceColor, width, height);
+	std::vector<float3> frameBlur = gaussian_blur(frameColor, width, height);
+	metrics.error_map.resize(count);
+	double flipSum = 0.0;
+	for (size_t i = 0; i < count; i++)
+	{
+		float hyab = hyab_distance(srgb_to_lab(referenceBlur[i]), srgb_to_lab(frameBlur[i]));
+		float error = std::min(1.0f, std::pow(hyab, 0.7f) / hyabMax);
+		metrics.error_map[i] = error;
+		flipSum += error;
+	}
+	metrics.flip = flipSum / count;
+
+	return metrics;
+}
+
+// Error map as a black, red, yellow, white ramp
+bool save_diff_image(std::string filename, const std::vector<float>& error_map, int width, int height)
+{
+	std::vector<byte3> pixels(error_map.size());
+	for (size_t i = 0; i < error_map.size(); i++)
+	{
+		float e = std::min(1.0f, error_map[i] * 4.0f);
+		float3 color{ std::min(1.0f, 3.0f * e), std::clamp(3.0f * e - 1.0f, 0.0f, 1.0f), std::clamp(3.0f * e - 2.0f, 0.0f, 1.0f) };
+		pixels[i] = byte3(color * 255.0f);
+	}
+	return stbi_write_png(filename.c_str(), width, height, 3, pixels.data(), width * 3) != 0;
+}
+
+// Compares the frame with the reference PNG under the tolerance. On a mismatch the metrics are printed and
+// the error map is written to the working directory as <reference name>_diff.png.
+bool validate_framebuffer(std::string reference_file, std::vector<byte3> frame_buffer, const ImageTolerance& tolerance = ImageTolerance())
 {
 	// Load a reference image
 	int width, height, channels;
 	unsigned char* img = stbi_load(reference_file.c_str(), &width, &height, &channels, 0);
 
 	if (!img)
+	{
+		std::printf("Could not load %s\n", reference_file.c_str());
 		return false;
+	}
+
+	if (channels < 3 || frame_buffer.size() != static_cast<size_t>(width) * height)
+	{
+		std::printf("%s is %dx%d with %d channels, the frame has %zu pixels\n", reference_file.c_str(), width, height, channels, frame_buffer.size());
+		stbi_image_free(img);
+		return false;
+	}
 
 	// Convert the reference to vector of colors
 	std::vector<byte3> reference;
@@ -22,14 +240,17 @@ bool validate_framebuffer(std::string reference_file, std::vector<byte3> frame_b
 		byte3 pixel{ img[channels * i], img[channels * i + 1], img[channels * i + 2] };
 		reference.push_back(pixel);
 	}
+	stbi_image_free(img);
 
-	// Compare with a frame buffer
-	bool result = (reference.size() == frame_buffer.size());
-	for (unsigned int i = 0; i < 1920 * 1080; i++)
-	{
-		result &= (reference[i] == frame_buffer[i]);
-	}
-
-	return result;
+	ImageMetrics metrics = compare_images(reference, frame_buffer, width, height);
+	if (metrics.Passes(tolerance))
+		return true;
 
-}
\ No newline at end of file
+	std::string name = reference_file.substr(reference_file.find_last_of("/\\") + 1);
+	std::string diff_file = name.substr(0, name.find_last_of('.')) + "_diff.png";
+	save_diff_image(diff_file, metrics.error_map, width, height);
+	std::printf("%s: RMSE %.4f (max %.4f), PSNR %.2f dB (min %.2f), SSIM %.5f (min %.5f), FLIP %.5f (max %.5f), diff in %s\n",
+		reference_file.c_str(), metrics.rmse, tolerance.max_rmse, metrics.psnr, tolerance.min_psnr,
+		metrics.ssim, tolerance.min_ssim, metrics.flip, tolerance.max_flip, diff_file.c_str());
+	return false;
+}
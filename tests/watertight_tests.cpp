@@ -0,0 +1,95 @@
+#define CATCH_CONFIG_RUNNER
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "catch.hpp"
+
+#include "mt_algorithm.h"
+
+#include <random>
+
+// Edge rays of the correctness check, each benchmark run traces a sixteenth of them. Set with --rays.
+static size_t rayCount = 1 << 22;
+
+// A shallow pyramid fan of triangles sharing one apex, with rays aimed at the shared edges.
+// Rays come from above, steeper than any face, so each one has to hit something.
+class EdgeFan {
+public:
+	EdgeFan(unsigned int segments, std::mt19937 &generator) {
+		std::uniform_real_distribution<float> jitter(-0.1f, 0.1f);
+		apex = float3 {0.3137f, 0.2718f + jitter(generator), -1.4142f};
+		for (unsigned int i = 0; i < segments; i++) {
+			float angle = 6.2831853f * (i + 0.5f * jitter(generator)) / segments;
+			rim.push_back(apex + float3 {std::cos(angle), 0.1f * jitter(generator) - 0.25f, std::sin(angle)});
+		}
+		for (unsigned int i = 0; i < segments; i++) {
+			triangles.push_back(Triangle(Vertex(apex), Vertex(rim[i]), Vertex(rim[(i + 1) % segments])));
+		}
+	}
+
+	// Counts rays which slip between the triangles
+	template <class Kernel>
+	size_t CountMisses(size_t ray_count, std::mt19937 &generator, Kernel kernel) const {
+		std::uniform_int_distribution<size_t> edge(0, rim.size() - 1);
+		std::uniform_real_distribution<float> along(0.001f, 0.999f);
+		std::uniform_real_distribution<float> spread(-2.0f, 2.0f);
+
+		size_t misses = 0;
+		for (size_t i = 0; i < ray_count; i++) {
+			float3 target = linalg::lerp(apex, rim[edge(generator)], along(generator));
+			float3 origin = apex + float3 {spread(generator), 3.0f, spread(generator)};
+			Ray ray(origin, target - origin);
+
+			bool hit = false;
+			for (auto &triangle : triangles) {
+				IntersectableData data = kernel(triangle, ray);
+				if (data.t > 0.0f) {
+					hit = true;
+					break;
+				}
+			}
+			misses += hit ? 0 : 1;
+		}
+		return misses;
+	}
+
+	float3 apex;
+	std::vector<float3> rim;
+	std::vector<Triangle> triangles;
+};
+
+TEST_CASE("Watertight intersection test") {
+	std::mt19937 generator(42);
+	EdgeFan fan(61, generator);
+
+	auto watertight = [](const Triangle &triangle, const Ray &ray) { return triangle.IntersectWatertight(ray); };
+	auto mollerTrumbore = [](const Triangle &triangle, const Ray &ray) { return triangle.IntersectMollerTrumbore(ray); };
+
+	std::mt19937 watertightRays(7);
+	size_t watertightMisses = fan.CountMisses(rayCount, watertightRays, watertight);
+
+	std::mt19937 mollerTrumboreRays(7);
+	size_t mollerTrumboreMisses = fan.CountMisses(rayCount, mollerTrumboreRays, mollerTrumbore);
+
+	INFO("Moller-Trumbore misses " << mollerTrumboreMisses << " of " << rayCount << " edge rays");
+	CHECK(watertightMisses == 0);
+
+	BENCHMARK("Watertight edge rays") {
+		std::mt19937 rays(11);
+		return fan.CountMisses(rayCount / 16, rays, watertight);
+	};
+
+	BENCHMARK("Moller-Trumbore edge rays") {
+		std::mt19937 rays(11);
+		return fan.CountMisses(rayCount / 16, rays, mollerTrumbore);
+	};
+}
+
+int main(int argc, char *argv[]) {
+	Catch::Session session;
+	session.cli(session.cli()
+		| Catch::clara::Opt(rayCount, "count")["--rays"]("edge rays of the watertight intersection test"));
+	int result = session.applyCommandLine(argc, argv);
+	if (result != 0) {
+		return result;
+	}
+	return session.run();
+}